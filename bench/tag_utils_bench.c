@@ -0,0 +1,476 @@
+/*****************************************************************************
+ * tag_utils_bench: micro-benchmarks for the tag_utils hot paths
+ *
+ * Every case runs its operation until a minimum wall time has elapsed and
+ * prints one JSON object per line:
+ *
+ *   {"bench":"url_decode_inplace/cjk_4k","iterations":..,"ns_per_op":..,
+ *    "allocs_per_op":..,"bytes_per_op":..,"mb_per_s":..}
+ *
+ * allocs_per_op is null when allocation counting is unavailable (non-glibc).
+ * In-place functions restore their input with memcpy before each call; the
+ * copy is included in the timing.
+ *****************************************************************************/
+#define _POSIX_C_SOURCE 200809L
+
+#include "../tag_utils.h"
+#include "../tests/alloc_counter.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define XATTR_SIZE 10000            // Matches library.c
+#define DEFAULT_MIN_TIME_MS 200
+
+typedef struct {
+    char *p_input;                  /**< Pristine input */
+    char *p_work;                   /**< Scratch copy for in-place functions */
+    size_t i_len;                   /**< strlen(p_input) */
+    char *psz_aux;                  /**< Second operand (tag, skip list, ...) */
+    const char **ppsz_tags;
+    size_t i_tag_count;
+    skip_matcher_t *p_matcher;
+} bench_ctx_t;
+
+typedef struct {
+    const char *psz_name;
+    void (*pf_setup)(bench_ctx_t *);
+    size_t (*pf_run)(bench_ctx_t *);    /**< Returns bytes processed */
+} bench_case_t;
+
+static volatile size_t i_sink;
+
+static char *xstrdup(const char *psz)
+{
+    char *p = strdup(psz);
+    if (p == NULL) {
+        fprintf(stderr, "tag_utils_bench: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static char *xmalloc(size_t i_size)
+{
+    char *p = malloc(i_size);
+    if (p == NULL) {
+        fprintf(stderr, "tag_utils_bench: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Fill a buffer by repeating \p psz_unit until \p i_len bytes. */
+static char *repeat(const char *psz_prefix, const char *psz_unit, size_t i_len)
+{
+    size_t i_prefix = strlen(psz_prefix), i_unit = strlen(psz_unit);
+    char *p = xmalloc(i_len + 1);
+    memcpy(p, psz_prefix, i_prefix);
+    size_t i = i_prefix;
+    while (i + i_unit <= i_len) {
+        memcpy(p + i, psz_unit, i_unit);
+        i += i_unit;
+    }
+    p[i] = '\0';
+    return p;
+}
+
+static void set_input(bench_ctx_t *p_ctx, char *p_input)
+{
+    p_ctx->p_input = p_input;
+    p_ctx->i_len = strlen(p_input);
+    p_ctx->p_work = xmalloc(p_ctx->i_len + 1);
+}
+
+/* ---- url_decode_inplace / decode_percent_sequence ---- */
+
+static void setup_decode_ascii(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, xstrdup("/home/user/Videos/Series/Season 01/Episode.01.1080p.WEB-DL.x264.mkv"));
+}
+
+static void setup_decode_spaces(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, repeat("/media/", "Some%20Show%20-%20", 512));
+}
+
+static void setup_decode_cjk(bench_ctx_t *p_ctx)
+{
+    // U+4E2D U+6587: every byte is a %XX triplet
+    set_input(p_ctx, repeat("/media/", "%E4%B8%AD%E6%96%87", 4096));
+}
+
+static void setup_decode_emoji(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, repeat("/media/", "%F0%9F%8E%AC%f0%9f%8d%bf_", 4096));
+}
+
+static void setup_decode_invalid(bench_ctx_t *p_ctx)
+{
+    // Adversarial: every '%' starts a sequence that fails validation
+    set_input(p_ctx, repeat("/media/", "%%%zz%4g%G1%", 4096));
+}
+
+static size_t run_decode(bench_ctx_t *p_ctx)
+{
+    memcpy(p_ctx->p_work, p_ctx->p_input, p_ctx->i_len + 1);
+    url_decode_inplace(p_ctx->p_work);
+    i_sink += (unsigned char)p_ctx->p_work[0];
+    return p_ctx->i_len;
+}
+
+static size_t run_decode_with(bench_ctx_t *p_ctx, url_decode_impl_t impl)
+{
+    memcpy(p_ctx->p_work, p_ctx->p_input, p_ctx->i_len + 1);
+    url_decode_inplace_with(p_ctx->p_work, impl);
+    i_sink += (unsigned char)p_ctx->p_work[0];
+    return p_ctx->i_len;
+}
+
+static size_t run_decode_scalar(bench_ctx_t *p_ctx)
+{
+    return run_decode_with(p_ctx, URL_DECODE_SCALAR);
+}
+
+static size_t run_decode_sse2(bench_ctx_t *p_ctx)
+{
+    return run_decode_with(p_ctx, URL_DECODE_SSE2);
+}
+
+static size_t run_decode_avx2(bench_ctx_t *p_ctx)
+{
+    return run_decode_with(p_ctx, URL_DECODE_AVX2);
+}
+
+static size_t run_decode_sequence(bench_ctx_t *p_ctx)
+{
+    size_t i_ok = 0;
+    for (size_t i = 0; i + 2 < p_ctx->i_len; i++) {
+        char c;
+        i_ok += decode_percent_sequence(p_ctx->p_input + i, &c);
+    }
+    i_sink += i_ok;
+    return p_ctx->i_len;
+}
+
+/* ---- xdg_tags_append_* ---- */
+
+/* A tag list just under the xattr size limit: "tag0000,tag0001,..." */
+static char *big_tag_list(void)
+{
+    char *p = xmalloc(XATTR_SIZE);
+    size_t i_len = 0;
+    for (int i = 0; i_len + 9 < XATTR_SIZE - 64; i++)
+        i_len += (size_t)sprintf(p + i_len, "%stag%04d", i ? "," : "", i);
+    return p;
+}
+
+static void setup_append_small(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, xstrdup("favourite,started"));
+    p_ctx->psz_aux = xstrdup("seen");
+}
+
+static void setup_append_big_present(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, big_tag_list());
+    // The last tag in the list: worst case for a linear search
+    const char *psz_last = strrchr(p_ctx->p_input, ',') + 1;
+    p_ctx->psz_aux = xstrdup(psz_last);
+}
+
+static void setup_append_big_missing(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, big_tag_list());
+    p_ctx->psz_aux = xstrdup("seen");
+}
+
+static size_t run_append_one(bench_ctx_t *p_ctx)
+{
+    bool b_added;
+    char *psz = xdg_tags_append_if_missing(p_ctx->p_input, p_ctx->psz_aux, &b_added);
+    i_sink += b_added;
+    free(psz);
+    return p_ctx->i_len;
+}
+
+static void setup_append_many_big(bench_ctx_t *p_ctx)
+{
+    static const char *tags[] = { "started", "seen", "tag0100", "half", "tag0900", "credits", "seen", "rewatched" };
+    set_input(p_ctx, big_tag_list());
+    p_ctx->ppsz_tags = tags;
+    p_ctx->i_tag_count = sizeof(tags) / sizeof(tags[0]);
+}
+
+static size_t run_append_many(bench_ctx_t *p_ctx)
+{
+    size_t i_added;
+    char *psz = xdg_tags_append_many(p_ctx->p_input, p_ctx->ppsz_tags, p_ctx->i_tag_count, &i_added);
+    i_sink += i_added;
+    free(psz);
+    return p_ctx->i_len;
+}
+
+static size_t run_append_many_buf(bench_ctx_t *p_ctx)
+{
+    // The same read-modify-write through a reused buffer, as WriteTags does
+    static tag_buffer_t buf;
+    tag_buffer_reserve(&buf, p_ctx->i_len + 1);
+    memcpy(buf.p_data, p_ctx->p_input, p_ctx->i_len + 1);
+    size_t i_len = p_ctx->i_len + 1, i_added;
+    xdg_tags_append_many_buf(&buf, &i_len, p_ctx->ppsz_tags, p_ctx->i_tag_count, &i_added);
+    i_sink += i_added;
+    return p_ctx->i_len;
+}
+
+static size_t run_append_many_set(bench_ctx_t *p_ctx)
+{
+    static tag_buffer_t buf;
+    static tag_set_t set;
+    tag_buffer_reserve(&buf, p_ctx->i_len + 1);
+    memcpy(buf.p_data, p_ctx->p_input, p_ctx->i_len + 1);
+    size_t i_len = p_ctx->i_len + 1, i_added;
+    xdg_tags_append_many_set(&set, &buf, &i_len, p_ctx->ppsz_tags, p_ctx->i_tag_count, &i_added);
+    i_sink += i_added;
+    return p_ctx->i_len;
+}
+
+static void setup_append_many_small(bench_ctx_t *p_ctx)
+{
+    static const char *tags[] = { "started", "seen" };
+    set_input(p_ctx, xstrdup("favourite,started,kids"));
+    p_ctx->ppsz_tags = tags;
+    p_ctx->i_tag_count = sizeof(tags) / sizeof(tags[0]);
+}
+
+/* ---- parse_xattr_targets ---- */
+
+static void setup_targets_default(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, xstrdup("seen@90,started@0"));
+}
+
+static void setup_targets_many(bench_ctx_t *p_ctx)
+{
+    char *p = xmalloc(8192);
+    size_t i_len = 0;
+    // Descending percents: worst case for the sort
+    for (int i = 0; i < 200; i++)
+        i_len += (size_t)sprintf(p + i_len, "%s pct%03d @ %d ", i ? "," : "", i, 100 - i / 2);
+    set_input(p_ctx, p);
+}
+
+static size_t run_targets(bench_ctx_t *p_ctx)
+{
+    int i_count;
+    xattr_target_t *p_targets = parse_xattr_targets(p_ctx->p_input, &i_count);
+    i_sink += (size_t)i_count;
+    free_xattr_targets(p_targets, i_count);
+    return p_ctx->i_len;
+}
+
+/* ---- should_skip_path / skip_matcher ---- */
+
+static char *big_skip_list(void)
+{
+    char *p = xmalloc(5000 * 40);
+    size_t i_len = 0;
+    for (int i = 0; i < 5000; i++)
+        i_len += (size_t)sprintf(p + i_len, "%s/mnt/share%04d/excluded/dir", i ? "\n" : "", i * 7919 % 10000);
+    return p;
+}
+
+static void setup_skip_miss(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, xstrdup("/media/tv/Some Show/Season 01/Some.Show.S01E01.mkv"));
+    p_ctx->psz_aux = big_skip_list();
+    p_ctx->p_matcher = skip_matcher_compile(p_ctx->psz_aux);
+}
+
+static void setup_skip_hit(bench_ctx_t *p_ctx)
+{
+    p_ctx->psz_aux = big_skip_list();
+    // The last entry: found only after scanning the whole list
+    const char *psz_last = strrchr(p_ctx->psz_aux, '\n') + 1;
+    char *psz_path = xmalloc(strlen(psz_last) + 16);
+    sprintf(psz_path, "%s/file.mkv", psz_last);
+    set_input(p_ctx, psz_path);
+    p_ctx->p_matcher = skip_matcher_compile(p_ctx->psz_aux);
+}
+
+static void setup_skip_short(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, xstrdup("/media/tv/Some Show/Season 01/Some.Show.S01E01.mkv"));
+    p_ctx->psz_aux = xstrdup("/tmp, /var/cache; /media/tv/Trash");
+    p_ctx->p_matcher = skip_matcher_compile(p_ctx->psz_aux);
+}
+
+static size_t run_skip(bench_ctx_t *p_ctx)
+{
+    i_sink += should_skip_path(p_ctx->p_input, p_ctx->psz_aux);
+    return p_ctx->i_len;
+}
+
+static size_t run_skip_matcher(bench_ctx_t *p_ctx)
+{
+    i_sink += skip_matcher_match(p_ctx->p_matcher, p_ctx->p_input);
+    return p_ctx->i_len;
+}
+
+/* ---- trim_token ---- */
+
+static void setup_trim_short(bench_ctx_t *p_ctx)
+{
+    set_input(p_ctx, xstrdup("  seen  "));
+}
+
+static void setup_trim_padded(bench_ctx_t *p_ctx)
+{
+    char *p = xmalloc(4096 + 1);
+    memset(p, ' ', 4096);
+    memcpy(p + 2040, "seen", 4);
+    for (int i = 0; i < 4096; i += 64)
+        if (i < 2040 || i > 2048)
+            p[i] = (char)(i % 128 ? '\t' : '\n');
+    p[4096] = '\0';
+    set_input(p_ctx, p);
+}
+
+static size_t run_trim(bench_ctx_t *p_ctx)
+{
+    memcpy(p_ctx->p_work, p_ctx->p_input, p_ctx->i_len + 1);
+    i_sink += (unsigned char)*trim_token(p_ctx->p_work);
+    return p_ctx->i_len;
+}
+
+static const bench_case_t cases[] = {
+    { "url_decode_inplace/ascii_path", setup_decode_ascii, run_decode },
+    { "url_decode_inplace/spaces_512", setup_decode_spaces, run_decode },
+    { "url_decode_inplace/cjk_4k", setup_decode_cjk, run_decode },
+    { "url_decode_inplace/emoji_4k", setup_decode_emoji, run_decode },
+    { "url_decode_inplace/invalid_4k", setup_decode_invalid, run_decode },
+    { "url_decode_inplace_scalar/cjk_4k", setup_decode_cjk, run_decode_scalar },
+    { "url_decode_inplace_sse2/cjk_4k", setup_decode_cjk, run_decode_sse2 },
+    { "url_decode_inplace_avx2/cjk_4k", setup_decode_cjk, run_decode_avx2 },
+    { "url_decode_inplace_scalar/spaces_512", setup_decode_spaces, run_decode_scalar },
+    { "url_decode_inplace_sse2/spaces_512", setup_decode_spaces, run_decode_sse2 },
+    { "url_decode_inplace_avx2/spaces_512", setup_decode_spaces, run_decode_avx2 },
+    { "decode_percent_sequence/cjk_4k", setup_decode_cjk, run_decode_sequence },
+    { "xdg_tags_append_if_missing/small", setup_append_small, run_append_one },
+    { "xdg_tags_append_if_missing/near_limit_present", setup_append_big_present, run_append_one },
+    { "xdg_tags_append_if_missing/near_limit_missing", setup_append_big_missing, run_append_one },
+    { "xdg_tags_append_many/near_limit_8", setup_append_many_big, run_append_many },
+    { "xdg_tags_append_many_buf/near_limit_8", setup_append_many_big, run_append_many_buf },
+    { "xdg_tags_append_many_set/near_limit_8", setup_append_many_big, run_append_many_set },
+    { "xdg_tags_append_many_buf/small_2", setup_append_many_small, run_append_many_buf },
+    { "xdg_tags_append_many_set/small_2", setup_append_many_small, run_append_many_set },
+    { "parse_xattr_targets/default", setup_targets_default, run_targets },
+    { "parse_xattr_targets/200_descending", setup_targets_many, run_targets },
+    { "should_skip_path/short_list", setup_skip_short, run_skip },
+    { "should_skip_path/5000_miss", setup_skip_miss, run_skip },
+    { "should_skip_path/5000_hit_last", setup_skip_hit, run_skip },
+    { "skip_matcher_match/short_list", setup_skip_short, run_skip_matcher },
+    { "skip_matcher_match/5000_miss", setup_skip_miss, run_skip_matcher },
+    { "skip_matcher_match/5000_hit_last", setup_skip_hit, run_skip_matcher },
+    { "trim_token/short", setup_trim_short, run_trim },
+    { "trim_token/padded_4k", setup_trim_padded, run_trim },
+};
+
+static void run_case(const bench_case_t *p_case, uint64_t i_min_ns)
+{
+    bench_ctx_t ctx = { 0 };
+    p_case->pf_setup(&ctx);
+
+    // Warm up caches and branch predictors, then grow the batch until it
+    // is long enough for the clock to be accurate
+    uint64_t i_iterations = 1;
+    p_case->pf_run(&ctx);
+    for (;;) {
+        unsigned long i_allocs = alloc_counter_get();
+        size_t i_bytes = 0;
+        uint64_t i_start = now_ns();
+        for (uint64_t i = 0; i < i_iterations; i++)
+            i_bytes += p_case->pf_run(&ctx);
+        uint64_t i_elapsed = now_ns() - i_start;
+        i_allocs = alloc_counter_get() - i_allocs;
+
+        if (i_elapsed >= i_min_ns || i_iterations >= (UINT64_C(1) << 40)) {
+            double f_ns = (double)i_elapsed / (double)i_iterations;
+            printf("{\"bench\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,",
+                   p_case->psz_name, (unsigned long long)i_iterations, f_ns);
+            if (alloc_counter_available())
+                printf("\"allocs_per_op\":%.2f,", (double)i_allocs / (double)i_iterations);
+            else
+                printf("\"allocs_per_op\":null,");
+            printf("\"bytes_per_op\":%zu,\"mb_per_s\":%.2f}\n",
+                   i_bytes / i_iterations,
+                   i_elapsed ? (double)i_bytes * 1e3 / (double)i_elapsed : 0.0);
+            break;
+        }
+        // Aim straight for the target, at most 10x per round
+        uint64_t i_next = i_elapsed ? i_iterations * i_min_ns / i_elapsed + 1 : i_iterations * 10;
+        if (i_next > i_iterations * 10)
+            i_next = i_iterations * 10;
+        i_iterations = i_next > i_iterations ? i_next : i_iterations + 1;
+    }
+
+    skip_matcher_free(ctx.p_matcher);
+    free(ctx.p_input);
+    free(ctx.p_work);
+    free(ctx.psz_aux);
+}
+
+static void usage(const char *psz_argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-t MIN_MS] [FILTER...]\n"
+            "Run the tag_utils micro-benchmarks whose name contains any FILTER.\n\n"
+            "  -t MIN_MS   minimum measured time per benchmark (default: %d)\n"
+            "  -l          list benchmark names and exit\n",
+            psz_argv0, DEFAULT_MIN_TIME_MS);
+}
+
+static bool selected(const char *psz_name, char **ppsz_filters, int i_filters)
+{
+    if (i_filters == 0)
+        return true;
+    for (int i = 0; i < i_filters; i++)
+        if (strstr(psz_name, ppsz_filters[i]) != NULL)
+            return true;
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    long i_min_ms = DEFAULT_MIN_TIME_MS;
+    int i_arg = 1;
+    for (; i_arg < argc && argv[i_arg][0] == '-'; i_arg++) {
+        if (strcmp(argv[i_arg], "-t") == 0 && i_arg + 1 < argc) {
+            i_min_ms = strtol(argv[++i_arg], NULL, 10);
+        } else if (strcmp(argv[i_arg], "-l") == 0) {
+            for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+                printf("%s\n", cases[i].psz_name);
+            return 0;
+        } else {
+            usage(argv[0]);
+            return strcmp(argv[i_arg], "-h") == 0 ? 0 : 2;
+        }
+    }
+    if (i_min_ms < 1)
+        i_min_ms = 1;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        if (selected(cases[i].psz_name, argv + i_arg, argc - i_arg))
+            run_case(&cases[i], (uint64_t)i_min_ms * 1000000u);
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include "dir_aggregate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void dir_aggregate_init(dir_aggregate_t *p_agg)
+{
+    p_agg->p_inodes = NULL;
+    p_agg->i_count = 0;
+    p_agg->i_capacity = 0;
+}
+
+void dir_aggregate_clear(dir_aggregate_t *p_agg)
+{
+    free(p_agg->p_inodes);
+    dir_aggregate_init(p_agg);
+}
+
+static bool reserve(dir_aggregate_t *p_agg, size_t i_count)
+{
+    if (i_count <= p_agg->i_capacity)
+        return true;
+    size_t i_capacity = p_agg->i_capacity ? p_agg->i_capacity : 16;
+    while (i_capacity < i_count) {
+        if (i_capacity > SIZE_MAX / 2 / sizeof(uint64_t))
+            return false;
+        i_capacity *= 2;
+    }
+    uint64_t *p_grown = realloc(p_agg->p_inodes, i_capacity * sizeof(uint64_t));
+    if (p_grown == NULL)
+        return false;
+    p_agg->p_inodes = p_grown;
+    p_agg->i_capacity = i_capacity;
+    return true;
+}
+
+static bool read_varint(const uint8_t **pp, const uint8_t *p_end, uint64_t *p_value)
+{
+    uint64_t i_value = 0;
+    for (unsigned i_shift = 0; i_shift < 64; i_shift += 7) {
+        if (*pp == p_end)
+            return false;
+        uint8_t b = *(*pp)++;
+        // The tenth byte only has room for the top bit
+        if (i_shift == 63 && b > 1)
+            return false;
+        i_value |= (uint64_t)(b & 0x7F) << i_shift;
+        if (!(b & 0x80)) {
+            *p_value = i_value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t write_varint(uint8_t *p, uint64_t i_value)
+{
+    size_t i_len = 0;
+    do {
+        uint8_t b = i_value & 0x7F;
+        i_value >>= 7;
+        if (p != NULL)
+            p[i_len] = b | (i_value ? 0x80 : 0);
+        i_len++;
+    } while (i_value);
+    return i_len;
+}
+
+bool dir_aggregate_decode(dir_aggregate_t *p_agg, const void *p_data, size_t i_len)
+{
+    p_agg->i_count = 0;
+    if (i_len == 0)
+        return true;
+
+    const uint8_t *p = p_data;
+    const uint8_t *p_end = p + i_len;
+    uint64_t i_entries;
+    if (*p++ != DIR_AGGREGATE_VERSION || !read_varint(&p, p_end, &i_entries)
+     || i_entries > (uint64_t)(p_end - p)) // At least a byte per entry
+        goto error;
+    if (!reserve(p_agg, (size_t)i_entries))
+        goto error;
+
+    uint64_t i_ino = 0;
+    for (uint64_t i = 0; i < i_entries; i++) {
+        uint64_t i_delta;
+        // Strictly increasing: a zero delta past the first entry is a duplicate
+        if (!read_varint(&p, p_end, &i_delta) || (i > 0 && i_delta == 0)
+         || i_delta > UINT64_MAX - i_ino)
+            goto error;
+        i_ino += i_delta;
+        p_agg->p_inodes[p_agg->i_count++] = i_ino;
+    }
+    if (p != p_end)
+        goto error;
+    return true;
+
+error:
+    p_agg->i_count = 0;
+    return false;
+}
+
+size_t dir_aggregate_encode(const dir_aggregate_t *p_agg, uint8_t *p_buf, size_t i_size)
+{
+    size_t i_len = 1 + write_varint(NULL, p_agg->i_count);
+    uint64_t i_prev = 0;
+    for (size_t i = 0; i < p_agg->i_count; i++) {
+        i_len += write_varint(NULL, p_agg->p_inodes[i] - i_prev);
+        i_prev = p_agg->p_inodes[i];
+    }
+    if (i_len > i_size || p_buf == NULL)
+        return i_len;
+
+    uint8_t *p = p_buf;
+    *p++ = DIR_AGGREGATE_VERSION;
+    p += write_varint(p, p_agg->i_count);
+    i_prev = 0;
+    for (size_t i = 0; i < p_agg->i_count; i++) {
+        p += write_varint(p, p_agg->p_inodes[i] - i_prev);
+        i_prev = p_agg->p_inodes[i];
+    }
+    return i_len;
+}
+
+/* Index of the first entry not below \p i_ino */
+static size_t lower_bound(const dir_aggregate_t *p_agg, uint64_t i_ino)
+{
+    size_t i_low = 0, i_high = p_agg->i_count;
+    while (i_low < i_high) {
+        size_t i_mid = i_low + (i_high - i_low) / 2;
+        if (p_agg->p_inodes[i_mid] < i_ino)
+            i_low = i_mid + 1;
+        else
+            i_high = i_mid;
+    }
+    return i_low;
+}
+
+bool dir_aggregate_contains(const dir_aggregate_t *p_agg, uint64_t i_ino)
+{
+    size_t i = lower_bound(p_agg, i_ino);
+    return i < p_agg->i_count && p_agg->p_inodes[i] == i_ino;
+}
+
+bool dir_aggregate_insert(dir_aggregate_t *p_agg, uint64_t i_ino, bool *pb_added)
+{
+    if (pb_added)
+        *pb_added = false;
+    size_t i = lower_bound(p_agg, i_ino);
+    if (i < p_agg->i_count && p_agg->p_inodes[i] == i_ino)
+        return true;
+    if (!reserve(p_agg, p_agg->i_count + 1))
+        return false;
+    memmove(&p_agg->p_inodes[i + 1], &p_agg->p_inodes[i],
+            (p_agg->i_count - i) * sizeof(uint64_t));
+    p_agg->p_inodes[i] = i_ino;
+    p_agg->i_count++;
+    if (pb_added)
+        *pb_added = true;
+    return true;
+}
+
+size_t dir_aggregate_format_count(const dir_aggregate_t *p_agg, char *psz_buf, size_t i_size)
+{
+    int i_len = snprintf(psz_buf, i_size, "%zu", p_agg->i_count);
+    return i_len > 0 && (size_t)i_len < i_size ? (size_t)i_len : 0;
+}
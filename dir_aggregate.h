@@ -0,0 +1,82 @@
+#ifndef DIR_AGGREGATE_H
+#define DIR_AGGREGATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Seen state of a directory's children, kept on the directory itself.
+ *
+ * Two xattrs on the directory let a file manager show "3/12 seen" with one
+ * getxattr instead of reading every child:
+ *  - DIR_AGGREGATE_COUNT_KEY: number of seen children, in decimal ("3");
+ *  - DIR_AGGREGATE_CHILDREN_KEY: the inode numbers of those children, so
+ *    updates are idempotent and a replayed file is not counted twice.
+ *
+ * The children value is a version byte followed by LEB128 varints: the
+ * number of entries, then the sorted inode numbers as deltas from the
+ * previous one (the first from 0). Files of one folder are usually created
+ * together, so most deltas take one or two bytes.
+ *
+ * Inode numbers go stale when files are deleted or replaced; xattr_scan
+ * --rebuild-aggregates recomputes both values from the children's tags.
+ */
+#define DIR_AGGREGATE_COUNT_KEY "user.vlc.seen_count"
+#define DIR_AGGREGATE_CHILDREN_KEY "user.vlc.seen_children"
+#define DIR_AGGREGATE_VERSION 1
+
+typedef struct {
+    uint64_t *p_inodes;         /**< Sorted, without duplicates */
+    size_t i_count;
+    size_t i_capacity;
+} dir_aggregate_t;
+
+/**
+ * Empty aggregate; also what a zeroed dir_aggregate_t is.
+ */
+void dir_aggregate_init(dir_aggregate_t *p_agg);
+
+/**
+ * Free the entries and empty the aggregate.
+ */
+void dir_aggregate_clear(dir_aggregate_t *p_agg);
+
+/**
+ * Replace the content of \p p_agg with a children value. An empty value
+ * decodes to an empty aggregate.
+ *
+ * \return false if the value is malformed, of another version, or on
+ *         allocation failure; \p p_agg is then empty.
+ */
+bool dir_aggregate_decode(dir_aggregate_t *p_agg, const void *p_data, size_t i_len);
+
+/**
+ * Encode the children value into \p p_buf.
+ *
+ * \return The size of the value, which may exceed \p i_size: nothing is
+ *         written then, and the caller retries with a larger buffer.
+ */
+size_t dir_aggregate_encode(const dir_aggregate_t *p_agg, uint8_t *p_buf, size_t i_size);
+
+/**
+ * Whether \p i_ino is one of the seen children.
+ */
+bool dir_aggregate_contains(const dir_aggregate_t *p_agg, uint64_t i_ino);
+
+/**
+ * Add \p i_ino, keeping the entries sorted.
+ *
+ * \param pb_added Set to whether it was missing (may be NULL).
+ * \return false on allocation failure.
+ */
+bool dir_aggregate_insert(dir_aggregate_t *p_agg, uint64_t i_ino, bool *pb_added);
+
+/**
+ * Format the count value ("12") into \p psz_buf.
+ *
+ * \return Its length without the terminator, or 0 when \p i_size is too small.
+ */
+size_t dir_aggregate_format_count(const dir_aggregate_t *p_agg, char *psz_buf, size_t i_size);
+
+#endif // DIR_AGGREGATE_H
@@ -0,0 +1,100 @@
+#ifndef HASH_SLOTS_H
+#define HASH_SLOTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Open-addressing index over an array of entries the caller owns.
+ *
+ * A table is a power-of-two array of slots, each holding an entry index + 1
+ * (0 is empty), and the mask slot count - 1. Probing is linear from
+ * hash & mask, and removal shifts the rest of the cluster back instead of
+ * leaving tombstones, so a lookup stops at the first empty slot. Callers
+ * compare their own keys while probing:
+ *
+ *     for (size_t i = hash & mask; slots[i] != 0; i = (i + 1) & mask)
+ *
+ * and keep the table at most half full with hash_slots_full() and
+ * hash_slots_build().
+ */
+
+/** Hash of entry \p i_entry, the same one it was inserted with. */
+typedef uint64_t (*hash_slots_hash_cb)(const void *p_opaque, size_t i_entry);
+
+/**
+ * Whether adding an entry to \p i_count would make the table more than half
+ * full (always true for a table not allocated yet, \p i_mask 0).
+ */
+static inline bool hash_slots_full(size_t i_count, size_t i_mask)
+{
+    return (i_count + 1) * 2 > i_mask + 1;
+}
+
+/**
+ * Put entry \p i_entry in the first free slot of its probe sequence. Keys
+ * are not compared: the caller knows the entry is not in the table.
+ */
+static inline void hash_slots_insert(size_t *p_slots, size_t i_mask, uint64_t i_hash,
+                                     size_t i_entry)
+{
+    size_t i = (size_t)i_hash & i_mask;
+    while (p_slots[i] != 0)
+        i = (i + 1) & i_mask;
+    p_slots[i] = i_entry + 1;
+}
+
+/**
+ * Slot holding entry \p i_entry, which must be in the table.
+ */
+static inline size_t *hash_slots_of(size_t *p_slots, size_t i_mask, uint64_t i_hash,
+                                    size_t i_entry)
+{
+    size_t i = (size_t)i_hash & i_mask;
+    while (p_slots[i] != i_entry + 1)
+        i = (i + 1) & i_mask;
+    return &p_slots[i];
+}
+
+/**
+ * Empty \p p_slot and backward-shift the rest of its cluster, so probes
+ * for the entries after it stay unbroken.
+ */
+static inline void hash_slots_remove(size_t *p_slots, size_t i_mask, size_t *p_slot,
+                                     hash_slots_hash_cb pf_hash, const void *p_opaque)
+{
+    size_t i = (size_t)(p_slot - p_slots);
+    p_slots[i] = 0;
+    for (size_t j = (i + 1) & i_mask; p_slots[j] != 0; j = (j + 1) & i_mask) {
+        size_t i_home = (size_t)pf_hash(p_opaque, p_slots[j] - 1) & i_mask;
+        if (((j - i_home) & i_mask) >= ((j - i) & i_mask)) {
+            p_slots[i] = p_slots[j];
+            p_slots[j] = 0;
+            i = j;
+        }
+    }
+}
+
+/**
+ * New table of \p i_slots slots (a power of two) holding entries
+ * [0, \p i_entries), for growing a table or rebuilding it. \p pf_live, when
+ * set, filters entries out.
+ *
+ * \return The slots, or NULL on allocation failure.
+ */
+static inline size_t *hash_slots_build(size_t i_slots, size_t i_entries, hash_slots_hash_cb pf_hash,
+                                       bool (*pf_live)(const void *p_opaque, size_t i_entry),
+                                       const void *p_opaque)
+{
+    size_t *p_slots = calloc(i_slots, sizeof(*p_slots));
+    if (p_slots == NULL)
+        return NULL;
+    for (size_t i = 0; i < i_entries; i++)
+        if (pf_live == NULL || pf_live(p_opaque, i))
+            hash_slots_insert(p_slots, i_slots - 1, pf_hash(p_opaque, i), i);
+    return p_slots;
+}
+
+#endif // HASH_SLOTS_H
@@ -6,16 +6,33 @@
 #include <vlc_stream.h>
 #include <vlc_threads.h>
 #include <vlc_playlist.h>
+#include <vlc_fs.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 
 #include "tag_utils.h"
+#include "tag_journal.h"
+#include "write_queue.h"
+#include "seen_index.h"
+#include "tag_cache.h"
+#include "tag_share.h"
+#include "dir_aggregate.h"
+#include "xattr_batch.h"
+#include "sidecar_store.h"
+#include "mount_table.h"
+#include "metrics.h"
 #include "compat.h"
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include "xattr_compat.h"
 #include <errno.h>
 
@@ -36,16 +53,73 @@
 #endif
 
 #define XATTR_SIZE 10000  // Maximum size of an extended attribute value
+#define WRITE_ATTEMPTS 5  // Conditional writes tried before a batch goes to the journal
+#define WRITE_BACKOFF_MS 2  // First retry delay after a conflicting write, doubled each time
 #define DEFAULT_TAG_NAME "seen"
+#define DEFAULT_QUEUE_SIZE 64
+#define DEFAULT_CACHE_SIZE 256      // Files whose tag list is remembered
+#define DEFAULT_SHARED_TTL 300      // Seconds a tag published by another instance is trusted
+#define SHARED_TABLE_SLOTS 8192     // Same in every instance, so they find each other's entries
+#define DEFAULT_METRICS_INTERVAL 15 // Seconds between metrics refreshes
+#define DEFAULT_CHECKPOINT_INTERVAL 30 // Minimum seconds between checkpoints of a file
+#define DEFAULT_RESUME_DEADLINE 500 // Milliseconds a stored position may take to arrive
+#define RESUME_MAX_FRACTION 0.95    // Positions past this share of the length are not resumed
+#define RESUME_QUEUE_SIZE 2         // Resume reads waiting for the writer thread
+#define DEFAULT_PREFETCH_COUNT 10   // Upcoming playlist items whose tags are read ahead
+#define DEFAULT_PREFETCH_THREADS 2  // Concurrent prefetch reads
+#define MAX_PREFETCH_THREADS 8
+#define PREFETCH_BATCH 16           // Playlist items read by one submission
+#define METRICS_PREFIX "vlc_xattr_"
+#define DEFAULT_JOURNAL_RETRY 60    // Seconds between journal replays
+#define JOURNAL_REPLAY_BATCH 32     // Journal entries retried per replay
+#define JOURNAL_FILE_NAME "xattr-journal.bin"
+#define INDEX_FILE_NAME "xattr-index.bin"
+#define SIDECAR_FILE_NAME "xattr-sidecar.log"
+#define SIDECAR_GROUP_MAX 32        // Sidecar values synced by one group commit
+#define SCHEDULE_SLACK (CLOCK_FREQ / 10)    // Fire a little late, so the position has crossed the threshold
+#define SEEK_TOLERANCE CLOCK_FREQ           // Drift from the expected playback time treated as a seek
+#define ANCHOR_IDLE (-1)                    // Anchor wall time while position events cannot make anything due
+#define ANCHOR_RATE_ONE 1000000             // Anchor rate fixed-point unit
 
 static int Open(vlc_object_t *);
 static void Close(vlc_object_t *);
 static int PlayingChange(vlc_object_t *p_this, const char *psz_var,
                          vlc_value_t oldval, vlc_value_t newval, void *p_data);
-static int PositionChange(vlc_object_t *p_this, const char *psz_var,
-                         vlc_value_t oldval, vlc_value_t newval, void *p_data);
+static void ScheduleTimer(void *p_data);
 static int ItemChange(vlc_object_t *p_this, const char *psz_var,
                       vlc_value_t oldval, vlc_value_t newval, void *p_data);
+static void *WriterThread(void *p_data);
+static char *UserDataFile(const char *psz_name);
+static void OpenJournal(intf_thread_t *p_intf);
+static void JournalTimer(void *p_data);
+static void MetricsTimer(void *p_data);
+
+typedef enum {
+    METRICS_VAR_CREATE,
+    METRICS_VAR_UPDATE,
+    METRICS_VAR_DESTROY,
+} metrics_var_op_t;
+
+static void MetricsVariables(intf_thread_t *p_intf, metrics_var_op_t op);
+static void PublishMetrics(intf_thread_t *p_intf);
+static void QueueCheckpoint(intf_thread_t *p_intf, input_thread_t *p_input, bool b_final);
+static void ObserveSince(intf_thread_t *p_intf, metrics_histogram_t histogram, mtime_t i_start);
+static bool IsMissingXattr(int err);
+static bool IsUnsupportedXattr(int err);
+static void *PrefetchThread(void *p_data);
+static char *ItemPath(input_item_t *p_item);
+static int PlaylistChange(vlc_object_t *p_this, const char *psz_var,
+                          vlc_value_t oldval, vlc_value_t newval, void *p_data);
+static int ConfigChange(vlc_object_t *p_this, const char *psz_var,
+                        vlc_value_t oldval, vlc_value_t newval, void *p_data);
+
+/* Options whose changes are applied without restarting the interface */
+static const char *const ppsz_config_vars[] = {
+    "xattr-key", "xattr-targets", "xattr-tag-name", "xattr-skip-paths", "xattr-skip-paths-file",
+};
+
+static const char *const ppsz_overflow_values[] = { "drop-newest", "drop-oldest" };
+static const char *const ppsz_overflow_names[] = { N_("Drop new writes"), N_("Drop oldest writes") };
 
 static const char *xattr_error_reason(int err)
 {
@@ -71,6 +145,20 @@ static const char *xattr_error_reason(int err)
             return NULL;
     }
 }
+/*
+ * Rules compiled from xattr-key, xattr-targets (or xattr-tag-name) and the
+ * skip lists. Immutable once published; reloads publish a new one.
+ */
+typedef struct xattr_config_t {
+    char *psz_xattr_key;                        /**< Xattr key to use */
+    xattr_target_t *targets;                    /**< Configured targets, sorted by percent */
+    int i_target_count;                         /**< Number of targets */
+    const char **ppsz_target_names;             /**< Target names in the same order, for batches */
+    skip_matcher_t *p_skip_matcher;             /**< Compiled xattr-skip-paths prefixes */
+    atomic_uint i_refs;                         /**< The published pointer holds one */
+    struct xattr_config_t *p_next_retired;      /**< Next unpublished config awaiting release */
+} xattr_config_t;
+
 struct current_item_t {
     // vlc_tick_t  i_start;            /**< playing start    */
 };
@@ -80,12 +168,84 @@ struct intf_sys_t {
     input_thread_t         *p_input;            /**< current input thread   */
     input_item_t *p_item;                       /**< Previous item */
     bool b_tagging_enabled;                     /**< Whether to write xattrs */
-    char *psz_xattr_key;                        /**< Xattr key to use */
-    xattr_target_t *targets;                    /**< Configured targets */
-    int i_target_count;                         /**< Number of targets */
-    bool *b_target_applied;                     /**< Flags for applied targets for current item */
+    _Atomic(xattr_config_t *) p_config;         /**< Current rules, swapped by the writer thread */
+    atomic_uint i_config_readers;               /**< Threads between loading p_config and taking a reference */
+    xattr_config_t *p_retired_configs;          /**< Unpublished, not released yet; writer thread only */
+    atomic_bool b_reload_due;                   /**< Set by ConfigChange, consumed by the writer */
+    xattr_config_t *p_item_config;              /**< Rules the current item started with, under schedule_lock */
+    int i_next_target;                          /**< Cursor: first target not yet applied to the current item */
+    vlc_mutex_t schedule_lock;                  /**< Serializes the input callbacks and schedule_timer on the item state */
+    vlc_timer_t schedule_timer;                 /**< Fires when the next target or checkpoint is due */
+    bool b_schedule_timer;                      /**< Whether schedule_timer was created */
+    atomic_uint_fast64_t i_anchor_seq;          /**< Odd while the anchor below is rewritten */
+    atomic_int_fast64_t i_anchor_wall;          /**< When the timer was last armed while playing, ANCHOR_IDLE or 0 */
+    atomic_int_fast64_t i_anchor_time;          /**< Playback time at i_anchor_wall */
+    atomic_int_fast64_t i_anchor_rate;          /**< Playback rate at i_anchor_wall, in 1/ANCHOR_RATE_ONE */
     char *psz_current_path;                     /**< Current file path being played */
-    char *psz_skip_paths;                       /**< Comma/newline-separated path prefixes to skip */
+    xattr_file_t *p_current_file;               /**< Current file, opened once for fd-based writes */
+    bool b_skip_current;                        /**< Current item matched the skip list */
+
+    char *psz_position_key;                     /**< Xattr holding the resume position, or NULL */
+    char *psz_watchtime_key;                    /**< Xattr accumulating watch time, or NULL */
+    mtime_t i_checkpoint_interval;              /**< Minimum time between checkpoints, 0 disables them */
+    mtime_t i_last_checkpoint;                  /**< When the current item was last checkpointed */
+    mtime_t i_position_written;                 /**< Playback time in the last checkpoint, or -1 */
+    mtime_t i_watch_pending;                    /**< Watch time not checkpointed yet */
+    mtime_t i_play_start;                       /**< Start of the current playing stretch, or 0 */
+
+    bool b_resume;                              /**< Seek new items to their stored position */
+    bool b_resume_skip_seen;                    /**< Do not resume files carrying the last target's tag */
+    mtime_t i_resume_deadline;                  /**< How long a stored position may take to arrive */
+    bool b_resume_pending;                      /**< A read was queued for the current input */
+    mtime_t i_resume_expiry;                    /**< When the pending read is given up */
+    atomic_uint_fast64_t i_resume_generation;   /**< Current item, bumped by ItemChange */
+    atomic_uint_fast64_t i_resume_ready;        /**< Item the published position belongs to */
+    atomic_int_fast64_t i_resume_ms;            /**< Published position, or -1 for none */
+
+    /* Playlist prefetch: tags of upcoming items are read into their meta */
+    int i_prefetch_count;                       /**< Upcoming items read first, 0 disables prefetch */
+    bool b_prefetch_all;                        /**< Then read every other playlist item */
+    bool b_io_uring;                            /**< Batch the reads through io_uring where available */
+    vlc_thread_t *p_prefetch_threads;           /**< Readers; their number caps concurrent reads */
+    int i_prefetch_threads;                     /**< Readers started */
+    int i_prefetch_share;                       /**< Readers the pending items are split between */
+    vlc_mutex_t prefetch_lock;                  /**< Protects the fields below */
+    vlc_cond_t prefetch_wait;                   /**< Signalled on new work and on stop */
+    input_item_t **pp_prefetch;                 /**< Held items to read, upcoming ones first */
+    size_t i_prefetch_size;
+    size_t i_prefetch_next;                     /**< First item not handed to a reader */
+    size_t i_prefetch_upcoming;                 /**< Items of the list that are upcoming ones */
+    bool b_prefetch_rescan;                     /**< The playlist changed: rebuild the list */
+    bool b_prefetch_stop;
+
+    write_queue_t write_queue;                  /**< Jobs waiting for the writer thread */
+    write_queue_t resume_queue;                 /**< Resume reads, run ahead of write_queue */
+    vlc_thread_t writer_thread;                 /**< Background xattr writer */
+    vlc_sem_t writer_sem;                       /**< Posted once per queued job and on stop */
+    atomic_bool b_writer_stop;                  /**< Set by Close to end the writer loop */
+    bool b_writer_started;                      /**< Whether writer_thread must be joined */
+    bool b_callbacks_added;                     /**< Whether the item and config callbacks are set */
+    bool b_flush_on_close;                      /**< Write (rather than discard) queued jobs on Close */
+    metrics_t metrics;                          /**< Pipeline counters, updated from any thread */
+    char *psz_metrics_file;                     /**< Prometheus textfile to refresh, or NULL */
+    vlc_timer_t metrics_timer;                  /**< Periodically publishes the metrics */
+    bool b_metrics_timer;                       /**< Whether metrics_timer was created */
+
+    tag_journal_t *p_journal;                   /**< Deferred writes, owned by the writer thread */
+    vlc_timer_t journal_timer;                  /**< Periodically requests a journal replay */
+    bool b_journal_timer;                       /**< Whether journal_timer was created */
+    atomic_bool b_replay_due;                   /**< Set by the timer, consumed by the writer */
+
+    seen_index_t *p_seen_index;                 /**< Index of tagged files, owned by the writer thread */
+    sidecar_store_t *p_sidecar;                 /**< Values of files without xattr support, owned by the writer thread */
+    mount_table_t *p_mounts;                    /**< Mount capabilities, owned by the writer thread */
+    tag_buffer_t tag_scratch;                   /**< Read-modify-write buffer, owned by the writer thread */
+    tag_set_t tag_set;                          /**< Membership index for large lists, owned by the writer thread */
+    tag_cache_t *p_tag_cache;                   /**< Known tag lists by inode, owned by the writer thread */
+    tag_share_t *p_tag_share;                   /**< Tags recently written by any instance, or NULL */
+    bool b_dir_aggregate;                       /**< Keep seen counts on parent directories */
+    tag_buffer_t dir_scratch;                   /**< Directory aggregate value, owned by the writer thread */
+    dir_aggregate_t dir_aggregate;              /**< Decoded aggregate, owned by the writer thread */
 };
 
 vlc_module_begin()
@@ -98,6 +258,7 @@ vlc_module_begin()
      *  - xattr-tagging-enabled: master switch to enable/disable xattr writes.
      *  - xattr-tag-name: tag to append to user.xdg.tags (default: "seen").
      *  - xattr-skip-paths: comma/newline separated absolute path prefixes to skip.
+     *  - xattr-skip-paths-file: file holding more prefixes, one per line.
      */
     add_bool("xattr-tagging-enabled", true,
              N_("Enable tagging"),
@@ -119,267 +280,2474 @@ vlc_module_begin()
                N_("Skip paths"),
                N_("Comma- or newline-separated list of absolute path prefixes that should not be tagged."),
                false)
+    add_loadfile("xattr-skip-paths-file", NULL,
+                 N_("Skip paths file"),
+                 N_("File listing additional path prefixes that should not be tagged, one per line."))
+    add_integer("xattr-queue-size", DEFAULT_QUEUE_SIZE,
+                N_("Write queue size"),
+                N_("Maximum number of tag writes waiting for the background writer."),
+                true)
+    add_string("xattr-queue-overflow", "drop-newest",
+               N_("Write queue overflow"),
+               N_("Which write to drop when the write queue is full."),
+               true)
+        change_string_list(ppsz_overflow_values, ppsz_overflow_names)
+    add_bool("xattr-flush-on-close", true,
+             N_("Flush writes on close"),
+             N_("Finish queued tag writes before the interface shuts down instead of discarding them."),
+             true)
+    add_bool("xattr-journal", true,
+             N_("Journal failed writes"),
+             N_("Keep tag writes that fail on read-only, full or offline filesystems in a journal and retry them later."),
+             true)
+    add_integer("xattr-journal-retry", DEFAULT_JOURNAL_RETRY,
+                N_("Journal retry interval"),
+                N_("Seconds between attempts to replay journaled tag writes."),
+                true)
+    add_bool("xattr-index", true,
+             N_("Maintain seen-state index"),
+             N_("Record every tagged file in an index in the user data directory, so tools can query the library without reading xattrs."),
+             true)
+    add_bool("xattr-sidecar", true,
+             N_("Store tags of files without xattr support"),
+             N_("Keep the tags, positions and watch times of files on filesystems without user xattrs (NTFS, FAT, exFAT, ...) in a log in the user data directory instead."),
+             true)
+    add_bool("xattr-mount-cache", true,
+             N_("Remember mount capabilities"),
+             N_("Read the mount table and skip xattr calls on mounts that are read-only or do not support user xattrs, refreshing it when mounts change. Linux only."),
+             true)
+    add_integer("xattr-cache-size", DEFAULT_CACHE_SIZE,
+                N_("Tag cache size"),
+                N_("Number of files whose tags are remembered, so replaying a file does not read or write its xattrs again. 0 disables the cache."),
+                true)
+    add_bool("xattr-shared-table", false,
+             N_("Share written tags between instances"),
+             N_("Keep recently written tags in a shared memory table, so VLC instances running as the same user skip reading and writing tags another one has just written."),
+             true)
+    add_integer("xattr-shared-ttl", DEFAULT_SHARED_TTL,
+                N_("Shared tag lifetime"),
+                N_("Seconds an entry of the shared tag table is trusted."),
+                true)
+    add_bool("xattr-dir-aggregate", false,
+             N_("Keep seen counts on directories"),
+             N_("When a file gets the last target's tag (e.g. seen), add it to the " DIR_AGGREGATE_COUNT_KEY " and " DIR_AGGREGATE_CHILDREN_KEY " attributes of its directory, so file managers can show how many files of a folder were seen with a single read."),
+             true)
+    add_integer("xattr-checkpoint-interval", DEFAULT_CHECKPOINT_INTERVAL,
+                N_("Checkpoint interval"),
+                N_("Minimum seconds between writes of the playback position and watch time to a file. The final state is always written when the item changes. 0 disables checkpoints."),
+                true)
+    add_string("xattr-position-key", "user.vlc.position",
+               N_("Position key"),
+               N_("Extended attribute storing the last playback position, in seconds. Empty disables it."),
+               true)
+    add_string("xattr-watchtime-key", "user.vlc.watchtime",
+               N_("Watch time key"),
+               N_("Extended attribute accumulating the time spent playing the file, in seconds. Empty disables it."),
+               true)
+    add_bool("xattr-resume", false,
+             N_("Resume from stored position"),
+             N_("When an item starts, seek to the position stored in the position key. The lookup runs in the background and is dropped if it misses the deadline."),
+             true)
+    add_integer("xattr-resume-deadline", DEFAULT_RESUME_DEADLINE,
+                N_("Resume deadline"),
+                N_("Milliseconds after the item starts during which a stored position is still applied."),
+                true)
+    add_bool("xattr-resume-skip-seen", true,
+             N_("Do not resume seen files"),
+             N_("Start files that already carry the last target's tag (e.g. seen) from the beginning."),
+             true)
+    add_integer("xattr-prefetch-count", DEFAULT_PREFETCH_COUNT,
+                N_("Prefetch upcoming items"),
+                N_("Read the tag key of this many upcoming playlist items in the background and publish it in their meta, so interfaces can show seen state without reading xattrs. 0 disables prefetching."),
+                true)
+    add_bool("xattr-prefetch-all", false,
+             N_("Prefetch the whole playlist"),
+             N_("After the upcoming items, read the tags of every other playlist item too."),
+             true)
+    add_integer_with_range("xattr-prefetch-threads", DEFAULT_PREFETCH_THREADS, 1, MAX_PREFETCH_THREADS,
+                           N_("Prefetch threads"),
+                           N_("Maximum number of playlist items read at the same time."),
+                           true)
+    add_bool("xattr-io-uring", true,
+             N_("Batch background reads with io_uring"),
+             N_("On Linux 5.19 and later, submit the prefetch reads of several playlist items at once through io_uring, so they overlap on network filesystems. Plain system calls are used where io_uring is unavailable."),
+             true)
+    add_string("xattr-metrics-file", "",
+               N_("Metrics file"),
+               N_("Prometheus textfile-collector file to refresh with the plugin's counters and latencies, e.g. /var/lib/node_exporter/vlc_xattr.prom. Empty disables it."),
+               true)
+    add_integer("xattr-metrics-interval", DEFAULT_METRICS_INTERVAL,
+                N_("Metrics interval"),
+                N_("Seconds between refreshes of the xattr-metric-* variables and the metrics file."),
+                true)
     set_callbacks(Open, Close)
 vlc_module_end()
 
 
-static int Open(vlc_object_t *p_this)
+/*****************************************************************************
+ * LoadSkipList: merge xattr-skip-paths with the contents of xattr-skip-paths-file
+ *****************************************************************************/
+static char *LoadSkipList(intf_thread_t *p_intf)
 {
-    intf_thread_t   *p_intf     = (intf_thread_t*) p_this;
-    p_intf->p_sys = calloc(1, sizeof(intf_sys_t));
-    printf("Report Playing extension activated\n");
-    msg_Info(p_this, "Report Playing extension activated");
+    char *psz_list = var_InheritString(p_intf, "xattr-skip-paths");
+    char *psz_file = var_InheritString(p_intf, "xattr-skip-paths-file");
+    if (psz_file == NULL || *psz_file == '\0') {
+        free(psz_file);
+        return psz_list;
+    }
 
-    if (p_intf->p_sys == NULL)
-        return VLC_ENOMEM;
+    FILE *p_file = vlc_fopen(psz_file, "rb");
+    if (p_file == NULL) {
+        msg_Warn(p_intf, "Cannot open skip paths file %s: %s", psz_file, strerror(errno));
+        free(psz_file);
+        return psz_list;
+    }
 
-    p_intf->p_sys->b_tagging_enabled = var_InheritBool(p_intf, "xattr-tagging-enabled");
-    p_intf->p_sys->psz_xattr_key = var_InheritString(p_intf, "xattr-key");
-    p_intf->p_sys->psz_skip_paths = var_InheritString(p_intf, "xattr-skip-paths");
+    size_t list_len = psz_list ? strlen(psz_list) : 0;
+    size_t capacity = list_len + 4096;
+    char *psz_merged = malloc(capacity);
+    if (psz_merged != NULL) {
+        if (list_len > 0)
+            memcpy(psz_merged, psz_list, list_len);
+        size_t used = list_len;
+        psz_merged[used++] = '\n';
+
+        for (;;) {
+            if (capacity - used < 4096) {
+                char *psz_grown = realloc(psz_merged, capacity * 2);
+                if (psz_grown == NULL) {
+                    free(psz_merged);
+                    psz_merged = NULL;
+                    break;
+                }
+                psz_merged = psz_grown;
+                capacity *= 2;
+            }
+            size_t n = fread(psz_merged + used, 1, capacity - used - 1, p_file);
+            used += n;
+            if (n == 0)
+                break;
+        }
+        if (psz_merged != NULL)
+            psz_merged[used] = '\0';
+    }
+    fclose(p_file);
+    free(psz_file);
+
+    if (psz_merged == NULL)
+        return psz_list;
+    free(psz_list);
+    return psz_merged;
+}
+
+/*****************************************************************************
+ * InheritKey: string option naming an xattr, NULL when empty
+ *****************************************************************************/
+static char *InheritKey(intf_thread_t *p_intf, const char *psz_option)
+{
+    char *psz_key = var_InheritString(p_intf, psz_option);
+    if (psz_key != NULL && *psz_key == '\0') {
+        free(psz_key);
+        psz_key = NULL;
+    }
+    return psz_key;
+}
+
+/*****************************************************************************
+ * BuildConfig: compile the tag key, targets and skip lists from the options
+ *****************************************************************************/
+static xattr_config_t *BuildConfig(intf_thread_t *p_intf)
+{
+    xattr_config_t *p_config = calloc(1, sizeof(*p_config));
+    if (p_config == NULL)
+        return NULL;
+    atomic_init(&p_config->i_refs, 1);
+
+    p_config->psz_xattr_key = var_InheritString(p_intf, "xattr-key");
+    char *psz_skip_list = LoadSkipList(p_intf);
+    p_config->p_skip_matcher = skip_matcher_compile(psz_skip_list);
+    free(psz_skip_list);
+    if (p_config->psz_xattr_key == NULL || p_config->p_skip_matcher == NULL) {
+        skip_matcher_free(p_config->p_skip_matcher);
+        free(p_config->psz_xattr_key);
+        free(p_config);
+        return NULL;
+    }
+    msg_Dbg(p_intf, "Compiled %zu skip path prefixes", p_config->p_skip_matcher->i_count);
 
     char *psz_targets = var_InheritString(p_intf, "xattr-targets");
     if (psz_targets && *psz_targets) {
-        p_intf->p_sys->targets = parse_xattr_targets(psz_targets, &p_intf->p_sys->i_target_count);
+        p_config->targets = parse_xattr_targets(psz_targets, &p_config->i_target_count);
     } else {
         // Fallback to xattr-tag-name with 0%
         char *psz_tag_name = var_InheritString(p_intf, "xattr-tag-name");
-        if (psz_tag_name && *psz_tag_name) {
-             p_intf->p_sys->targets = calloc(1, sizeof(xattr_target_t));
-             p_intf->p_sys->targets[0].name = psz_tag_name; // Ownership transferred
-             p_intf->p_sys->targets[0].percent = 0;
-             p_intf->p_sys->i_target_count = 1;
+        if (psz_tag_name && *psz_tag_name
+         && (p_config->targets = calloc(1, sizeof(xattr_target_t))) != NULL) {
+             p_config->targets[0].name = psz_tag_name; // Ownership transferred
+             p_config->targets[0].percent = 0;
+             p_config->i_target_count = 1;
         } else {
             free(psz_tag_name);
         }
     }
     free(psz_targets);
 
-    if (p_intf->p_sys->i_target_count > 0) {
-        p_intf->p_sys->b_target_applied = calloc(p_intf->p_sys->i_target_count, sizeof(bool));
+    // Targets that fire together are contiguous: a batch is a slice of this
+    if (p_config->i_target_count > 0) {
+        p_config->ppsz_target_names = malloc(p_config->i_target_count
+                                             * sizeof(*p_config->ppsz_target_names));
+        if (p_config->ppsz_target_names == NULL) {
+            free_xattr_targets(p_config->targets, p_config->i_target_count);
+            p_config->targets = NULL;
+            p_config->i_target_count = 0;
+        }
+        for (int i = 0; i < p_config->i_target_count; i++)
+            p_config->ppsz_target_names[i] = p_config->targets[i].name;
     }
+    return p_config;
+}
 
-    var_AddCallback(pl_Get(p_intf), "input-current", ItemChange, p_intf);
+static void ConfigRelease(xattr_config_t *p_config)
+{
+    if (p_config == NULL
+     || atomic_fetch_sub_explicit(&p_config->i_refs, 1, memory_order_acq_rel) != 1)
+        return;
+    free_xattr_targets(p_config->targets, p_config->i_target_count);
+    free(p_config->ppsz_target_names);
+    skip_matcher_free(p_config->p_skip_matcher);
+    free(p_config->psz_xattr_key);
+    free(p_config);
+}
 
-    return VLC_SUCCESS;
+/*****************************************************************************
+ * ConfigAcquire: reference the current rules without taking a lock.
+ * The reader count tells ReloadConfig when nobody can still be about to
+ * reference a config it unpublished.
+ *****************************************************************************/
+static xattr_config_t *ConfigAcquire(intf_sys_t *p_sys)
+{
+    atomic_fetch_add(&p_sys->i_config_readers, 1);
+    xattr_config_t *p_config = atomic_load(&p_sys->p_config);
+    if (p_config != NULL)
+        atomic_fetch_add_explicit(&p_config->i_refs, 1, memory_order_relaxed);
+    atomic_fetch_sub(&p_sys->i_config_readers, 1);
+    return p_config;
 }
 
-static void Close(vlc_object_t *p_this)
+/*****************************************************************************
+ * WriterConfig: current rules, as seen by the writer thread. Only that
+ * thread replaces them, so it reads them without a reference.
+ *****************************************************************************/
+static const xattr_config_t *WriterConfig(intf_sys_t *p_sys)
 {
-    intf_thread_t               *p_intf = (intf_thread_t*) p_this;
-    intf_sys_t                  *p_sys  = p_intf->p_sys;
-    msg_Info(p_this, "Report Playing extension deactivated");
-    var_DelCallback(pl_Get(p_intf), "input-current", ItemChange, p_intf);
-    if (p_sys->p_input != NULL)
-    {
-        var_DelCallback(p_sys->p_input, "intf-event", PlayingChange, p_intf);
-        var_DelCallback(p_sys->p_input, "position", PositionChange, p_intf);
-        vlc_object_release(p_sys->p_input);
-        p_sys->p_input = NULL;
-    }
-    free_xattr_targets(p_sys->targets, p_sys->i_target_count);
-    free(p_sys->b_target_applied);
-    free(p_sys->psz_xattr_key);
-    free(p_sys->psz_skip_paths);
-    free(p_sys->psz_current_path);
-    free(p_sys);
-    p_intf->p_sys = NULL;
+    return atomic_load_explicit(&p_sys->p_config, memory_order_relaxed);
 }
 
-static void WriteTag(vlc_object_t *p_this, const char *psz_path, const char *newTag, const char *psz_xattr_key);
+/*****************************************************************************
+ * ReleaseRetiredConfigs: drop the published reference of the unpublished
+ * configs once no reader is between loading the pointer and referencing it.
+ * Called on every writer iteration, so a busy moment only delays it.
+ *****************************************************************************/
+static void ReleaseRetiredConfigs(intf_sys_t *p_sys)
+{
+    // Every retired config was unpublished before this load
+    if (p_sys->p_retired_configs == NULL || atomic_load(&p_sys->i_config_readers) != 0)
+        return;
+    while (p_sys->p_retired_configs != NULL) {
+        xattr_config_t *p_config = p_sys->p_retired_configs;
+        p_sys->p_retired_configs = p_config->p_next_retired;
+        ConfigRelease(p_config);
+    }
+}
 
 /*****************************************************************************
- * ItemChange: Playlist item change callback
+ * ReloadConfig: rebuild the rules and publish them, on the writer thread.
+ * Items already playing keep the rules they started with.
  *****************************************************************************/
-static int PositionChange(vlc_object_t *p_this, const char *psz_var,
-                         vlc_value_t oldval, vlc_value_t newval, void *p_data);
+static void ReloadConfig(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    xattr_config_t *p_config = BuildConfig(p_intf);
+    if (p_config == NULL) {
+        msg_Warn(p_intf, "Cannot rebuild the tagging rules, keeping the current ones");
+        return;
+    }
 
-static int ItemChange(vlc_object_t *p_this, const char *psz_var,
-                      vlc_value_t oldval, vlc_value_t newval, void *p_data)
+    xattr_config_t *p_old = atomic_exchange(&p_sys->p_config, p_config);
+    // Cached lists belong to the old key
+    if (strcmp(p_old->psz_xattr_key, p_config->psz_xattr_key) != 0)
+        tag_cache_clear(p_sys->p_tag_cache);
+    msg_Info(p_intf, "Tagging rules reloaded: %d target(s) on %s, %zu skip prefix(es)",
+             p_config->i_target_count, p_config->psz_xattr_key,
+             p_config->p_skip_matcher->i_count);
+
+    // A reader that loaded the old pointer has not necessarily referenced it yet
+    p_old->p_next_retired = p_sys->p_retired_configs;
+    p_sys->p_retired_configs = p_old;
+    ReleaseRetiredConfigs(p_sys);
+}
+
+/*****************************************************************************
+ * ConfigChange: a watched option changed; the writer thread rebuilds the rules
+ *****************************************************************************/
+static int ConfigChange(vlc_object_t *p_this, const char *psz_var,
+                        vlc_value_t oldval, vlc_value_t newval, void *p_data)
 {
-    intf_thread_t  *p_intf  = p_data;
-    intf_sys_t     *p_sys   = p_intf->p_sys;
-    input_thread_t *p_input = newval.p_address;
+    intf_thread_t *p_intf = p_data;
+    intf_sys_t    *p_sys  = p_intf->p_sys;
 
-    VLC_UNUSED(psz_var);
+    VLC_UNUSED(p_this);
     VLC_UNUSED(oldval);
+    VLC_UNUSED(newval);
 
-    if (p_sys->p_input != NULL)
-    {
-        var_DelCallback(p_sys->p_input, "intf-event", PlayingChange, p_intf);
-        var_DelCallback(p_sys->p_input, "position", PositionChange, p_intf);
-        vlc_object_release(p_sys->p_input);
-        p_sys->p_item = NULL;
-        p_sys->p_input = NULL;
-    }
+    msg_Dbg(p_intf, "%s changed, reloading the tagging rules", psz_var);
+    atomic_store(&p_sys->b_reload_due, true);
+    vlc_sem_post(&p_sys->writer_sem);
+    return VLC_SUCCESS;
+}
 
-    if (p_input == NULL)
-    {
-        p_sys->p_item = NULL;
-        return VLC_SUCCESS;
+/*****************************************************************************
+ * StartPrefetch: start the readers and follow playlist changes
+ *****************************************************************************/
+static void StartPrefetch(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    int64_t i_count = var_InheritInteger(p_intf, "xattr-prefetch-count");
+    int64_t i_threads = var_InheritInteger(p_intf, "xattr-prefetch-threads");
+    if (i_count < 1)
+        return;
+    if (i_threads < 1 || i_threads > MAX_PREFETCH_THREADS)
+        i_threads = DEFAULT_PREFETCH_THREADS;
+
+    p_sys->p_prefetch_threads = calloc((size_t)i_threads, sizeof(*p_sys->p_prefetch_threads));
+    if (p_sys->p_prefetch_threads == NULL)
+        return;
+    p_sys->i_prefetch_count = (int)i_count;
+    p_sys->b_prefetch_all = var_InheritBool(p_intf, "xattr-prefetch-all");
+    p_sys->b_io_uring = var_InheritBool(p_intf, "xattr-io-uring");
+    p_sys->i_prefetch_share = (int)i_threads;
+    vlc_mutex_init(&p_sys->prefetch_lock);
+    vlc_cond_init(&p_sys->prefetch_wait);
+    p_sys->b_prefetch_rescan = true;
+
+    while (p_sys->i_prefetch_threads < i_threads
+        && vlc_clone(&p_sys->p_prefetch_threads[p_sys->i_prefetch_threads], PrefetchThread,
+                     p_intf, VLC_THREAD_PRIORITY_LOW) == 0)
+        p_sys->i_prefetch_threads++;
+    if (p_sys->i_prefetch_threads == 0) {
+        msg_Warn(p_intf, "Failed to start the playlist prefetch threads");
+        return;
     }
 
-    input_item_t *p_item = input_GetItem(p_input);
-    if (p_item == NULL)
-        return VLC_SUCCESS;
+    playlist_t *p_playlist = pl_Get(p_intf);
+    var_AddCallback(p_playlist, "input-current", PlaylistChange, p_intf);
+    var_AddCallback(p_playlist, "playlist-item-append", PlaylistChange, p_intf);
+    var_AddCallback(p_playlist, "playlist-item-deleted", PlaylistChange, p_intf);
+}
 
-    if (var_CountChoices(p_input, "video-es"))
-    {
-        msg_Dbg(p_this, "Not an audio-only input, not submitting");
-        return VLC_SUCCESS;
+/*****************************************************************************
+ * DropPrefetchList: release the items not handed to a reader yet
+ *****************************************************************************/
+static void DropPrefetchList(intf_sys_t *p_sys)
+{
+    for (size_t i = p_sys->i_prefetch_next; i < p_sys->i_prefetch_size; i++)
+        input_item_Release(p_sys->pp_prefetch[i]);
+    free(p_sys->pp_prefetch);
+    p_sys->pp_prefetch = NULL;
+    p_sys->i_prefetch_size = p_sys->i_prefetch_next = p_sys->i_prefetch_upcoming = 0;
+}
+
+static void StopPrefetch(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    if (p_sys->p_prefetch_threads == NULL)
+        return;
+
+    if (p_sys->i_prefetch_threads > 0) {
+        playlist_t *p_playlist = pl_Get(p_intf);
+        var_DelCallback(p_playlist, "input-current", PlaylistChange, p_intf);
+        var_DelCallback(p_playlist, "playlist-item-append", PlaylistChange, p_intf);
+        var_DelCallback(p_playlist, "playlist-item-deleted", PlaylistChange, p_intf);
     }
 
-    p_sys->p_input = vlc_object_hold(p_input);
-    var_AddCallback(p_input, "intf-event", PlayingChange, p_intf);
-    var_AddCallback(p_input, "position", PositionChange, p_intf);
+    vlc_mutex_lock(&p_sys->prefetch_lock);
+    p_sys->b_prefetch_stop = true;
+    vlc_cond_broadcast(&p_sys->prefetch_wait);
+    vlc_mutex_unlock(&p_sys->prefetch_lock);
+    for (int i = 0; i < p_sys->i_prefetch_threads; i++)
+        vlc_join(p_sys->p_prefetch_threads[i], NULL);
 
-    return VLC_SUCCESS;
+    DropPrefetchList(p_sys);
+    vlc_cond_destroy(&p_sys->prefetch_wait);
+    vlc_mutex_destroy(&p_sys->prefetch_lock);
+    free(p_sys->p_prefetch_threads);
+    p_sys->p_prefetch_threads = NULL;
 }
 
-static int PositionChange(vlc_object_t *p_this, const char *psz_var,
-                         vlc_value_t oldval, vlc_value_t newval, void *p_data)
+/*****************************************************************************
+ * PlaylistChange: cancel pending prefetches and ask for a rebuild.
+ * Item append/delete events are sent with the playlist locked: only the
+ * readers walk the playlist.
+ *****************************************************************************/
+static int PlaylistChange(vlc_object_t *p_this, const char *psz_var,
+                          vlc_value_t oldval, vlc_value_t newval, void *p_data)
 {
-    input_thread_t *p_input_thread = (input_thread_t *)p_this;
-    intf_thread_t  *p_intf  = p_data;
-    intf_sys_t     *p_sys   = p_intf->p_sys;
+    intf_thread_t *p_intf = p_data;
+    intf_sys_t    *p_sys  = p_intf->p_sys;
 
-    VLC_UNUSED(p_input_thread);
+    VLC_UNUSED(p_this);
     VLC_UNUSED(psz_var);
     VLC_UNUSED(oldval);
+    VLC_UNUSED(newval);
 
-    if (!p_sys->b_tagging_enabled || p_sys->i_target_count == 0)
-        return VLC_SUCCESS;
+    vlc_mutex_lock(&p_sys->prefetch_lock);
+    DropPrefetchList(p_sys);
+    p_sys->b_prefetch_rescan = true;
+    vlc_cond_signal(&p_sys->prefetch_wait);
+    vlc_mutex_unlock(&p_sys->prefetch_lock);
+    return VLC_SUCCESS;
+}
 
-    if (p_sys->psz_current_path == NULL)
-        return VLC_SUCCESS;
+/*****************************************************************************
+ * BuildPrefetchList: hold the upcoming items, then (optionally) all others
+ *****************************************************************************/
+static input_item_t **BuildPrefetchList(intf_thread_t *p_intf, size_t *p_size,
+                                        size_t *p_upcoming)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    playlist_t *p_playlist = pl_Get(p_intf);
+    input_item_t **pp_items = NULL;
+    size_t i_size = 0;
 
-    if (should_skip_path(p_sys->psz_current_path, p_sys->psz_skip_paths))
-         return VLC_SUCCESS;
+    PL_LOCK;
+    int i_total = p_playlist->current.i_size;
+    int i_first = p_playlist->i_current_index + 1;
+    if (i_first < 0 || i_first > i_total)
+        i_first = 0;
+    int i_upcoming = i_total - i_first < p_sys->i_prefetch_count
+                   ? i_total - i_first : p_sys->i_prefetch_count;
+    size_t i_capacity = (size_t)(p_sys->b_prefetch_all ? i_total : i_upcoming);
+    if (i_capacity > 0)
+        pp_items = malloc(i_capacity * sizeof(*pp_items));
+    if (pp_items != NULL) {
+        for (int i = 0; i < i_upcoming; i++)
+            pp_items[i_size++] = input_item_Hold(p_playlist->current.p_elems[i_first + i]->p_input);
+        // The rest in playlist order, after the upcoming ones
+        for (int i = 0; p_sys->b_prefetch_all && i < i_total; i++)
+            if (i < i_first || i >= i_first + i_upcoming)
+                pp_items[i_size++] = input_item_Hold(p_playlist->current.p_elems[i]->p_input);
+    }
+    PL_UNLOCK;
+
+    *p_size = i_size;
+    *p_upcoming = (size_t)(i_upcoming > 0 ? i_upcoming : 0);
+    return pp_items;
+}
+
+/*****************************************************************************
+ * PrefetchItems: read the tag key of a few items in one batch and publish
+ * each value as extra meta
+ *****************************************************************************/
+static void PrefetchItems(intf_thread_t *p_intf, input_item_t *const *pp_items,
+                          const bool *pb_upcoming, size_t i_count, xattr_batch_t *p_batch,
+                          tag_buffer_t *p_bufs)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    xattr_config_t *p_config = ConfigAcquire(p_sys);
+    if (p_config == NULL)
+        return;
+    const char *psz_key = p_config->psz_xattr_key;
 
-    float position = newval.f_float;
-    int percent = (int)(position * 100);
+    xattr_batch_op_t ops[PREFETCH_BATCH];
+    input_item_t *pp_read[PREFETCH_BATCH];
+    size_t i_ops = 0;
+    for (size_t i = 0; i < i_count; i++) {
+        input_item_t *p_item = pp_items[i];
+        // Background items are read once; upcoming ones again, as they may
+        // have been tagged since
+        if (!pb_upcoming[i]) {
+            vlc_mutex_lock(&p_item->lock);
+            bool b_known = p_item->p_meta != NULL
+                        && vlc_meta_GetExtra(p_item->p_meta, psz_key) != NULL;
+            vlc_mutex_unlock(&p_item->lock);
+            if (b_known)
+                continue;
+        }
 
-    for (int i = 0; i < p_sys->i_target_count; i++) {
-        if (!p_sys->b_target_applied[i] && percent >= p_sys->targets[i].percent) {
-             WriteTag((vlc_object_t*)p_intf, p_sys->psz_current_path, p_sys->targets[i].name, p_sys->psz_xattr_key);
-             p_sys->b_target_applied[i] = true;
+        char *psz_path = ItemPath(p_item);
+        if (psz_path == NULL || skip_matcher_match(p_config->p_skip_matcher, psz_path)
+         || !tag_buffer_reserve(&p_bufs[i_ops], XATTR_SIZE)) {
+            free(psz_path);
+            continue;
         }
+        ops[i_ops] = (xattr_batch_op_t) {
+            .i_kind = XATTR_BATCH_GET, .psz_path = psz_path, .i_fd = -1, .psz_name = psz_key,
+            .p_value = p_bufs[i_ops].p_data, .i_size = p_bufs[i_ops].i_capacity - 1,
+        };
+        pp_read[i_ops++] = p_item;
     }
 
-    return VLC_SUCCESS;
+    mtime_t i_start = mdate();
+    xattr_batch_run(p_batch, ops, i_ops);
+    ObserveSince(p_intf, METRIC_GETXATTR_SECONDS, i_start);
+
+    for (size_t i = 0; i < i_ops; i++) {
+        tag_buffer_t *p_buf = &p_bufs[i];
+        ssize_t i_len = ops[i].i_result;
+        int err = ops[i].i_errno;
+        // Larger than usual: read it again on its own
+        if (i_len == -1 && err == ERANGE) {
+            ssize_t i_size = sys_getxattr(ops[i].psz_path, psz_key, NULL, 0);
+            if (i_size > 0 && tag_buffer_reserve(p_buf, (size_t)i_size + 1))
+                i_len = sys_getxattr(ops[i].psz_path, psz_key, p_buf->p_data,
+                                     p_buf->i_capacity - 1);
+            err = errno;
+        }
+        free((char *)ops[i].psz_path);
+
+        // No value means no tags; any other failure leaves the meta alone
+        if (i_len == -1 && !IsMissingXattr(err)) {
+            metrics_count_error(&p_sys->metrics, err);
+            continue;
+        }
+        size_t i_tags_len = i_len > 0 ? (size_t)i_len : 0;
+        p_buf->p_data[i_tags_len] = '\0';
+
+        input_item_t *p_item = pp_read[i];
+        vlc_mutex_lock(&p_item->lock);
+        if (p_item->p_meta == NULL)
+            p_item->p_meta = vlc_meta_New();
+        if (p_item->p_meta != NULL)
+            vlc_meta_AddExtra(p_item->p_meta, psz_key, p_buf->p_data);
+        vlc_mutex_unlock(&p_item->lock);
+        metrics_add(&p_sys->metrics, METRIC_ITEMS_PREFETCHED, 1);
+    }
+    ConfigRelease(p_config);
 }
 
-static void WriteTag(vlc_object_t *p_this, const char *psz_path, const char *newTag, const char *psz_xattr_key)
+/*****************************************************************************
+ * PrefetchThread: one reader; rebuilds the list when the playlist changed
+ *****************************************************************************/
+static void *PrefetchThread(void *p_data)
 {
-    char value[XATTR_SIZE];
-    char *value_dynamic = NULL;
-    ssize_t value_len;
+    intf_thread_t *p_intf = p_data;
+    intf_sys_t    *p_sys  = p_intf->p_sys;
+    tag_buffer_t bufs[PREFETCH_BATCH];
+    memset(bufs, 0, sizeof(bufs));
+    xattr_batch_t *p_batch = p_sys->b_io_uring ? xattr_batch_new(PREFETCH_BATCH) : NULL;
+
+    vlc_mutex_lock(&p_sys->prefetch_lock);
+    while (!p_sys->b_prefetch_stop) {
+        if (p_sys->b_prefetch_rescan) {
+            p_sys->b_prefetch_rescan = false;
+            vlc_mutex_unlock(&p_sys->prefetch_lock);
+
+            size_t i_size, i_upcoming;
+            input_item_t **pp_items = BuildPrefetchList(p_intf, &i_size, &i_upcoming);
+
+            vlc_mutex_lock(&p_sys->prefetch_lock);
+            DropPrefetchList(p_sys);
+            p_sys->pp_prefetch = pp_items;
+            p_sys->i_prefetch_size = i_size;
+            p_sys->i_prefetch_upcoming = i_upcoming;
+            // Another change came in meanwhile: this list is already stale
+            if (p_sys->b_prefetch_rescan)
+                DropPrefetchList(p_sys);
+            vlc_cond_broadcast(&p_sys->prefetch_wait);
+            continue;
+        }
 
-    // Check if the attribute already exists
-    value_len = sys_getxattr(psz_path, psz_xattr_key, value, XATTR_SIZE);
-    if (value_len == -1 && errno == ERANGE) {
-        // Buffer too small, get size first
-        value_len = sys_getxattr(psz_path, psz_xattr_key, NULL, 0);
-        if (value_len != -1) {
-            value_dynamic = malloc(value_len);
-            if (value_dynamic == NULL) {
-                perror("malloc");
-                return;
+        if (p_sys->i_prefetch_next < p_sys->i_prefetch_size) {
+            // Share what is left with the other readers, a batch at most
+            size_t i_left = p_sys->i_prefetch_size - p_sys->i_prefetch_next;
+            size_t i_count = (i_left + p_sys->i_prefetch_share - 1) / p_sys->i_prefetch_share;
+            if (i_count > PREFETCH_BATCH)
+                i_count = PREFETCH_BATCH;
+            input_item_t *pp_items[PREFETCH_BATCH];
+            bool pb_upcoming[PREFETCH_BATCH];
+            for (size_t i = 0; i < i_count; i++) {
+                pb_upcoming[i] = p_sys->i_prefetch_next < p_sys->i_prefetch_upcoming;
+                pp_items[i] = p_sys->pp_prefetch[p_sys->i_prefetch_next++];
             }
-            value_len = sys_getxattr(psz_path, psz_xattr_key, value_dynamic, value_len);
+            vlc_mutex_unlock(&p_sys->prefetch_lock);
+
+            int canc = vlc_savecancel();
+            PrefetchItems(p_intf, pp_items, pb_upcoming, i_count, p_batch, bufs);
+            for (size_t i = 0; i < i_count; i++)
+                input_item_Release(pp_items[i]);
+            vlc_restorecancel(canc);
+
+            vlc_mutex_lock(&p_sys->prefetch_lock);
+            continue;
         }
+
+        vlc_cond_wait(&p_sys->prefetch_wait, &p_sys->prefetch_lock);
     }
+    vlc_mutex_unlock(&p_sys->prefetch_lock);
 
-    char *userXdgTags = strdup(newTag);
-    bool tag_added = false;
-    bool xattr_key_found = false;
+    xattr_batch_free(p_batch);
+    for (size_t i = 0; i < PREFETCH_BATCH; i++)
+        tag_buffer_free(&bufs[i]);
+    return NULL;
+}
+
+static int Open(vlc_object_t *p_this)
+{
+    intf_thread_t   *p_intf     = (intf_thread_t*) p_this;
+    p_intf->p_sys = calloc(1, sizeof(intf_sys_t));
+    msg_Info(p_this, "Report Playing extension activated");
+
+    if (p_intf->p_sys == NULL)
+        return VLC_ENOMEM;
+    metrics_init(&p_intf->p_sys->metrics);
+    vlc_mutex_init(&p_intf->p_sys->schedule_lock);
+    vlc_sem_init(&p_intf->p_sys->writer_sem, 0);
 
-    if (value_len != -1) {
-        xattr_key_found = true;
-        char *value_buffer = value_dynamic ? value_dynamic : value;
-        free(userXdgTags);
-        char *value_copy = strndup(value_buffer, value_len);
-        userXdgTags = xdg_tags_append_if_missing(value_copy, newTag, &tag_added);
-        free(value_copy);
+    // Copies on the interface: changing them there reloads the rules
+    for (size_t i = 0; i < ARRAY_SIZE(ppsz_config_vars); i++)
+        var_Create(p_intf, ppsz_config_vars[i], VLC_VAR_STRING | VLC_VAR_DOINHERIT);
+    atomic_init(&p_intf->p_sys->i_config_readers, 0);
+    atomic_init(&p_intf->p_sys->b_reload_due, false);
+    atomic_init(&p_intf->p_sys->p_config, BuildConfig(p_intf));
+    if (atomic_load(&p_intf->p_sys->p_config) == NULL) {
+        Close(p_this);
+        return VLC_ENOMEM;
     }
 
-    if ((!xattr_key_found || tag_added) && userXdgTags != NULL) {
-        printf("Adding a extended attribute %s to key %s\n", newTag, psz_xattr_key);
+    p_intf->p_sys->b_tagging_enabled = var_InheritBool(p_intf, "xattr-tagging-enabled");
+    p_intf->p_sys->psz_position_key = InheritKey(p_intf, "xattr-position-key");
+    p_intf->p_sys->psz_watchtime_key = InheritKey(p_intf, "xattr-watchtime-key");
+    int64_t i_checkpoint = var_InheritInteger(p_intf, "xattr-checkpoint-interval");
+    if (i_checkpoint > 0 && (p_intf->p_sys->psz_position_key != NULL
+                          || p_intf->p_sys->psz_watchtime_key != NULL))
+        p_intf->p_sys->i_checkpoint_interval = i_checkpoint * CLOCK_FREQ;
+    p_intf->p_sys->b_resume = var_InheritBool(p_intf, "xattr-resume")
+                           && p_intf->p_sys->psz_position_key != NULL;
+    p_intf->p_sys->b_resume_skip_seen = var_InheritBool(p_intf, "xattr-resume-skip-seen");
+    int64_t i_deadline = var_InheritInteger(p_intf, "xattr-resume-deadline");
+    p_intf->p_sys->i_resume_deadline = (i_deadline > 0 ? i_deadline : DEFAULT_RESUME_DEADLINE)
+                                     * (CLOCK_FREQ / 1000);
+    atomic_init(&p_intf->p_sys->i_resume_generation, 0);
+    atomic_init(&p_intf->p_sys->i_resume_ready, 0);
+    atomic_init(&p_intf->p_sys->i_resume_ms, -1);
+    atomic_init(&p_intf->p_sys->i_anchor_seq, 0);
+    atomic_init(&p_intf->p_sys->i_anchor_wall, 0);
+    atomic_init(&p_intf->p_sys->i_anchor_time, 0);
+    atomic_init(&p_intf->p_sys->i_anchor_rate, 0);
+
 
-        size_t tag_len = strlen(userXdgTags);
-        size_t required_size = tag_len + 1; // Ensure space for null terminator
-        char *resized_tags = realloc(userXdgTags, required_size);
-        if (resized_tags == NULL) {
-            msg_Err(p_this, "Failed to resize buffer for %s on %s", psz_xattr_key, psz_path);
-        } else {
-            userXdgTags = resized_tags;
-            userXdgTags[tag_len] = '\0';
-
-            int ret = sys_setxattr(psz_path, psz_xattr_key, userXdgTags, required_size, 0);
-            if (ret == -1) {
-                int err = errno;
-                const char *psz_reason = xattr_error_reason(err);
-                if (psz_reason != NULL) {
-                    msg_Err(p_this, "Failed to set xattr %s on %s: %s (%s)",
-                            psz_xattr_key, psz_path, strerror(err), psz_reason);
-                } else {
-                    msg_Err(p_this, "Failed to set xattr %s on %s: %s", psz_xattr_key, psz_path,
-                            strerror(err));
-                }
-            }
+    intf_sys_t *p_sys = p_intf->p_sys;
+    p_sys->b_flush_on_close = var_InheritBool(p_intf, "xattr-flush-on-close");
+
+    int64_t i_queue_size = var_InheritInteger(p_intf, "xattr-queue-size");
+    if (i_queue_size < 1)
+        i_queue_size = DEFAULT_QUEUE_SIZE;
+
+    write_queue_overflow_t overflow = WRITE_QUEUE_DROP_NEWEST;
+    char *psz_overflow = var_InheritString(p_intf, "xattr-queue-overflow");
+    if (psz_overflow && strcmp(psz_overflow, "drop-oldest") == 0)
+        overflow = WRITE_QUEUE_DROP_OLDEST;
+    free(psz_overflow);
+
+    // Only the newest item's read matters: older ones give way
+    if (!write_queue_init(&p_sys->write_queue, (size_t)i_queue_size, overflow)
+     || !write_queue_init(&p_sys->resume_queue, RESUME_QUEUE_SIZE, WRITE_QUEUE_DROP_OLDEST)) {
+        Close(p_this);
+        return VLC_ENOMEM;
+    }
+
+    atomic_init(&p_sys->b_writer_stop, false);
+    atomic_init(&p_sys->b_replay_due, false);
+
+    if (var_InheritBool(p_intf, "xattr-journal"))
+        OpenJournal(p_intf);
+    if (var_InheritBool(p_intf, "xattr-index")) {
+        char *psz_file = UserDataFile(INDEX_FILE_NAME);
+        if (psz_file != NULL) {
+            p_sys->p_seen_index = seen_index_open(psz_file);
+            if (p_sys->p_seen_index == NULL)
+                msg_Warn(p_intf, "Cannot open seen-state index %s", psz_file);
+            free(psz_file);
+        }
+    }
+    if (var_InheritBool(p_intf, "xattr-sidecar")) {
+        char *psz_file = UserDataFile(SIDECAR_FILE_NAME);
+        if (psz_file != NULL) {
+            p_sys->p_sidecar = sidecar_store_open(psz_file);
+            if (p_sys->p_sidecar == NULL)
+                msg_Warn(p_intf, "Cannot open sidecar tag store %s", psz_file);
+            free(psz_file);
+        }
+    }
+    if (var_InheritBool(p_intf, "xattr-mount-cache"))
+        p_sys->p_mounts = mount_table_open();
+    p_sys->b_dir_aggregate = var_InheritBool(p_intf, "xattr-dir-aggregate");
+    int64_t i_cache_size = var_InheritInteger(p_intf, "xattr-cache-size");
+    if (i_cache_size > 0) {
+        p_sys->p_tag_cache = tag_cache_new((size_t)i_cache_size, true);
+        if (p_sys->p_tag_cache != NULL && !tag_cache_is_watching(p_sys->p_tag_cache))
+            msg_Dbg(p_intf, "Tag cache entries will be checked against ctime");
+    }
+    if (var_InheritBool(p_intf, "xattr-shared-table")) {
+        int64_t i_ttl = var_InheritInteger(p_intf, "xattr-shared-ttl");
+        if (i_ttl < 1)
+            i_ttl = DEFAULT_SHARED_TTL;
+#ifndef _WIN32
+        // One table per user: instances of other users cannot read our files' tags anyway
+        char psz_name[32];
+        snprintf(psz_name, sizeof(psz_name), "/vlc-xattr-%u", (unsigned)geteuid());
+        p_sys->p_tag_share = tag_share_open(psz_name, SHARED_TABLE_SLOTS, (uint64_t)i_ttl * 1000);
+#endif
+        if (p_sys->p_tag_share == NULL)
+            msg_Warn(p_intf, "Shared tag table unavailable, tags are not shared between instances");
+    }
+    if (vlc_clone(&p_sys->writer_thread, WriterThread, p_intf, VLC_THREAD_PRIORITY_LOW)) {
+        msg_Err(p_intf, "Failed to start the xattr writer thread");
+        Close(p_this);
+        return VLC_ENOMEM;
+    }
+    p_sys->b_writer_started = true;
+
+    if (p_sys->p_journal != NULL) {
+        // Replay leftovers from earlier sessions right away, then periodically
+        atomic_store(&p_sys->b_replay_due, true);
+        vlc_sem_post(&p_sys->writer_sem);
+
+        int64_t i_retry = var_InheritInteger(p_intf, "xattr-journal-retry");
+        if (i_retry < 1)
+            i_retry = DEFAULT_JOURNAL_RETRY;
+        if (vlc_timer_create(&p_sys->journal_timer, JournalTimer, p_intf) == 0) {
+            p_sys->b_journal_timer = true;
+            vlc_timer_schedule(p_sys->journal_timer, false, i_retry * CLOCK_FREQ,
+                               i_retry * CLOCK_FREQ);
         }
     }
-    if (userXdgTags != NULL) {
-        free(userXdgTags);
+
+    MetricsVariables(p_intf, METRICS_VAR_CREATE);
+    p_sys->psz_metrics_file = InheritKey(p_intf, "xattr-metrics-file");
+    int64_t i_interval = var_InheritInteger(p_intf, "xattr-metrics-interval");
+    if (i_interval < 1)
+        i_interval = DEFAULT_METRICS_INTERVAL;
+    if (vlc_timer_create(&p_sys->metrics_timer, MetricsTimer, p_intf) == 0) {
+        p_sys->b_metrics_timer = true;
+        vlc_timer_schedule(p_sys->metrics_timer, false, i_interval * CLOCK_FREQ,
+                           i_interval * CLOCK_FREQ);
+    }
+
+    if (vlc_timer_create(&p_sys->schedule_timer, ScheduleTimer, p_intf) != 0) {
+        msg_Err(p_intf, "Failed to create the tag schedule timer");
+        Close(p_this);
+        return VLC_ENOMEM;
     }
-    free(value_dynamic);
+    p_sys->b_schedule_timer = true;
+
+    var_AddCallback(pl_Get(p_intf), "input-current", ItemChange, p_intf);
+    StartPrefetch(p_intf);
+    for (size_t i = 0; i < ARRAY_SIZE(ppsz_config_vars); i++)
+        var_AddCallback(p_intf, ppsz_config_vars[i], ConfigChange, p_intf);
+    p_sys->b_callbacks_added = true;
+
+    return VLC_SUCCESS;
 }
 
-static int PlayingChange(vlc_object_t *p_this, const char *psz_var,
-                         vlc_value_t oldval, vlc_value_t newval, void *p_data)
+static void Close(vlc_object_t *p_this)
 {
-    input_thread_t *p_input_thread = (input_thread_t *)p_this;
-    intf_thread_t  *p_intf  = p_data;
-    intf_sys_t     *p_sys   = p_intf->p_sys;
-    input_item_t *p_item = input_GetItem(p_input_thread);
+    intf_thread_t               *p_intf = (intf_thread_t*) p_this;
+    intf_sys_t                  *p_sys  = p_intf->p_sys;
+    msg_Info(p_this, "Report Playing extension deactivated");
+    if (p_sys->b_callbacks_added) {
+        for (size_t i = 0; i < ARRAY_SIZE(ppsz_config_vars); i++)
+            var_DelCallback(p_intf, ppsz_config_vars[i], ConfigChange, p_intf);
+        var_DelCallback(pl_Get(p_intf), "input-current", ItemChange, p_intf);
+    }
+    StopPrefetch(p_intf);
+    // Detaching waits for a running PlayingChange, which may re-arm the timer
+    if (p_sys->p_input != NULL)
+        var_DelCallback(p_sys->p_input, "intf-event", PlayingChange, p_intf);
+    // Waits for a running wakeup: nothing else touches the item state after this
+    if (p_sys->b_schedule_timer)
+        vlc_timer_destroy(p_sys->schedule_timer);
+    if (p_sys->p_input != NULL)
+    {
+        // Still ahead of the writer shutdown, so it is flushed or journaled
+        QueueCheckpoint(p_intf, p_sys->p_input, true);
+        vlc_object_release(p_sys->p_input);
+        p_sys->p_input = NULL;
+    }
 
-    if (p_item && p_item != p_sys->p_item) {
-        p_sys->p_item = p_item;
+    if (p_sys->b_journal_timer)
+        vlc_timer_destroy(p_sys->journal_timer);
+    if (p_sys->b_metrics_timer)
+        vlc_timer_destroy(p_sys->metrics_timer);
 
-        // Reset applied flags
-        if (p_sys->b_target_applied) {
-            memset(p_sys->b_target_applied, 0, sizeof(bool) * p_sys->i_target_count);
-        }
+    // No callback can enqueue any more: stop the writer and let it drain
+    if (p_sys->b_writer_started) {
+        atomic_store(&p_sys->b_writer_stop, true);
+        vlc_sem_post(&p_sys->writer_sem);
+        vlc_join(p_sys->writer_thread, NULL);
 
-        // Resolve path once
-        free(p_sys->psz_current_path);
-        p_sys->psz_current_path = NULL;
-
-        char *psz_uri = input_item_GetURI(p_item);
-        if (psz_uri) {
-            const char *psz_scheme_end = strstr(psz_uri, "://");
-            if (psz_scheme_end != NULL) {
-                size_t scheme_len = psz_scheme_end - psz_uri;
-                if (scheme_len == 4 && strncasecmp(psz_uri, "file", 4) == 0) {
-                     const char *psz_path_start = psz_scheme_end + 3; // Skip "://"
-                     if (*psz_path_start != '\0') {
-                         p_sys->psz_current_path = strdup(psz_path_start);
-                         if (p_sys->psz_current_path) {
-                            if (p_sys->psz_current_path[0] == '/' && isalpha((unsigned char)p_sys->psz_current_path[1]) && p_sys->psz_current_path[2] == ':') {
-                                memmove(p_sys->psz_current_path, p_sys->psz_current_path + 1, strlen(p_sys->psz_current_path) + 1);
-                            }
-                            url_decode_inplace(p_sys->psz_current_path);
-                         }
-                     }
-                }
-            }
-            free(psz_uri);
-        }
+        const metrics_t *p_metrics = &p_sys->metrics;
+        msg_Dbg(p_intf, "xattr writer: %" PRIuFAST64 " queued, %" PRIuFAST64 " dropped, "
+                "%" PRIu64 " written, %" PRIu64 " failed, %" PRIu64 " discarded, "
+                "%" PRIu64 " journaled, %" PRIu64 " cached",
+                atomic_load(&p_sys->write_queue.i_enqueued),
+                atomic_load(&p_sys->write_queue.i_dropped),
+                metrics_get(p_metrics, METRIC_JOBS_WRITTEN),
+                metrics_get(p_metrics, METRIC_JOBS_FAILED),
+                metrics_get(p_metrics, METRIC_JOBS_DISCARDED),
+                metrics_get(p_metrics, METRIC_JOBS_JOURNALED),
+                metrics_get(p_metrics, METRIC_SKIPPED_CACHED));
 
-        char *psz_name = input_item_GetTitleFbName(p_item);
-        if (psz_name) {
-            msg_Info(p_this, "Now playing: %s", psz_name);
-            free(psz_name);
-        }
+        // Last refresh, so the textfile does not keep stale totals
+        PublishMetrics(p_intf);
+        MetricsVariables(p_intf, METRICS_VAR_DESTROY);
     }
-    return VLC_SUCCESS;
+    free(p_sys->psz_metrics_file);
+    if (p_sys->p_journal != NULL) {
+        if (tag_journal_needs_compaction(p_sys->p_journal))
+            tag_journal_compact(p_sys->p_journal);
+        tag_journal_close(p_sys->p_journal);
+    }
+    if (p_sys->p_seen_index != NULL) {
+        if (seen_index_needs_compaction(p_sys->p_seen_index))
+            seen_index_compact(p_sys->p_seen_index);
+        seen_index_close(p_sys->p_seen_index);
+    }
+    if (p_sys->p_sidecar != NULL) {
+        if (sidecar_store_needs_compaction(p_sys->p_sidecar))
+            sidecar_store_compact(p_sys->p_sidecar);
+        sidecar_store_close(p_sys->p_sidecar); // Commits what is still buffered
+    }
+    mount_table_close(p_sys->p_mounts);
+    // Either queue may not have been initialised: destroy skips those
+    write_queue_destroy(&p_sys->write_queue);
+    write_queue_destroy(&p_sys->resume_queue);
+    vlc_sem_destroy(&p_sys->writer_sem);
+    ConfigRelease(p_sys->p_item_config);
+    ConfigRelease(atomic_load(&p_sys->p_config));
+    ReleaseRetiredConfigs(p_sys); // The callbacks that read p_config are gone
+    for (size_t i = 0; i < ARRAY_SIZE(ppsz_config_vars); i++)
+        var_Destroy(p_intf, ppsz_config_vars[i]);
+    free(p_sys->psz_position_key);
+    free(p_sys->psz_watchtime_key);
+    tag_buffer_free(&p_sys->tag_scratch);
+    tag_buffer_free(&p_sys->dir_scratch);
+    dir_aggregate_clear(&p_sys->dir_aggregate);
+    tag_set_free(&p_sys->tag_set);
+    tag_cache_free(p_sys->p_tag_cache);
+    tag_share_close(p_sys->p_tag_share);
+    free(p_sys->psz_current_path);
+    xattr_file_release(p_sys->p_current_file);
+    vlc_mutex_destroy(&p_sys->schedule_lock);
+    free(p_sys);
+    p_intf->p_sys = NULL;
+}
+
+static bool WriteTags(intf_thread_t *p_intf, xattr_file_t *p_file, const char *const *ppsz_tags,
+                      size_t i_tag_count, const char *psz_xattr_key, int *p_err);
+static ssize_t FileGetXattr(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                            const char *psz_key, void *p_value, size_t i_size);
+static int FileSetXattr(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                        const char *psz_key, const void *p_value, size_t i_size, int i_flags);
+static ssize_t ReadTags(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                        const char *psz_xattr_key);
+static int MountRefusal(intf_sys_t *p_sys, const xattr_file_t *p_file, const char *psz_key,
+                        bool b_write, mount_entry_t **pp_mount);
+static void MountLearn(mount_entry_t *p_mount, const char *psz_key, ssize_t ret, int err);
+
+/*****************************************************************************
+ * QueueJob: hand a job to the writer thread without blocking
+ *****************************************************************************/
+static bool QueueJob(intf_thread_t *p_intf, xattr_job_t *p_job)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    if (!write_queue_push(&p_sys->write_queue, p_job))
+        return false;
+    vlc_sem_post(&p_sys->writer_sem);
+    return true;
+}
+
+/*****************************************************************************
+ * QueueTags: hand a batch of tags to the writer thread without blocking
+ *****************************************************************************/
+static void QueueTags(intf_thread_t *p_intf, xattr_file_t *p_file,
+                      const char *const *ppsz_tags, size_t i_tag_count)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    xattr_job_t *p_job = xattr_job_new(&p_sys->write_queue, p_file,
+                                       p_sys->p_item_config->psz_xattr_key, ppsz_tags, i_tag_count);
+    if (p_job != NULL && !QueueJob(p_intf, p_job))
+        msg_Warn(p_intf, "xattr write queue full, dropped %zu tag(s) for %s", i_tag_count,
+                 p_file->psz_path);
+}
+
+/*****************************************************************************
+ * TrackPlayState: accumulate watch time over the item's playing stretches
+ *****************************************************************************/
+static void TrackPlayState(intf_sys_t *p_sys, bool b_playing, mtime_t i_now)
+{
+    if (b_playing && p_sys->i_play_start == 0)
+        p_sys->i_play_start = i_now;
+    else if (!b_playing && p_sys->i_play_start != 0) {
+        p_sys->i_watch_pending += i_now - p_sys->i_play_start;
+        p_sys->i_play_start = 0;
+    }
+}
+
+/*****************************************************************************
+ * QueueCheckpoint: queue the current position and the watch time gathered
+ * since the last checkpoint. Called from the input callbacks, or once the
+ * callbacks are detached for the final flush.
+ *****************************************************************************/
+static void QueueCheckpoint(intf_thread_t *p_intf, input_thread_t *p_input, bool b_final)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    if (p_sys->i_checkpoint_interval == 0 || p_sys->p_current_file == NULL)
+        return;
+
+    mtime_t i_now = mdate();
+    p_sys->i_last_checkpoint = i_now;
+    if (p_sys->i_play_start != 0) {
+        p_sys->i_watch_pending += i_now - p_sys->i_play_start;
+        p_sys->i_play_start = b_final ? 0 : i_now;
+    }
+
+    mtime_t i_time = p_sys->psz_position_key != NULL ? var_GetInteger(p_input, "time") : -1;
+    if (i_time < 0 || i_time / 1000 == p_sys->i_position_written / 1000)
+        i_time = -1;
+    int64_t i_watch_ms = p_sys->psz_watchtime_key != NULL ? p_sys->i_watch_pending / 1000 : 0;
+
+    xattr_job_t *p_job = xattr_checkpoint_job_new(&p_sys->write_queue, p_sys->p_current_file,
+                                                  i_time >= 0 ? i_time / 1000 : -1,
+                                                  i_watch_ms);
+    if (p_job == NULL)
+        return;
+    if (!QueueJob(p_intf, p_job)) {
+        // Keep the watch time for the next checkpoint
+        msg_Dbg(p_intf, "xattr write queue full, checkpoint of %s postponed",
+                p_sys->p_current_file->psz_path);
+        return;
+    }
+    if (i_time >= 0)
+        p_sys->i_position_written = i_time;
+    p_sys->i_watch_pending -= i_watch_ms * 1000;
+}
+
+/*****************************************************************************
+ * UserDataFile: path of a plugin file in the user data directory
+ *****************************************************************************/
+static char *UserDataFile(const char *psz_name)
+{
+    char *psz_dir = config_GetUserDir(VLC_USERDATA_DIR);
+    if (psz_dir == NULL)
+        return NULL;
+
+    char *psz_file;
+    vlc_mkdir(psz_dir, 0700);
+    if (asprintf(&psz_file, "%s" DIR_SEP "%s", psz_dir, psz_name) == -1)
+        psz_file = NULL;
+    free(psz_dir);
+    return psz_file;
+}
+
+/*****************************************************************************
+ * OpenJournal: open the deferred-write journal in the user data directory
+ *****************************************************************************/
+static void OpenJournal(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    char *psz_file = UserDataFile(JOURNAL_FILE_NAME);
+    if (psz_file == NULL)
+        return;
+
+    p_sys->p_journal = tag_journal_open(psz_file);
+    if (p_sys->p_journal == NULL)
+        msg_Warn(p_intf, "Cannot open xattr journal %s, failed writes will be lost", psz_file);
+    else if (tag_journal_count(p_sys->p_journal) > 0)
+        msg_Info(p_intf, "%zu journaled tag write(s) pending",
+                 tag_journal_count(p_sys->p_journal));
+    free(psz_file);
+}
+
+static void JournalTimer(void *p_data)
+{
+    intf_thread_t *p_intf = p_data;
+    intf_sys_t    *p_sys  = p_intf->p_sys;
+
+    atomic_store(&p_sys->b_replay_due, true);
+    vlc_sem_post(&p_sys->writer_sem);
+}
+
+/*****************************************************************************
+ * MetricVarName: "xattr-metric-" followed by the metric name, dash-separated
+ *****************************************************************************/
+static void MetricVarName(char *psz_var, size_t i_size, const char *psz_name,
+                          const char *psz_suffix)
+{
+    snprintf(psz_var, i_size, "xattr-metric-%s%s", psz_name, psz_suffix);
+    for (char *p = psz_var; *p != '\0'; p++)
+        *p = *p == '_' ? '-' : (char)tolower((unsigned char)*p);
+}
+
+/*****************************************************************************
+ * MetricsVariables: create, refresh or destroy the xattr-metric-* variables
+ *****************************************************************************/
+static void MetricsVariables(intf_thread_t *p_intf, metrics_var_op_t op)
+{
+    const metrics_t *p_metrics = &p_intf->p_sys->metrics;
+    char psz_var[96];
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        MetricVarName(psz_var, sizeof(psz_var), metrics_counter_name((metrics_counter_t)i), "");
+        if (op == METRICS_VAR_CREATE)
+            var_Create(p_intf, psz_var, VLC_VAR_INTEGER);
+        else if (op == METRICS_VAR_UPDATE)
+            var_SetInteger(p_intf, psz_var, (int64_t)metrics_get(p_metrics, (metrics_counter_t)i));
+        else
+            var_Destroy(p_intf, psz_var);
+    }
+
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        const metrics_histo_t *p_histo = &p_metrics->histograms[i];
+        const char *psz_name = metrics_histogram_name((metrics_histogram_t)i);
+        MetricVarName(psz_var, sizeof(psz_var), psz_name, "_count");
+        if (op == METRICS_VAR_CREATE)
+            var_Create(p_intf, psz_var, VLC_VAR_INTEGER);
+        else if (op == METRICS_VAR_UPDATE)
+            var_SetInteger(p_intf, psz_var, (int64_t)atomic_load(&p_histo->i_count));
+        else
+            var_Destroy(p_intf, psz_var);
+
+        MetricVarName(psz_var, sizeof(psz_var), psz_name, "_sum");
+        if (op == METRICS_VAR_CREATE)
+            var_Create(p_intf, psz_var, VLC_VAR_FLOAT);
+        else if (op == METRICS_VAR_UPDATE)
+            var_SetFloat(p_intf, psz_var, (float)atomic_load(&p_histo->i_sum_us) / 1e6f);
+        else
+            var_Destroy(p_intf, psz_var);
+    }
+
+    for (unsigned i = 0; i < METRICS_ERROR_SLOTS; i++) {
+        const char *psz_errno, *psz_reason;
+        metrics_error_labels(i, &psz_errno, &psz_reason);
+        if (i != METRICS_ERROR_SLOTS - 1 && strcmp(psz_errno, "other") == 0)
+            continue; // Unused slot
+        MetricVarName(psz_var, sizeof(psz_var), "xattr_errors_", psz_errno);
+        if (op == METRICS_VAR_CREATE)
+            var_Create(p_intf, psz_var, VLC_VAR_INTEGER);
+        else if (op == METRICS_VAR_UPDATE)
+            var_SetInteger(p_intf, psz_var, (int64_t)atomic_load(&p_metrics->i_errors[i]));
+        else
+            var_Destroy(p_intf, psz_var);
+    }
+}
+
+/*****************************************************************************
+ * PublishMetrics: refresh the metric variables and the Prometheus textfile
+ *****************************************************************************/
+static void PublishMetrics(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+
+    // The write queue keeps its own counters
+    metrics_set(&p_sys->metrics, METRIC_JOBS_QUEUED, atomic_load(&p_sys->write_queue.i_enqueued));
+    metrics_set(&p_sys->metrics, METRIC_JOBS_DROPPED, atomic_load(&p_sys->write_queue.i_dropped));
+
+    MetricsVariables(p_intf, METRICS_VAR_UPDATE);
+    if (p_sys->psz_metrics_file != NULL
+     && !metrics_write_textfile(&p_sys->metrics, METRICS_PREFIX, p_sys->psz_metrics_file))
+        msg_Warn(p_intf, "Cannot write metrics to %s: %s", p_sys->psz_metrics_file,
+                 strerror(errno));
+}
+
+static void MetricsTimer(void *p_data)
+{
+    PublishMetrics(p_data);
+}
+
+/*****************************************************************************
+ * ObserveSince: record the time elapsed since i_start in a histogram
+ *****************************************************************************/
+static void ObserveSince(intf_thread_t *p_intf, metrics_histogram_t histogram, mtime_t i_start)
+{
+    mtime_t i_elapsed = mdate() - i_start;
+    metrics_observe(&p_intf->p_sys->metrics, histogram, i_elapsed > 0 ? (uint64_t)i_elapsed : 0);
+}
+
+/*****************************************************************************
+ * JournalJob: durably record a job that cannot be written right now
+ *****************************************************************************/
+static bool JournalJob(intf_thread_t *p_intf, const xattr_job_t *p_job)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    // Checkpoints are superseded by the next one: not worth journaling
+    if (p_sys->p_journal == NULL || p_job->i_kind != XATTR_JOB_TAGS
+     || !tag_journal_append(p_sys->p_journal, p_job->p_file->psz_path, p_job->psz_key,
+                            (const char *const *)p_job->ppsz_tags, p_job->i_tag_count, NULL))
+        return false;
+
+    metrics_add(&p_sys->metrics, METRIC_JOBS_JOURNALED, 1);
+    msg_Dbg(p_intf, "Journaled %zu tag(s) for %s", p_job->i_tag_count, p_job->p_file->psz_path);
+    return true;
+}
+
+/*****************************************************************************
+ * IndexTags: record tags that reached a file in the seen-state index
+ *****************************************************************************/
+static void IndexTags(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                      const char *const *ppsz_tags, size_t i_tag_count)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    if (p_sys->p_seen_index == NULL)
+        return;
+
+    if (!p_file->b_identity)
+        return;
+
+    if (!seen_index_update(p_sys->p_seen_index, p_file->i_dev, p_file->i_ino,
+                           p_file->psz_path, ppsz_tags, i_tag_count))
+        msg_Warn(p_intf, "Failed to index tags for %s", p_file->psz_path);
+    else if (seen_index_needs_compaction(p_sys->p_seen_index)
+          && !seen_index_compact(p_sys->p_seen_index))
+        msg_Warn(p_intf, "Failed to compact the seen-state index");
+}
+
+/*****************************************************************************
+ * ReadDirAggregate: read and decode the children value of psz_dir into
+ * p_sys->dir_aggregate; a missing value is an empty aggregate
+ *****************************************************************************/
+static bool ReadDirAggregate(intf_thread_t *p_intf, const char *psz_dir, mount_entry_t *p_mount,
+                             bool *pb_exists)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    tag_buffer_t *p_buf = &p_sys->dir_scratch;
+    if (!tag_buffer_reserve(p_buf, XATTR_SIZE))
+        return false;
+
+    mtime_t i_start = mdate();
+    ssize_t i_len = sys_getxattr(psz_dir, DIR_AGGREGATE_CHILDREN_KEY, p_buf->p_data,
+                                 p_buf->i_capacity);
+    if (i_len == -1 && errno == ERANGE) {
+        ssize_t i_size = sys_getxattr(psz_dir, DIR_AGGREGATE_CHILDREN_KEY, NULL, 0);
+        if (i_size > 0 && tag_buffer_reserve(p_buf, (size_t)i_size))
+            i_len = sys_getxattr(psz_dir, DIR_AGGREGATE_CHILDREN_KEY, p_buf->p_data,
+                                 p_buf->i_capacity);
+    }
+    int err = errno;
+    ObserveSince(p_intf, METRIC_GETXATTR_SECONDS, i_start);
+    MountLearn(p_mount, DIR_AGGREGATE_CHILDREN_KEY, i_len, err);
+
+    *pb_exists = i_len >= 0;
+    if (i_len == -1 && !IsMissingXattr(err)) {
+        // The sidecar keeps file values only: no aggregates on such mounts
+        if (!IsUnsupportedXattr(err))
+            metrics_count_error(&p_sys->metrics, err);
+        msg_Dbg(p_intf, "Failed to read xattr %s on %s: %s", DIR_AGGREGATE_CHILDREN_KEY,
+                psz_dir, strerror(err));
+        return false;
+    }
+    if (!dir_aggregate_decode(&p_sys->dir_aggregate, p_buf->p_data, i_len > 0 ? (size_t)i_len : 0)) {
+        msg_Warn(p_intf, "Unreadable %s on %s, run xattr_scan --rebuild-aggregates",
+                 DIR_AGGREGATE_CHILDREN_KEY, psz_dir);
+        return false;
+    }
+    return true;
+}
+
+/*****************************************************************************
+ * UpdateDirAggregate: count a file that just got its seen tag in the
+ * aggregate of its directory. Adding an inode already listed changes
+ * nothing, so replays and journal retries are not counted twice.
+ *****************************************************************************/
+static void UpdateDirAggregate(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                               const char *const *ppsz_tags, size_t i_tag_count,
+                               const char *psz_xattr_key)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    const xattr_config_t *p_config = WriterConfig(p_sys);
+    if (!p_sys->b_dir_aggregate || !p_file->b_identity || p_config->i_target_count == 0
+     || strcmp(psz_xattr_key, p_config->psz_xattr_key) != 0)
+        return;
+
+    // Targets are sorted by percent: the last one marks a finished file
+    const char *psz_seen = p_config->targets[p_config->i_target_count - 1].name;
+    size_t i;
+    for (i = 0; i < i_tag_count && strcmp(ppsz_tags[i], psz_seen) != 0; i++)
+        ;
+    if (i == i_tag_count)
+        return;
+
+    char *psz_dir = strdup(p_file->psz_path);
+    char *psz_sep = psz_dir != NULL ? strrchr(psz_dir, '/') : NULL;
+#ifdef _WIN32
+    char *psz_backslash = psz_dir != NULL ? strrchr(psz_dir, '\\') : NULL;
+    if (psz_backslash > psz_sep)
+        psz_sep = psz_backslash;
+#endif
+    if (psz_sep == NULL) {
+        free(psz_dir);
+        return;
+    }
+    psz_sep[psz_sep == psz_dir] = '\0'; // Keep the root's separator
+
+    // The directory shares the file's mount; skip it like the file's own xattrs
+    mount_entry_t *p_mount;
+    if (MountRefusal(p_sys, p_file, DIR_AGGREGATE_CHILDREN_KEY, true, &p_mount) != 0) {
+        free(psz_dir);
+        return;
+    }
+
+    // Same protocol as WriteTags: conditional write, then re-read to detect
+    // a racing instance that replaced the list
+    unsigned i_conflicts = 0;
+    bool b_wrote = false, b_done = false, b_last_wrote = false;
+    for (unsigned i_attempt = 0; i_attempt < WRITE_ATTEMPTS; i_attempt++) {
+        if (i_conflicts > 0) {
+            mtime_t i_delay = (mtime_t)WRITE_BACKOFF_MS * 1000 << (i_conflicts - 1);
+            msleep(i_delay + mdate() % i_delay);
+        }
+
+        bool b_exists, b_added;
+        b_last_wrote = false;
+        if (!ReadDirAggregate(p_intf, psz_dir, p_mount, &b_exists)
+         || !dir_aggregate_insert(&p_sys->dir_aggregate, p_file->i_ino, &b_added))
+            break;
+        if (!b_added) {
+            // Our write read back, or the file was counted before: only
+            // the former needs the count refreshed
+            b_done = b_wrote;
+            break;
+        }
+        if (b_wrote)
+            i_conflicts++; // A racing writer replaced the list we wrote
+
+        size_t i_len = dir_aggregate_encode(&p_sys->dir_aggregate, NULL, 0);
+        if (!tag_buffer_reserve(&p_sys->dir_scratch, i_len))
+            break;
+        dir_aggregate_encode(&p_sys->dir_aggregate, (uint8_t *)p_sys->dir_scratch.p_data, i_len);
+        mtime_t i_start = mdate();
+        int i_ret = sys_setxattr(psz_dir, DIR_AGGREGATE_CHILDREN_KEY, p_sys->dir_scratch.p_data,
+                                 i_len, b_exists ? XATTR_REPLACE : XATTR_CREATE);
+        int err = errno;
+        ObserveSince(p_intf, METRIC_SETXATTR_SECONDS, i_start);
+        MountLearn(p_mount, DIR_AGGREGATE_CHILDREN_KEY, i_ret, err);
+        if (i_ret != 0) {
+            if (err == EEXIST || IsMissingXattr(err)) {
+                i_conflicts++;
+                continue;
+            }
+            // E2BIG or ENOSPC: the list outgrew what the filesystem stores per inode
+            if (!IsUnsupportedXattr(err))
+                metrics_count_error(&p_sys->metrics, err);
+            msg_Dbg(p_intf, "Failed to set xattr %s on %s: %s", DIR_AGGREGATE_CHILDREN_KEY,
+                    psz_dir, strerror(err));
+            break;
+        }
+        metrics_add(&p_sys->metrics, METRIC_BYTES_WRITTEN, i_len);
+        b_wrote = b_last_wrote = true;
+    }
+    if (i_conflicts > 0)
+        metrics_add(&p_sys->metrics, METRIC_WRITE_CONFLICTS, i_conflicts);
+    // The attempts ran out right after a write: count the list it wrote
+    if (b_last_wrote)
+        b_done = true;
+
+    if (b_done) {
+        // Derived from the list just read back, so racing updates converge
+        char psz_count[24];
+        size_t i_len = dir_aggregate_format_count(&p_sys->dir_aggregate, psz_count,
+                                                  sizeof(psz_count));
+        if (i_len > 0 && sys_setxattr(psz_dir, DIR_AGGREGATE_COUNT_KEY, psz_count, i_len, 0) == 0) {
+            metrics_add(&p_sys->metrics, METRIC_BYTES_WRITTEN, i_len);
+            metrics_add(&p_sys->metrics, METRIC_DIR_AGGREGATES_UPDATED, 1);
+        } else if (i_len > 0)
+            metrics_count_error(&p_sys->metrics, errno);
+    }
+    free(psz_dir);
+}
+
+/*****************************************************************************
+ * RunCheckpoint: store the position and add to the watch time of a file
+ *****************************************************************************/
+static void RunCheckpoint(intf_thread_t *p_intf, const xattr_job_t *p_job)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    const xattr_file_t *p_file = p_job->p_file;
+    char psz_value[32];
+    size_t i_len;
+    bool b_ok = true;
+
+    if (p_job->i_position_ms >= 0 && p_sys->psz_position_key != NULL
+     && (i_len = format_seconds_ms(psz_value, sizeof(psz_value), p_job->i_position_ms)) > 0) {
+        if (FileSetXattr(p_intf, p_file, p_sys->psz_position_key, psz_value, i_len, 0) == 0)
+            metrics_add(&p_sys->metrics, METRIC_BYTES_WRITTEN, i_len);
+        else {
+            msg_Dbg(p_intf, "Failed to set xattr %s on %s: %s", p_sys->psz_position_key,
+                    p_file->psz_path, strerror(errno));
+            b_ok = false;
+        }
+    }
+
+    if (p_job->i_watch_ms > 0 && p_sys->psz_watchtime_key != NULL) {
+        // Read-modify-write: the total spans every session that played the file
+        int64_t i_total_ms = 0;
+        ssize_t i_read = FileGetXattr(p_intf, p_file, p_sys->psz_watchtime_key,
+                                      psz_value, sizeof(psz_value));
+        if (i_read == -1 && !IsMissingXattr(errno) && errno != ERANGE) {
+            msg_Dbg(p_intf, "Failed to read xattr %s on %s: %s", p_sys->psz_watchtime_key,
+                    p_file->psz_path, strerror(errno));
+            b_ok = false;
+        } else {
+            if (i_read > 0 && !parse_seconds_ms(psz_value, (size_t)i_read, &i_total_ms)) {
+                msg_Warn(p_intf, "Replacing unreadable %s on %s", p_sys->psz_watchtime_key,
+                         p_file->psz_path);
+                i_total_ms = 0;
+            }
+            i_len = format_seconds_ms(psz_value, sizeof(psz_value), i_total_ms + p_job->i_watch_ms);
+            if (i_len > 0
+             && FileSetXattr(p_intf, p_file, p_sys->psz_watchtime_key, psz_value, i_len, 0) == 0)
+                metrics_add(&p_sys->metrics, METRIC_BYTES_WRITTEN, i_len);
+            else {
+                msg_Dbg(p_intf, "Failed to set xattr %s on %s: %s", p_sys->psz_watchtime_key,
+                        p_file->psz_path, strerror(errno));
+                b_ok = false;
+            }
+        }
+    }
+
+    metrics_add(&p_sys->metrics, b_ok ? METRIC_JOBS_WRITTEN : METRIC_JOBS_FAILED, 1);
+}
+
+/*****************************************************************************
+ * RunResume: read the stored position of an item and publish it
+ *****************************************************************************/
+static void RunResume(intf_thread_t *p_intf, const xattr_job_t *p_job)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    // The item already changed again: nobody waits for this one
+    if (atomic_load(&p_sys->i_resume_generation) != p_job->i_generation)
+        return;
+
+    int64_t i_ms = -1;
+    xattr_file_t *p_file = xattr_file_open(p_job->psz_path);
+    if (p_file != NULL) {
+        const xattr_config_t *p_config = WriterConfig(p_sys);
+        bool b_seen = false;
+        if (p_sys->b_resume_skip_seen && p_config->i_target_count > 0) {
+            // Targets are sorted by percent: the last one marks a finished file
+            const char *psz_seen = p_config->targets[p_config->i_target_count - 1].name;
+            ssize_t i_len = ReadTags(p_intf, p_file, p_config->psz_xattr_key);
+            b_seen = i_len > 0 && xdg_tags_contains(p_sys->tag_scratch.p_data, (size_t)i_len,
+                                                    psz_seen);
+        }
+
+        char psz_value[32];
+        ssize_t i_len = b_seen ? -1 : FileGetXattr(p_intf, p_file, p_sys->psz_position_key,
+                                                   psz_value, sizeof(psz_value));
+        if (i_len > 0 && !parse_seconds_ms(psz_value, (size_t)i_len, &i_ms))
+            i_ms = -1;
+        xattr_file_release(p_file);
+    }
+
+    atomic_store_explicit(&p_sys->i_resume_ms, i_ms, memory_order_relaxed);
+    atomic_store_explicit(&p_sys->i_resume_ready, p_job->i_generation, memory_order_release);
+}
+
+static void RunJob(intf_thread_t *p_intf, const xattr_job_t *p_job)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    int err = 0;
+
+    // Files are created on the input threads, which never wait on the filesystem
+    if (p_job->p_file != NULL && xattr_file_resolve(p_job->p_file) && p_job->p_file->i_fd < 0)
+        msg_Dbg(p_intf, "No xattr descriptor for %s (%s), using its path",
+                p_job->p_file->psz_path, strerror(errno));
+
+    if (p_job->i_kind == XATTR_JOB_CHECKPOINT) {
+        RunCheckpoint(p_intf, p_job);
+        return;
+    }
+    if (p_job->i_kind == XATTR_JOB_RESUME) {
+        RunResume(p_intf, p_job);
+        return;
+    }
+
+    mtime_t i_start = mdate();
+    bool b_written = WriteTags(p_intf, p_job->p_file, (const char *const *)p_job->ppsz_tags,
+                               p_job->i_tag_count, p_job->psz_key, &err);
+    ObserveSince(p_intf, METRIC_WRITE_TAGS_SECONDS, i_start);
+    if (b_written) {
+        metrics_add(&p_sys->metrics, METRIC_JOBS_WRITTEN, 1);
+        IndexTags(p_intf, p_job->p_file, (const char *const *)p_job->ppsz_tags, p_job->i_tag_count);
+        UpdateDirAggregate(p_intf, p_job->p_file, (const char *const *)p_job->ppsz_tags,
+                           p_job->i_tag_count, p_job->psz_key);
+    }
+    else if (!tag_journal_is_retryable(err) || !JournalJob(p_intf, p_job))
+        metrics_add(&p_sys->metrics, METRIC_JOBS_FAILED, 1);
+}
+
+/*****************************************************************************
+ * ReplayJournal: retry a batch of journaled writes, then compact
+ *****************************************************************************/
+static void ReplayJournal(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    tag_journal_t *p_journal = p_sys->p_journal;
+
+    // Other instances share the journal: take the ids up front, and look
+    // each one up again since completing an entry refreshes the journal
+    uint64_t ids[JOURNAL_REPLAY_BATCH];
+    size_t i_ids = 0;
+    tag_journal_refresh(p_journal);
+    while (i_ids < JOURNAL_REPLAY_BATCH && i_ids < tag_journal_count(p_journal)) {
+        ids[i_ids] = tag_journal_get(p_journal, i_ids)->i_id;
+        i_ids++;
+    }
+
+    for (size_t i = 0; i < i_ids; i++) {
+        // Gone when another instance replayed it first
+        const tag_journal_entry_t *p_entry = tag_journal_find(p_journal, ids[i]);
+        if (p_entry == NULL)
+            continue;
+        int err = ENOMEM;
+        bool b_done = false;
+
+        // Journaled tags are stored comma-separated: split them back into a batch
+        char *psz_tags = strdup(p_entry->psz_tags);
+        const char **ppsz_tags = psz_tags ? malloc(sizeof(*ppsz_tags) * (strlen(psz_tags) / 2 + 1)) : NULL;
+        xattr_file_t *p_file = xattr_file_open(p_entry->psz_path);
+        if (ppsz_tags != NULL && p_file != NULL) {
+            size_t i_count = 0;
+            char *saveptr = NULL;
+            for (char *psz_tag = strtok_r(psz_tags, ",", &saveptr); psz_tag != NULL;
+                 psz_tag = strtok_r(NULL, ",", &saveptr))
+                ppsz_tags[i_count++] = psz_tag;
+
+            mtime_t i_start = mdate();
+            b_done = WriteTags(p_intf, p_file, ppsz_tags, i_count,
+                               p_entry->psz_key, &err);
+            ObserveSince(p_intf, METRIC_WRITE_TAGS_SECONDS, i_start);
+            if (b_done) {
+                IndexTags(p_intf, p_file, ppsz_tags, i_count);
+                UpdateDirAggregate(p_intf, p_file, ppsz_tags, i_count, p_entry->psz_key);
+            }
+        }
+        else
+            msg_Dbg(p_intf, "Failed to prepare journaled tags for %s: %s",
+                    p_entry->psz_path, strerror(err));
+        // A replay that could not even start follows the same policy as a failed write
+        if (!b_done && !tag_journal_is_retryable(err)) {
+            msg_Warn(p_intf, "Dropping journaled tags for %s: %s",
+                     p_entry->psz_path, strerror(err));
+            b_done = true;
+        }
+        xattr_file_release(p_file);
+        free(ppsz_tags);
+        free(psz_tags);
+
+        // Tag merges are idempotent, so a replay racing another instance's
+        // only costs the later one a rewrite of the same tags
+        if (b_done)
+            tag_journal_complete(p_journal, ids[i]);
+    }
+
+    if (tag_journal_needs_compaction(p_journal) && !tag_journal_compact(p_journal))
+        msg_Warn(p_intf, "Failed to compact the xattr journal");
+}
+
+/*****************************************************************************
+ * CommitSidecar: sync the values buffered in the sidecar store with one
+ * fsync, and compact it while the writer has nothing else to do
+ *****************************************************************************/
+static void CommitSidecar(intf_thread_t *p_intf)
+{
+    sidecar_store_t *p_sidecar = p_intf->p_sys->p_sidecar;
+    if (sidecar_store_pending(p_sidecar) == 0)
+        return;
+    if (!sidecar_store_commit(p_sidecar))
+        msg_Warn(p_intf, "Failed to sync the sidecar tag store, retrying with the next write");
+    else if (sidecar_store_needs_compaction(p_sidecar) && !sidecar_store_compact(p_sidecar))
+        msg_Warn(p_intf, "Failed to compact the sidecar tag store");
+}
+
+/*****************************************************************************
+ * RunResumes: run the reads waiting in resume_queue, which go before any
+ * write still queued
+ *****************************************************************************/
+static void RunResumes(intf_thread_t *p_intf)
+{
+    xattr_job_t *p_job;
+    while ((p_job = write_queue_pop(&p_intf->p_sys->resume_queue)) != NULL) {
+        RunJob(p_intf, p_job);
+        xattr_job_free(p_job);
+    }
+}
+
+/*****************************************************************************
+ * WriterThread: performs queued xattr writes off the input thread
+ *****************************************************************************/
+static void *WriterThread(void *p_data)
+{
+    intf_thread_t *p_intf = p_data;
+    intf_sys_t    *p_sys  = p_intf->p_sys;
+
+    for (;;) {
+        vlc_sem_wait(&p_sys->writer_sem);
+        if (atomic_load(&p_sys->b_writer_stop))
+            break;
+
+        int canc = vlc_savecancel();
+        if (atomic_exchange(&p_sys->b_reload_due, false))
+            ReloadConfig(p_intf);
+        else
+            ReleaseRetiredConfigs(p_sys);
+        RunResumes(p_intf);
+        if (atomic_exchange(&p_sys->b_replay_due, false) && p_sys->p_journal != NULL)
+            ReplayJournal(p_intf);
+
+        // NULL means a spare post (timer wakeup, drop-oldest eviction, or a
+        // job already run in an earlier group)
+        xattr_job_t *p_job = write_queue_pop(&p_sys->write_queue);
+        while (p_job != NULL) {
+            RunJob(p_intf, p_job);
+            xattr_job_free(p_job);
+            RunResumes(p_intf);
+            // Sidecar values are synced in groups: run what is queued first
+            size_t i_pending = sidecar_store_pending(p_sys->p_sidecar);
+            p_job = i_pending > 0 && i_pending < SIDECAR_GROUP_MAX
+                  ? write_queue_pop(&p_sys->write_queue) : NULL;
+        }
+        CommitSidecar(p_intf);
+        vlc_restorecancel(canc);
+    }
+
+    // Whatever is not flushed now still reaches the file through the journal
+    xattr_job_t *p_job;
+    while ((p_job = write_queue_pop(&p_sys->write_queue)) != NULL) {
+        if (p_sys->b_flush_on_close)
+            RunJob(p_intf, p_job);
+        else if (!JournalJob(p_intf, p_job))
+            metrics_add(&p_sys->metrics, METRIC_JOBS_DISCARDED, 1);
+        xattr_job_free(p_job);
+    }
+
+    return NULL;
+}
+
+/*****************************************************************************
+ * ItemPath: local path of a file:// item, or NULL
+ *****************************************************************************/
+static char *ItemPath(input_item_t *p_item)
+{
+    char *psz_path = NULL;
+    char *psz_uri = input_item_GetURI(p_item);
+    if (psz_uri) {
+        const char *psz_scheme_end = strstr(psz_uri, "://");
+        if (psz_scheme_end != NULL) {
+            size_t scheme_len = psz_scheme_end - psz_uri;
+            if (scheme_len == 4 && strncasecmp(psz_uri, "file", 4) == 0) {
+                 const char *psz_path_start = psz_scheme_end + 3; // Skip "://"
+                 if (*psz_path_start != '\0') {
+                     psz_path = strdup(psz_path_start);
+                     if (psz_path) {
+                        if (psz_path[0] == '/' && isalpha((unsigned char)psz_path[1]) && psz_path[2] == ':') {
+                            memmove(psz_path, psz_path + 1, strlen(psz_path) + 1);
+                        }
+                        url_decode_inplace(psz_path);
+                     }
+                 }
+            }
+        }
+        free(psz_uri);
+    }
+    return psz_path;
+}
+
+/*****************************************************************************
+ * StartResume: queue a background read of the new item's stored position
+ *****************************************************************************/
+static void StartResume(intf_thread_t *p_intf, input_item_t *p_item, uint64_t i_generation)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    char *psz_path = ItemPath(p_item);
+    if (psz_path == NULL || skip_matcher_match(p_sys->p_item_config->p_skip_matcher, psz_path)) {
+        free(psz_path);
+        return;
+    }
+
+    // Reads skip ahead of queued writes, to meet the deadline. The same file
+    // again goes behind them instead: its final checkpoint was queued last,
+    // and the FIFO queue writes it before this read.
+    bool b_same = p_sys->psz_current_path != NULL && strcmp(p_sys->psz_current_path, psz_path) == 0;
+    write_queue_t *p_queue = b_same ? &p_sys->write_queue : &p_sys->resume_queue;
+    xattr_job_t *p_job = xattr_resume_job_new(p_queue, psz_path, i_generation);
+    free(psz_path);
+    if (p_job == NULL || !write_queue_push(p_queue, p_job))
+        return;
+    vlc_sem_post(&p_sys->writer_sem);
+    p_sys->b_resume_pending = true;
+    p_sys->i_resume_expiry = mdate() + p_sys->i_resume_deadline;
+}
+
+/*****************************************************************************
+ * ApplyResume: seek to the stored position once it is published, on the
+ * input thread; give up after the deadline
+ *****************************************************************************/
+static void ApplyResume(intf_thread_t *p_intf, input_thread_t *p_input)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    uint64_t i_generation = atomic_load_explicit(&p_sys->i_resume_generation, memory_order_relaxed);
+
+    if (atomic_load_explicit(&p_sys->i_resume_ready, memory_order_acquire) != i_generation) {
+        if (mdate() > p_sys->i_resume_expiry) {
+            p_sys->b_resume_pending = false;
+            metrics_add(&p_sys->metrics, METRIC_RESUMES_DROPPED, 1);
+            msg_Dbg(p_intf, "Stored position arrived too late, not resuming");
+        }
+        return;
+    }
+    p_sys->b_resume_pending = false;
+
+    int64_t i_ms = atomic_load_explicit(&p_sys->i_resume_ms, memory_order_relaxed);
+    if (i_ms <= 0)
+        return;
+    mtime_t i_length = var_GetInteger(p_input, "length");
+    if (i_length > 0 && i_ms * 1000 >= (mtime_t)(i_length * RESUME_MAX_FRACTION))
+        return; // Finished last time: start over
+
+    msg_Dbg(p_intf, "Resuming at %" PRId64 " ms", i_ms);
+    var_SetInteger(p_input, "time", i_ms * 1000);
+    metrics_add(&p_sys->metrics, METRIC_RESUMES_APPLIED, 1);
+}
+
+/*****************************************************************************
+ * FireTargets: queue every pending target at or below percent as one batch
+ *****************************************************************************/
+static void FireTargets(intf_thread_t *p_intf, int percent)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    const xattr_config_t *p_config = p_sys->p_item_config;
+
+    // Targets are sorted by percent, so one comparison against the next
+    // pending threshold decides whether there is anything to do.
+    // Checkpoints alone also open the file, with every target consumed.
+    int i_next = p_sys->i_next_target;
+    if (p_sys->p_current_file == NULL || p_config == NULL || i_next >= p_config->i_target_count
+     || percent < p_config->targets[i_next].percent)
+        return;
+
+    int i_first = i_next;
+    do
+        i_next++;
+    while (i_next < p_config->i_target_count && percent >= p_config->targets[i_next].percent);
+    p_sys->i_next_target = i_next;
+
+    QueueTags(p_intf, p_sys->p_current_file, p_config->ppsz_target_names + i_first,
+              (size_t)(i_next - i_first));
+}
+
+/*****************************************************************************
+ * SetAnchor: publish where the armed schedule expects playback to be, for
+ * position events to check without schedule_lock. Called with it held, so
+ * the sequence count has a single writer.
+ *****************************************************************************/
+static void SetAnchor(intf_sys_t *p_sys, mtime_t i_wall, mtime_t i_time, int64_t i_rate)
+{
+    uint_fast64_t i_seq = atomic_load_explicit(&p_sys->i_anchor_seq, memory_order_relaxed);
+    atomic_store_explicit(&p_sys->i_anchor_seq, i_seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&p_sys->i_anchor_wall, i_wall, memory_order_relaxed);
+    atomic_store_explicit(&p_sys->i_anchor_time, i_time, memory_order_relaxed);
+    atomic_store_explicit(&p_sys->i_anchor_rate, i_rate, memory_order_relaxed);
+    atomic_store_explicit(&p_sys->i_anchor_seq, i_seq + 2, memory_order_release);
+}
+
+/*****************************************************************************
+ * PositionIsExpected: whether a position event leaves the schedule as it
+ * is, i.e. playback is where the anchor puts it or nothing can become due.
+ * Position events carry no seek flag: a time away from the expected one
+ * means the timer is aimed wrong. An anchor being rewritten, or none, sends
+ * the event to the locked path.
+ *****************************************************************************/
+static bool PositionIsExpected(intf_sys_t *p_sys, input_thread_t *p_input)
+{
+    uint_fast64_t i_seq = atomic_load_explicit(&p_sys->i_anchor_seq, memory_order_acquire);
+    mtime_t i_wall = atomic_load_explicit(&p_sys->i_anchor_wall, memory_order_relaxed);
+    mtime_t i_time = atomic_load_explicit(&p_sys->i_anchor_time, memory_order_relaxed);
+    int64_t i_rate = atomic_load_explicit(&p_sys->i_anchor_rate, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (i_seq & 1 || atomic_load_explicit(&p_sys->i_anchor_seq, memory_order_relaxed) != i_seq
+     || i_wall == 0)
+        return false;
+    if (i_wall == ANCHOR_IDLE)
+        return true;
+
+    mtime_t i_expected = i_time + (mdate() - i_wall) * i_rate / ANCHOR_RATE_ONE;
+    mtime_t i_drift = var_GetInteger(p_input, "time") - i_expected;
+    return i_drift <= SEEK_TOLERANCE && i_drift >= -SEEK_TOLERANCE;
+}
+
+/*****************************************************************************
+ * Reschedule: arm schedule_timer for the next target or checkpoint, from the
+ * playback time, length and rate; disarm it while nothing can become due.
+ * Called with schedule_lock held.
+ *****************************************************************************/
+static void Reschedule(intf_thread_t *p_intf, input_thread_t *p_input)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    const xattr_config_t *p_config = p_sys->p_item_config;
+    bool b_target = p_config != NULL && p_sys->i_next_target < p_config->i_target_count;
+    bool b_checkpoint = p_sys->i_checkpoint_interval != 0;
+
+    if (p_sys->p_current_file == NULL || (!b_target && !b_checkpoint)
+     || var_GetInteger(p_input, "state") != PLAYING_S) {
+        // Paused, stopped or done: the next state or rate event re-arms it.
+        // A pending resume still needs the position events.
+        SetAnchor(p_sys, p_sys->b_resume_pending ? 0 : ANCHOR_IDLE, 0, 0);
+        vlc_timer_schedule(p_sys->schedule_timer, false, 0, 0);
+        return;
+    }
+
+    mtime_t i_now = mdate();
+    mtime_t i_time = var_GetInteger(p_input, "time");
+    float f_rate = var_GetFloat(p_input, "rate");
+    if (!(f_rate > 0.f))
+        f_rate = 1.f;
+    SetAnchor(p_sys, p_sys->b_resume_pending ? 0 : i_now, i_time,
+              (int64_t)(f_rate * ANCHOR_RATE_ONE));
+
+    mtime_t i_due = 0;
+    mtime_t i_length = var_GetInteger(p_input, "length");
+    // Without a length there is no position to reach: the length event re-arms
+    if (b_target && i_length > 0) {
+        mtime_t i_target = i_length * p_config->targets[p_sys->i_next_target].percent / 100;
+        mtime_t i_wait = i_target > i_time ? (mtime_t)((i_target - i_time) / f_rate) : 0;
+        i_due = i_now + i_wait;
+    }
+    if (b_checkpoint) {
+        mtime_t i_checkpoint = p_sys->i_last_checkpoint + p_sys->i_checkpoint_interval;
+        if (i_due == 0 || i_checkpoint < i_due)
+            i_due = i_checkpoint;
+    }
+
+    if (i_due != 0)
+        vlc_timer_schedule(p_sys->schedule_timer, true, i_due + SCHEDULE_SLACK, 0);
+    else
+        vlc_timer_schedule(p_sys->schedule_timer, false, 0, 0);
+}
+
+/*****************************************************************************
+ * ScheduleTimer: fire what is due, then arm the timer for what comes next.
+ * A wakeup that lost a race with a seek or an item change finds nothing due
+ * and only re-arms.
+ *****************************************************************************/
+static void HandleScheduleTimer(intf_thread_t *p_intf)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+
+    vlc_mutex_lock(&p_sys->schedule_lock);
+    input_thread_t *p_input = p_sys->p_input;
+    if (p_input != NULL && p_sys->p_current_file != NULL) {
+        if (p_sys->i_checkpoint_interval != 0
+         && mdate() - p_sys->i_last_checkpoint >= p_sys->i_checkpoint_interval)
+            QueueCheckpoint(p_intf, p_input, false);
+        FireTargets(p_intf, (int)(var_GetFloat(p_input, "position") * 100));
+        Reschedule(p_intf, p_input);
+    }
+    vlc_mutex_unlock(&p_sys->schedule_lock);
+}
+
+static void ScheduleTimer(void *p_data)
+{
+    intf_thread_t *p_intf = p_data;
+    mtime_t i_start = mdate();
+    HandleScheduleTimer(p_intf);
+    metrics_add(&p_intf->p_sys->metrics, METRIC_SCHEDULE_WAKEUPS, 1);
+    ObserveSince(p_intf, METRIC_SCHEDULE_WAKEUP_SECONDS, i_start);
+}
+
+/*****************************************************************************
+ * ItemChange: Playlist item change callback
+ *****************************************************************************/
+static int HandleItemChange(vlc_object_t *p_this, const char *psz_var,
+                            vlc_value_t oldval, vlc_value_t newval, void *p_data)
+{
+    intf_thread_t  *p_intf  = p_data;
+    intf_sys_t     *p_sys   = p_intf->p_sys;
+    input_thread_t *p_input = newval.p_address;
+
+    VLC_UNUSED(psz_var);
+    VLC_UNUSED(oldval);
+
+    // Only this callback changes p_input. Detaching waits for a running
+    // PlayingChange, so it is done without schedule_lock.
+    input_thread_t *p_old = p_sys->p_input;
+    if (p_old != NULL)
+        var_DelCallback(p_old, "intf-event", PlayingChange, p_intf);
+
+    vlc_mutex_lock(&p_sys->schedule_lock);
+    vlc_timer_schedule(p_sys->schedule_timer, false, 0, 0);
+    SetAnchor(p_sys, 0, 0, 0);
+    if (p_old != NULL)
+    {
+        // The callbacks are detached: the last state of the item is final
+        QueueCheckpoint(p_intf, p_old, true);
+        p_sys->p_item = NULL;
+        p_sys->p_input = NULL;
+    }
+
+    // Queued jobs hold their own reference to the file
+    xattr_file_release(p_sys->p_current_file);
+    p_sys->p_current_file = NULL;
+
+    // The item keeps the rules current as it starts, whatever reloads come
+    ConfigRelease(p_sys->p_item_config);
+    p_sys->p_item_config = p_input != NULL ? ConfigAcquire(p_sys) : NULL;
+
+    // Nothing is pending until PlayingChange resolves the new item's path
+    p_sys->i_next_target = INT_MAX;
+
+    // Results of reads queued for earlier items are ignored from now on
+    uint64_t i_generation = atomic_fetch_add(&p_sys->i_resume_generation, 1) + 1;
+    p_sys->b_resume_pending = false;
+
+    input_item_t *p_item = p_input != NULL ? input_GetItem(p_input) : NULL;
+    bool b_attach = false;
+    if (p_input == NULL)
+        p_sys->p_item = NULL;
+    else if (p_item == NULL)
+        ;
+    else if (var_CountChoices(p_input, "video-es"))
+        msg_Dbg(p_this, "Not an audio-only input, not submitting");
+    else {
+        p_sys->p_input = vlc_object_hold(p_input);
+        // Before the callback is attached, which publishes the pending state to it
+        if (p_sys->b_resume && p_sys->p_item_config != NULL)
+            StartResume(p_intf, p_item, i_generation);
+        b_attach = true;
+    }
+    vlc_mutex_unlock(&p_sys->schedule_lock);
+
+    // A wakeup still running for the old input has dropped it by now
+    if (p_old != NULL)
+        vlc_object_release(p_old);
+    if (b_attach)
+        var_AddCallback(p_input, "intf-event", PlayingChange, p_intf);
+
+    return VLC_SUCCESS;
+}
+
+static int ItemChange(vlc_object_t *p_this, const char *psz_var,
+                      vlc_value_t oldval, vlc_value_t newval, void *p_data)
+{
+    intf_thread_t *p_intf = p_data;
+    mtime_t i_start = mdate();
+    int i_ret = HandleItemChange(p_this, psz_var, oldval, newval, p_data);
+    metrics_add(&p_intf->p_sys->metrics, METRIC_ITEM_CALLBACKS, 1);
+    ObserveSince(p_intf, METRIC_ITEM_CALLBACK_SECONDS, i_start);
+    return i_ret;
+}
+
+/*****************************************************************************
+ * FileGetXattr/FileSetXattr: descriptor-based xattr I/O with a path fallback
+ *****************************************************************************/
+static ssize_t FileGetXattrUntimed(const xattr_file_t *p_file, const char *psz_key,
+                                   void *p_value, size_t i_size)
+{
+    if (p_file->i_fd >= 0) {
+        ssize_t ret = sys_fgetxattr(p_file->i_fd, psz_key, p_value, i_size);
+        if (ret != -1 || (errno != EBADF && errno != ENOENT))
+            return ret;
+    }
+    return sys_getxattr(p_file->psz_path, psz_key, p_value, i_size);
+}
+
+static int FileSetXattrUntimed(const xattr_file_t *p_file, const char *psz_key,
+                               const void *p_value, size_t i_size, int i_flags)
+{
+    if (p_file->i_fd >= 0) {
+        int ret = sys_fsetxattr(p_file->i_fd, psz_key, p_value, i_size, i_flags);
+        if (ret != -1 || (errno != EBADF && errno != ENOENT))
+            return ret;
+    }
+    return sys_setxattr(p_file->psz_path, psz_key, p_value, i_size, i_flags);
+}
+
+static bool IsMissingXattr(int err)
+{
+#ifdef ENOATTR
+    if (err == ENOATTR)
+        return true;
+#endif
+#ifdef ENODATA
+    if (err == ENODATA)
+        return true;
+#endif
+    return false;
+}
+
+static bool IsUnsupportedXattr(int err)
+{
+#ifdef ENOTSUP
+    if (err == ENOTSUP)
+        return true;
+#endif
+#ifdef EOPNOTSUPP
+    if (err == EOPNOTSUPP)
+        return true;
+#endif
+    return false;
+}
+
+/*****************************************************************************
+ * SidecarGetXattr/SidecarSetXattr: the sidecar store standing in for the
+ * xattrs of a file, with the same results, flags and errnos
+ *****************************************************************************/
+static bool UseSidecar(intf_sys_t *p_sys, const xattr_file_t *p_file, ssize_t ret, int err)
+{
+    return ret == -1 && IsUnsupportedXattr(err) && p_sys->p_sidecar != NULL && p_file->b_identity;
+}
+
+static ssize_t SidecarGetXattr(intf_sys_t *p_sys, const xattr_file_t *p_file,
+                               const char *psz_key, void *p_value, size_t i_size)
+{
+    const void *p_stored;
+    size_t i_len;
+    // Other instances commit to the same log
+    sidecar_store_refresh(p_sys->p_sidecar);
+    if (!sidecar_store_get(p_sys->p_sidecar, p_file->i_dev, p_file->i_ino, p_file->psz_path,
+                           psz_key, &p_stored, &i_len)) {
+#ifdef ENOATTR
+        errno = ENOATTR;
+#else
+        errno = ENODATA;
+#endif
+        return -1;
+    }
+    if (i_size == 0)
+        return (ssize_t)i_len;
+    if (i_len > i_size) {
+        errno = ERANGE;
+        return -1;
+    }
+    memcpy(p_value, p_stored, i_len);
+    return (ssize_t)i_len;
+}
+
+static int SidecarSetXattr(intf_sys_t *p_sys, const xattr_file_t *p_file, const char *psz_key,
+                           const void *p_value, size_t i_size, int i_flags)
+{
+    const void *p_stored;
+    size_t i_len;
+    sidecar_store_refresh(p_sys->p_sidecar);
+    bool b_exists = sidecar_store_get(p_sys->p_sidecar, p_file->i_dev, p_file->i_ino,
+                                      p_file->psz_path, psz_key, &p_stored, &i_len);
+    if (i_flags & XATTR_CREATE && b_exists) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (i_flags & XATTR_REPLACE && !b_exists) {
+#ifdef ENOATTR
+        errno = ENOATTR;
+#else
+        errno = ENODATA;
+#endif
+        return -1;
+    }
+    if (!sidecar_store_put(p_sys->p_sidecar, p_file->i_dev, p_file->i_ino, p_file->psz_path,
+                           psz_key, p_value, i_size)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    metrics_add(&p_sys->metrics, METRIC_SIDECAR_WRITES, 1);
+    return 0;
+}
+
+/*****************************************************************************
+ * MountRefusal: the errno an xattr call on a known-bad mount would fail
+ * with, so the call can be skipped, or 0. MountLearn records what a call
+ * that was made found out about user xattrs on its mount.
+ *****************************************************************************/
+static int MountRefusal(intf_sys_t *p_sys, const xattr_file_t *p_file, const char *psz_key,
+                        bool b_write, mount_entry_t **pp_mount)
+{
+    *pp_mount = NULL;
+    if (p_sys->p_mounts == NULL || !p_file->b_identity)
+        return 0;
+    mount_table_poll(p_sys->p_mounts);
+    mount_entry_t *p_mount = mount_table_lookup(p_sys->p_mounts, p_file->psz_path, p_file->i_dev);
+    if (p_mount == NULL)
+        return 0;
+    *pp_mount = p_mount;
+
+    int err = 0;
+    if (strncmp(psz_key, "user.", 5) == 0
+     && mount_table_user_xattr(p_mount) == MOUNT_XATTR_UNSUPPORTED)
+        err = ENOTSUP;
+    else if (b_write && p_mount->b_readonly)
+        err = EROFS;
+    if (err != 0)
+        metrics_add(&p_sys->metrics, METRIC_SKIPPED_MOUNT, 1);
+    return err;
+}
+
+static void MountLearn(mount_entry_t *p_mount, const char *psz_key, ssize_t ret, int err)
+{
+    if (p_mount == NULL || strncmp(psz_key, "user.", 5) != 0)
+        return;
+    if (ret != -1 || IsMissingXattr(err) || err == ERANGE || err == EEXIST)
+        p_mount->user_xattr = MOUNT_XATTR_SUPPORTED;
+    else if (IsUnsupportedXattr(err))
+        p_mount->user_xattr = MOUNT_XATTR_UNSUPPORTED;
+}
+
+static ssize_t FileGetXattr(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                            const char *psz_key, void *p_value, size_t i_size)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    mount_entry_t *p_mount;
+    ssize_t ret = -1;
+    int err = MountRefusal(p_sys, p_file, psz_key, false, &p_mount);
+    if (err == 0) {
+        mtime_t i_start = mdate();
+        ret = FileGetXattrUntimed(p_file, psz_key, p_value, i_size);
+        err = errno;
+        ObserveSince(p_intf, METRIC_GETXATTR_SECONDS, i_start);
+        MountLearn(p_mount, psz_key, ret, err);
+    }
+    if (UseSidecar(p_sys, p_file, ret, err)) {
+        ret = SidecarGetXattr(p_sys, p_file, psz_key, p_value, i_size);
+        err = errno;
+    }
+    // A missing value or a buffer to grow is part of normal operation
+    if (ret == -1 && !IsMissingXattr(err) && err != ERANGE)
+        metrics_count_error(&p_sys->metrics, err);
+    errno = err;
+    return ret;
+}
+
+static int FileSetXattr(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                        const char *psz_key, const void *p_value, size_t i_size, int i_flags)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    mount_entry_t *p_mount;
+    int ret = -1;
+    int err = MountRefusal(p_sys, p_file, psz_key, true, &p_mount);
+    if (err == 0) {
+        mtime_t i_start = mdate();
+        ret = FileSetXattrUntimed(p_file, psz_key, p_value, i_size, i_flags);
+        err = errno;
+        ObserveSince(p_intf, METRIC_SETXATTR_SECONDS, i_start);
+        MountLearn(p_mount, psz_key, ret, err);
+    }
+    if (UseSidecar(p_sys, p_file, ret, err)) {
+        ret = SidecarSetXattr(p_sys, p_file, psz_key, p_value, i_size, i_flags);
+        err = errno;
+    }
+    // A failed condition is a lost race, counted as a conflict by the caller
+    bool b_condition = (i_flags & XATTR_CREATE && err == EEXIST)
+                    || (i_flags & XATTR_REPLACE && IsMissingXattr(err));
+    if (ret == -1 && !b_condition)
+        metrics_count_error(&p_sys->metrics, err);
+    errno = err;
+    return ret;
+}
+
+/*****************************************************************************
+ * ReadTags: read the current value of psz_xattr_key into p_sys->tag_scratch
+ *****************************************************************************/
+static ssize_t ReadTags(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                        const char *psz_xattr_key)
+{
+    tag_buffer_t *p_buf = &p_intf->p_sys->tag_scratch;
+    if (!tag_buffer_reserve(p_buf, XATTR_SIZE)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ssize_t value_len = FileGetXattr(p_intf, p_file, psz_xattr_key, p_buf->p_data, p_buf->i_capacity);
+    // The value outgrew the buffer: grow it for good and read again, giving
+    // up if another writer keeps growing the value in between
+    for (int i_try = 0; value_len == -1 && errno == ERANGE && i_try < 3; i_try++) {
+        ssize_t i_size = FileGetXattr(p_intf, p_file, psz_xattr_key, NULL, 0);
+        if (i_size == -1)
+            return -1;
+        if (!tag_buffer_reserve(p_buf, (size_t)i_size + 1)) {
+            errno = ENOMEM;
+            return -1;
+        }
+        value_len = FileGetXattr(p_intf, p_file, psz_xattr_key, p_buf->p_data, p_buf->i_capacity);
+    }
+    return value_len;
+}
+
+/*****************************************************************************
+ * FileCtime: current inode change time, which every xattr change bumps
+ *****************************************************************************/
+static bool FileCtime(const xattr_file_t *p_file, int64_t *p_sec, long *p_nsec)
+{
+    struct stat st;
+    if ((p_file->i_fd < 0 || fstat(p_file->i_fd, &st) != 0)
+     && vlc_stat(p_file->psz_path, &st) != 0)
+        return false;
+    *p_sec = (int64_t)st.st_ctime;
+#if defined(__APPLE__)
+    *p_nsec = st.st_ctimespec.tv_nsec;
+#elif defined(_WIN32)
+    *p_nsec = 0;
+#else
+    *p_nsec = st.st_ctim.tv_nsec;
+#endif
+    return true;
+}
+
+/*****************************************************************************
+ * TagsPresent: whether every non-empty tag of the batch is in the list
+ *****************************************************************************/
+static bool TagsPresent(const char *psz_list, size_t i_len, const char *const *ppsz_tags,
+                        size_t i_tag_count)
+{
+    for (size_t i = 0; i < i_tag_count; i++)
+        if (ppsz_tags[i] != NULL && *ppsz_tags[i] != '\0'
+         && !xdg_tags_contains(psz_list, i_len, ppsz_tags[i]))
+            return false;
+    return true;
+}
+
+/*****************************************************************************
+ * CachedTagsPresent: whether the tag cache proves the batch is already written
+ *****************************************************************************/
+static bool CachedTagsPresent(intf_thread_t *p_intf, const xattr_file_t *p_file,
+                              const char *const *ppsz_tags, size_t i_tag_count)
+{
+    tag_cache_t *p_cache = p_intf->p_sys->p_tag_cache;
+    tag_cache_poll(p_cache);
+
+    bool b_recheck;
+    const tag_cache_entry_t *p_entry = tag_cache_lookup(p_cache, p_file->i_dev, p_file->i_ino,
+                                                        &b_recheck);
+    if (p_entry == NULL)
+        return false;
+    if (b_recheck) {
+        int64_t i_sec;
+        long i_nsec;
+        if (!FileCtime(p_file, &i_sec, &i_nsec)
+         || i_sec != p_entry->i_ctime_sec || i_nsec != p_entry->i_ctime_nsec) {
+            tag_cache_invalidate(p_cache, p_file->i_dev, p_file->i_ino);
+            return false;
+        }
+        tag_cache_confirm(p_cache, p_file->i_dev, p_file->i_ino);
+    }
+
+    return TagsPresent(p_entry->psz_tags, p_entry->i_len, ppsz_tags, i_tag_count);
+}
+
+/*****************************************************************************
+ * SharedTagsPresent/PublishSharedTags: the table shared with other instances
+ *****************************************************************************/
+static bool SharedTagsPresent(tag_share_t *p_share, const xattr_file_t *p_file,
+                              const char *const *ppsz_tags, size_t i_tag_count,
+                              const char *psz_xattr_key, int64_t i_ctime_sec, long i_ctime_nsec)
+{
+    bool b_any = false;
+    for (size_t i = 0; i < i_tag_count; i++) {
+        if (ppsz_tags[i] == NULL || *ppsz_tags[i] == '\0')
+            continue;
+        if (!tag_share_contains(p_share, p_file->i_dev, p_file->i_ino, i_ctime_sec,
+                                i_ctime_nsec, psz_xattr_key, ppsz_tags[i]))
+            return false;
+        b_any = true;
+    }
+    return b_any;
+}
+
+static void PublishSharedTags(tag_share_t *p_share, const xattr_file_t *p_file,
+                              const char *const *ppsz_tags, size_t i_tag_count,
+                              const char *psz_xattr_key, int64_t i_ctime_sec, long i_ctime_nsec)
+{
+    for (size_t i = 0; i < i_tag_count; i++)
+        if (ppsz_tags[i] != NULL && *ppsz_tags[i] != '\0')
+            tag_share_publish(p_share, p_file->i_dev, p_file->i_ino, i_ctime_sec,
+                              i_ctime_nsec, psz_xattr_key, ppsz_tags[i]);
+}
+
+static bool WriteTags(intf_thread_t *p_intf, xattr_file_t *p_file, const char *const *ppsz_tags,
+                      size_t i_tag_count, const char *psz_xattr_key, int *p_err)
+{
+    intf_sys_t *p_sys = p_intf->p_sys;
+    const char *psz_path = p_file->psz_path;
+    tag_buffer_t *p_buf = &p_sys->tag_scratch;
+
+    // Repeats and loops: skip both syscalls when the tags are known present.
+    // The cache only follows the configured key.
+    bool b_cache = p_sys->p_tag_cache != NULL && p_file->b_identity
+                && strcmp(psz_xattr_key, WriterConfig(p_sys)->psz_xattr_key) == 0;
+    if (b_cache && CachedTagsPresent(p_intf, p_file, ppsz_tags, i_tag_count)) {
+        metrics_add(&p_sys->metrics, METRIC_SKIPPED_CACHED, 1);
+        return true;
+    }
+    // Taken before reading, so a change racing the read fails the next check
+    int64_t i_ctime_sec;
+    long i_ctime_nsec;
+    bool b_share = p_sys->p_tag_share != NULL && p_file->b_identity;
+    if (b_cache || b_share) {
+        bool b_ctime = FileCtime(p_file, &i_ctime_sec, &i_ctime_nsec);
+        b_cache = b_cache && b_ctime;
+        b_share = b_share && b_ctime;
+    }
+    // Another instance wrote these tags and the file has not changed since
+    if (b_share && SharedTagsPresent(p_sys->p_tag_share, p_file, ppsz_tags, i_tag_count,
+                                     psz_xattr_key, i_ctime_sec, i_ctime_nsec)) {
+        metrics_add(&p_sys->metrics, METRIC_SKIPPED_SHARED, 1);
+        return true;
+    }
+
+    // Other players and batch taggers update the same key. Every write is
+    // conditional (XATTR_CREATE or XATTR_REPLACE) and followed by a re-read,
+    // so a racing writer that replaced our value is seen and we merge again.
+    // xattrs have no compare-and-swap: a writer that follows the same
+    // protocol detects a write of ours that dropped its tags the same way.
+    bool b_known = p_file->b_key_exists
+                && strcmp(psz_xattr_key, WriterConfig(p_sys)->psz_xattr_key) == 0;
+    unsigned i_conflicts = 0;
+    size_t tags_len = 0;
+    size_t tags_added = 0;
+    size_t i_written = 0;
+    int err = 0;
+    bool b_done = false;
+
+    for (unsigned i_attempt = 0; i_attempt < WRITE_ATTEMPTS && !b_done; i_attempt++) {
+        if (i_conflicts > 0 && i_attempt > 0) {
+            // Exponential backoff with jitter, so two retrying writers drift apart
+            mtime_t i_delay = (mtime_t)WRITE_BACKOFF_MS * 1000 << (i_conflicts - 1);
+            msleep(i_delay + mdate() % i_delay);
+        }
+
+        // Files never tagged before: a single create, without reading first
+        if (!b_known) {
+            tags_len = 0;
+            if (!xdg_tags_append_many_buf(p_buf, &tags_len, ppsz_tags, i_tag_count, &tags_added)) {
+                err = ENOMEM;
+                break;
+            }
+            if (tags_added == 0)
+                return true; // Only empty tags: nothing to write
+            if (FileSetXattr(p_intf, p_file, psz_xattr_key, p_buf->p_data, tags_len + 1,
+                             XATTR_CREATE) == 0) {
+                i_written = tags_len + 1;
+                b_done = true;
+                break;
+            }
+            err = errno;
+            if (err != EEXIST)
+                break;
+            // Somebody tagged it first, or we had never looked: merge below
+            err = 0;
+            b_known = true;
+        }
+
+        // One read and at most one write whatever the batch size, both through
+        // the reusable scratch buffer: no allocation once it has grown enough
+        ssize_t value_len = ReadTags(p_intf, p_file, psz_xattr_key);
+        if (value_len == -1 && IsMissingXattr(errno)) {
+            // Removed since we last saw it
+            b_known = false;
+            i_conflicts++;
+            continue;
+        }
+        if (value_len == -1 && (errno == ENOMEM || errno == ERANGE)) {
+            // Writing now would replace tags we could not read
+            err = errno;
+            msg_Err(p_intf, "Failed to read xattr %s on %s: %s", psz_xattr_key, psz_path,
+                    strerror(err));
+            break;
+        }
+
+        tags_len = value_len != -1 ? (size_t)value_len : 0;
+        // Lists shared with other taggers can hold hundreds of tags: hash them
+        // rather than rescanning the whole list for every tag in the batch
+        bool b_ok = tags_len >= TAG_SET_MIN_LIST_LEN
+            ? xdg_tags_append_many_set(&p_intf->p_sys->tag_set, p_buf, &tags_len,
+                                       ppsz_tags, i_tag_count, &tags_added)
+            : xdg_tags_append_many_buf(p_buf, &tags_len, ppsz_tags, i_tag_count, &tags_added);
+        if (!b_ok) {
+            msg_Err(p_intf, "Failed to resize buffer for %s on %s", psz_xattr_key, psz_path);
+            err = ENOMEM;
+            break;
+        }
+        if (tags_added == 0) {
+            // Written by us in an earlier attempt, or by somebody else
+            b_done = true;
+            break;
+        }
+
+        // Stored with its terminator, as earlier versions did
+        if (FileSetXattr(p_intf, p_file, psz_xattr_key, p_buf->p_data, tags_len + 1,
+                         XATTR_REPLACE) == -1) {
+            err = errno;
+            if (!IsMissingXattr(err))
+                break;
+            err = 0;
+            b_known = false;
+            i_conflicts++;
+            continue;
+        }
+        i_written += tags_len + 1;
+
+        // Verify: the next pass re-reads, and finds every tag present unless
+        // a racing writer replaced the value we just wrote
+        ssize_t check_len = ReadTags(p_intf, p_file, psz_xattr_key);
+        if (check_len != -1 && TagsPresent(p_buf->p_data, (size_t)check_len,
+                                           ppsz_tags, i_tag_count)) {
+            tags_len = (size_t)check_len;
+            b_done = true;
+            break;
+        }
+        i_conflicts++;
+    }
+
+    if (i_conflicts > 0)
+        metrics_add(&p_sys->metrics, METRIC_WRITE_CONFLICTS, i_conflicts);
+    if (!b_done) {
+        if (err == 0) {
+            // Out of attempts: leave it to the journal
+            err = EAGAIN;
+            msg_Warn(p_intf, "Giving up on xattr %s on %s after %u conflicting writes",
+                     psz_xattr_key, psz_path, i_conflicts);
+        } else {
+            const char *psz_reason = xattr_error_reason(err);
+            if (psz_reason != NULL) {
+                msg_Err(p_intf, "Failed to set xattr %s on %s: %s (%s)",
+                        psz_xattr_key, psz_path, strerror(err), psz_reason);
+            } else {
+                msg_Err(p_intf, "Failed to set xattr %s on %s: %s", psz_xattr_key, psz_path,
+                        strerror(err));
+            }
+        }
+        *p_err = err;
+        if (b_cache)
+            tag_cache_invalidate(p_sys->p_tag_cache, p_file->i_dev, p_file->i_ino);
+        return false;
+    }
+    if (i_conflicts > 0)
+        msg_Dbg(p_intf, "Wrote xattr %s on %s after %u conflicting write(s)", psz_xattr_key,
+                psz_path, i_conflicts);
+    if (strcmp(psz_xattr_key, WriterConfig(p_sys)->psz_xattr_key) == 0)
+        p_file->b_key_exists = true;
+
+    if (i_written == 0) {
+        metrics_add(&p_sys->metrics, METRIC_SKIPPED_PRESENT, 1);
+        if (b_cache)
+            tag_cache_store(p_sys->p_tag_cache, p_file->i_dev, p_file->i_ino, i_ctime_sec,
+                            i_ctime_nsec, psz_path, p_buf->p_data, tags_len);
+        if (b_share)
+            PublishSharedTags(p_sys->p_tag_share, p_file, ppsz_tags, i_tag_count,
+                              psz_xattr_key, i_ctime_sec, i_ctime_nsec);
+        return true;
+    }
+
+    msg_Dbg(p_intf, "Added %zu tag(s) to xattr %s on %s", tags_added, psz_xattr_key, psz_path);
+    metrics_add(&p_sys->metrics, METRIC_TAGS_ADDED, tags_added);
+    metrics_add(&p_sys->metrics, METRIC_BYTES_WRITTEN, i_written);
+
+    // Our own write moved ctime: record the list under the new one
+    bool b_ctime = (b_cache || b_share) && FileCtime(p_file, &i_ctime_sec, &i_ctime_nsec);
+    if (b_cache && b_ctime)
+        tag_cache_store(p_sys->p_tag_cache, p_file->i_dev, p_file->i_ino, i_ctime_sec,
+                        i_ctime_nsec, psz_path, p_buf->p_data, tags_len);
+    else if (b_cache)
+        tag_cache_invalidate(p_sys->p_tag_cache, p_file->i_dev, p_file->i_ino);
+    if (b_share && b_ctime)
+        PublishSharedTags(p_sys->p_tag_share, p_file, ppsz_tags, i_tag_count,
+                          psz_xattr_key, i_ctime_sec, i_ctime_nsec);
+    return true;
+}
+
+static int HandlePlayingChange(vlc_object_t *p_this, const char *psz_var,
+                               vlc_value_t oldval, vlc_value_t newval, void *p_data)
+{
+    input_thread_t *p_input_thread = (input_thread_t *)p_this;
+    intf_thread_t  *p_intf  = p_data;
+    intf_sys_t     *p_sys   = p_intf->p_sys;
+    input_item_t *p_item = input_GetItem(p_input_thread);
+    bool b_reschedule = newval.i_int == INPUT_EVENT_STATE || newval.i_int == INPUT_EVENT_RATE
+                     || newval.i_int == INPUT_EVENT_LENGTH;
+
+    // Most events are position ticks on a correctly aimed timer
+    if (newval.i_int == INPUT_EVENT_POSITION && PositionIsExpected(p_sys, p_input_thread))
+        return VLC_SUCCESS;
+
+    vlc_mutex_lock(&p_sys->schedule_lock);
+    if (p_item && p_item != p_sys->p_item) {
+        p_sys->p_item = p_item;
+
+        xattr_file_release(p_sys->p_current_file);
+        p_sys->p_current_file = NULL;
+
+        // Resolve path once
+        free(p_sys->psz_current_path);
+        p_sys->psz_current_path = ItemPath(p_item);
+
+        // Decide once per item; skipped items start with every target consumed
+        const xattr_config_t *p_config = p_sys->p_item_config;
+        p_sys->b_skip_current = p_config != NULL
+                             && skip_matcher_match(p_config->p_skip_matcher, p_sys->psz_current_path);
+        if (p_sys->b_skip_current)
+            metrics_add(&p_sys->metrics, METRIC_SKIPPED_PATHS, 1);
+        // Tags and checkpoints each need the file, independently of the other
+        bool b_tags = p_sys->b_tagging_enabled && p_config != NULL && p_config->i_target_count > 0;
+        if ((b_tags || p_sys->i_checkpoint_interval != 0) && !p_sys->b_skip_current
+            && p_sys->psz_current_path != NULL) {
+            // The writer opens it with the first job; every later write for
+            // this item reuses the descriptor
+            p_sys->p_current_file = xattr_file_new(p_sys->psz_current_path);
+        }
+        p_sys->i_next_target = b_tags && p_sys->p_current_file != NULL ? 0 : INT_MAX;
+
+        // Checkpoints start over: the first one comes a full interval in
+        p_sys->i_last_checkpoint = mdate();
+        p_sys->i_position_written = -1;
+        p_sys->i_watch_pending = 0;
+        p_sys->i_play_start = 0;
+
+        // Targets at 0% need no position: they go out as the item starts
+        FireTargets(p_intf, 0);
+        b_reschedule = true;
+
+        char *psz_name = input_item_GetTitleFbName(p_item);
+        if (psz_name) {
+            msg_Info(p_this, "Now playing: %s", psz_name);
+            free(psz_name);
+        }
+    }
+
+    if (p_sys->b_resume_pending) {
+        ApplyResume(p_intf, p_input_thread);
+        // Settled: publish an anchor so position events skip the lock again
+        b_reschedule |= !p_sys->b_resume_pending;
+    }
+
+    if (p_sys->i_checkpoint_interval != 0 && p_sys->p_current_file != NULL
+        && (newval.i_int == INPUT_EVENT_STATE || p_sys->i_play_start == 0))
+        TrackPlayState(p_sys, var_GetInteger(p_input_thread, "state") == PLAYING_S, mdate());
+
+    // Checked again under the lock: the anchor may have moved meanwhile
+    if (newval.i_int == INPUT_EVENT_POSITION && !PositionIsExpected(p_sys, p_input_thread))
+        b_reschedule = true;
+
+    if (b_reschedule && p_sys->p_item != NULL)
+        Reschedule(p_intf, p_input_thread);
+    vlc_mutex_unlock(&p_sys->schedule_lock);
+    return VLC_SUCCESS;
+}
+
+static int PlayingChange(vlc_object_t *p_this, const char *psz_var,
+                         vlc_value_t oldval, vlc_value_t newval, void *p_data)
+{
+    intf_thread_t *p_intf = p_data;
+    mtime_t i_start = mdate();
+    int i_ret = HandlePlayingChange(p_this, psz_var, oldval, newval, p_data);
+    metrics_add(&p_intf->p_sys->metrics, METRIC_PLAYING_CALLBACKS, 1);
+    ObserveSince(p_intf, METRIC_PLAYING_CALLBACK_SECONDS, i_start);
+    return i_ret;
 }
@@ -0,0 +1,234 @@
+#include "metrics.h"
+#include "compat.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+    const char *psz_name;
+    const char *psz_help;
+} counter_info[METRIC_COUNTER_COUNT] = {
+    [METRIC_SCHEDULE_WAKEUPS]   = { "schedule_wakeups", "Target and checkpoint timer wakeups" },
+    [METRIC_PLAYING_CALLBACKS]  = { "playing_callbacks", "Input event callbacks handled" },
+    [METRIC_ITEM_CALLBACKS]     = { "item_callbacks", "Playlist item change callbacks handled" },
+    [METRIC_JOBS_QUEUED]        = { "jobs_queued", "Tag writes accepted by the write queue" },
+    [METRIC_JOBS_DROPPED]       = { "jobs_dropped", "Tag writes dropped because the write queue was full" },
+    [METRIC_JOBS_WRITTEN]       = { "jobs_written", "Tag writes that reached the file" },
+    [METRIC_JOBS_FAILED]        = { "jobs_failed", "Tag writes that failed for good" },
+    [METRIC_JOBS_DISCARDED]     = { "jobs_discarded", "Tag writes discarded at shutdown" },
+    [METRIC_JOBS_JOURNALED]     = { "jobs_journaled", "Tag writes deferred to the journal" },
+    [METRIC_TAGS_ADDED]         = { "tags_added", "Tags appended to extended attributes" },
+    [METRIC_BYTES_WRITTEN]      = { "bytes_written", "Extended attribute bytes written" },
+    [METRIC_SKIPPED_PRESENT]    = { "skipped_present", "Tag writes skipped because every tag was already present" },
+    [METRIC_SKIPPED_CACHED]     = { "skipped_cached", "Tag writes skipped by the tag cache without any I/O" },
+    [METRIC_SKIPPED_SHARED]     = { "skipped_shared", "Tag writes skipped because another instance had just written the tags" },
+    [METRIC_SKIPPED_PATHS]      = { "skipped_paths", "Items not tagged because they matched xattr-skip-paths" },
+    [METRIC_RESUMES_APPLIED]    = { "resumes_applied", "Items resumed from their stored position" },
+    [METRIC_RESUMES_DROPPED]    = { "resumes_dropped", "Stored positions dropped because they arrived after the deadline" },
+    [METRIC_WRITE_CONFLICTS]    = { "write_conflicts", "Tag writes retried because another writer changed the value" },
+    [METRIC_ITEMS_PREFETCHED]   = { "items_prefetched", "Playlist items whose tags were read ahead into their meta" },
+    [METRIC_DIR_AGGREGATES_UPDATED] = { "dir_aggregates_updated", "Seen files added to the seen count of their directory" },
+    [METRIC_SIDECAR_WRITES] = { "sidecar_writes", "Values stored in the sidecar store because the filesystem has no user xattrs" },
+    [METRIC_SKIPPED_MOUNT] = { "skipped_mount", "Xattr calls not made because the mount is read-only or has no user xattrs" },
+};
+
+static const struct {
+    const char *psz_name;
+    const char *psz_help;
+} histogram_info[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_SCHEDULE_WAKEUP_SECONDS]   = { "schedule_wakeup_seconds", "Time spent in the target and checkpoint timer" },
+    [METRIC_PLAYING_CALLBACK_SECONDS]  = { "playing_callback_seconds", "Time spent in the input event callback" },
+    [METRIC_ITEM_CALLBACK_SECONDS]     = { "item_callback_seconds", "Time spent in the playlist item change callback" },
+    [METRIC_GETXATTR_SECONDS]          = { "getxattr_seconds", "Latency of extended attribute reads" },
+    [METRIC_SETXATTR_SECONDS]          = { "setxattr_seconds", "Latency of extended attribute writes" },
+    [METRIC_WRITE_TAGS_SECONDS]        = { "write_tags_seconds", "Latency of one tag batch read-modify-write" },
+};
+
+// Errno values worth their own series, grouped like xattr_error_reason()
+static const struct {
+    int err;
+    const char *psz_errno;
+    const char *psz_reason;
+} error_info[] = {
+    { EACCES, "EACCES", "permission" },
+    { EPERM, "EPERM", "permission" },
+    { EROFS, "EROFS", "read_only" },
+    { ENOSPC, "ENOSPC", "no_space" },
+#ifdef EDQUOT
+    { EDQUOT, "EDQUOT", "quota" },
+#endif
+#ifdef ENOTSUP
+    { ENOTSUP, "ENOTSUP", "unsupported" },
+#endif
+#if defined(EOPNOTSUPP) && (!defined(ENOTSUP) || EOPNOTSUPP != ENOTSUP)
+    { EOPNOTSUPP, "EOPNOTSUPP", "unsupported" },
+#endif
+    { ENOENT, "ENOENT", "other" },
+    { EIO, "EIO", "other" },
+    { ERANGE, "ERANGE", "other" },
+    { E2BIG, "E2BIG", "other" },
+    { ENOMEM, "ENOMEM", "other" },
+    { EBADF, "EBADF", "other" },
+#ifdef ESTALE
+    { ESTALE, "ESTALE", "other" },
+#endif
+#ifdef ETIMEDOUT
+    { ETIMEDOUT, "ETIMEDOUT", "other" },
+#endif
+};
+
+#define ERROR_INFO_COUNT (sizeof(error_info) / sizeof(error_info[0]))
+_Static_assert(ERROR_INFO_COUNT < METRICS_ERROR_SLOTS, "METRICS_ERROR_SLOTS too small");
+
+void metrics_init(metrics_t *p_metrics)
+{
+    for (size_t i = 0; i < METRIC_COUNTER_COUNT; i++)
+        atomic_init(&p_metrics->i_counters[i], 0);
+    for (size_t i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+        metrics_histo_t *p_histo = &p_metrics->histograms[i];
+        for (size_t j = 0; j < METRICS_BUCKETS; j++)
+            atomic_init(&p_histo->i_buckets[j], 0);
+        atomic_init(&p_histo->i_count, 0);
+        atomic_init(&p_histo->i_sum_us, 0);
+    }
+    for (size_t i = 0; i < METRICS_ERROR_SLOTS; i++)
+        atomic_init(&p_metrics->i_errors[i], 0);
+}
+
+unsigned metrics_bucket(uint64_t i_us)
+{
+    // Smallest i with i_us <= 2^i, clamped to the +Inf bucket
+    unsigned i_bucket = 0;
+    while (i_bucket < METRICS_BUCKETS - 1 && i_us > (UINT64_C(1) << i_bucket))
+        i_bucket++;
+    return i_bucket;
+}
+
+void metrics_observe(metrics_t *p_metrics, metrics_histogram_t histogram, uint64_t i_us)
+{
+    metrics_histo_t *p_histo = &p_metrics->histograms[histogram];
+    atomic_fetch_add_explicit(&p_histo->i_buckets[metrics_bucket(i_us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p_histo->i_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p_histo->i_sum_us, i_us, memory_order_relaxed);
+}
+
+unsigned metrics_error_slot(int err)
+{
+    for (unsigned i = 0; i < ERROR_INFO_COUNT; i++)
+        if (error_info[i].err == err)
+            return i;
+    return METRICS_ERROR_SLOTS - 1;
+}
+
+void metrics_count_error(metrics_t *p_metrics, int err)
+{
+    atomic_fetch_add_explicit(&p_metrics->i_errors[metrics_error_slot(err)], 1,
+                              memory_order_relaxed);
+}
+
+void metrics_error_labels(unsigned i_slot, const char **ppsz_errno, const char **ppsz_reason)
+{
+    if (i_slot < ERROR_INFO_COUNT) {
+        *ppsz_errno = error_info[i_slot].psz_errno;
+        *ppsz_reason = error_info[i_slot].psz_reason;
+    } else {
+        *ppsz_errno = "other";
+        *ppsz_reason = "other";
+    }
+}
+
+const char *metrics_counter_name(metrics_counter_t counter)
+{
+    return counter_info[counter].psz_name;
+}
+
+const char *metrics_histogram_name(metrics_histogram_t histogram)
+{
+    return histogram_info[histogram].psz_name;
+}
+
+static bool write_histogram(const metrics_histo_t *p_histo, const char *psz_prefix,
+                            const char *psz_name, const char *psz_help, FILE *p_out)
+{
+    bool b_ok = fprintf(p_out, "# HELP %s%s %s\n# TYPE %s%s histogram\n",
+                        psz_prefix, psz_name, psz_help, psz_prefix, psz_name) > 0;
+
+    // Buckets are stored separately and made cumulative here; the count is
+    // derived from them so it always matches the +Inf bucket
+    uint64_t i_cumulative = 0;
+    for (unsigned i = 0; i < METRICS_BUCKETS && b_ok; i++) {
+        i_cumulative += atomic_load_explicit(&p_histo->i_buckets[i], memory_order_relaxed);
+        if (i == METRICS_BUCKETS - 1)
+            b_ok = fprintf(p_out, "%s%s_bucket{le=\"+Inf\"} %" PRIu64 "\n",
+                           psz_prefix, psz_name, i_cumulative) > 0;
+        else
+            b_ok = fprintf(p_out, "%s%s_bucket{le=\"%.9g\"} %" PRIu64 "\n", psz_prefix, psz_name,
+                           (double)(UINT64_C(1) << i) / 1e6, i_cumulative) > 0;
+    }
+    uint64_t i_sum_us = atomic_load_explicit(&p_histo->i_sum_us, memory_order_relaxed);
+    return b_ok
+        && fprintf(p_out, "%s%s_sum %.6f\n%s%s_count %" PRIu64 "\n", psz_prefix, psz_name,
+                   (double)i_sum_us / 1e6, psz_prefix, psz_name, i_cumulative) > 0;
+}
+
+bool metrics_write_prometheus(const metrics_t *p_metrics, const char *psz_prefix, FILE *p_out)
+{
+    bool b_ok = true;
+    for (unsigned i = 0; i < METRIC_COUNTER_COUNT && b_ok; i++)
+        b_ok = fprintf(p_out, "# HELP %s%s_total %s\n# TYPE %s%s_total counter\n%s%s_total %" PRIu64 "\n",
+                       psz_prefix, counter_info[i].psz_name, counter_info[i].psz_help,
+                       psz_prefix, counter_info[i].psz_name,
+                       psz_prefix, counter_info[i].psz_name,
+                       metrics_get(p_metrics, (metrics_counter_t)i)) > 0;
+
+    for (unsigned i = 0; i < METRIC_HISTOGRAM_COUNT && b_ok; i++)
+        b_ok = write_histogram(&p_metrics->histograms[i], psz_prefix, histogram_info[i].psz_name,
+                               histogram_info[i].psz_help, p_out);
+
+    if (b_ok)
+        b_ok = fprintf(p_out, "# HELP %sxattr_errors_total Failed extended attribute calls by errno\n"
+                       "# TYPE %sxattr_errors_total counter\n", psz_prefix, psz_prefix) > 0;
+    for (unsigned i = 0; i < METRICS_ERROR_SLOTS && b_ok; i++) {
+        if (i >= ERROR_INFO_COUNT && i != METRICS_ERROR_SLOTS - 1)
+            continue;
+        const char *psz_errno, *psz_reason;
+        metrics_error_labels(i, &psz_errno, &psz_reason);
+        b_ok = fprintf(p_out, "%sxattr_errors_total{errno=\"%s\",reason=\"%s\"} %" PRIu64 "\n",
+                       psz_prefix, psz_errno, psz_reason,
+                       (uint64_t)atomic_load_explicit(&p_metrics->i_errors[i],
+                                                      memory_order_relaxed)) > 0;
+    }
+    return b_ok;
+}
+
+bool metrics_write_textfile(const metrics_t *p_metrics, const char *psz_prefix,
+                            const char *psz_path)
+{
+    size_t tmp_len = strlen(psz_path) + sizeof(".tmp");
+    char *psz_tmp = malloc(tmp_len);
+    if (psz_tmp == NULL)
+        return false;
+    snprintf(psz_tmp, tmp_len, "%s.tmp", psz_path);
+
+    FILE *p_tmp = fopen(psz_tmp, "w");
+    if (p_tmp == NULL) {
+        free(psz_tmp);
+        return false;
+    }
+
+    bool b_ok = metrics_write_prometheus(p_metrics, psz_prefix, p_tmp);
+    if (fclose(p_tmp) != 0)
+        b_ok = false;
+#ifdef _WIN32
+    if (b_ok)
+        remove(psz_path);
+#endif
+    if (b_ok && rename(psz_tmp, psz_path) != 0)
+        b_ok = false;
+    if (!b_ok)
+        remove(psz_tmp);
+    free(psz_tmp);
+    return b_ok;
+}
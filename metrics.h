@@ -0,0 +1,148 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Monotonic event counters.
+ */
+typedef enum {
+    METRIC_SCHEDULE_WAKEUPS = 0,    /**< Target and checkpoint timer wakeups */
+    METRIC_PLAYING_CALLBACKS,       /**< PlayingChange invocations */
+    METRIC_ITEM_CALLBACKS,          /**< ItemChange invocations */
+    METRIC_JOBS_QUEUED,             /**< Jobs accepted by the write queue */
+    METRIC_JOBS_DROPPED,            /**< Jobs rejected or evicted by the write queue */
+    METRIC_JOBS_WRITTEN,            /**< Jobs whose tags reached the file */
+    METRIC_JOBS_FAILED,             /**< Jobs that failed for good */
+    METRIC_JOBS_DISCARDED,          /**< Jobs dropped at shutdown */
+    METRIC_JOBS_JOURNALED,          /**< Jobs deferred to the journal */
+    METRIC_TAGS_ADDED,              /**< Tags appended to xattr values */
+    METRIC_BYTES_WRITTEN,           /**< Value bytes passed to setxattr */
+    METRIC_SKIPPED_PRESENT,         /**< Writes skipped: every tag was already present */
+    METRIC_SKIPPED_CACHED,          /**< Writes skipped by the tag cache, without I/O */
+    METRIC_SKIPPED_SHARED,          /**< Writes skipped: another instance just wrote the tags */
+    METRIC_SKIPPED_PATHS,           /**< Items not tagged because of xattr-skip-paths */
+    METRIC_RESUMES_APPLIED,         /**< Items resumed from their stored position */
+    METRIC_RESUMES_DROPPED,         /**< Stored positions that arrived after the deadline */
+    METRIC_WRITE_CONFLICTS,         /**< Tag writes that lost a race and were retried */
+    METRIC_ITEMS_PREFETCHED,        /**< Playlist items whose tags were published in their meta */
+    METRIC_DIR_AGGREGATES_UPDATED,  /**< Files added to their directory's seen count */
+    METRIC_SIDECAR_WRITES,          /**< Values stored in the sidecar store instead of xattrs */
+    METRIC_SKIPPED_MOUNT,           /**< Xattr calls not made: the mount is read-only or has no user xattrs */
+    METRIC_COUNTER_COUNT
+} metrics_counter_t;
+
+/**
+ * Latency histograms.
+ */
+typedef enum {
+    METRIC_SCHEDULE_WAKEUP_SECONDS = 0,
+    METRIC_PLAYING_CALLBACK_SECONDS,
+    METRIC_ITEM_CALLBACK_SECONDS,
+    METRIC_GETXATTR_SECONDS,
+    METRIC_SETXATTR_SECONDS,
+    METRIC_WRITE_TAGS_SECONDS,      /**< Whole read-modify-write of one batch */
+    METRIC_HISTOGRAM_COUNT
+} metrics_histogram_t;
+
+/** Bucket i counts durations of at most 2^i microseconds; the last one is +Inf. */
+#define METRICS_BUCKETS 24
+/** Errno values counted separately; the last slot holds every other value. */
+#define METRICS_ERROR_SLOTS 16
+
+typedef struct {
+    atomic_uint_fast64_t i_buckets[METRICS_BUCKETS];   /**< Not cumulative */
+    atomic_uint_fast64_t i_count;
+    atomic_uint_fast64_t i_sum_us;
+} metrics_histo_t;
+
+/**
+ * Counters and histograms of the tagging pipeline.
+ *
+ * Every update is a single relaxed atomic add, so any thread may record
+ * without locking; readers see each value atomically but not a consistent
+ * snapshot across values.
+ */
+typedef struct {
+    atomic_uint_fast64_t i_counters[METRIC_COUNTER_COUNT];
+    metrics_histo_t histograms[METRIC_HISTOGRAM_COUNT];
+    atomic_uint_fast64_t i_errors[METRICS_ERROR_SLOTS];   /**< Failed xattr syscalls by errno */
+} metrics_t;
+
+void metrics_init(metrics_t *p_metrics);
+
+static inline void metrics_add(metrics_t *p_metrics, metrics_counter_t counter, uint64_t i_value)
+{
+    atomic_fetch_add_explicit(&p_metrics->i_counters[counter], i_value, memory_order_relaxed);
+}
+
+/**
+ * Overwrite a counter maintained elsewhere (e.g. by the write queue).
+ */
+static inline void metrics_set(metrics_t *p_metrics, metrics_counter_t counter, uint64_t i_value)
+{
+    atomic_store_explicit(&p_metrics->i_counters[counter], i_value, memory_order_relaxed);
+}
+
+static inline uint64_t metrics_get(const metrics_t *p_metrics, metrics_counter_t counter)
+{
+    return atomic_load_explicit(&p_metrics->i_counters[counter], memory_order_relaxed);
+}
+
+/**
+ * Record one duration, in microseconds.
+ */
+void metrics_observe(metrics_t *p_metrics, metrics_histogram_t histogram, uint64_t i_us);
+
+/**
+ * Index of the bucket a duration falls in.
+ */
+unsigned metrics_bucket(uint64_t i_us);
+
+/**
+ * Count a failed xattr syscall.
+ */
+void metrics_count_error(metrics_t *p_metrics, int err);
+
+/**
+ * Slot metrics_count_error() uses for \p err.
+ */
+unsigned metrics_error_slot(int err);
+
+/**
+ * Labels of an error slot: the errno name ("EACCES", "other") and the
+ * failure class ("permission", "read_only", "no_space", "quota",
+ * "unsupported", "other").
+ */
+void metrics_error_labels(unsigned i_slot, const char **ppsz_errno, const char **ppsz_reason);
+
+/**
+ * Snake-case name of a counter, e.g. "position_callbacks".
+ */
+const char *metrics_counter_name(metrics_counter_t counter);
+
+/**
+ * Snake-case name of a histogram, e.g. "setxattr_seconds".
+ */
+const char *metrics_histogram_name(metrics_histogram_t histogram);
+
+/**
+ * Write every metric in the Prometheus text exposition format.
+ *
+ * \param psz_prefix Prepended to every metric name, e.g. "vlc_xattr_".
+ * \return false on write error.
+ */
+bool metrics_write_prometheus(const metrics_t *p_metrics, const char *psz_prefix, FILE *p_out);
+
+/**
+ * Replace \p psz_path with the current metrics, atomically for readers:
+ * the text is written to "<path>.tmp" and renamed over the file, so a
+ * textfile collector never scrapes a partial file.
+ */
+bool metrics_write_textfile(const metrics_t *p_metrics, const char *psz_prefix,
+                            const char *psz_path);
+
+#endif // METRICS_H
@@ -0,0 +1,357 @@
+#include "mount_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#define MOUNTINFO_FILE "/proc/self/mountinfo"
+#define PROBE_KEY "user.vlc.probe"
+
+struct mount_table_t {
+    int i_fd;                   /**< Open on the table file, read again on reload */
+    bool b_watch;               /**< i_fd reports mount changes as POLLPRI */
+    mount_entry_t *p_entries;   /**< In mountinfo order: later mounts are on top */
+    size_t i_count;
+    size_t *p_by_point;         /**< Open addressing, entry index + 1, 0 is empty */
+    size_t i_slot_mask;
+};
+
+static uint64_t hash_point(const char *psz_point, size_t i_len)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < i_len; i++)
+        h = (h ^ (unsigned char)psz_point[i]) * 0x100000001b3ull;
+    return h;
+}
+
+static void free_entries(mount_entry_t *p_entries, size_t i_count)
+{
+    for (size_t i = 0; i < i_count; i++) {
+        free(p_entries[i].psz_point);
+        free(p_entries[i].psz_fstype);
+    }
+    free(p_entries);
+}
+
+/* Slot of the mount point \p psz_point (not NUL-terminated), or of the
+ * empty slot where it belongs */
+static size_t *find_point(size_t *p_by_point, size_t i_slot_mask, const mount_entry_t *p_entries,
+                          const char *psz_point, size_t i_len)
+{
+    for (size_t i = hash_point(psz_point, i_len) & i_slot_mask; ; i = (i + 1) & i_slot_mask) {
+        size_t *p_slot = &p_by_point[i];
+        if (*p_slot == 0)
+            return p_slot;
+        const char *psz_other = p_entries[*p_slot - 1].psz_point;
+        if (strncmp(psz_other, psz_point, i_len) == 0 && psz_other[i_len] == '\0')
+            return p_slot;
+    }
+}
+
+/* Undo the octal escapes mountinfo uses for spaces, tabs, newlines and
+ * backslashes, in place */
+static void unescape(char *psz)
+{
+    char *p_out = psz;
+    for (const char *p = psz; *p != '\0'; p++) {
+        if (p[0] == '\\' && p[1] >= '0' && p[1] <= '3' && p[2] >= '0' && p[2] <= '7'
+         && p[3] >= '0' && p[3] <= '7') {
+            *p_out++ = (char)((p[1] - '0') << 6 | (p[2] - '0') << 3 | (p[3] - '0'));
+            p += 3;
+        } else
+            *p_out++ = *p;
+    }
+    *p_out = '\0';
+}
+
+static bool has_option(const char *psz_options, const char *psz_option)
+{
+    size_t i_len = strlen(psz_option);
+    for (const char *p = psz_options; p != NULL; p = strchr(p, ',')) {
+        if (*p == ',')
+            p++;
+        if (strncmp(p, psz_option, i_len) == 0 && (p[i_len] == ',' || p[i_len] == '\0'))
+            return true;
+    }
+    return false;
+}
+
+/* Parse one line, e.g.
+ * 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+ * (ID, parent ID, device, root, mount point, mount options, optional
+ * fields up to "-", type, source, superblock options) */
+static bool parse_line(char *psz_line, mount_entry_t *p_entry)
+{
+    char *ppsz_fields[6];
+    char *saveptr = NULL;
+    char *psz_field = strtok_r(psz_line, " ", &saveptr);
+    for (int i = 0; i < 6; i++) {
+        if (psz_field == NULL)
+            return false;
+        ppsz_fields[i] = psz_field;
+        psz_field = strtok_r(NULL, " ", &saveptr);
+    }
+    while (psz_field != NULL && strcmp(psz_field, "-") != 0)
+        psz_field = strtok_r(NULL, " ", &saveptr);
+    char *psz_fstype = strtok_r(NULL, " ", &saveptr);
+    char *psz_source = psz_fstype ? strtok_r(NULL, " ", &saveptr) : NULL;
+    char *psz_super = psz_source ? strtok_r(NULL, " ", &saveptr) : NULL;
+    if (psz_super == NULL)
+        return false;
+
+    unsigned i_major, i_minor;
+    char *psz_end;
+    long i_id = strtol(ppsz_fields[0], &psz_end, 10);
+    if (*psz_end != '\0' || sscanf(ppsz_fields[2], "%u:%u", &i_major, &i_minor) != 2)
+        return false;
+    unescape(ppsz_fields[4]);
+    unescape(psz_fstype);
+    if (ppsz_fields[4][0] != '/')
+        return false;
+
+    *p_entry = (mount_entry_t) {
+        .i_id = (int)i_id,
+        .i_dev = (uint64_t)makedev(i_major, i_minor),
+        .psz_point = strdup(ppsz_fields[4]),
+        .psz_fstype = strdup(psz_fstype),
+        .b_readonly = has_option(ppsz_fields[5], "ro") || has_option(psz_super, "ro"),
+    };
+    if (p_entry->psz_point == NULL || p_entry->psz_fstype == NULL) {
+        free(p_entry->psz_point);
+        free(p_entry->psz_fstype);
+        return false;
+    }
+    return true;
+}
+
+/* Whole content of the table file, read again from the start through
+ * i_fd: for mountinfo, reading is also what re-arms the change event */
+static char *read_table(int fd)
+{
+    if (lseek(fd, 0, SEEK_SET) != 0)
+        return NULL;
+    size_t i_len = 0, i_capacity = 16384;
+    char *p_data = malloc(i_capacity);
+    while (p_data != NULL) {
+        if (i_len + 1 == i_capacity) {
+            char *p_grown = realloc(p_data, i_capacity * 2);
+            if (p_grown == NULL)
+                break;
+            p_data = p_grown;
+            i_capacity *= 2;
+        }
+        ssize_t i_read = read(fd, p_data + i_len, i_capacity - i_len - 1);
+        if (i_read == 0) {
+            p_data[i_len] = '\0';
+            return p_data;
+        }
+        if (i_read < 0 && errno != EINTR)
+            break;
+        if (i_read > 0)
+            i_len += (size_t)i_read;
+    }
+    free(p_data);
+    return NULL;
+}
+
+bool mount_table_reload(mount_table_t *p_table)
+{
+    if (p_table == NULL)
+        return false;
+    char *p_data = read_table(p_table->i_fd);
+    if (p_data == NULL)
+        return false;
+
+    size_t i_lines = 1;
+    for (const char *p = p_data; *p != '\0'; p++)
+        i_lines += *p == '\n';
+    size_t i_slots = 16;
+    while (i_slots < i_lines * 2)
+        i_slots *= 2;
+    mount_entry_t *p_entries = malloc(i_lines * sizeof(*p_entries));
+    size_t *p_by_point = calloc(i_slots, sizeof(*p_by_point));
+    if (p_entries == NULL || p_by_point == NULL) {
+        free(p_entries);
+        free(p_by_point);
+        free(p_data);
+        return false;
+    }
+
+    size_t i_count = 0;
+    char *saveptr = NULL;
+    for (char *psz_line = strtok_r(p_data, "\n", &saveptr); psz_line != NULL;
+         psz_line = strtok_r(NULL, "\n", &saveptr)) {
+        mount_entry_t *p_entry = &p_entries[i_count];
+        if (!parse_line(psz_line, p_entry))
+            continue;
+        // Keep what was learned about mounts that are still there
+        for (size_t i = 0; i < p_table->i_count; i++) {
+            const mount_entry_t *p_old = &p_table->p_entries[i];
+            if (p_old->i_id == p_entry->i_id && p_old->i_dev == p_entry->i_dev) {
+                p_entry->user_xattr = p_old->user_xattr;
+                p_entry->b_probed = p_old->b_probed;
+                break;
+            }
+        }
+        // A later mount on the same point hides the earlier one
+        *find_point(p_by_point, i_slots - 1, p_entries, p_entry->psz_point,
+                    strlen(p_entry->psz_point)) = ++i_count;
+    }
+    free(p_data);
+
+    free_entries(p_table->p_entries, p_table->i_count);
+    free(p_table->p_by_point);
+    p_table->p_entries = p_entries;
+    p_table->i_count = i_count;
+    p_table->p_by_point = p_by_point;
+    p_table->i_slot_mask = i_slots - 1;
+    return true;
+}
+
+static mount_table_t *table_open(const char *psz_file, bool b_watch)
+{
+    mount_table_t *p_table = calloc(1, sizeof(*p_table));
+    if (p_table == NULL)
+        return NULL;
+    p_table->i_fd = open(psz_file, O_RDONLY | O_CLOEXEC);
+    p_table->b_watch = b_watch;
+    if (p_table->i_fd < 0 || !mount_table_reload(p_table)) {
+        mount_table_close(p_table);
+        return NULL;
+    }
+    return p_table;
+}
+
+mount_table_t *mount_table_open(void)
+{
+    return table_open(MOUNTINFO_FILE, true);
+}
+
+mount_table_t *mount_table_open_file(const char *psz_file)
+{
+    return psz_file != NULL ? table_open(psz_file, false) : NULL;
+}
+
+void mount_table_close(mount_table_t *p_table)
+{
+    if (p_table == NULL)
+        return;
+    if (p_table->i_fd >= 0)
+        close(p_table->i_fd);
+    free_entries(p_table->p_entries, p_table->i_count);
+    free(p_table->p_by_point);
+    free(p_table);
+}
+
+bool mount_table_poll(mount_table_t *p_table)
+{
+    if (p_table == NULL || !p_table->b_watch)
+        return false;
+    struct pollfd pfd = { .fd = p_table->i_fd, .events = POLLPRI };
+    if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLPRI | POLLERR)))
+        return false;
+    return mount_table_reload(p_table);
+}
+
+mount_entry_t *mount_table_lookup(mount_table_t *p_table, const char *psz_path, uint64_t i_dev)
+{
+    if (p_table == NULL || psz_path == NULL || psz_path[0] != '/')
+        return NULL;
+
+    // The path itself, then each parent directory, down to "/"
+    size_t i_len = strlen(psz_path);
+    for (;;) {
+        size_t i_slot = *find_point(p_table->p_by_point, p_table->i_slot_mask,
+                                    p_table->p_entries, psz_path, i_len);
+        if (i_slot != 0) {
+            mount_entry_t *p_entry = &p_table->p_entries[i_slot - 1];
+            return p_entry->i_dev == i_dev ? p_entry : NULL;
+        }
+        if (i_len == 1)
+            return NULL;
+        do
+            i_len--;
+        while (i_len > 1 && psz_path[i_len] != '/');
+    }
+}
+
+mount_xattr_t mount_table_user_xattr(mount_entry_t *p_entry)
+{
+    if (p_entry == NULL)
+        return MOUNT_XATTR_UNKNOWN;
+    if (p_entry->user_xattr == MOUNT_XATTR_UNKNOWN && !p_entry->b_probed) {
+        p_entry->b_probed = true;
+        if (getxattr(p_entry->psz_point, PROBE_KEY, NULL, 0) >= 0 || errno == ENODATA
+         || errno == ERANGE)
+            p_entry->user_xattr = MOUNT_XATTR_SUPPORTED;
+        else if (errno == ENOTSUP)
+            p_entry->user_xattr = MOUNT_XATTR_UNSUPPORTED;
+        // Anything else (permissions, a stale network mount) says nothing
+    }
+    return p_entry->user_xattr;
+}
+
+size_t mount_table_count(const mount_table_t *p_table)
+{
+    return p_table ? p_table->i_count : 0;
+}
+
+#else
+
+mount_table_t *mount_table_open(void)
+{
+    return NULL;
+}
+
+mount_table_t *mount_table_open_file(const char *psz_file)
+{
+    (void)psz_file;
+    return NULL;
+}
+
+void mount_table_close(mount_table_t *p_table)
+{
+    (void)p_table;
+}
+
+bool mount_table_poll(mount_table_t *p_table)
+{
+    (void)p_table;
+    return false;
+}
+
+bool mount_table_reload(mount_table_t *p_table)
+{
+    (void)p_table;
+    return false;
+}
+
+mount_entry_t *mount_table_lookup(mount_table_t *p_table, const char *psz_path, uint64_t i_dev)
+{
+    (void)p_table;
+    (void)psz_path;
+    (void)i_dev;
+    return NULL;
+}
+
+mount_xattr_t mount_table_user_xattr(mount_entry_t *p_entry)
+{
+    (void)p_entry;
+    return MOUNT_XATTR_UNKNOWN;
+}
+
+size_t mount_table_count(const mount_table_t *p_table)
+{
+    (void)p_table;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef MOUNT_TABLE_H
+#define MOUNT_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    MOUNT_XATTR_UNKNOWN = 0,    /**< Not probed yet, or the probe was inconclusive */
+    MOUNT_XATTR_SUPPORTED,
+    MOUNT_XATTR_UNSUPPORTED,    /**< user.* xattrs fail with ENOTSUP */
+} mount_xattr_t;
+
+/**
+ * Capabilities of one mount.
+ */
+typedef struct {
+    int i_id;                   /**< Mount ID, unique among current mounts */
+    uint64_t i_dev;             /**< st_dev of the files on the mount */
+    char *psz_point;            /**< Mount point, unescaped */
+    char *psz_fstype;           /**< e.g. "ext4", "vfat", "fuseblk" */
+    bool b_readonly;            /**< Mount or superblock is read-only */
+    mount_xattr_t user_xattr;
+    bool b_probed;              /**< Whether the mount point was probed */
+} mount_entry_t;
+
+/**
+ * The mounts of the process, from /proc/self/mountinfo (Linux only).
+ *
+ * A file's mount is the one with the longest mount point that prefixes its
+ * path, the latest mount winning when several share a point; lookups walk
+ * the path's directories up through a hash of the mount points. Whether a
+ * mount takes user xattrs is probed on the mount point the first time it is
+ * asked, and callers record what their own xattr calls find out. Polling
+ * re-reads the table when the kernel reports a mount change, keeping what
+ * was learned about mounts that are still there. Not thread-safe.
+ */
+typedef struct mount_table_t mount_table_t;
+
+/**
+ * Load /proc/self/mountinfo and watch it for changes.
+ *
+ * \return The table, or NULL on other platforms or when it cannot be read.
+ */
+mount_table_t *mount_table_open(void);
+
+/**
+ * Load a file in mountinfo format, without change notifications.
+ *
+ * \return The table, or NULL when the file cannot be read.
+ */
+mount_table_t *mount_table_open_file(const char *psz_file);
+
+/**
+ * Free the table. NULL is ignored.
+ */
+void mount_table_close(mount_table_t *p_table);
+
+/**
+ * Re-read the table if the mounts changed since the last load. Costs one
+ * non-blocking poll() when nothing changed.
+ *
+ * \return true when the table was re-read.
+ */
+bool mount_table_poll(mount_table_t *p_table);
+
+/**
+ * Re-read the table now.
+ *
+ * \return false when the file cannot be read; the table is left as it was.
+ */
+bool mount_table_reload(mount_table_t *p_table);
+
+/**
+ * Mount holding the file at the absolute path \p psz_path.
+ *
+ * \param i_dev st_dev of the file: a mount of another device (the path goes
+ *        through a symlink, or the table is stale) is not returned.
+ * \return The entry, valid until the next poll or reload, or NULL.
+ */
+mount_entry_t *mount_table_lookup(mount_table_t *p_table, const char *psz_path, uint64_t i_dev);
+
+/**
+ * Whether the mount takes user xattrs, probing its mount point once.
+ */
+mount_xattr_t mount_table_user_xattr(mount_entry_t *p_entry);
+
+/**
+ * Number of mounts in the table.
+ */
+size_t mount_table_count(const mount_table_t *p_table);
+
+#endif // MOUNT_TABLE_H
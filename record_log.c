@@ -0,0 +1,494 @@
+#include "record_log.h"
+#include "compat.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define FILE_HEADER_SIZE 16         // magic, version, reserved
+#define RECORD_CHECK_SEED 0x811c9dc5u   // FNV-1a offset basis
+
+struct record_log_t {
+    char *psz_file;
+    const record_log_format_t *p_format;
+    void *p_opaque;
+    FILE *p_append;                 /**< NULL when opened read-only */
+    int i_lock_fd;                  /**< Open on "<file>.lock", -1 when opened read-only */
+    bool b_locked;
+    bool b_rewrite;                 /**< A failed append may have left a torn record */
+    uint64_t i_loaded;              /**< Bytes of the file parsed so far */
+    uint64_t i_file_dev;            /**< Identity of the file that was parsed */
+    uint64_t i_file_ino;
+};
+
+static uint32_t record_check(uint32_t h, const unsigned char *p_data, size_t i_len)
+{
+    for (size_t i = 0; i < i_len; i++) {
+        h ^= p_data[i];
+        h *= 0x01000193u;
+    }
+    return h;
+}
+
+static void put_header(unsigned char *p, uint32_t i_type, size_t i_size, uint32_t i_check)
+{
+    record_log_put_u32(p, i_type);
+    record_log_put_u32(p + 4, (uint32_t)i_size);
+    record_log_put_u32(p + 8, i_check);
+    record_log_put_u32(p + 12, 0);
+}
+
+void record_log_seal(unsigned char *p_record, uint32_t i_type, size_t i_body)
+{
+    size_t i_size = record_log_size(i_body);
+    memset(p_record + RECORD_LOG_HEADER_SIZE + i_body, 0,
+           i_size - RECORD_LOG_HEADER_SIZE - i_body);
+    put_header(p_record, i_type, i_size,
+               record_check(RECORD_CHECK_SEED, p_record + RECORD_LOG_HEADER_SIZE,
+                            i_size - RECORD_LOG_HEADER_SIZE));
+}
+
+bool record_log_write(FILE *p_file, uint32_t i_type, const void *p_body, size_t i_body)
+{
+    static const unsigned char pad[8];
+    size_t i_size = record_log_size(i_body);
+    size_t i_pad = i_size - RECORD_LOG_HEADER_SIZE - i_body;
+    unsigned char header[RECORD_LOG_HEADER_SIZE];
+    put_header(header, i_type, i_size,
+               record_check(record_check(RECORD_CHECK_SEED, p_body, i_body), pad, i_pad));
+    return fwrite(header, 1, sizeof(header), p_file) == sizeof(header)
+        && fwrite(p_body, 1, i_body, p_file) == i_body
+        && fwrite(pad, 1, i_pad, p_file) == i_pad;
+}
+
+/* ---- parsing ---- */
+
+/* Validate and apply one record. Returns its size, or 0 when the bytes at
+ * \p p are not a complete record (torn tail or garbage). */
+static size_t parse_record(record_log_t *p_log, const unsigned char *p, size_t i_avail)
+{
+    if (i_avail < RECORD_LOG_HEADER_SIZE)
+        return 0;
+    uint32_t i_size = record_log_get_u32(p + 4);
+    if (i_size < RECORD_LOG_HEADER_SIZE || i_size > p_log->p_format->i_max_record
+     || i_size % 8 != 0 || i_size > i_avail)
+        return 0;
+    const unsigned char *p_body = p + RECORD_LOG_HEADER_SIZE;
+    size_t i_body = i_size - RECORD_LOG_HEADER_SIZE;
+    if (record_check(RECORD_CHECK_SEED, p_body, i_body) != record_log_get_u32(p + 8)
+     || !p_log->p_format->pf_apply(p_log->p_opaque, record_log_get_u32(p), p_body, i_body))
+        return 0;
+    return i_size;
+}
+
+/* Parse [i_loaded, i_len) of a file image. Returns the offset parsing
+ * stopped at, or 0 when the header does not match the format. */
+static uint64_t parse_image(record_log_t *p_log, const unsigned char *p_data, uint64_t i_len)
+{
+    uint64_t i_pos = p_log->i_loaded;
+    if (i_pos == 0) {
+        if (i_len < FILE_HEADER_SIZE || memcmp(p_data, p_log->p_format->psz_magic, 8) != 0
+         || record_log_get_u32(p_data + 8) != p_log->p_format->i_version)
+            return 0;
+        i_pos = FILE_HEADER_SIZE;
+    }
+    while (i_pos < i_len) {
+        size_t i_size = parse_record(p_log, p_data + i_pos, (size_t)(i_len - i_pos));
+        if (i_size == 0)
+            break;
+        i_pos += i_size;
+    }
+    return i_pos;
+}
+
+/* ---- file ---- */
+
+static int sync_file(FILE *p_file)
+{
+    if (fflush(p_file) != 0)
+        return -1;
+#ifdef _WIN32
+    return _commit(_fileno(p_file));
+#else
+    return fsync(fileno(p_file));
+#endif
+}
+
+static bool reopen_append(record_log_t *p_log)
+{
+    if (p_log->p_append != NULL)
+        fclose(p_log->p_append);
+    p_log->p_append = fopen(p_log->psz_file, "ab");
+    // Unbuffered: a failed write leaves nothing behind to be flushed later
+    if (p_log->p_append != NULL)
+        setvbuf(p_log->p_append, NULL, _IONBF, 0);
+    return p_log->p_append != NULL;
+}
+
+static void reset(record_log_t *p_log)
+{
+    p_log->p_format->pf_reset(p_log->p_opaque);
+    p_log->i_loaded = 0;
+}
+
+/* Map the file and parse what was appended since the last load. A file
+ * that was replaced (compacted by another process) is parsed from scratch.
+ * Returns false when the file is unreadable or not of this format. */
+static bool load_file(record_log_t *p_log, bool *p_torn)
+{
+    *p_torn = false;
+#ifdef _WIN32
+    FILE *p_file = fopen(p_log->psz_file, "rb");
+    if (p_file == NULL)
+        return false;
+    struct _stat64 st;
+    if (_fstat64(_fileno(p_file), &st) != 0) {
+        fclose(p_file);
+        return false;
+    }
+#else
+    int fd = open(p_log->psz_file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+#endif
+    uint64_t i_len = (uint64_t)st.st_size;
+    bool b_replaced = (uint64_t)st.st_dev != p_log->i_file_dev
+                   || (uint64_t)st.st_ino != p_log->i_file_ino;
+    // Nothing is applied while i_loaded is 0
+    if ((b_replaced || i_len < p_log->i_loaded) && p_log->i_loaded != 0)
+        reset(p_log);
+    p_log->i_file_dev = (uint64_t)st.st_dev;
+    p_log->i_file_ino = (uint64_t)st.st_ino;
+
+    bool b_ok = i_len >= FILE_HEADER_SIZE;
+    if (b_ok && i_len > p_log->i_loaded) {
+#ifdef _WIN32
+        // No mmap: read the whole image
+        unsigned char *p_data = malloc((size_t)i_len);
+        b_ok = p_data != NULL && fread(p_data, 1, (size_t)i_len, p_file) == i_len;
+        if (b_ok) {
+            uint64_t i_end = parse_image(p_log, p_data, i_len);
+            b_ok = i_end != 0;
+            *p_torn = i_end != i_len;
+            if (b_ok)
+                p_log->i_loaded = i_end;
+        }
+        free(p_data);
+#else
+        void *p_map = mmap(NULL, (size_t)i_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p_map == MAP_FAILED) {
+            b_ok = false;
+        } else {
+            uint64_t i_end = parse_image(p_log, p_map, i_len);
+            b_ok = i_end != 0;
+            *p_torn = i_end != i_len;
+            if (b_ok)
+                p_log->i_loaded = i_end;
+            munmap(p_map, (size_t)i_len);
+        }
+#endif
+    }
+#ifdef _WIN32
+    fclose(p_file);
+#else
+    close(fd);
+#endif
+
+    // Another process compacted: our append stream points at the old file
+    if (b_ok && b_replaced && p_log->p_append != NULL && !reopen_append(p_log))
+        b_ok = false;
+    return b_ok;
+}
+
+static bool write_header(FILE *p_file, const record_log_format_t *p_format)
+{
+    unsigned char header[FILE_HEADER_SIZE] = { 0 };
+    memcpy(header, p_format->psz_magic, 8);
+    record_log_put_u32(header + 8, p_format->i_version);
+    return fwrite(header, 1, sizeof(header), p_file) == sizeof(header);
+}
+
+/* ---- locking ---- */
+
+/* Writers serialize on "<file>.lock" rather than on the log, which
+ * compaction replaces: a lock on the old inode would not exclude a writer
+ * that already opened the new one. */
+static bool open_lock(record_log_t *p_log)
+{
+    size_t i_len = strlen(p_log->psz_file) + sizeof(".lock");
+    char *psz_lock = malloc(i_len);
+    if (psz_lock == NULL)
+        return false;
+    snprintf(psz_lock, i_len, "%s.lock", p_log->psz_file);
+#ifdef _WIN32
+    p_log->i_lock_fd = _open(psz_lock, _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    p_log->i_lock_fd = open(psz_lock, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+#endif
+    free(psz_lock);
+    return p_log->i_lock_fd >= 0;
+}
+
+static bool take_lock(record_log_t *p_log)
+{
+#ifdef _WIN32
+    OVERLAPPED ov = { 0 };
+    p_log->b_locked = LockFileEx((HANDLE)_get_osfhandle(p_log->i_lock_fd),
+                                 LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov) != 0;
+#else
+    int ret;
+    while ((ret = flock(p_log->i_lock_fd, LOCK_EX)) != 0 && errno == EINTR)
+        ;
+    p_log->b_locked = ret == 0;
+#endif
+    return p_log->b_locked;
+}
+
+void record_log_unlock(record_log_t *p_log)
+{
+    if (p_log == NULL || !p_log->b_locked)
+        return;
+#ifdef _WIN32
+    OVERLAPPED ov = { 0 };
+    UnlockFileEx((HANDLE)_get_osfhandle(p_log->i_lock_fd), 0, 1, 0, &ov);
+#else
+    flock(p_log->i_lock_fd, LOCK_UN);
+#endif
+    p_log->b_locked = false;
+}
+
+/* ---- public API ---- */
+
+static record_log_t *log_new(const char *psz_file, const record_log_format_t *p_format,
+                             void *p_opaque)
+{
+    if (psz_file == NULL || p_format == NULL)
+        return NULL;
+    record_log_t *p_log = calloc(1, sizeof(*p_log));
+    if (p_log == NULL)
+        return NULL;
+    p_log->psz_file = strdup(psz_file);
+    if (p_log->psz_file == NULL) {
+        free(p_log);
+        return NULL;
+    }
+    p_log->p_format = p_format;
+    p_log->p_opaque = p_opaque;
+    p_log->i_lock_fd = -1;
+    return p_log;
+}
+
+/* Whether the file is missing or empty, the only states a new file may be
+ * created over: anything else may be a newer version's data or a file that
+ * could not be read this time, and is left alone. */
+static bool may_create(const char *psz_file)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(psz_file, &st) != 0)
+#else
+    struct stat st;
+    if (stat(psz_file, &st) != 0)
+#endif
+        return errno == ENOENT;
+    return st.st_size == 0;
+}
+
+/* Write a file holding just the header, swapped in atomically so a crash
+ * never leaves a partial header behind. */
+static bool create_file(record_log_t *p_log)
+{
+    size_t tmp_len = strlen(p_log->psz_file) + sizeof(".tmp");
+    char *psz_tmp = malloc(tmp_len);
+    if (psz_tmp == NULL)
+        return false;
+    snprintf(psz_tmp, tmp_len, "%s.tmp", p_log->psz_file);
+    FILE *p_file = fopen(psz_tmp, "wb");
+    bool b_ok = p_file != NULL && write_header(p_file, p_log->p_format) && sync_file(p_file) == 0;
+    if (p_file != NULL && fclose(p_file) != 0)
+        b_ok = false;
+#ifdef _WIN32
+    if (b_ok)
+        remove(p_log->psz_file);
+#endif
+    if (b_ok && rename(psz_tmp, p_log->psz_file) != 0)
+        b_ok = false;
+    if (!b_ok)
+        remove(psz_tmp);
+    free(psz_tmp);
+    return b_ok;
+}
+
+static bool open_locked(record_log_t *p_log)
+{
+    bool b_torn;
+    if (!load_file(p_log, &b_torn)) {
+        if (!may_create(p_log->psz_file) || !create_file(p_log) || !load_file(p_log, &b_torn))
+            return false;
+    }
+    if (b_torn && !record_log_compact(p_log))
+        return false;
+    return p_log->p_append != NULL || reopen_append(p_log);
+}
+
+record_log_t *record_log_open(const char *psz_file, const record_log_format_t *p_format,
+                              void *p_opaque)
+{
+    record_log_t *p_log = log_new(psz_file, p_format, p_opaque);
+    if (p_log == NULL)
+        return NULL;
+    if (!open_lock(p_log) || !take_lock(p_log)) {
+        record_log_close(p_log);
+        return NULL;
+    }
+    bool b_ok = open_locked(p_log);
+    record_log_unlock(p_log);
+    if (!b_ok) {
+        record_log_close(p_log);
+        return NULL;
+    }
+    return p_log;
+}
+
+record_log_t *record_log_open_readonly(const char *psz_file, const record_log_format_t *p_format,
+                                       void *p_opaque)
+{
+    record_log_t *p_log = log_new(psz_file, p_format, p_opaque);
+    if (p_log == NULL)
+        return NULL;
+    bool b_torn;
+    if (!load_file(p_log, &b_torn)) {
+        record_log_close(p_log);
+        return NULL;
+    }
+    return p_log;
+}
+
+void record_log_close(record_log_t *p_log)
+{
+    if (p_log == NULL)
+        return;
+    record_log_unlock(p_log);
+    if (p_log->p_append != NULL)
+        fclose(p_log->p_append);
+    if (p_log->i_lock_fd >= 0)
+#ifdef _WIN32
+        _close(p_log->i_lock_fd);
+#else
+        close(p_log->i_lock_fd);
+#endif
+    free(p_log->psz_file);
+    free(p_log);
+}
+
+bool record_log_refresh(record_log_t *p_log)
+{
+    if (p_log == NULL)
+        return false;
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(p_log->psz_file, &st) == 0
+#else
+    struct stat st;
+    if (stat(p_log->psz_file, &st) == 0
+#endif
+     && (uint64_t)st.st_dev == p_log->i_file_dev && (uint64_t)st.st_ino == p_log->i_file_ino
+     && (uint64_t)st.st_size == p_log->i_loaded)
+        return true;
+    bool b_torn;
+    return load_file(p_log, &b_torn);
+}
+
+bool record_log_lock(record_log_t *p_log)
+{
+    if (p_log == NULL || p_log->p_append == NULL || !take_lock(p_log))
+        return false;
+    bool b_torn;
+    if (!load_file(p_log, &b_torn)
+     || ((b_torn || p_log->b_rewrite) && !record_log_compact(p_log))) {
+        record_log_unlock(p_log);
+        return false;
+    }
+    return true;
+}
+
+bool record_log_append(record_log_t *p_log, const void *p_records, size_t i_len)
+{
+    if (p_log == NULL || p_log->p_append == NULL || !p_log->b_locked || p_log->b_rewrite)
+        return false;
+    if (fwrite(p_records, 1, i_len, p_log->p_append) != i_len
+     || (p_log->p_format->b_sync ? sync_file(p_log->p_append) : fflush(p_log->p_append)) != 0) {
+        p_log->b_rewrite = true;
+        clearerr(p_log->p_append);
+        return false;
+    }
+    // Nobody else appends under the lock: the file ends with our records
+    p_log->i_loaded += i_len;
+    return true;
+}
+
+bool record_log_compact(record_log_t *p_log)
+{
+    if (p_log == NULL || !p_log->b_locked)
+        return false;
+
+    size_t tmp_len = strlen(p_log->psz_file) + sizeof(".tmp");
+    char *psz_tmp = malloc(tmp_len);
+    if (psz_tmp == NULL)
+        return false;
+    snprintf(psz_tmp, tmp_len, "%s.tmp", p_log->psz_file);
+
+    FILE *p_tmp = fopen(psz_tmp, "wb");
+    if (p_tmp == NULL) {
+        free(psz_tmp);
+        return false;
+    }
+    bool b_ok = write_header(p_tmp, p_log->p_format)
+             && p_log->p_format->pf_dump(p_log->p_opaque, p_tmp)
+             && sync_file(p_tmp) == 0;
+    if (fclose(p_tmp) != 0)
+        b_ok = false;
+
+    if (b_ok && p_log->p_append != NULL) {
+        fclose(p_log->p_append);
+        p_log->p_append = NULL;
+    }
+#ifdef _WIN32
+    if (b_ok)
+        remove(p_log->psz_file);
+#endif
+    if (b_ok && rename(psz_tmp, p_log->psz_file) != 0)
+        b_ok = false;
+    if (!b_ok)
+        remove(psz_tmp);
+    free(psz_tmp);
+
+    // Re-read the new file so offsets and file identity match it
+    if (b_ok) {
+        bool b_torn;
+        p_log->b_rewrite = false;
+        reset(p_log);
+        b_ok = load_file(p_log, &b_torn);
+    }
+    if (p_log->p_append == NULL && !reopen_append(p_log))
+        b_ok = false;
+    return b_ok;
+}
@@ -0,0 +1,161 @@
+#ifndef RECORD_LOG_H
+#define RECORD_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RECORD_LOG_HEADER_SIZE 16   // type, size, check, reserved
+
+/**
+ * Append-only file of checksummed records, the storage under the seen index,
+ * the sidecar store and the tag journal.
+ *
+ * The file starts with an 8-byte magic and a version, followed by 8-byte
+ * aligned records: type, total size and a check of the body, then the body.
+ * Loading hands every intact record to the owner's apply callback and
+ * remembers how far it got; a refresh parses only what was appended since.
+ * A file that was replaced by another process's compaction, or truncated,
+ * is parsed again from scratch after a reset callback.
+ *
+ * Writers in any process serialize on an exclusive lock on "<file>.lock",
+ * a file compaction never replaces. Taking the lock refreshes, so changes
+ * are made to the latest state; and since nobody else appends while it is
+ * held, bytes that do not parse then are a torn tail left by a crash or a
+ * failed append, which is compacted away so new records never follow it.
+ * Readers take no lock and stop at the first record that does not parse,
+ * which may be one still being written.
+ */
+typedef struct record_log_t record_log_t;
+
+typedef struct {
+    const char *psz_magic;          /**< 8 bytes identifying the file */
+    uint32_t i_version;
+    uint32_t i_max_record;          /**< Larger records are corrupt */
+    bool b_sync;                    /**< fsync every append */
+    /**
+     * Apply one intact record. Unknown types should be accepted, so newer
+     * writers stay readable; false means the body is malformed and stops
+     * parsing there.
+     */
+    bool (*pf_apply)(void *p_opaque, uint32_t i_type, const unsigned char *p_body, size_t i_body);
+    /** Forget what was applied: the file is parsed again from its start. */
+    void (*pf_reset)(void *p_opaque);
+    /** Write the live state with record_log_write(), for compaction. */
+    bool (*pf_dump)(void *p_opaque, FILE *p_file);
+} record_log_format_t;
+
+/**
+ * Open the log at \p psz_file for writing, creating it when it is missing or
+ * empty, and load it into the owner \p p_opaque. \p p_format must outlive
+ * the log.
+ *
+ * \return The log, or NULL when the file cannot be created or read, or is
+ *         not of this format (e.g. written by a newer version); such a file
+ *         is left untouched.
+ */
+record_log_t *record_log_open(const char *psz_file, const record_log_format_t *p_format,
+                              void *p_opaque);
+
+/**
+ * Open an existing log and load it, without write access or locking.
+ *
+ * \return The log, or NULL when the file is missing or not of this format.
+ */
+record_log_t *record_log_open_readonly(const char *psz_file, const record_log_format_t *p_format,
+                                       void *p_opaque);
+
+/**
+ * Close the log. The owner's state is left as it is.
+ */
+void record_log_close(record_log_t *p_log);
+
+/**
+ * Apply records appended by other processes since the last load, without
+ * locking. Costs one stat() when nothing changed.
+ *
+ * \return true on success (including when nothing changed).
+ */
+bool record_log_refresh(record_log_t *p_log);
+
+/**
+ * Take the exclusive lock and refresh, compacting a torn tail away.
+ * Appends and compactions need the lock.
+ *
+ * \return false when the lock cannot be taken or the file cannot be read;
+ *         the lock is not held then.
+ */
+bool record_log_lock(record_log_t *p_log);
+
+/**
+ * Release the lock taken by record_log_lock().
+ */
+void record_log_unlock(record_log_t *p_log);
+
+/**
+ * Append framed records (see record_log_seal()) with a single write, synced
+ * when the format asks for it. The owner applies them itself.
+ *
+ * \return false when the write failed; the next record_log_lock() then
+ *         compacts, since part of it may have reached the file.
+ */
+bool record_log_append(record_log_t *p_log, const void *p_records, size_t i_len);
+
+/**
+ * Rewrite the file from the owner's pf_dump and swap it in atomically, then
+ * load it again from scratch. Needs the lock.
+ *
+ * \return true on success; on failure the old file is left in place.
+ */
+bool record_log_compact(record_log_t *p_log);
+
+/**
+ * Size of the framed record holding a body of \p i_body bytes.
+ */
+static inline size_t record_log_size(size_t i_body)
+{
+    return RECORD_LOG_HEADER_SIZE + ((i_body + 7) & ~(size_t)7);
+}
+
+/**
+ * Frame the \p i_body bytes already written at p_record +
+ * RECORD_LOG_HEADER_SIZE, in a buffer of record_log_size(i_body) bytes:
+ * zero the padding and fill in the header.
+ */
+void record_log_seal(unsigned char *p_record, uint32_t i_type, size_t i_body);
+
+/**
+ * Frame and write one record to \p p_file, from pf_dump.
+ */
+bool record_log_write(FILE *p_file, uint32_t i_type, const void *p_body, size_t i_body);
+
+static inline void record_log_put_u32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static inline void record_log_put_u64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static inline uint32_t record_log_get_u32(const unsigned char *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static inline uint64_t record_log_get_u64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+#endif // RECORD_LOG_H
@@ -0,0 +1,485 @@
+#include "seen_index.h"
+#include "compat.h"
+#include "hash_slots.h"
+#include "record_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INDEX_MAGIC "XSIDX\0\0\1"
+#define INDEX_VERSION 1u
+#define ENTRY_FIXED_SIZE 48         // dev, ino, path hash, bits, time, path length, pad
+#define TAG_FIXED_SIZE 8            // bit, name length
+#define RECORD_MAX_SIZE (1u << 16)
+#define INDEX_COMPACT_MIN_DEAD 256
+
+enum {
+    RECORD_TAG = 1,
+    RECORD_ENTRY = 2,
+};
+
+struct seen_index_t {
+    record_log_t *p_log;
+    seen_index_entry_t *p_entries;  /**< One per file, in first-seen order */
+    size_t i_count;
+    size_t i_capacity;
+    size_t *p_by_inode;             /**< hash_slots.h tables sharing i_slot_mask */
+    size_t *p_by_path;
+    size_t i_slot_mask;
+    char *ppsz_tags[SEEN_INDEX_MAX_TAGS];
+    unsigned i_tag_count;
+    size_t i_dead;                  /**< Superseded entry records */
+    unsigned char *p_buf;           /**< Records being encoded */
+    size_t i_buf_size;
+};
+
+uint64_t seen_index_hash_path(const char *psz_path)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const unsigned char *p = (const unsigned char *)psz_path; *p; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static uint64_t hash_inode(uint64_t i_dev, uint64_t i_ino)
+{
+    uint64_t h = i_ino * 0x9E3779B97F4A7C15ull ^ (i_dev + 0x632BE59BD9B4E019ull);
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 29);
+}
+
+static uint64_t entry_inode_hash(const void *p_opaque, size_t i_entry)
+{
+    const seen_index_entry_t *p_entry = &((const seen_index_t *)p_opaque)->p_entries[i_entry];
+    return hash_inode(p_entry->i_dev, p_entry->i_ino);
+}
+
+static uint64_t entry_path_hash(const void *p_opaque, size_t i_entry)
+{
+    return ((const seen_index_t *)p_opaque)->p_entries[i_entry].i_path_hash;
+}
+
+/* ---- in-memory tables ---- */
+
+static void reset_tables(void *p_opaque)
+{
+    seen_index_t *p_index = p_opaque;
+    for (size_t i = 0; i < p_index->i_count; i++)
+        free(p_index->p_entries[i].psz_path);
+    for (unsigned i = 0; i < p_index->i_tag_count; i++)
+        free(p_index->ppsz_tags[i]);
+    free(p_index->p_entries);
+    free(p_index->p_by_inode);
+    free(p_index->p_by_path);
+    p_index->p_entries = NULL;
+    p_index->p_by_inode = NULL;
+    p_index->p_by_path = NULL;
+    p_index->i_count = p_index->i_capacity = 0;
+    p_index->i_slot_mask = 0;
+    p_index->i_tag_count = 0;
+    p_index->i_dead = 0;
+}
+
+static size_t *find_inode_slot(const seen_index_t *p_index, uint64_t i_dev, uint64_t i_ino)
+{
+    if (p_index->p_by_inode == NULL)
+        return NULL;
+    size_t i = hash_inode(i_dev, i_ino) & p_index->i_slot_mask;
+    for (;;) {
+        size_t *p_slot = &p_index->p_by_inode[i];
+        if (*p_slot == 0)
+            return p_slot;
+        const seen_index_entry_t *p_entry = &p_index->p_entries[*p_slot - 1];
+        if (p_entry->i_dev == i_dev && p_entry->i_ino == i_ino)
+            return p_slot;
+        i = (i + 1) & p_index->i_slot_mask;
+    }
+}
+
+static bool rehash(seen_index_t *p_index, size_t i_slots)
+{
+    size_t *p_by_inode = hash_slots_build(i_slots, p_index->i_count, entry_inode_hash, NULL, p_index);
+    size_t *p_by_path = hash_slots_build(i_slots, p_index->i_count, entry_path_hash, NULL, p_index);
+    if (p_by_inode == NULL || p_by_path == NULL) {
+        free(p_by_inode);
+        free(p_by_path);
+        return false;
+    }
+    free(p_index->p_by_inode);
+    free(p_index->p_by_path);
+    p_index->p_by_inode = p_by_inode;
+    p_index->p_by_path = p_by_path;
+    p_index->i_slot_mask = i_slots - 1;
+    return true;
+}
+
+/* Make (dev, ino) map to the given state, under the \p i_len bytes of path
+ * at \p p_path. */
+static bool apply_entry(seen_index_t *p_index, uint64_t i_dev, uint64_t i_ino,
+                        uint64_t i_bits, int64_t i_updated, const char *p_path, size_t i_len)
+{
+    if (hash_slots_full(p_index->i_count, p_index->i_slot_mask)) {
+        size_t i_slots = p_index->i_slot_mask ? (p_index->i_slot_mask + 1) * 2 : 64;
+        if (!rehash(p_index, i_slots))
+            return false;
+    }
+
+    size_t *p_slot = find_inode_slot(p_index, i_dev, i_ino);
+    seen_index_entry_t *p_entry = *p_slot != 0 ? &p_index->p_entries[*p_slot - 1] : NULL;
+    // New tags on a file under the path it had, the usual update: nothing to copy
+    if (p_entry != NULL && strlen(p_entry->psz_path) == i_len
+     && memcmp(p_entry->psz_path, p_path, i_len) == 0) {
+        p_entry->i_tag_bits = i_bits;
+        p_entry->i_updated = i_updated;
+        p_index->i_dead++;
+        return true;
+    }
+
+    char *psz_path = strndup(p_path, i_len);
+    if (psz_path == NULL)
+        return false;
+    if (p_entry != NULL) {
+        size_t i_entry = *p_slot - 1;
+        // Several paths may share a hash; lookups compare paths while probing
+        hash_slots_remove(p_index->p_by_path, p_index->i_slot_mask,
+                          hash_slots_of(p_index->p_by_path, p_index->i_slot_mask,
+                                        p_entry->i_path_hash, i_entry),
+                          entry_path_hash, p_index);
+        free(p_entry->psz_path);
+        p_index->i_dead++;
+    } else {
+        if (p_index->i_count == p_index->i_capacity) {
+            size_t i_capacity = p_index->i_capacity ? p_index->i_capacity * 2 : 64;
+            seen_index_entry_t *p_entries = realloc(p_index->p_entries, i_capacity * sizeof(*p_entries));
+            if (p_entries == NULL) {
+                free(psz_path);
+                return false;
+            }
+            p_index->p_entries = p_entries;
+            p_index->i_capacity = i_capacity;
+        }
+        *p_slot = ++p_index->i_count;
+        p_entry = &p_index->p_entries[p_index->i_count - 1];
+        p_entry->i_dev = i_dev;
+        p_entry->i_ino = i_ino;
+    }
+
+    p_entry->i_tag_bits = i_bits;
+    p_entry->i_updated = i_updated;
+    p_entry->psz_path = psz_path;
+    p_entry->i_path_hash = seen_index_hash_path(psz_path);
+    hash_slots_insert(p_index->p_by_path, p_index->i_slot_mask, p_entry->i_path_hash,
+                      (size_t)(p_entry - p_index->p_entries));
+    return true;
+}
+
+/* ---- records ---- */
+
+static bool apply_record(void *p_opaque, uint32_t i_type, const unsigned char *p_body, size_t i_body)
+{
+    seen_index_t *p_index = p_opaque;
+    if (i_type == RECORD_TAG) {
+        if (i_body < TAG_FIXED_SIZE)
+            return false;
+        uint32_t i_bit = record_log_get_u32(p_body);
+        uint32_t i_len = record_log_get_u32(p_body + 4);
+        if (i_len > i_body - TAG_FIXED_SIZE || i_bit >= SEEN_INDEX_MAX_TAGS)
+            return false;
+        // Bits are assigned in order, so a gap means a lost record
+        if (i_bit == p_index->i_tag_count) {
+            char *psz_name = strndup((const char *)p_body + TAG_FIXED_SIZE, i_len);
+            if (psz_name == NULL)
+                return false;
+            p_index->ppsz_tags[p_index->i_tag_count++] = psz_name;
+        }
+    } else if (i_type == RECORD_ENTRY) {
+        if (i_body < ENTRY_FIXED_SIZE)
+            return false;
+        uint32_t i_len = record_log_get_u32(p_body + 40);
+        if (i_len > i_body - ENTRY_FIXED_SIZE)
+            return false;
+        return apply_entry(p_index, record_log_get_u64(p_body), record_log_get_u64(p_body + 8),
+                           record_log_get_u64(p_body + 24), (int64_t)record_log_get_u64(p_body + 32),
+                           (const char *)p_body + ENTRY_FIXED_SIZE, i_len);
+    }
+    return true;
+}
+
+static unsigned char *reserve(seen_index_t *p_index, size_t i_size)
+{
+    if (i_size > p_index->i_buf_size) {
+        unsigned char *p_buf = realloc(p_index->p_buf, i_size);
+        if (p_buf == NULL)
+            return NULL;
+        p_index->p_buf = p_buf;
+        p_index->i_buf_size = i_size;
+    }
+    return p_index->p_buf;
+}
+
+static size_t encode_tag(unsigned char *p_body, uint32_t i_bit, const char *psz_name)
+{
+    size_t i_len = strlen(psz_name);
+    record_log_put_u32(p_body, i_bit);
+    record_log_put_u32(p_body + 4, (uint32_t)i_len);
+    memcpy(p_body + TAG_FIXED_SIZE, psz_name, i_len);
+    return TAG_FIXED_SIZE + i_len;
+}
+
+static size_t encode_entry(unsigned char *p_body, const seen_index_entry_t *p_entry)
+{
+    size_t i_len = strlen(p_entry->psz_path);
+    record_log_put_u64(p_body, p_entry->i_dev);
+    record_log_put_u64(p_body + 8, p_entry->i_ino);
+    record_log_put_u64(p_body + 16, p_entry->i_path_hash);
+    record_log_put_u64(p_body + 24, p_entry->i_tag_bits);
+    record_log_put_u64(p_body + 32, (uint64_t)p_entry->i_updated);
+    record_log_put_u32(p_body + 40, (uint32_t)i_len);
+    record_log_put_u32(p_body + 44, 0);
+    memcpy(p_body + ENTRY_FIXED_SIZE, p_entry->psz_path, i_len);
+    return ENTRY_FIXED_SIZE + i_len;
+}
+
+static bool dump_index(void *p_opaque, FILE *p_file)
+{
+    seen_index_t *p_index = p_opaque;
+    for (unsigned i = 0; i < p_index->i_tag_count; i++) {
+        unsigned char *p_body = reserve(p_index, TAG_FIXED_SIZE + strlen(p_index->ppsz_tags[i]));
+        if (p_body == NULL
+         || !record_log_write(p_file, RECORD_TAG, p_body, encode_tag(p_body, i, p_index->ppsz_tags[i])))
+            return false;
+    }
+    for (size_t i = 0; i < p_index->i_count; i++) {
+        const seen_index_entry_t *p_entry = &p_index->p_entries[i];
+        unsigned char *p_body = reserve(p_index, ENTRY_FIXED_SIZE + strlen(p_entry->psz_path));
+        if (p_body == NULL
+         || !record_log_write(p_file, RECORD_ENTRY, p_body, encode_entry(p_body, p_entry)))
+            return false;
+    }
+    return true;
+}
+
+static const record_log_format_t index_format = {
+    .psz_magic = INDEX_MAGIC,
+    .i_version = INDEX_VERSION,
+    .i_max_record = RECORD_MAX_SIZE,
+    .b_sync = false,
+    .pf_apply = apply_record,
+    .pf_reset = reset_tables,
+    .pf_dump = dump_index,
+};
+
+/* ---- public API ---- */
+
+static seen_index_t *index_open(const char *psz_file, bool b_write)
+{
+    if (psz_file == NULL)
+        return NULL;
+    seen_index_t *p_index = calloc(1, sizeof(*p_index));
+    if (p_index == NULL)
+        return NULL;
+    p_index->p_log = b_write ? record_log_open(psz_file, &index_format, p_index)
+                             : record_log_open_readonly(psz_file, &index_format, p_index);
+    if (p_index->p_log == NULL) {
+        seen_index_close(p_index);
+        return NULL;
+    }
+    return p_index;
+}
+
+seen_index_t *seen_index_open(const char *psz_file)
+{
+    return index_open(psz_file, true);
+}
+
+seen_index_t *seen_index_open_readonly(const char *psz_file)
+{
+    return index_open(psz_file, false);
+}
+
+void seen_index_close(seen_index_t *p_index)
+{
+    if (p_index == NULL)
+        return;
+    record_log_close(p_index->p_log);
+    reset_tables(p_index);
+    free(p_index->p_buf);
+    free(p_index);
+}
+
+bool seen_index_refresh(seen_index_t *p_index)
+{
+    return p_index != NULL && record_log_refresh(p_index->p_log);
+}
+
+static int find_tag(const seen_index_t *p_index, const char *psz_tag)
+{
+    for (unsigned i = 0; i < p_index->i_tag_count; i++)
+        if (strcmp(p_index->ppsz_tags[i], psz_tag) == 0)
+            return (int)i;
+    return -1;
+}
+
+/* With the lock held and the tables refreshed, so tag bits are assigned
+ * from every writer's records and appended before anyone else can. New tag
+ * records and the entry go out in one write, then are applied like records
+ * read back from the file. */
+static bool update_locked(seen_index_t *p_index, uint64_t i_dev, uint64_t i_ino,
+                          const char *psz_path, const char *const *ppsz_tags, size_t i_tag_count)
+{
+    const seen_index_entry_t *p_old = seen_index_lookup(p_index, i_dev, i_ino);
+    uint64_t i_bits = p_old ? p_old->i_tag_bits : 0;
+    const char *ppsz_new[SEEN_INDEX_MAX_TAGS];
+    unsigned i_new = 0;
+    size_t i_size = 0;
+    for (size_t i = 0; i < i_tag_count; i++) {
+        if (ppsz_tags[i] == NULL || ppsz_tags[i][0] == '\0')
+            continue;
+        int i_bit = find_tag(p_index, ppsz_tags[i]);
+        for (unsigned j = 0; j < i_new && i_bit < 0; j++)
+            if (strcmp(ppsz_new[j], ppsz_tags[i]) == 0)
+                i_bit = (int)(p_index->i_tag_count + j);
+        if (i_bit < 0) {
+            if (p_index->i_tag_count + i_new == SEEN_INDEX_MAX_TAGS)
+                continue;
+            i_bit = (int)(p_index->i_tag_count + i_new);
+            ppsz_new[i_new++] = ppsz_tags[i];
+            i_size += record_log_size(TAG_FIXED_SIZE + strlen(ppsz_tags[i]));
+        }
+        i_bits |= UINT64_C(1) << i_bit;
+    }
+
+    if (p_old != NULL && p_old->i_tag_bits == i_bits && strcmp(p_old->psz_path, psz_path) == 0)
+        return true;
+
+    seen_index_entry_t entry = {
+        .i_dev = i_dev,
+        .i_ino = i_ino,
+        .i_path_hash = seen_index_hash_path(psz_path),
+        .i_tag_bits = i_bits,
+        .i_updated = (int64_t)time(NULL),
+        .psz_path = (char *)psz_path,
+    };
+    size_t i_entry_size = record_log_size(ENTRY_FIXED_SIZE + strlen(psz_path));
+    if (i_entry_size > RECORD_MAX_SIZE)
+        return false;
+    unsigned char *p_buf = reserve(p_index, i_size + i_entry_size);
+    if (p_buf == NULL)
+        return false;
+
+    size_t i_pos = 0;
+    for (unsigned i = 0; i < i_new; i++) {
+        size_t i_body = encode_tag(p_buf + i_pos + RECORD_LOG_HEADER_SIZE,
+                                   p_index->i_tag_count + i, ppsz_new[i]);
+        record_log_seal(p_buf + i_pos, RECORD_TAG, i_body);
+        i_pos += record_log_size(i_body);
+    }
+    size_t i_body = encode_entry(p_buf + i_pos + RECORD_LOG_HEADER_SIZE, &entry);
+    record_log_seal(p_buf + i_pos, RECORD_ENTRY, i_body);
+    i_pos += record_log_size(i_body);
+
+    if (!record_log_append(p_index->p_log, p_buf, i_pos))
+        return false;
+    for (size_t i = 0; i < i_pos; i += record_log_get_u32(p_buf + i + 4))
+        if (!apply_record(p_index, record_log_get_u32(p_buf + i), p_buf + i + RECORD_LOG_HEADER_SIZE,
+                          record_log_get_u32(p_buf + i + 4) - RECORD_LOG_HEADER_SIZE))
+            return false;
+    return true;
+}
+
+bool seen_index_update(seen_index_t *p_index, uint64_t i_dev, uint64_t i_ino,
+                       const char *psz_path, const char *const *ppsz_tags, size_t i_tag_count)
+{
+    if (p_index == NULL || psz_path == NULL || !record_log_lock(p_index->p_log))
+        return false;
+    bool b_ok = update_locked(p_index, i_dev, i_ino, psz_path, ppsz_tags, i_tag_count);
+    record_log_unlock(p_index->p_log);
+    return b_ok;
+}
+
+const seen_index_entry_t *seen_index_lookup(const seen_index_t *p_index,
+                                            uint64_t i_dev, uint64_t i_ino)
+{
+    if (p_index == NULL)
+        return NULL;
+    size_t *p_slot = find_inode_slot(p_index, i_dev, i_ino);
+    if (p_slot == NULL || *p_slot == 0)
+        return NULL;
+    return &p_index->p_entries[*p_slot - 1];
+}
+
+const seen_index_entry_t *seen_index_lookup_path(const seen_index_t *p_index,
+                                                 const char *psz_path)
+{
+    if (p_index == NULL || psz_path == NULL || p_index->p_by_path == NULL)
+        return NULL;
+    uint64_t i_hash = seen_index_hash_path(psz_path);
+    for (size_t i = i_hash & p_index->i_slot_mask; p_index->p_by_path[i] != 0;
+         i = (i + 1) & p_index->i_slot_mask) {
+        const seen_index_entry_t *p_entry = &p_index->p_entries[p_index->p_by_path[i] - 1];
+        if (p_entry->i_path_hash == i_hash && strcmp(p_entry->psz_path, psz_path) == 0)
+            return p_entry;
+    }
+    return NULL;
+}
+
+int seen_index_tag_bit(const seen_index_t *p_index, const char *psz_tag)
+{
+    if (p_index == NULL || psz_tag == NULL)
+        return -1;
+    return find_tag(p_index, psz_tag);
+}
+
+size_t seen_index_query(const seen_index_t *p_index, const char *psz_prefix,
+                        const char *psz_tag, bool b_with_tag,
+                        seen_index_cb pf_callback, void *p_opaque)
+{
+    if (p_index == NULL)
+        return 0;
+    size_t i_prefix = psz_prefix ? strlen(psz_prefix) : 0;
+    int i_bit = psz_tag ? find_tag(p_index, psz_tag) : -1;
+    uint64_t i_mask = i_bit >= 0 ? UINT64_C(1) << i_bit : 0;
+    // An unknown tag is on no file
+    if (psz_tag != NULL && i_bit < 0 && b_with_tag)
+        return 0;
+
+    size_t i_matched = 0;
+    for (size_t i = 0; i < p_index->i_count; i++) {
+        const seen_index_entry_t *p_entry = &p_index->p_entries[i];
+        if (i_prefix && strncmp(p_entry->psz_path, psz_prefix, i_prefix) != 0)
+            continue;
+        if (psz_tag != NULL && ((p_entry->i_tag_bits & i_mask) != 0) != b_with_tag)
+            continue;
+        i_matched++;
+        if (pf_callback != NULL && !pf_callback(p_entry, p_opaque))
+            break;
+    }
+    return i_matched;
+}
+
+size_t seen_index_count(const seen_index_t *p_index)
+{
+    return p_index ? p_index->i_count : 0;
+}
+
+bool seen_index_needs_compaction(const seen_index_t *p_index)
+{
+    return p_index != NULL && p_index->i_dead >= INDEX_COMPACT_MIN_DEAD
+        && p_index->i_dead > p_index->i_count;
+}
+
+bool seen_index_compact(seen_index_t *p_index)
+{
+    // Locking refreshes: rewrite from the latest state, or records appended
+    // since are lost
+    if (p_index == NULL || !record_log_lock(p_index->p_log))
+        return false;
+    bool b_ok = record_log_compact(p_index->p_log);
+    record_log_unlock(p_index->p_log);
+    return b_ok;
+}
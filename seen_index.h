@@ -0,0 +1,128 @@
+#ifndef SEEN_INDEX_H
+#define SEEN_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEEN_INDEX_MAX_TAGS 64
+
+/**
+ * Latest known state of one file.
+ */
+typedef struct {
+    uint64_t i_dev;         /**< st_dev of the file */
+    uint64_t i_ino;         /**< st_ino of the file */
+    uint64_t i_path_hash;   /**< seen_index_hash_path() of psz_path */
+    uint64_t i_tag_bits;    /**< Bit n set when tag n (see seen_index_tag_name) is present */
+    int64_t i_updated;      /**< Unix time of the last update */
+    char *psz_path;         /**< Path the file was last tagged under */
+} seen_index_entry_t;
+
+/**
+ * On-disk index of tagged files, so library-wide questions can be answered
+ * without touching the media filesystems.
+ *
+ * The file is a header followed by 8-byte aligned, checksummed records that
+ * are only ever appended: tag records name a bit, entry records carry the
+ * full state of one (st_dev, st_ino). The last entry for a file wins. Readers
+ * map the file and index it in memory; compaction rewrites it with one entry
+ * per file and atomically replaces it. Writers in any process take an
+ * exclusive lock on "<file>.lock" and refresh before they assign tag bits,
+ * append or compact; readers take no lock.
+ */
+typedef struct seen_index_t seen_index_t;
+
+/**
+ * Called by seen_index_query() for every matching entry.
+ * Return false to stop the iteration.
+ */
+typedef bool (*seen_index_cb)(const seen_index_entry_t *p_entry, void *p_opaque);
+
+/**
+ * Open the index at \p psz_file for reading and updating, creating it if
+ * needed.
+ *
+ * \return The index, or NULL when the file cannot be created or read.
+ */
+seen_index_t *seen_index_open(const char *psz_file);
+
+/**
+ * Open an existing index without write access.
+ *
+ * \return The index, or NULL when the file is missing or not an index.
+ */
+seen_index_t *seen_index_open_readonly(const char *psz_file);
+
+/**
+ * Close the index.
+ */
+void seen_index_close(seen_index_t *p_index);
+
+/**
+ * Pick up records appended by other processes since the last load.
+ *
+ * \return true on success (including when nothing changed).
+ */
+bool seen_index_refresh(seen_index_t *p_index);
+
+/**
+ * Record that \p ppsz_tags are present on the file (dev, ino) at \p psz_path.
+ * Tags are merged into the bits already known; a record is only appended
+ * when the state or path changed.
+ *
+ * \return true on success.
+ */
+bool seen_index_update(seen_index_t *p_index, uint64_t i_dev, uint64_t i_ino,
+                       const char *psz_path, const char *const *ppsz_tags, size_t i_tag_count);
+
+/**
+ * Look a file up by device and inode.
+ */
+const seen_index_entry_t *seen_index_lookup(const seen_index_t *p_index,
+                                            uint64_t i_dev, uint64_t i_ino);
+
+/**
+ * Look a file up by the path it was last tagged under.
+ */
+const seen_index_entry_t *seen_index_lookup_path(const seen_index_t *p_index,
+                                                 const char *psz_path);
+
+/**
+ * Bit assigned to \p psz_tag, or -1 when no file in the index carries it.
+ */
+int seen_index_tag_bit(const seen_index_t *p_index, const char *psz_tag);
+
+/**
+ * Iterate the files whose path starts with \p psz_prefix (NULL or "" for
+ * all) and that have (\p b_with_tag true) or lack (false) \p psz_tag.
+ *
+ * \return Number of matching entries visited.
+ */
+size_t seen_index_query(const seen_index_t *p_index, const char *psz_prefix,
+                        const char *psz_tag, bool b_with_tag,
+                        seen_index_cb pf_callback, void *p_opaque);
+
+/**
+ * Number of files in the index.
+ */
+size_t seen_index_count(const seen_index_t *p_index);
+
+/**
+ * Rewrite the file with one record per file and swap it in atomically.
+ *
+ * \return true on success.
+ */
+bool seen_index_compact(seen_index_t *p_index);
+
+/**
+ * Whether superseded records outweigh live ones enough to compact.
+ */
+bool seen_index_needs_compaction(const seen_index_t *p_index);
+
+/**
+ * 64-bit FNV-1a hash used for path keys.
+ */
+uint64_t seen_index_hash_path(const char *psz_path);
+
+#endif // SEEN_INDEX_H
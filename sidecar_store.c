@@ -0,0 +1,501 @@
+#include "sidecar_store.h"
+#include "compat.h"
+#include "hash_slots.h"
+#include "record_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STORE_MAGIC "XSCAR\0\0\1"
+#define STORE_VERSION 1u
+#define VALUE_FIXED_SIZE 32         // dev, ino, path/key/value lengths, pad
+#define RECORD_MAX_SIZE (1u << 20)
+#define STORE_COMPACT_MIN_DEAD 256
+
+enum {
+    RECORD_VALUE = 1,
+};
+
+typedef struct {
+    uint64_t i_dev;
+    uint64_t i_ino;
+    uint64_t i_inode_hash;      /**< hash_inode() of dev, ino and key */
+    uint64_t i_path_hash;       /**< hash_path() of path and key */
+    char *psz_path;
+    char *psz_key;
+    unsigned char *p_value;
+    size_t i_len;
+} store_entry_t;
+
+struct sidecar_store_t {
+    record_log_t *p_log;
+    store_entry_t *p_entries;
+    size_t i_count;
+    size_t i_capacity;
+    size_t *p_by_inode;             /**< hash_slots.h tables sharing i_slot_mask */
+    size_t *p_by_path;
+    size_t i_slot_mask;
+    unsigned char *p_pending;       /**< Framed records not committed yet */
+    size_t i_pending_len;
+    size_t i_pending_capacity;
+    size_t i_pending_count;
+    bool b_reapply;                 /**< The log was parsed again: apply p_pending on top */
+    bool b_dumped;                  /**< Our compaction wrote p_pending out */
+    unsigned char *p_buf;           /**< Record body being written by a compaction */
+    size_t i_buf_size;
+    size_t i_dead;                  /**< Superseded value records */
+};
+
+static uint64_t fnv1a(uint64_t h, const char *psz)
+{
+    for (const unsigned char *p = (const unsigned char *)psz; ; p++) {
+        h = (h ^ *p) * 0x100000001b3ull;
+        if (*p == '\0')
+            return h;
+    }
+}
+
+static uint64_t hash_path(const char *psz_path, const char *psz_key)
+{
+    return fnv1a(fnv1a(0xcbf29ce484222325ull, psz_path), psz_key);
+}
+
+static uint64_t hash_inode(uint64_t i_dev, uint64_t i_ino, const char *psz_key)
+{
+    uint64_t h = i_ino * 0x9E3779B97F4A7C15ull ^ (i_dev + 0x632BE59BD9B4E019ull);
+    h ^= fnv1a(0xcbf29ce484222325ull, psz_key);
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 29);
+}
+
+/* ---- in-memory tables ---- */
+
+static void free_entry(store_entry_t *p_entry)
+{
+    free(p_entry->psz_path);
+    free(p_entry->psz_key);
+    free(p_entry->p_value);
+}
+
+static void reset_tables(sidecar_store_t *p_store)
+{
+    for (size_t i = 0; i < p_store->i_count; i++)
+        free_entry(&p_store->p_entries[i]);
+    free(p_store->p_entries);
+    free(p_store->p_by_inode);
+    free(p_store->p_by_path);
+    p_store->p_entries = NULL;
+    p_store->p_by_inode = NULL;
+    p_store->p_by_path = NULL;
+    p_store->i_count = p_store->i_capacity = 0;
+    p_store->i_slot_mask = 0;
+    p_store->i_dead = 0;
+}
+
+static uint64_t entry_inode_hash(const void *p_opaque, size_t i_entry)
+{
+    return ((const sidecar_store_t *)p_opaque)->p_entries[i_entry].i_inode_hash;
+}
+
+static uint64_t entry_path_hash(const void *p_opaque, size_t i_entry)
+{
+    return ((const sidecar_store_t *)p_opaque)->p_entries[i_entry].i_path_hash;
+}
+
+static size_t find_path(const sidecar_store_t *p_store, uint64_t i_hash,
+                        const char *psz_path, const char *psz_key)
+{
+    if (p_store->p_by_path == NULL)
+        return 0;
+    for (size_t i = i_hash & p_store->i_slot_mask; p_store->p_by_path[i] != 0;
+         i = (i + 1) & p_store->i_slot_mask) {
+        const store_entry_t *p_entry = &p_store->p_entries[p_store->p_by_path[i] - 1];
+        if (p_entry->i_path_hash == i_hash && strcmp(p_entry->psz_path, psz_path) == 0
+         && strcmp(p_entry->psz_key, psz_key) == 0)
+            return p_store->p_by_path[i];
+    }
+    return 0;
+}
+
+static size_t find_inode(const sidecar_store_t *p_store, uint64_t i_hash,
+                         uint64_t i_dev, uint64_t i_ino, const char *psz_key)
+{
+    if (p_store->p_by_inode == NULL)
+        return 0;
+    for (size_t i = i_hash & p_store->i_slot_mask; p_store->p_by_inode[i] != 0;
+         i = (i + 1) & p_store->i_slot_mask) {
+        const store_entry_t *p_entry = &p_store->p_entries[p_store->p_by_inode[i] - 1];
+        if (p_entry->i_inode_hash == i_hash && p_entry->i_dev == i_dev
+         && p_entry->i_ino == i_ino && strcmp(p_entry->psz_key, psz_key) == 0)
+            return p_store->p_by_inode[i];
+    }
+    return 0;
+}
+
+static void insert_slots(sidecar_store_t *p_store, size_t i_entry)
+{
+    const store_entry_t *p_entry = &p_store->p_entries[i_entry];
+    hash_slots_insert(p_store->p_by_path, p_store->i_slot_mask, p_entry->i_path_hash, i_entry);
+    hash_slots_insert(p_store->p_by_inode, p_store->i_slot_mask, p_entry->i_inode_hash, i_entry);
+}
+
+static void remove_slots(sidecar_store_t *p_store, size_t i_entry)
+{
+    const store_entry_t *p_entry = &p_store->p_entries[i_entry];
+    hash_slots_remove(p_store->p_by_path, p_store->i_slot_mask,
+                      hash_slots_of(p_store->p_by_path, p_store->i_slot_mask,
+                                    p_entry->i_path_hash, i_entry),
+                      entry_path_hash, p_store);
+    hash_slots_remove(p_store->p_by_inode, p_store->i_slot_mask,
+                      hash_slots_of(p_store->p_by_inode, p_store->i_slot_mask,
+                                    p_entry->i_inode_hash, i_entry),
+                      entry_inode_hash, p_store);
+}
+
+/* Drop an entry, moving the last one into its place. */
+static void remove_entry(sidecar_store_t *p_store, size_t i_entry)
+{
+    remove_slots(p_store, i_entry);
+    free_entry(&p_store->p_entries[i_entry]);
+
+    size_t i_last = --p_store->i_count;
+    if (i_entry != i_last) {
+        const store_entry_t *p_last = &p_store->p_entries[i_last];
+        *hash_slots_of(p_store->p_by_path, p_store->i_slot_mask, p_last->i_path_hash, i_last) = i_entry + 1;
+        *hash_slots_of(p_store->p_by_inode, p_store->i_slot_mask, p_last->i_inode_hash, i_last) = i_entry + 1;
+        p_store->p_entries[i_entry] = *p_last;
+    }
+}
+
+static bool rehash(sidecar_store_t *p_store, size_t i_slots)
+{
+    size_t *p_by_inode = hash_slots_build(i_slots, p_store->i_count, entry_inode_hash, NULL, p_store);
+    size_t *p_by_path = hash_slots_build(i_slots, p_store->i_count, entry_path_hash, NULL, p_store);
+    if (p_by_inode == NULL || p_by_path == NULL) {
+        free(p_by_inode);
+        free(p_by_path);
+        return false;
+    }
+    free(p_store->p_by_inode);
+    free(p_store->p_by_path);
+    p_store->p_by_inode = p_by_inode;
+    p_store->p_by_path = p_by_path;
+    p_store->i_slot_mask = i_slots - 1;
+    return true;
+}
+
+/* Make (path, key), also reachable as (dev, ino, key), hold the value.
+ * Copies the strings and the value. */
+static bool apply_value(sidecar_store_t *p_store, uint64_t i_dev, uint64_t i_ino,
+                        const char *psz_path, size_t i_path_len,
+                        const char *psz_key, size_t i_key_len,
+                        const unsigned char *p_value, size_t i_len)
+{
+    if (hash_slots_full(p_store->i_count, p_store->i_slot_mask)) {
+        size_t i_slots = p_store->i_slot_mask ? (p_store->i_slot_mask + 1) * 2 : 64;
+        if (!rehash(p_store, i_slots))
+            return false;
+    }
+
+    store_entry_t entry = {
+        .i_dev = i_dev,
+        .i_ino = i_ino,
+        .psz_path = strndup(psz_path, i_path_len),
+        .psz_key = strndup(psz_key, i_key_len),
+        .p_value = malloc(i_len ? i_len : 1),
+        .i_len = i_len,
+    };
+    if (entry.psz_path == NULL || entry.psz_key == NULL || entry.p_value == NULL) {
+        free_entry(&entry);
+        return false;
+    }
+    memcpy(entry.p_value, p_value, i_len);
+    entry.i_path_hash = hash_path(entry.psz_path, entry.psz_key);
+    entry.i_inode_hash = hash_inode(i_dev, i_ino, entry.psz_key);
+
+    // The path's old value, or the inode's under its former path
+    size_t i_slot = find_path(p_store, entry.i_path_hash, entry.psz_path, entry.psz_key);
+    size_t i_inode_slot = find_inode(p_store, entry.i_inode_hash, i_dev, i_ino, entry.psz_key);
+    if (i_slot == 0)
+        i_slot = i_inode_slot;
+    else if (i_inode_slot != 0 && i_inode_slot != i_slot) {
+        // Another path claimed this identity before a remount: it is stale
+        remove_entry(p_store, i_inode_slot - 1);
+        p_store->i_dead++;
+        i_slot = find_path(p_store, entry.i_path_hash, entry.psz_path, entry.psz_key);
+    }
+
+    size_t i_entry;
+    if (i_slot != 0) {
+        i_entry = i_slot - 1;
+        remove_slots(p_store, i_entry);
+        free_entry(&p_store->p_entries[i_entry]);
+        p_store->i_dead++;
+    } else {
+        if (p_store->i_count == p_store->i_capacity) {
+            size_t i_capacity = p_store->i_capacity ? p_store->i_capacity * 2 : 64;
+            store_entry_t *p_entries = realloc(p_store->p_entries, i_capacity * sizeof(*p_entries));
+            if (p_entries == NULL) {
+                free_entry(&entry);
+                return false;
+            }
+            p_store->p_entries = p_entries;
+            p_store->i_capacity = i_capacity;
+        }
+        i_entry = p_store->i_count++;
+    }
+    p_store->p_entries[i_entry] = entry;
+    insert_slots(p_store, i_entry);
+    return true;
+}
+
+/* ---- records ---- */
+
+static size_t body_size(size_t i_path_len, size_t i_key_len, size_t i_len)
+{
+    return VALUE_FIXED_SIZE + i_path_len + i_key_len + i_len;
+}
+
+static void encode_body(unsigned char *p_body, uint64_t i_dev, uint64_t i_ino,
+                        const char *psz_path, size_t i_path_len,
+                        const char *psz_key, size_t i_key_len,
+                        const void *p_value, size_t i_len)
+{
+    record_log_put_u64(p_body, i_dev);
+    record_log_put_u64(p_body + 8, i_ino);
+    record_log_put_u32(p_body + 16, (uint32_t)i_path_len);
+    record_log_put_u32(p_body + 20, (uint32_t)i_key_len);
+    record_log_put_u32(p_body + 24, (uint32_t)i_len);
+    record_log_put_u32(p_body + 28, 0);
+    memcpy(p_body + VALUE_FIXED_SIZE, psz_path, i_path_len);
+    memcpy(p_body + VALUE_FIXED_SIZE + i_path_len, psz_key, i_key_len);
+    if (i_len > 0)
+        memcpy(p_body + VALUE_FIXED_SIZE + i_path_len + i_key_len, p_value, i_len);
+}
+
+static bool apply_record(void *p_opaque, uint32_t i_type, const unsigned char *p_body, size_t i_body)
+{
+    if (i_type != RECORD_VALUE)
+        return true;
+    if (i_body < VALUE_FIXED_SIZE)
+        return false;
+    size_t i_path_len = record_log_get_u32(p_body + 16);
+    size_t i_key_len = record_log_get_u32(p_body + 20);
+    size_t i_len = record_log_get_u32(p_body + 24);
+    if (i_path_len + i_key_len + i_len > i_body - VALUE_FIXED_SIZE)
+        return false;
+    const char *psz_path = (const char *)p_body + VALUE_FIXED_SIZE;
+    return apply_value(p_opaque, record_log_get_u64(p_body), record_log_get_u64(p_body + 8),
+                       psz_path, i_path_len, psz_path + i_path_len, i_key_len,
+                       p_body + VALUE_FIXED_SIZE + i_path_len + i_key_len, i_len);
+}
+
+/* The log is parsed again from its start: the puts not committed yet are
+ * applied again on top once it is loaded, see settle(). */
+static void reset_store(void *p_opaque)
+{
+    sidecar_store_t *p_store = p_opaque;
+    reset_tables(p_store);
+    p_store->b_reapply = true;
+}
+
+/* Compaction: the entries already hold the buffered puts. */
+static bool dump_store(void *p_opaque, FILE *p_file)
+{
+    sidecar_store_t *p_store = p_opaque;
+    for (size_t i = 0; i < p_store->i_count; i++) {
+        const store_entry_t *p_entry = &p_store->p_entries[i];
+        size_t i_path_len = strlen(p_entry->psz_path);
+        size_t i_key_len = strlen(p_entry->psz_key);
+        size_t i_body = body_size(i_path_len, i_key_len, p_entry->i_len);
+        if (i_body > p_store->i_buf_size) {
+            unsigned char *p_buf = realloc(p_store->p_buf, i_body);
+            if (p_buf == NULL)
+                return false;
+            p_store->p_buf = p_buf;
+            p_store->i_buf_size = i_body;
+        }
+        encode_body(p_store->p_buf, p_entry->i_dev, p_entry->i_ino, p_entry->psz_path, i_path_len,
+                    p_entry->psz_key, i_key_len, p_entry->p_value, p_entry->i_len);
+        if (!record_log_write(p_file, RECORD_VALUE, p_store->p_buf, i_body))
+            return false;
+    }
+    p_store->b_dumped = true;
+    return true;
+}
+
+static const record_log_format_t store_format = {
+    .psz_magic = STORE_MAGIC,
+    .i_version = STORE_VERSION,
+    .i_max_record = RECORD_MAX_SIZE,
+    .b_sync = true,
+    .pf_apply = apply_record,
+    .pf_reset = reset_store,
+    .pf_dump = dump_store,
+};
+
+static void clear_pending(sidecar_store_t *p_store)
+{
+    p_store->i_pending_len = 0;
+    p_store->i_pending_count = 0;
+}
+
+/* After a successful log call: buffered puts that our own compaction wrote
+ * out are committed; if the file was parsed from scratch otherwise, they
+ * are applied again on top of it. */
+static bool settle(sidecar_store_t *p_store, bool b_ok)
+{
+    if (b_ok && p_store->b_dumped) {
+        clear_pending(p_store);
+    } else if (b_ok && p_store->b_reapply) {
+        for (size_t i = 0; i < p_store->i_pending_len; i += record_log_get_u32(p_store->p_pending + i + 4)) {
+            const unsigned char *p_record = p_store->p_pending + i;
+            apply_record(p_store, record_log_get_u32(p_record), p_record + RECORD_LOG_HEADER_SIZE,
+                         record_log_get_u32(p_record + 4) - RECORD_LOG_HEADER_SIZE);
+        }
+    }
+    if (b_ok)
+        p_store->b_reapply = false;
+    p_store->b_dumped = false;
+    return b_ok;
+}
+
+/* ---- public API ---- */
+
+sidecar_store_t *sidecar_store_open(const char *psz_file)
+{
+    if (psz_file == NULL)
+        return NULL;
+    sidecar_store_t *p_store = calloc(1, sizeof(*p_store));
+    if (p_store == NULL)
+        return NULL;
+    p_store->p_log = record_log_open(psz_file, &store_format, p_store);
+    if (p_store->p_log == NULL) {
+        sidecar_store_close(p_store);
+        return NULL;
+    }
+    settle(p_store, true);
+    return p_store;
+}
+
+void sidecar_store_close(sidecar_store_t *p_store)
+{
+    if (p_store == NULL)
+        return;
+    if (p_store->p_log != NULL) {
+        sidecar_store_commit(p_store);
+        record_log_close(p_store->p_log);
+    }
+    reset_tables(p_store);
+    free(p_store->p_pending);
+    free(p_store->p_buf);
+    free(p_store);
+}
+
+bool sidecar_store_refresh(sidecar_store_t *p_store)
+{
+    // Called before every fallback read: nothing appended costs one stat
+    return p_store != NULL && settle(p_store, record_log_refresh(p_store->p_log));
+}
+
+bool sidecar_store_get(const sidecar_store_t *p_store, uint64_t i_dev, uint64_t i_ino,
+                       const char *psz_path, const char *psz_key,
+                       const void **pp_value, size_t *p_len)
+{
+    if (p_store == NULL || psz_path == NULL || psz_key == NULL)
+        return false;
+    size_t i_slot = find_path(p_store, hash_path(psz_path, psz_key), psz_path, psz_key);
+    if (i_slot == 0)
+        i_slot = find_inode(p_store, hash_inode(i_dev, i_ino, psz_key), i_dev, i_ino, psz_key);
+    if (i_slot == 0)
+        return false;
+    const store_entry_t *p_entry = &p_store->p_entries[i_slot - 1];
+    *pp_value = p_entry->p_value;
+    *p_len = p_entry->i_len;
+    return true;
+}
+
+bool sidecar_store_put(sidecar_store_t *p_store, uint64_t i_dev, uint64_t i_ino,
+                       const char *psz_path, const char *psz_key,
+                       const void *p_value, size_t i_len)
+{
+    if (p_store == NULL || psz_path == NULL || psz_key == NULL)
+        return false;
+    size_t i_path_len = strlen(psz_path);
+    size_t i_key_len = strlen(psz_key);
+    if (i_path_len > RECORD_MAX_SIZE || i_key_len > RECORD_MAX_SIZE || i_len > RECORD_MAX_SIZE)
+        return false;
+    size_t i_body = body_size(i_path_len, i_key_len, i_len);
+    size_t i_size = record_log_size(i_body);
+    if (i_size > RECORD_MAX_SIZE)
+        return false;
+
+    if (p_store->i_pending_len + i_size > p_store->i_pending_capacity) {
+        size_t i_capacity = p_store->i_pending_capacity ? p_store->i_pending_capacity : 4096;
+        while (i_capacity < p_store->i_pending_len + i_size)
+            i_capacity *= 2;
+        unsigned char *p_pending = realloc(p_store->p_pending, i_capacity);
+        if (p_pending == NULL)
+            return false;
+        p_store->p_pending = p_pending;
+        p_store->i_pending_capacity = i_capacity;
+    }
+    if (!apply_value(p_store, i_dev, i_ino, psz_path, i_path_len, psz_key, i_key_len,
+                     p_value, i_len))
+        return false;
+    unsigned char *p_record = p_store->p_pending + p_store->i_pending_len;
+    encode_body(p_record + RECORD_LOG_HEADER_SIZE, i_dev, i_ino, psz_path, i_path_len,
+                psz_key, i_key_len, p_value, i_len);
+    record_log_seal(p_record, RECORD_VALUE, i_body);
+    p_store->i_pending_len += i_size;
+    p_store->i_pending_count++;
+    return true;
+}
+
+size_t sidecar_store_pending(const sidecar_store_t *p_store)
+{
+    return p_store ? p_store->i_pending_count : 0;
+}
+
+bool sidecar_store_commit(sidecar_store_t *p_store)
+{
+    if (p_store == NULL)
+        return false;
+    if (p_store->i_pending_count == 0)
+        return true;
+    // Locking picks up other writers' groups, or compacts our buffered puts
+    // in with what a failed commit left behind
+    if (!settle(p_store, record_log_lock(p_store->p_log)))
+        return false;
+    // One write for the whole group, after the last group of any writer
+    bool b_ok = p_store->i_pending_count == 0
+             || record_log_append(p_store->p_log, p_store->p_pending, p_store->i_pending_len);
+    if (b_ok)
+        clear_pending(p_store);
+    record_log_unlock(p_store->p_log);
+    return b_ok;
+}
+
+size_t sidecar_store_count(const sidecar_store_t *p_store)
+{
+    return p_store ? p_store->i_count : 0;
+}
+
+bool sidecar_store_needs_compaction(const sidecar_store_t *p_store)
+{
+    return p_store != NULL && p_store->i_dead >= STORE_COMPACT_MIN_DEAD
+        && p_store->i_dead > p_store->i_count;
+}
+
+bool sidecar_store_compact(sidecar_store_t *p_store)
+{
+    // Locking refreshes: rewrite from the latest state, or values committed
+    // since are lost
+    if (p_store == NULL || !settle(p_store, record_log_lock(p_store->p_log)))
+        return false;
+    bool b_ok = settle(p_store, record_log_compact(p_store->p_log));
+    record_log_unlock(p_store->p_log);
+    return b_ok;
+}
@@ -0,0 +1,101 @@
+#ifndef SIDECAR_STORE_H
+#define SIDECAR_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Xattr values kept outside the filesystem, for files on NTFS, FAT/exFAT
+ * and other mounts without user xattrs.
+ *
+ * The store is a log of checksummed records, each holding the full value of
+ * one key on one file together with the file's (st_dev, st_ino) and path.
+ * The last record for a (file, key) wins. The whole log is indexed in
+ * memory by open-addressing hash tables, so lookups never touch the disk.
+ *
+ * A file is found by path first, then by (dev, ino): FAT inode numbers and
+ * removable device numbers change across mounts, while renames on NTFS
+ * keep the inode. Either way the next put records the current identity.
+ *
+ * Puts are visible to lookups at once but only buffered: commit writes
+ * every buffered record with one append and one fsync (group commit).
+ * Compaction rewrites the log with one record per value and atomically
+ * replaces it. Commits and compactions in any process hold an exclusive
+ * lock on "<file>.lock" and refresh under it first, so nothing another
+ * process committed is rewritten away.
+ */
+typedef struct sidecar_store_t sidecar_store_t;
+
+/**
+ * Open the store at \p psz_file, creating it if needed, and index it.
+ *
+ * \return The store, or NULL when the file cannot be created or read.
+ */
+sidecar_store_t *sidecar_store_open(const char *psz_file);
+
+/**
+ * Commit buffered puts and close the store.
+ */
+void sidecar_store_close(sidecar_store_t *p_store);
+
+/**
+ * Pick up records committed by other processes since the last load.
+ *
+ * \return true on success (including when nothing changed).
+ */
+bool sidecar_store_refresh(sidecar_store_t *p_store);
+
+/**
+ * Value of \p psz_key on the file at \p psz_path, identified by (dev, ino).
+ *
+ * \param pp_value Set to the value, valid until the next put, refresh or
+ *        compaction.
+ * \param p_len Set to its length.
+ * \return false when the file has no value for the key.
+ */
+bool sidecar_store_get(const sidecar_store_t *p_store, uint64_t i_dev, uint64_t i_ino,
+                       const char *psz_path, const char *psz_key,
+                       const void **pp_value, size_t *p_len);
+
+/**
+ * Replace the value of \p psz_key on the file, buffered until the next
+ * sidecar_store_commit().
+ *
+ * \return false on allocation failure or an oversized value.
+ */
+bool sidecar_store_put(sidecar_store_t *p_store, uint64_t i_dev, uint64_t i_ino,
+                       const char *psz_path, const char *psz_key,
+                       const void *p_value, size_t i_len);
+
+/**
+ * Number of puts buffered since the last commit.
+ */
+size_t sidecar_store_pending(const sidecar_store_t *p_store);
+
+/**
+ * Append the buffered puts and flush them to disk.
+ *
+ * \return true once they are durable; on failure they stay buffered.
+ */
+bool sidecar_store_commit(sidecar_store_t *p_store);
+
+/**
+ * Number of (file, key) values in the store.
+ */
+size_t sidecar_store_count(const sidecar_store_t *p_store);
+
+/**
+ * Whether superseded records outweigh live ones enough to compact.
+ */
+bool sidecar_store_needs_compaction(const sidecar_store_t *p_store);
+
+/**
+ * Commit, then rewrite the file with one record per value and swap it in
+ * atomically.
+ *
+ * \return true on success; on failure the old file is left in place.
+ */
+bool sidecar_store_compact(sidecar_store_t *p_store);
+
+#endif // SIDECAR_STORE_H
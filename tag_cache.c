@@ -0,0 +1,330 @@
+#include "tag_cache.h"
+#include "compat.h"
+#include "hash_slots.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#define NONE SIZE_MAX
+
+typedef struct {
+    tag_cache_entry_t entry;
+    size_t i_prev;              /**< Towards the most recently used node */
+    size_t i_next;              /**< Towards the least recently used node */
+    int i_watch;                /**< inotify watch descriptor, or -1 */
+    size_t i_tags_size;         /**< Allocated size of entry.psz_tags, kept when freed */
+    bool b_used;
+    bool b_changed;             /**< A change was reported since the last check */
+} cache_node_t;
+
+struct tag_cache_t {
+    cache_node_t *p_nodes;
+    size_t i_capacity;
+    size_t i_count;
+    size_t i_head;              /**< Most recently used */
+    size_t i_tail;              /**< Least recently used, evicted first */
+    size_t *p_slots;            /**< hash_slots.h table of node indexes */
+    size_t i_slot_mask;
+    int i_inotify;              /**< inotify descriptor, or -1 */
+};
+
+static size_t hash_key(uint64_t i_dev, uint64_t i_ino)
+{
+    uint64_t h = i_ino * 0x9E3779B97F4A7C15ull ^ (i_dev + 0x632BE59BD9B4E019ull);
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return (size_t)(h ^ (h >> 29));
+}
+
+static size_t *find_slot(const tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino)
+{
+    for (size_t i = hash_key(i_dev, i_ino) & p_cache->i_slot_mask;;
+         i = (i + 1) & p_cache->i_slot_mask) {
+        size_t *p_slot = &p_cache->p_slots[i];
+        if (*p_slot == 0)
+            return p_slot;
+        const tag_cache_entry_t *p_entry = &p_cache->p_nodes[*p_slot - 1].entry;
+        if (p_entry->i_dev == i_dev && p_entry->i_ino == i_ino)
+            return p_slot;
+    }
+}
+
+static uint64_t node_hash(const void *p_opaque, size_t i_node)
+{
+    const tag_cache_entry_t *p_entry = &((const tag_cache_t *)p_opaque)->p_nodes[i_node].entry;
+    return hash_key(p_entry->i_dev, p_entry->i_ino);
+}
+
+static void remove_slot(tag_cache_t *p_cache, size_t *p_slot)
+{
+    hash_slots_remove(p_cache->p_slots, p_cache->i_slot_mask, p_slot, node_hash, p_cache);
+}
+
+static void unlink_node(tag_cache_t *p_cache, size_t i_node)
+{
+    cache_node_t *p_node = &p_cache->p_nodes[i_node];
+    if (p_node->i_prev != NONE)
+        p_cache->p_nodes[p_node->i_prev].i_next = p_node->i_next;
+    else
+        p_cache->i_head = p_node->i_next;
+    if (p_node->i_next != NONE)
+        p_cache->p_nodes[p_node->i_next].i_prev = p_node->i_prev;
+    else
+        p_cache->i_tail = p_node->i_prev;
+}
+
+static void push_front(tag_cache_t *p_cache, size_t i_node)
+{
+    cache_node_t *p_node = &p_cache->p_nodes[i_node];
+    p_node->i_prev = NONE;
+    p_node->i_next = p_cache->i_head;
+    if (p_cache->i_head != NONE)
+        p_cache->p_nodes[p_cache->i_head].i_prev = i_node;
+    p_cache->i_head = i_node;
+    if (p_cache->i_tail == NONE)
+        p_cache->i_tail = i_node;
+}
+
+static void drop_watch(tag_cache_t *p_cache, cache_node_t *p_node)
+{
+#ifdef __linux__
+    if (p_node->i_watch >= 0)
+        inotify_rm_watch(p_cache->i_inotify, p_node->i_watch);
+#else
+    (void)p_cache;
+#endif
+    p_node->i_watch = -1;
+}
+
+/* Remove the node behind \p p_slot; its index becomes free. */
+static size_t remove_node(tag_cache_t *p_cache, size_t *p_slot)
+{
+    size_t i_node = *p_slot - 1;
+    cache_node_t *p_node = &p_cache->p_nodes[i_node];
+    remove_slot(p_cache, p_slot);
+    unlink_node(p_cache, i_node);
+    drop_watch(p_cache, p_node);
+    p_node->b_used = false;
+    p_cache->i_count--;
+    return i_node;
+}
+
+tag_cache_t *tag_cache_new(size_t i_capacity, bool b_watch)
+{
+    if (i_capacity == 0)
+        return NULL;
+
+    tag_cache_t *p_cache = calloc(1, sizeof(*p_cache));
+    if (p_cache == NULL)
+        return NULL;
+
+    size_t i_slots = 16;
+    while (i_slots < i_capacity * 2)
+        i_slots *= 2;
+    p_cache->p_nodes = calloc(i_capacity, sizeof(*p_cache->p_nodes));
+    p_cache->p_slots = calloc(i_slots, sizeof(*p_cache->p_slots));
+    if (p_cache->p_nodes == NULL || p_cache->p_slots == NULL) {
+        free(p_cache->p_nodes);
+        free(p_cache->p_slots);
+        free(p_cache);
+        return NULL;
+    }
+    p_cache->i_capacity = i_capacity;
+    p_cache->i_slot_mask = i_slots - 1;
+    p_cache->i_head = p_cache->i_tail = NONE;
+    p_cache->i_inotify = -1;
+#ifdef __linux__
+    if (b_watch)
+        p_cache->i_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    (void)b_watch;
+#endif
+    return p_cache;
+}
+
+void tag_cache_free(tag_cache_t *p_cache)
+{
+    if (p_cache == NULL)
+        return;
+    for (size_t i = 0; i < p_cache->i_capacity; i++)
+        free(p_cache->p_nodes[i].entry.psz_tags);
+#ifdef __linux__
+    // Closing the descriptor drops every watch
+    if (p_cache->i_inotify >= 0)
+        close(p_cache->i_inotify);
+#endif
+    free(p_cache->p_nodes);
+    free(p_cache->p_slots);
+    free(p_cache);
+}
+
+bool tag_cache_is_watching(const tag_cache_t *p_cache)
+{
+    return p_cache != NULL && p_cache->i_inotify >= 0;
+}
+
+static void mark_changed(tag_cache_t *p_cache, int i_watch, bool b_gone)
+{
+    for (size_t i = p_cache->i_head; i != NONE; i = p_cache->p_nodes[i].i_next) {
+        cache_node_t *p_node = &p_cache->p_nodes[i];
+        if (i_watch >= 0 && p_node->i_watch != i_watch)
+            continue;
+        p_node->b_changed = true;
+        // The kernel already dropped this watch
+        if (b_gone)
+            p_node->i_watch = -1;
+        if (i_watch >= 0)
+            break;
+    }
+}
+
+void tag_cache_poll(tag_cache_t *p_cache)
+{
+#ifdef __linux__
+    if (p_cache == NULL || p_cache->i_inotify < 0)
+        return;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(p_cache->i_inotify, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *p_event = (const struct inotify_event *)p;
+            if (p_event->mask & IN_Q_OVERFLOW)
+                mark_changed(p_cache, -1, false);   // Events were lost: recheck everything
+            else if (p_event->mask & (IN_ATTRIB | IN_IGNORED))
+                mark_changed(p_cache, p_event->wd, (p_event->mask & IN_IGNORED) != 0);
+            p += sizeof(struct inotify_event) + p_event->len;
+        }
+    }
+#else
+    (void)p_cache;
+#endif
+}
+
+const tag_cache_entry_t *tag_cache_lookup(tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino,
+                                          bool *pb_recheck)
+{
+    if (pb_recheck)
+        *pb_recheck = true;
+    if (p_cache == NULL)
+        return NULL;
+
+    size_t *p_slot = find_slot(p_cache, i_dev, i_ino);
+    if (*p_slot == 0)
+        return NULL;
+
+    size_t i_node = *p_slot - 1;
+    cache_node_t *p_node = &p_cache->p_nodes[i_node];
+    unlink_node(p_cache, i_node);
+    push_front(p_cache, i_node);
+    if (pb_recheck)
+        *pb_recheck = p_node->i_watch < 0 || p_node->b_changed;
+    return &p_node->entry;
+}
+
+void tag_cache_confirm(tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino)
+{
+    if (p_cache == NULL)
+        return;
+    size_t *p_slot = find_slot(p_cache, i_dev, i_ino);
+    if (*p_slot != 0)
+        p_cache->p_nodes[*p_slot - 1].b_changed = false;
+}
+
+void tag_cache_invalidate(tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino)
+{
+    if (p_cache == NULL)
+        return;
+    size_t *p_slot = find_slot(p_cache, i_dev, i_ino);
+    if (*p_slot != 0)
+        remove_node(p_cache, p_slot);
+}
+
+void tag_cache_clear(tag_cache_t *p_cache)
+{
+    if (p_cache == NULL)
+        return;
+    while (p_cache->i_head != NONE) {
+        const tag_cache_entry_t *p_entry = &p_cache->p_nodes[p_cache->i_head].entry;
+        remove_node(p_cache, find_slot(p_cache, p_entry->i_dev, p_entry->i_ino));
+    }
+}
+
+bool tag_cache_store(tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino,
+                     int64_t i_ctime_sec, long i_ctime_nsec, const char *psz_watch_path,
+                     const char *psz_tags, size_t i_len)
+{
+    if (p_cache == NULL || psz_tags == NULL)
+        return false;
+
+    const char *nul = memchr(psz_tags, '\0', i_len);
+    if (nul != NULL)
+        i_len = (size_t)(nul - psz_tags);
+
+    size_t *p_slot = find_slot(p_cache, i_dev, i_ino);
+    size_t i_node;
+    if (*p_slot != 0) {
+        i_node = *p_slot - 1;
+        unlink_node(p_cache, i_node);
+    } else {
+        if (p_cache->i_count == p_cache->i_capacity) {
+            remove_node(p_cache, find_slot(p_cache, p_cache->p_nodes[p_cache->i_tail].entry.i_dev,
+                                           p_cache->p_nodes[p_cache->i_tail].entry.i_ino));
+            p_slot = find_slot(p_cache, i_dev, i_ino);
+        }
+        for (i_node = 0; p_cache->p_nodes[i_node].b_used; i_node++)
+            ;
+        cache_node_t *p_node = &p_cache->p_nodes[i_node];
+        p_node->b_used = true;
+        p_node->i_watch = -1;
+        p_node->entry.i_dev = i_dev;
+        p_node->entry.i_ino = i_ino;
+        *p_slot = i_node + 1;
+        p_cache->i_count++;
+    }
+
+    cache_node_t *p_node = &p_cache->p_nodes[i_node];
+    push_front(p_cache, i_node);
+    // Nodes keep their buffer across entries: storing allocates only to grow it
+    if (i_len >= p_node->i_tags_size) {
+        char *psz_grown = realloc(p_node->entry.psz_tags, i_len + 1);
+        if (psz_grown == NULL) {
+            remove_node(p_cache, find_slot(p_cache, i_dev, i_ino));
+            return false;
+        }
+        p_node->entry.psz_tags = psz_grown;
+        p_node->i_tags_size = i_len + 1;
+    }
+    memcpy(p_node->entry.psz_tags, psz_tags, i_len);
+    p_node->entry.psz_tags[i_len] = '\0';
+    p_node->entry.i_ctime_sec = i_ctime_sec;
+    p_node->entry.i_ctime_nsec = i_ctime_nsec;
+    p_node->entry.i_len = i_len;
+    p_node->b_changed = false;
+#ifdef __linux__
+    // Events for our own write may still be queued: drain them before
+    // trusting the watch with the state we just recorded
+    if (p_cache->i_inotify >= 0 && psz_watch_path != NULL) {
+        tag_cache_poll(p_cache);
+        p_node->b_changed = false;
+        if (p_node->i_watch < 0)
+            p_node->i_watch = inotify_add_watch(p_cache->i_inotify, psz_watch_path, IN_ATTRIB);
+    }
+#else
+    (void)psz_watch_path;
+#endif
+    return true;
+}
+
+size_t tag_cache_count(const tag_cache_t *p_cache)
+{
+    return p_cache ? p_cache->i_count : 0;
+}
@@ -0,0 +1,99 @@
+#ifndef TAG_CACHE_H
+#define TAG_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Last known xattr tag list of one file.
+ */
+typedef struct {
+    uint64_t i_dev;
+    uint64_t i_ino;
+    int64_t i_ctime_sec;       /**< Inode change time the list was read or written at */
+    long i_ctime_nsec;
+    char *psz_tags;            /**< NUL-terminated tag list */
+    size_t i_len;
+} tag_cache_entry_t;
+
+/**
+ * Bounded LRU cache of tag lists keyed by (st_dev, st_ino).
+ *
+ * An entry is only trusted while the file's ctime still matches the one
+ * recorded with it: any xattr change bumps ctime. On Linux the cache can
+ * also watch cached files with inotify; until IN_ATTRIB reports a change,
+ * lookups are trusted without the stat call. Not thread-safe.
+ */
+typedef struct tag_cache_t tag_cache_t;
+
+/**
+ * Create a cache holding at most \p i_capacity files.
+ *
+ * \param b_watch Use inotify where available to skip ctime rechecks.
+ * \return The cache, or NULL on allocation failure or zero capacity.
+ */
+tag_cache_t *tag_cache_new(size_t i_capacity, bool b_watch);
+
+/**
+ * Free the cache and drop its watches. NULL is ignored.
+ */
+void tag_cache_free(tag_cache_t *p_cache);
+
+/**
+ * Whether cached files are watched, i.e. inotify is in use.
+ */
+bool tag_cache_is_watching(const tag_cache_t *p_cache);
+
+/**
+ * Apply pending change notifications without blocking: entries of files
+ * that changed will need a ctime recheck.
+ */
+void tag_cache_poll(tag_cache_t *p_cache);
+
+/**
+ * Find the entry of (dev, ino) and mark it most recently used.
+ *
+ * \param pb_recheck Set to true when the caller must compare the file's
+ *                   current ctime with the entry's before trusting it (no
+ *                   watch, or a change was reported), then call
+ *                   tag_cache_confirm() or tag_cache_invalidate().
+ * \return The entry, or NULL on a miss.
+ */
+const tag_cache_entry_t *tag_cache_lookup(tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino,
+                                          bool *pb_recheck);
+
+/**
+ * Record that the entry of (dev, ino) was checked against the file's ctime
+ * and is still current.
+ */
+void tag_cache_confirm(tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino);
+
+/**
+ * Drop the entry of (dev, ino), if any.
+ */
+void tag_cache_invalidate(tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino);
+
+/**
+ * Drop every entry, e.g. when the tag key they were read from changes.
+ */
+void tag_cache_clear(tag_cache_t *p_cache);
+
+/**
+ * Remember \p psz_tags (\p i_len bytes, up to the first NUL) as the tag list
+ * of (dev, ino) at the given ctime, evicting the least recently used entry
+ * when full.
+ *
+ * \param psz_watch_path Path to watch for changes (may be NULL).
+ * \return false on allocation failure (the file is then not cached).
+ */
+bool tag_cache_store(tag_cache_t *p_cache, uint64_t i_dev, uint64_t i_ino,
+                     int64_t i_ctime_sec, long i_ctime_nsec, const char *psz_watch_path,
+                     const char *psz_tags, size_t i_len);
+
+/**
+ * Number of cached files.
+ */
+size_t tag_cache_count(const tag_cache_t *p_cache);
+
+#endif // TAG_CACHE_H
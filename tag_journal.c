@@ -0,0 +1,369 @@
+#include "tag_journal.h"
+#include "compat.h"
+#include "record_log.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOURNAL_MAGIC "XJRNL\0\0\1"
+#define JOURNAL_VERSION 1u
+#define PENDING_FIXED_SIZE 24        // id, path/key/tags lengths, pad
+#define ID_SIZE 8
+#define JOURNAL_MAX_RECORD (1u << 20)
+#define JOURNAL_COMPACT_MIN_DEAD 64
+
+enum {
+    RECORD_PENDING = 1,
+    RECORD_DONE = 2,
+    RECORD_NEXT_ID = 3,              /**< Written first by compaction, so ids never restart */
+};
+
+struct tag_journal_t {
+    record_log_t *p_log;
+    tag_journal_entry_t *p_entries;  /**< Pending entries, oldest first */
+    size_t i_count;
+    size_t i_capacity;
+    uint64_t i_next_id;
+    size_t i_dead_records;           /**< Records compaction would drop */
+};
+
+bool tag_journal_is_retryable(int err)
+{
+    switch (err) {
+        case EROFS:
+        case ENOSPC:
+        case EIO:
+        case EAGAIN:
+        case EINTR:
+        case EBUSY:
+        case ENODEV:
+#ifdef EDQUOT
+        case EDQUOT:
+#endif
+#ifdef ETIMEDOUT
+        case ETIMEDOUT:
+#endif
+#ifdef ENOTCONN
+        case ENOTCONN:
+#endif
+#ifdef EHOSTDOWN
+        case EHOSTDOWN:
+#endif
+#ifdef EHOSTUNREACH
+        case EHOSTUNREACH:
+#endif
+#ifdef ENETDOWN
+        case ENETDOWN:
+#endif
+#ifdef ENETUNREACH
+        case ENETUNREACH:
+#endif
+#ifdef ESTALE
+        case ESTALE:
+#endif
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+static void free_entry(tag_journal_entry_t *p_entry)
+{
+    free(p_entry->psz_path);
+    free(p_entry->psz_key);
+    free(p_entry->psz_tags);
+}
+
+static void see_id(tag_journal_t *p_journal, uint64_t i_id)
+{
+    if (i_id >= p_journal->i_next_id)
+        p_journal->i_next_id = i_id + 1;
+}
+
+static bool push_entry(tag_journal_t *p_journal, tag_journal_entry_t *p_entry)
+{
+    if (p_journal->i_count == p_journal->i_capacity) {
+        size_t capacity = p_journal->i_capacity ? p_journal->i_capacity * 2 : 16;
+        tag_journal_entry_t *p_grown = realloc(p_journal->p_entries, capacity * sizeof(*p_grown));
+        if (p_grown == NULL)
+            return false;
+        p_journal->p_entries = p_grown;
+        p_journal->i_capacity = capacity;
+    }
+    p_journal->p_entries[p_journal->i_count++] = *p_entry;
+    see_id(p_journal, p_entry->i_id);
+    return true;
+}
+
+static size_t find_entry(const tag_journal_t *p_journal, uint64_t i_id)
+{
+    for (size_t i = 0; i < p_journal->i_count; i++)
+        if (p_journal->p_entries[i].i_id == i_id)
+            return i;
+    return SIZE_MAX;
+}
+
+static void remove_entry(tag_journal_t *p_journal, size_t i_index)
+{
+    free_entry(&p_journal->p_entries[i_index]);
+    memmove(&p_journal->p_entries[i_index], &p_journal->p_entries[i_index + 1],
+            (p_journal->i_count - i_index - 1) * sizeof(*p_journal->p_entries));
+    p_journal->i_count--;
+}
+
+/* ---- records ---- */
+
+static bool apply_record(void *p_opaque, uint32_t i_type, const unsigned char *p_body, size_t i_body)
+{
+    tag_journal_t *p_journal = p_opaque;
+    if (i_type == RECORD_DONE || i_type == RECORD_NEXT_ID) {
+        if (i_body < ID_SIZE)
+            return false;
+        uint64_t i_id = record_log_get_u64(p_body);
+        if (i_type == RECORD_NEXT_ID) {
+            if (i_id > p_journal->i_next_id)
+                p_journal->i_next_id = i_id;
+            return true;
+        }
+        size_t i_index = find_entry(p_journal, i_id);
+        if (i_index != SIZE_MAX)
+            remove_entry(p_journal, i_index);
+        // Both the done record and the pending one it cancels are dead now
+        p_journal->i_dead_records += 2;
+        see_id(p_journal, i_id);
+    } else if (i_type == RECORD_PENDING) {
+        if (i_body < PENDING_FIXED_SIZE)
+            return false;
+        size_t i_path_len = record_log_get_u32(p_body + 8);
+        size_t i_key_len = record_log_get_u32(p_body + 12);
+        size_t i_tags_len = record_log_get_u32(p_body + 16);
+        if (i_path_len + i_key_len + i_tags_len > i_body - PENDING_FIXED_SIZE)
+            return false;
+        const char *psz = (const char *)p_body + PENDING_FIXED_SIZE;
+        tag_journal_entry_t entry = {
+            .i_id = record_log_get_u64(p_body),
+            .psz_path = strndup(psz, i_path_len),
+            .psz_key = strndup(psz + i_path_len, i_key_len),
+            .psz_tags = strndup(psz + i_path_len + i_key_len, i_tags_len),
+        };
+        if (entry.psz_path == NULL || entry.psz_key == NULL || entry.psz_tags == NULL
+         || !push_entry(p_journal, &entry)) {
+            free_entry(&entry);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void reset_journal(void *p_opaque)
+{
+    tag_journal_t *p_journal = p_opaque;
+    for (size_t i = 0; i < p_journal->i_count; i++)
+        free_entry(&p_journal->p_entries[i]);
+    p_journal->i_count = 0;
+    p_journal->i_next_id = 1;
+    p_journal->i_dead_records = 0;
+}
+
+/* Body of a pending record, in a buffer of record_log_size() bytes with
+ * room for the header in front. */
+static unsigned char *encode_pending(uint64_t i_id, const char *psz_path, const char *psz_key,
+                                     const char *psz_tags, size_t i_tags_len, size_t *p_body)
+{
+    size_t i_path_len = strlen(psz_path);
+    size_t i_key_len = strlen(psz_key);
+    size_t i_body = PENDING_FIXED_SIZE + i_path_len + i_key_len + i_tags_len;
+    if (record_log_size(i_body) > JOURNAL_MAX_RECORD)
+        return NULL;
+    unsigned char *p_record = malloc(record_log_size(i_body));
+    if (p_record == NULL)
+        return NULL;
+    unsigned char *p = p_record + RECORD_LOG_HEADER_SIZE;
+    record_log_put_u64(p, i_id);
+    record_log_put_u32(p + 8, (uint32_t)i_path_len);
+    record_log_put_u32(p + 12, (uint32_t)i_key_len);
+    record_log_put_u32(p + 16, (uint32_t)i_tags_len);
+    record_log_put_u32(p + 20, 0);
+    p += PENDING_FIXED_SIZE;
+    memcpy(p, psz_path, i_path_len);
+    memcpy(p + i_path_len, psz_key, i_key_len);
+    memcpy(p + i_path_len + i_key_len, psz_tags, i_tags_len);
+    *p_body = i_body;
+    return p_record;
+}
+
+static bool dump_journal(void *p_opaque, FILE *p_file)
+{
+    tag_journal_t *p_journal = p_opaque;
+    unsigned char id[ID_SIZE];
+    record_log_put_u64(id, p_journal->i_next_id);
+    if (!record_log_write(p_file, RECORD_NEXT_ID, id, sizeof(id)))
+        return false;
+    for (size_t i = 0; i < p_journal->i_count; i++) {
+        const tag_journal_entry_t *p_entry = &p_journal->p_entries[i];
+        size_t i_body;
+        unsigned char *p_record = encode_pending(p_entry->i_id, p_entry->psz_path, p_entry->psz_key,
+                                                 p_entry->psz_tags, strlen(p_entry->psz_tags), &i_body);
+        bool b_ok = p_record != NULL
+                 && record_log_write(p_file, RECORD_PENDING, p_record + RECORD_LOG_HEADER_SIZE, i_body);
+        free(p_record);
+        if (!b_ok)
+            return false;
+    }
+    return true;
+}
+
+static const record_log_format_t journal_format = {
+    .psz_magic = JOURNAL_MAGIC,
+    .i_version = JOURNAL_VERSION,
+    .i_max_record = JOURNAL_MAX_RECORD,
+    .b_sync = true,
+    .pf_apply = apply_record,
+    .pf_reset = reset_journal,
+    .pf_dump = dump_journal,
+};
+
+/* ---- public API ---- */
+
+tag_journal_t *tag_journal_open(const char *psz_file)
+{
+    if (psz_file == NULL)
+        return NULL;
+    tag_journal_t *p_journal = calloc(1, sizeof(*p_journal));
+    if (p_journal == NULL)
+        return NULL;
+    p_journal->i_next_id = 1;
+    p_journal->p_log = record_log_open(psz_file, &journal_format, p_journal);
+    if (p_journal->p_log == NULL) {
+        tag_journal_close(p_journal);
+        return NULL;
+    }
+    return p_journal;
+}
+
+void tag_journal_close(tag_journal_t *p_journal)
+{
+    if (p_journal == NULL)
+        return;
+    record_log_close(p_journal->p_log);
+    reset_journal(p_journal);
+    free(p_journal->p_entries);
+    free(p_journal);
+}
+
+bool tag_journal_refresh(tag_journal_t *p_journal)
+{
+    return p_journal != NULL && record_log_refresh(p_journal->p_log);
+}
+
+bool tag_journal_append(tag_journal_t *p_journal, const char *psz_path, const char *psz_key,
+                        const char *const *ppsz_tags, size_t i_tag_count, uint64_t *out_id)
+{
+    if (p_journal == NULL || psz_path == NULL || psz_key == NULL || ppsz_tags == NULL
+        || i_tag_count == 0)
+        return false;
+
+    size_t tags_len = 0;
+    for (size_t i = 0; i < i_tag_count; i++)
+        tags_len += strlen(ppsz_tags[i]) + 1;
+    char *psz_tags = malloc(tags_len);
+    if (psz_tags == NULL)
+        return false;
+    char *p = psz_tags;
+    for (size_t i = 0; i < i_tag_count; i++) {
+        size_t len = strlen(ppsz_tags[i]);
+        if (i > 0)
+            *p++ = ',';
+        memcpy(p, ppsz_tags[i], len);
+        p += len;
+    }
+    *p = '\0';
+
+    // Ids are taken from the refreshed state under the lock, so instances
+    // sharing the file never hand out the same one
+    if (!record_log_lock(p_journal->p_log)) {
+        free(psz_tags);
+        return false;
+    }
+    uint64_t i_id = p_journal->i_next_id;
+    size_t i_body;
+    unsigned char *p_record = encode_pending(i_id, psz_path, psz_key, psz_tags,
+                                             (size_t)(p - psz_tags), &i_body);
+    bool b_ok = p_record != NULL;
+    if (b_ok) {
+        record_log_seal(p_record, RECORD_PENDING, i_body);
+        // Part of a failed write may have reached the file: never reuse its id
+        p_journal->i_next_id = i_id + 1;
+        b_ok = record_log_append(p_journal->p_log, p_record, record_log_size(i_body))
+            && apply_record(p_journal, RECORD_PENDING, p_record + RECORD_LOG_HEADER_SIZE, i_body);
+    }
+    record_log_unlock(p_journal->p_log);
+    free(p_record);
+    free(psz_tags);
+
+    if (b_ok && out_id)
+        *out_id = i_id;
+    return b_ok;
+}
+
+bool tag_journal_complete(tag_journal_t *p_journal, uint64_t i_id)
+{
+    if (p_journal == NULL || !record_log_lock(p_journal->p_log))
+        return false;
+    // Another instance may have replayed and completed it meanwhile
+    bool b_ok = find_entry(p_journal, i_id) != SIZE_MAX;
+    if (b_ok) {
+        unsigned char record[RECORD_LOG_HEADER_SIZE + ID_SIZE];
+        record_log_put_u64(record + RECORD_LOG_HEADER_SIZE, i_id);
+        record_log_seal(record, RECORD_DONE, ID_SIZE);
+        // Losing a done record only means one extra, idempotent replay
+        record_log_append(p_journal->p_log, record, sizeof(record));
+        apply_record(p_journal, RECORD_DONE, record + RECORD_LOG_HEADER_SIZE, ID_SIZE);
+    }
+    record_log_unlock(p_journal->p_log);
+    return b_ok;
+}
+
+size_t tag_journal_count(const tag_journal_t *p_journal)
+{
+    return p_journal ? p_journal->i_count : 0;
+}
+
+const tag_journal_entry_t *tag_journal_get(const tag_journal_t *p_journal, size_t i_index)
+{
+    if (p_journal == NULL || i_index >= p_journal->i_count)
+        return NULL;
+    return &p_journal->p_entries[i_index];
+}
+
+const tag_journal_entry_t *tag_journal_find(const tag_journal_t *p_journal, uint64_t i_id)
+{
+    if (p_journal == NULL)
+        return NULL;
+    size_t i_index = find_entry(p_journal, i_id);
+    return i_index != SIZE_MAX ? &p_journal->p_entries[i_index] : NULL;
+}
+
+bool tag_journal_needs_compaction(const tag_journal_t *p_journal)
+{
+    if (p_journal == NULL || p_journal->i_dead_records == 0)
+        return false;
+    if (p_journal->i_count == 0)
+        return true;
+    return p_journal->i_dead_records >= JOURNAL_COMPACT_MIN_DEAD
+        && p_journal->i_dead_records >= p_journal->i_count;
+}
+
+bool tag_journal_compact(tag_journal_t *p_journal)
+{
+    // Locking refreshes: rewrite from the latest state, or entries other
+    // instances appended since are lost
+    if (p_journal == NULL || !record_log_lock(p_journal->p_log))
+        return false;
+    bool b_ok = record_log_compact(p_journal->p_log);
+    record_log_unlock(p_journal->p_log);
+    return b_ok;
+}
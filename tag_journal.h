@@ -0,0 +1,107 @@
+#ifndef TAG_JOURNAL_H
+#define TAG_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A tag write that has not reached the filesystem yet.
+ */
+typedef struct {
+    uint64_t i_id;      /**< Journal sequence number */
+    char *psz_path;     /**< File to tag */
+    char *psz_key;      /**< Xattr key, e.g. user.xdg.tags */
+    char *psz_tags;     /**< Comma-separated tags to append */
+} tag_journal_entry_t;
+
+/**
+ * Append-only journal of deferred tag writes, stored in a record log (see
+ * record_log.h), so a record torn by a crash is dropped on the next open.
+ * A "pending" record is cancelled by a later "done" record with the same
+ * id; compaction rewrites the file with only the pending ones.
+ *
+ * Several VLC instances may share the file. Appends, completions and
+ * compactions take the log's lock and refresh first, so ids are assigned
+ * from every instance's records and never collide, and compaction keeps
+ * the records of the others. Compaction also records the next id, so ids
+ * never restart.
+ */
+typedef struct tag_journal_t tag_journal_t;
+
+/**
+ * Open (creating if needed) the journal at \p psz_file and load the
+ * pending entries it holds.
+ *
+ * \return The journal, or NULL when the file cannot be created or read.
+ */
+tag_journal_t *tag_journal_open(const char *psz_file);
+
+/**
+ * Close the journal. Pending entries stay on disk for the next open.
+ */
+void tag_journal_close(tag_journal_t *p_journal);
+
+/**
+ * Pick up entries appended or completed by other instances.
+ *
+ * \return true on success (including when nothing changed).
+ */
+bool tag_journal_refresh(tag_journal_t *p_journal);
+
+/**
+ * Durably record a pending write of \p ppsz_tags to \p psz_key on \p psz_path.
+ *
+ * \param out_id Optional output for the new entry's id.
+ * \return true once the record is flushed to disk. On failure part of it
+ *         may have reached the file: its id is not handed out again, and
+ *         the file is rewritten before the next append.
+ */
+bool tag_journal_append(tag_journal_t *p_journal, const char *psz_path, const char *psz_key,
+                        const char *const *ppsz_tags, size_t i_tag_count, uint64_t *out_id);
+
+/**
+ * Mark entry \p i_id as written so it is not replayed again.
+ *
+ * \return true when the entry was still pending, false when it is unknown
+ *         or another instance completed it first.
+ */
+bool tag_journal_complete(tag_journal_t *p_journal, uint64_t i_id);
+
+/**
+ * Number of entries still pending.
+ */
+size_t tag_journal_count(const tag_journal_t *p_journal);
+
+/**
+ * Pending entry at \p i_index (oldest first). The pointer is valid until the
+ * next call that modifies or refreshes the journal.
+ */
+const tag_journal_entry_t *tag_journal_get(const tag_journal_t *p_journal, size_t i_index);
+
+/**
+ * Pending entry with id \p i_id, or NULL once it is completed. The pointer
+ * is valid until the next call that modifies or refreshes the journal.
+ */
+const tag_journal_entry_t *tag_journal_find(const tag_journal_t *p_journal, uint64_t i_id);
+
+/**
+ * Whether enough completed records have piled up for
+ * tag_journal_compact() to be worthwhile.
+ */
+bool tag_journal_needs_compaction(const tag_journal_t *p_journal);
+
+/**
+ * Atomically replace the file with one holding only the pending entries.
+ *
+ * \return true on success; on failure the old file is left untouched.
+ */
+bool tag_journal_compact(tag_journal_t *p_journal);
+
+/**
+ * Whether a failed xattr write with \p err is worth retrying later
+ * (read-only or full filesystems, offline network mounts, ...).
+ */
+bool tag_journal_is_retryable(int err);
+
+#endif // TAG_JOURNAL_H
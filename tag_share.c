@@ -0,0 +1,283 @@
+#include "tag_share.h"
+#include "compat.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#define HAVE_SHM 1
+
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared slots need lock-free 64-bit atomics");
+#endif
+
+struct tag_share_t {
+    void *p_map;
+    size_t i_map_size;
+    tag_share_slot_t *p_slots;
+    size_t i_slots;
+    uint64_t i_ttl_ms;
+};
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 29;
+    h *= 0x94D049BB133111EBull;
+    return h ^ (h >> 32);
+}
+
+uint64_t tag_share_hash(const char *psz_key, const char *psz_tag)
+{
+    // FNV-1a over "key\0tag"
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (const char *p = psz_key; ; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001B3ull;
+        if (*p == '\0')
+            break;
+    }
+    for (const char *p = psz_tag; *p != '\0'; p++)
+        h = (h ^ (unsigned char)*p) * 0x100000001B3ull;
+    return h;
+}
+
+static uint64_t checksum(uint64_t i_dev, uint64_t i_ino, uint64_t i_tag_hash,
+                         int64_t i_ctime_sec, int64_t i_ctime_nsec, uint64_t i_stamp_ms)
+{
+    uint64_t h = mix(i_dev + 0x9E3779B97F4A7C15ull);
+    h = mix(h ^ i_ino);
+    h = mix(h ^ i_tag_hash);
+    h = mix(h ^ (uint64_t)i_ctime_sec);
+    h = mix(h ^ (uint64_t)i_ctime_nsec);
+    // Never 0, so a zeroed slot never checks out
+    return mix(h ^ i_stamp_ms) | 1;
+}
+
+static uint64_t now_ms(void)
+{
+#ifdef HAVE_SHM
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#else
+    return 0;
+#endif
+}
+
+static size_t home_slot(const tag_share_t *p_share, uint64_t i_dev, uint64_t i_ino,
+                        uint64_t i_tag_hash)
+{
+    return (size_t)(mix(mix(i_dev ^ mix(i_ino)) ^ i_tag_hash) % p_share->i_slots);
+}
+
+typedef struct {
+    uint64_t i_dev, i_ino, i_tag_hash;
+    int64_t i_ctime_sec, i_ctime_nsec;
+    uint64_t i_stamp_ms;
+} slot_value_t;
+
+/* Consistent copy of a slot, or false if it is empty, being written or torn */
+static bool read_slot(tag_share_slot_t *p_slot, slot_value_t *p_value)
+{
+    uint64_t i_seq = atomic_load_explicit(&p_slot->i_seq, memory_order_acquire);
+    if (i_seq == 0 || (i_seq & 1))
+        return false;
+    p_value->i_dev = atomic_load_explicit(&p_slot->i_dev, memory_order_relaxed);
+    p_value->i_ino = atomic_load_explicit(&p_slot->i_ino, memory_order_relaxed);
+    p_value->i_tag_hash = atomic_load_explicit(&p_slot->i_tag_hash, memory_order_relaxed);
+    p_value->i_ctime_sec = atomic_load_explicit(&p_slot->i_ctime_sec, memory_order_relaxed);
+    p_value->i_ctime_nsec = atomic_load_explicit(&p_slot->i_ctime_nsec, memory_order_relaxed);
+    p_value->i_stamp_ms = atomic_load_explicit(&p_slot->i_stamp_ms, memory_order_relaxed);
+    uint64_t i_check = atomic_load_explicit(&p_slot->i_check, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&p_slot->i_seq, memory_order_relaxed) != i_seq)
+        return false;
+    // A peer that lost its claim mid-write may have mixed its fields in
+    return i_check == checksum(p_value->i_dev, p_value->i_ino, p_value->i_tag_hash,
+                               p_value->i_ctime_sec, p_value->i_ctime_nsec,
+                               p_value->i_stamp_ms);
+}
+
+/* Make the slot's sequence odd, taking over claims abandoned by dead peers */
+static bool claim_slot(tag_share_slot_t *p_slot, uint64_t i_now, uint64_t *p_seq)
+{
+    uint64_t i_seq = atomic_load_explicit(&p_slot->i_seq, memory_order_relaxed);
+    if (i_seq & 1) {
+        uint64_t i_claimed = atomic_load_explicit(&p_slot->i_claimed_ms, memory_order_relaxed);
+        // Peers share the monotonic clock, but may have read it after us
+        if (i_claimed + TAG_SHARE_STALE_MS > i_now)
+            return false;
+    }
+    uint64_t i_claim = (i_seq | 1) + ((i_seq & 1) ? 2 : 0);
+    if (!atomic_compare_exchange_strong_explicit(&p_slot->i_seq, &i_seq, i_claim,
+                                                 memory_order_acquire, memory_order_relaxed))
+        return false;
+    atomic_store_explicit(&p_slot->i_claimed_ms, i_now, memory_order_relaxed);
+    // Field stores must not become visible before the odd sequence
+    atomic_thread_fence(memory_order_release);
+    *p_seq = i_claim;
+    return true;
+}
+
+tag_share_t *tag_share_open(const char *psz_name, size_t i_slots, uint64_t i_ttl_ms)
+{
+#ifdef HAVE_SHM
+    if (psz_name == NULL || i_slots == 0
+     || i_slots > (SIZE_MAX - sizeof(tag_share_header_t)) / sizeof(tag_share_slot_t))
+        return NULL;
+
+    int fd = shm_open(psz_name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+        return NULL;
+
+    // Peers may race here: growing to the same size is idempotent, and the
+    // segment is never shrunk under a peer's mapping
+    size_t i_size = sizeof(tag_share_header_t) + i_slots * sizeof(tag_share_slot_t);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size < (off_t)i_size && ftruncate(fd, (off_t)i_size) != 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *p_map = mmap(NULL, i_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p_map == MAP_FAILED)
+        return NULL;
+
+    tag_share_header_t *p_header = p_map;
+    uint64_t i_magic = 0;
+    if (!atomic_compare_exchange_strong(&p_header->i_magic, &i_magic, TAG_SHARE_MAGIC)
+     && i_magic != TAG_SHARE_MAGIC) {
+        munmap(p_map, i_size);
+        return NULL;
+    }
+
+    tag_share_t *p_share = malloc(sizeof(*p_share));
+    if (p_share == NULL) {
+        munmap(p_map, i_size);
+        return NULL;
+    }
+    p_share->p_map = p_map;
+    p_share->i_map_size = i_size;
+    p_share->p_slots = (tag_share_slot_t *)(p_header + 1);
+    p_share->i_slots = i_slots;
+    p_share->i_ttl_ms = i_ttl_ms;
+    return p_share;
+#else
+    (void)psz_name;
+    (void)i_slots;
+    (void)i_ttl_ms;
+    return NULL;
+#endif
+}
+
+void tag_share_close(tag_share_t *p_share)
+{
+    if (p_share == NULL)
+        return;
+#ifdef HAVE_SHM
+    munmap(p_share->p_map, p_share->i_map_size);
+#endif
+    free(p_share);
+}
+
+void tag_share_unlink(const char *psz_name)
+{
+#ifdef HAVE_SHM
+    shm_unlink(psz_name);
+#else
+    (void)psz_name;
+#endif
+}
+
+size_t tag_share_slots(const tag_share_t *p_share)
+{
+    return p_share != NULL ? p_share->i_slots : 0;
+}
+
+bool tag_share_contains(tag_share_t *p_share, uint64_t i_dev, uint64_t i_ino,
+                        int64_t i_ctime_sec, long i_ctime_nsec,
+                        const char *psz_key, const char *psz_tag)
+{
+    if (p_share == NULL)
+        return false;
+
+    uint64_t i_tag_hash = tag_share_hash(psz_key, psz_tag);
+    uint64_t i_now = now_ms();
+    size_t i = home_slot(p_share, i_dev, i_ino, i_tag_hash);
+    for (unsigned i_probe = 0; i_probe < TAG_SHARE_PROBES; i_probe++, i = (i + 1) % p_share->i_slots) {
+        slot_value_t value;
+        if (!read_slot(&p_share->p_slots[i], &value))
+            continue;
+        if (value.i_dev == i_dev && value.i_ino == i_ino && value.i_tag_hash == i_tag_hash)
+            return value.i_ctime_sec == i_ctime_sec && value.i_ctime_nsec == i_ctime_nsec
+                && value.i_stamp_ms + p_share->i_ttl_ms >= i_now;
+    }
+    return false;
+}
+
+void tag_share_publish(tag_share_t *p_share, uint64_t i_dev, uint64_t i_ino,
+                       int64_t i_ctime_sec, long i_ctime_nsec,
+                       const char *psz_key, const char *psz_tag)
+{
+    if (p_share == NULL)
+        return;
+
+    uint64_t i_tag_hash = tag_share_hash(psz_key, psz_tag);
+    uint64_t i_now = now_ms();
+
+    // Prefer the entry of the same tag, then a free or expired slot, then the oldest
+    size_t i_home = home_slot(p_share, i_dev, i_ino, i_tag_hash);
+    size_t i_best = SIZE_MAX;
+    unsigned i_best_rank = 0;
+    uint64_t i_best_stamp = UINT64_MAX;
+    for (unsigned i_probe = 0; i_probe < TAG_SHARE_PROBES; i_probe++) {
+        size_t i = (i_home + i_probe) % p_share->i_slots;
+        slot_value_t value;
+        unsigned i_rank;
+        uint64_t i_stamp = 0;
+        if (!read_slot(&p_share->p_slots[i], &value))
+            i_rank = atomic_load_explicit(&p_share->p_slots[i].i_seq, memory_order_relaxed) & 1
+                   ? 0 : 2; // Being written: last resort, via claim_slot's staleness test
+        else if (value.i_dev == i_dev && value.i_ino == i_ino && value.i_tag_hash == i_tag_hash)
+            i_rank = 3;
+        else if (value.i_stamp_ms + p_share->i_ttl_ms < i_now)
+            i_rank = 2;
+        else {
+            i_rank = 1;
+            i_stamp = value.i_stamp_ms;
+        }
+        if (i_rank > i_best_rank || (i_rank == 1 && i_best_rank == 1 && i_stamp < i_best_stamp)
+         || i_best == SIZE_MAX) {
+            i_best = i;
+            i_best_rank = i_rank;
+            i_best_stamp = i_stamp;
+        }
+        if (i_rank == 3)
+            break;
+    }
+
+    tag_share_slot_t *p_slot = &p_share->p_slots[i_best];
+    uint64_t i_seq;
+    if (!claim_slot(p_slot, i_now, &i_seq))
+        return;
+
+    atomic_store_explicit(&p_slot->i_dev, i_dev, memory_order_relaxed);
+    atomic_store_explicit(&p_slot->i_ino, i_ino, memory_order_relaxed);
+    atomic_store_explicit(&p_slot->i_tag_hash, i_tag_hash, memory_order_relaxed);
+    atomic_store_explicit(&p_slot->i_ctime_sec, i_ctime_sec, memory_order_relaxed);
+    atomic_store_explicit(&p_slot->i_ctime_nsec, i_ctime_nsec, memory_order_relaxed);
+    atomic_store_explicit(&p_slot->i_stamp_ms, i_now, memory_order_relaxed);
+    atomic_store_explicit(&p_slot->i_check,
+                          checksum(i_dev, i_ino, i_tag_hash, i_ctime_sec, i_ctime_nsec, i_now),
+                          memory_order_relaxed);
+
+    // Publish; if a peer took the slot over meanwhile, its own release wins
+    atomic_compare_exchange_strong_explicit(&p_slot->i_seq, &i_seq, i_seq + 1,
+                                            memory_order_release, memory_order_relaxed);
+}
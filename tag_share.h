@@ -0,0 +1,108 @@
+#ifndef TAG_SHARE_H
+#define TAG_SHARE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Table of recently written tags shared between processes.
+ *
+ * Several VLC instances tagging the same library map one POSIX shared
+ * memory segment. Each entry records that a tag was present on a file
+ * (st_dev, st_ino) at a given ctime; an instance that finds every tag of a
+ * batch there skips its own getxattr/setxattr.
+ *
+ * The table is a fixed array of slots probed linearly from the key's hash.
+ * Every slot is a seqlock: a writer claims it by making its sequence odd,
+ * fills it in and makes it even again; readers retry nothing and simply
+ * treat a slot that changed under them as a miss. A checksum over the
+ * fields lets readers discard slots left half-written by a peer that
+ * crashed or was preempted mid-write, and a claim older than
+ * TAG_SHARE_STALE_MS may be taken over, so a dead peer never blocks a slot.
+ * Zeroed memory is an empty table: a new segment needs no initialisation.
+ *
+ * Every function is safe to call from any thread of any process.
+ */
+typedef struct tag_share_t tag_share_t;
+
+/** "XTAGSHR" plus the layout version */
+#define TAG_SHARE_MAGIC ((UINT64_C(0x58544147534852) << 8) | 1)
+/** Entries examined from the home slot of a key */
+#define TAG_SHARE_PROBES 8
+/** Age after which an odd (claimed) slot is considered abandoned */
+#define TAG_SHARE_STALE_MS 1000
+
+/*
+ * Segment layout, shared by every process: the header, then the slots.
+ * Only lock-free 64-bit atomics are used, so they work across mappings.
+ */
+typedef struct {
+    atomic_uint_fast64_t i_magic;       /**< 0 in a new segment, then TAG_SHARE_MAGIC */
+    uint64_t reserved[7];
+} tag_share_header_t;
+
+typedef struct {
+    atomic_uint_fast64_t i_seq;         /**< Odd while a writer owns the slot, 0 if never used */
+    atomic_uint_fast64_t i_claimed_ms;  /**< When the current or last writer claimed it */
+    atomic_uint_fast64_t i_dev;
+    atomic_uint_fast64_t i_ino;
+    atomic_uint_fast64_t i_tag_hash;    /**< Hash of the key name and the tag */
+    atomic_int_fast64_t i_ctime_sec;    /**< ctime of the file once the tag was present */
+    atomic_int_fast64_t i_ctime_nsec;
+    atomic_uint_fast64_t i_stamp_ms;    /**< Monotonic time of publication */
+    atomic_uint_fast64_t i_check;       /**< Checksum of the fields above, from i_dev */
+} tag_share_slot_t;
+
+/**
+ * Map (creating it if needed) the segment \p psz_name, e.g. "/vlc-xattr-1000".
+ *
+ * The segment is sized for \p i_slots slots and never shrunk: peers must
+ * use the same slot count to find each other's entries. It outlives the
+ * processes, and is dropped at reboot.
+ *
+ * \param i_ttl_ms Entries older than this are ignored.
+ * \return The table, or NULL when shared memory is unavailable or the
+ *         segment holds another layout version.
+ */
+tag_share_t *tag_share_open(const char *psz_name, size_t i_slots, uint64_t i_ttl_ms);
+
+/**
+ * Unmap the table. The segment itself stays for other processes. NULL is ignored.
+ */
+void tag_share_close(tag_share_t *p_share);
+
+/**
+ * Hash of a tag written to key \p psz_key, as stored in the slots.
+ */
+uint64_t tag_share_hash(const char *psz_key, const char *psz_tag);
+
+/**
+ * Whether a live entry says \p psz_tag was on (dev, ino) at exactly this ctime.
+ */
+bool tag_share_contains(tag_share_t *p_share, uint64_t i_dev, uint64_t i_ino,
+                        int64_t i_ctime_sec, long i_ctime_nsec,
+                        const char *psz_key, const char *psz_tag);
+
+/**
+ * Record that \p psz_tag is on (dev, ino) as of this ctime. Replaces the
+ * entry of the same tag, else an empty or expired slot, else the oldest
+ * one in the probe window. Best effort: gives up when every candidate is
+ * being written by a live peer.
+ */
+void tag_share_publish(tag_share_t *p_share, uint64_t i_dev, uint64_t i_ino,
+                       int64_t i_ctime_sec, long i_ctime_nsec,
+                       const char *psz_key, const char *psz_tag);
+
+/**
+ * Number of slots mapped.
+ */
+size_t tag_share_slots(const tag_share_t *p_share);
+
+/**
+ * Remove the segment \p psz_name; processes that mapped it keep their mapping.
+ */
+void tag_share_unlink(const char *psz_name);
+
+#endif // TAG_SHARE_H
@@ -1,7 +1,9 @@
 #include "tag_utils.h"
 #include "compat.h"
+#include "hash_slots.h"
 
 #include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -34,28 +36,27 @@ bool decode_percent_sequence(const char *p_src, char *p_decoded)
     if (p_src == NULL || p_decoded == NULL)
         return false;
 
-    if (p_src[0] != '%' || !isxdigit((unsigned char)p_src[1]) || !isxdigit((unsigned char)p_src[2]))
+    if (p_src[0] != '%')
         return false;
 
+    // hex_value() rejects everything isxdigit() does, including the NUL terminator
     int hi = hex_value(p_src[1]);
+    if (hi < 0)
+        return false;
     int lo = hex_value(p_src[2]);
-    if (hi < 0 || lo < 0)
+    if (lo < 0)
         return false;
 
     *p_decoded = (char)((hi << 4) | lo);
     return true;
 }
 
-void url_decode_inplace(char *p_str)
+/* Decode [p_read, p_end) into p_write (which may alias p_read but never
+ * runs ahead of it) and return the new write position. */
+static char *decode_span_scalar(char *p_write, const char *p_read, const char *p_end)
 {
-    if (p_str == NULL)
-        return;
-
-    char *p_read = p_str;
-    char *p_write = p_str;
-
-    while (*p_read != '\0') {
-        if (*p_read == '%' && p_read[1] != '\0' && p_read[2] != '\0') {
+    while (p_read < p_end) {
+        if (*p_read == '%' && p_end - p_read >= 3) {
             char decoded;
             if (decode_percent_sequence(p_read, &decoded)) {
                 *p_write++ = decoded;
@@ -65,56 +66,412 @@ void url_decode_inplace(char *p_str)
         }
         *p_write++ = *p_read++;
     }
+    return p_write;
+}
 
-    *p_write = '\0';
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TAG_UTILS_X86_SIMD 1
+#include <immintrin.h>
+
+/*
+ * The vector decoders rely on valid triplets never overlapping: the two
+ * bytes after a decoded '%' are hex digits, so they cannot start another
+ * triplet. Every '%' followed by two hex digits can therefore be found
+ * independently with three shifted loads, and the block is then compacted
+ * by dropping the two digit bytes after each triplet start.
+ *
+ * Loads stay inside the string: the caller passes its length and the last
+ * bytes are left to decode_span_scalar().
+ */
+
+/* For each 8-bit keep mask, the pshufb indices that pack the kept bytes to
+ * the front (0x80 zeroes the unused tail). */
+static const uint64_t compact_lut[256] = {
+    0x8080808080808080ull, 0x8080808080808000ull, 0x8080808080808001ull, 0x8080808080800100ull,
+    0x8080808080808002ull, 0x8080808080800200ull, 0x8080808080800201ull, 0x8080808080020100ull,
+    0x8080808080808003ull, 0x8080808080800300ull, 0x8080808080800301ull, 0x8080808080030100ull,
+    0x8080808080800302ull, 0x8080808080030200ull, 0x8080808080030201ull, 0x8080808003020100ull,
+    0x8080808080808004ull, 0x8080808080800400ull, 0x8080808080800401ull, 0x8080808080040100ull,
+    0x8080808080800402ull, 0x8080808080040200ull, 0x8080808080040201ull, 0x8080808004020100ull,
+    0x8080808080800403ull, 0x8080808080040300ull, 0x8080808080040301ull, 0x8080808004030100ull,
+    0x8080808080040302ull, 0x8080808004030200ull, 0x8080808004030201ull, 0x8080800403020100ull,
+    0x8080808080808005ull, 0x8080808080800500ull, 0x8080808080800501ull, 0x8080808080050100ull,
+    0x8080808080800502ull, 0x8080808080050200ull, 0x8080808080050201ull, 0x8080808005020100ull,
+    0x8080808080800503ull, 0x8080808080050300ull, 0x8080808080050301ull, 0x8080808005030100ull,
+    0x8080808080050302ull, 0x8080808005030200ull, 0x8080808005030201ull, 0x8080800503020100ull,
+    0x8080808080800504ull, 0x8080808080050400ull, 0x8080808080050401ull, 0x8080808005040100ull,
+    0x8080808080050402ull, 0x8080808005040200ull, 0x8080808005040201ull, 0x8080800504020100ull,
+    0x8080808080050403ull, 0x8080808005040300ull, 0x8080808005040301ull, 0x8080800504030100ull,
+    0x8080808005040302ull, 0x8080800504030200ull, 0x8080800504030201ull, 0x8080050403020100ull,
+    0x8080808080808006ull, 0x8080808080800600ull, 0x8080808080800601ull, 0x8080808080060100ull,
+    0x8080808080800602ull, 0x8080808080060200ull, 0x8080808080060201ull, 0x8080808006020100ull,
+    0x8080808080800603ull, 0x8080808080060300ull, 0x8080808080060301ull, 0x8080808006030100ull,
+    0x8080808080060302ull, 0x8080808006030200ull, 0x8080808006030201ull, 0x8080800603020100ull,
+    0x8080808080800604ull, 0x8080808080060400ull, 0x8080808080060401ull, 0x8080808006040100ull,
+    0x8080808080060402ull, 0x8080808006040200ull, 0x8080808006040201ull, 0x8080800604020100ull,
+    0x8080808080060403ull, 0x8080808006040300ull, 0x8080808006040301ull, 0x8080800604030100ull,
+    0x8080808006040302ull, 0x8080800604030200ull, 0x8080800604030201ull, 0x8080060403020100ull,
+    0x8080808080800605ull, 0x8080808080060500ull, 0x8080808080060501ull, 0x8080808006050100ull,
+    0x8080808080060502ull, 0x8080808006050200ull, 0x8080808006050201ull, 0x8080800605020100ull,
+    0x8080808080060503ull, 0x8080808006050300ull, 0x8080808006050301ull, 0x8080800605030100ull,
+    0x8080808006050302ull, 0x8080800605030200ull, 0x8080800605030201ull, 0x8080060503020100ull,
+    0x8080808080060504ull, 0x8080808006050400ull, 0x8080808006050401ull, 0x8080800605040100ull,
+    0x8080808006050402ull, 0x8080800605040200ull, 0x8080800605040201ull, 0x8080060504020100ull,
+    0x8080808006050403ull, 0x8080800605040300ull, 0x8080800605040301ull, 0x8080060504030100ull,
+    0x8080800605040302ull, 0x8080060504030200ull, 0x8080060504030201ull, 0x8006050403020100ull,
+    0x8080808080808007ull, 0x8080808080800700ull, 0x8080808080800701ull, 0x8080808080070100ull,
+    0x8080808080800702ull, 0x8080808080070200ull, 0x8080808080070201ull, 0x8080808007020100ull,
+    0x8080808080800703ull, 0x8080808080070300ull, 0x8080808080070301ull, 0x8080808007030100ull,
+    0x8080808080070302ull, 0x8080808007030200ull, 0x8080808007030201ull, 0x8080800703020100ull,
+    0x8080808080800704ull, 0x8080808080070400ull, 0x8080808080070401ull, 0x8080808007040100ull,
+    0x8080808080070402ull, 0x8080808007040200ull, 0x8080808007040201ull, 0x8080800704020100ull,
+    0x8080808080070403ull, 0x8080808007040300ull, 0x8080808007040301ull, 0x8080800704030100ull,
+    0x8080808007040302ull, 0x8080800704030200ull, 0x8080800704030201ull, 0x8080070403020100ull,
+    0x8080808080800705ull, 0x8080808080070500ull, 0x8080808080070501ull, 0x8080808007050100ull,
+    0x8080808080070502ull, 0x8080808007050200ull, 0x8080808007050201ull, 0x8080800705020100ull,
+    0x8080808080070503ull, 0x8080808007050300ull, 0x8080808007050301ull, 0x8080800705030100ull,
+    0x8080808007050302ull, 0x8080800705030200ull, 0x8080800705030201ull, 0x8080070503020100ull,
+    0x8080808080070504ull, 0x8080808007050400ull, 0x8080808007050401ull, 0x8080800705040100ull,
+    0x8080808007050402ull, 0x8080800705040200ull, 0x8080800705040201ull, 0x8080070504020100ull,
+    0x8080808007050403ull, 0x8080800705040300ull, 0x8080800705040301ull, 0x8080070504030100ull,
+    0x8080800705040302ull, 0x8080070504030200ull, 0x8080070504030201ull, 0x8007050403020100ull,
+    0x8080808080800706ull, 0x8080808080070600ull, 0x8080808080070601ull, 0x8080808007060100ull,
+    0x8080808080070602ull, 0x8080808007060200ull, 0x8080808007060201ull, 0x8080800706020100ull,
+    0x8080808080070603ull, 0x8080808007060300ull, 0x8080808007060301ull, 0x8080800706030100ull,
+    0x8080808007060302ull, 0x8080800706030200ull, 0x8080800706030201ull, 0x8080070603020100ull,
+    0x8080808080070604ull, 0x8080808007060400ull, 0x8080808007060401ull, 0x8080800706040100ull,
+    0x8080808007060402ull, 0x8080800706040200ull, 0x8080800706040201ull, 0x8080070604020100ull,
+    0x8080808007060403ull, 0x8080800706040300ull, 0x8080800706040301ull, 0x8080070604030100ull,
+    0x8080800706040302ull, 0x8080070604030200ull, 0x8080070604030201ull, 0x8007060403020100ull,
+    0x8080808080070605ull, 0x8080808007060500ull, 0x8080808007060501ull, 0x8080800706050100ull,
+    0x8080808007060502ull, 0x8080800706050200ull, 0x8080800706050201ull, 0x8080070605020100ull,
+    0x8080808007060503ull, 0x8080800706050300ull, 0x8080800706050301ull, 0x8080070605030100ull,
+    0x8080800706050302ull, 0x8080070605030200ull, 0x8080070605030201ull, 0x8007060503020100ull,
+    0x8080808007060504ull, 0x8080800706050400ull, 0x8080800706050401ull, 0x8080070605040100ull,
+    0x8080800706050402ull, 0x8080070605040200ull, 0x8080070605040201ull, 0x8007060504020100ull,
+    0x8080800706050403ull, 0x8080070605040300ull, 0x8080070605040301ull, 0x8007060504030100ull,
+    0x8080070605040302ull, 0x8007060504030200ull, 0x8007060504030201ull, 0x0706050403020100ull,
+};
+
+__attribute__((target("sse2")))
+static inline __m128i hex_classify_sse2(__m128i v, __m128i *p_value)
+{
+    // Bytes >= 0x80 are negative for the signed compares and never match
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+    __m128i digit_value = _mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0')));
+    __m128i alpha_value = _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)));
+    *p_value = _mm_or_si128(digit_value, alpha_value);
+    return _mm_or_si128(digit, alpha);
 }
 
-char *xdg_tags_append_if_missing(const char *existing_tags, const char *new_tag,
-                                 bool *out_added)
+__attribute__((target("sse2")))
+static char *decode_span_sse2(char *p_write, const char *p_read, const char *p_end)
 {
-    if (out_added)
-        *out_added = false;
+    const __m128i percent = _mm_set1_epi8('%');
+
+    while (p_end - p_read >= 16 + 2) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p_read);
+        unsigned i_percent = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, percent));
+        if (i_percent == 0) {
+            _mm_storeu_si128((__m128i *)p_write, v0);
+            p_read += 16;
+            p_write += 16;
+            continue;
+        }
 
-    if (new_tag == NULL || *new_tag == '\0')
-        return NULL;
+        __m128i hi, lo;
+        __m128i valid = _mm_and_si128(
+            _mm_cmpeq_epi8(v0, percent),
+            _mm_and_si128(hex_classify_sse2(_mm_loadu_si128((const __m128i *)(p_read + 1)), &hi),
+                          hex_classify_sse2(_mm_loadu_si128((const __m128i *)(p_read + 2)), &lo)));
+        unsigned i_start = (unsigned)_mm_movemask_epi8(valid);
+
+        // 16-bit shift: hi < 16 so nothing crosses into the neighbouring byte
+        __m128i decoded = _mm_or_si128(_mm_slli_epi16(hi, 4), lo);
+        __m128i out = _mm_or_si128(_mm_and_si128(valid, decoded), _mm_andnot_si128(valid, v0));
+        unsigned i_keep = ~((i_start << 1) | (i_start << 2)) & 0xFFFFu;
+
+        unsigned char bytes[16];
+        _mm_storeu_si128((__m128i *)bytes, out);
+        while (i_keep != 0) {
+            *p_write++ = (char)bytes[__builtin_ctz(i_keep)];
+            i_keep &= i_keep - 1;
+        }
+        // A triplet starting in the last two lanes also consumes the next block's first bytes
+        p_read += 16 + ((i_start >> 15) ? 2 : (i_start >> 14) & 1);
+    }
+    return decode_span_scalar(p_write, p_read, p_end);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_classify_avx2(__m256i v, __m256i *p_value)
+{
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+    __m256i digit_value = _mm256_and_si256(digit, _mm256_sub_epi8(v, _mm256_set1_epi8('0')));
+    __m256i alpha_value = _mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10)));
+    *p_value = _mm256_or_si256(digit_value, alpha_value);
+    return _mm256_or_si256(digit, alpha);
+}
 
-    if (existing_tags == NULL || *existing_tags == '\0') {
-        char *result = strdup(new_tag);
-        if (result && out_added)
-            *out_added = true;
-        return result;
+__attribute__((target("avx2")))
+static inline char *compact8_avx2(char *p_write, __m128i chunk, unsigned i_keep)
+{
+    __m128i shuffle = _mm_loadl_epi64((const __m128i *)&compact_lut[i_keep]);
+    _mm_storel_epi64((__m128i *)p_write, _mm_shuffle_epi8(chunk, shuffle));
+    return p_write + __builtin_popcount(i_keep);
+}
+
+__attribute__((target("avx2")))
+static char *decode_span_avx2(char *p_write, const char *p_read, const char *p_end)
+{
+    const __m256i percent = _mm256_set1_epi8('%');
+
+    while (p_end - p_read >= 32 + 2) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p_read);
+        __m256i is_percent = _mm256_cmpeq_epi8(v0, percent);
+        if (_mm256_testz_si256(is_percent, is_percent)) {
+            _mm256_storeu_si256((__m256i *)p_write, v0);
+            p_read += 32;
+            p_write += 32;
+            continue;
+        }
+
+        __m256i hi, lo;
+        __m256i valid = _mm256_and_si256(
+            is_percent,
+            _mm256_and_si256(hex_classify_avx2(_mm256_loadu_si256((const __m256i *)(p_read + 1)), &hi),
+                             hex_classify_avx2(_mm256_loadu_si256((const __m256i *)(p_read + 2)), &lo)));
+        uint32_t i_start = (uint32_t)_mm256_movemask_epi8(valid);
+
+        __m256i decoded = _mm256_or_si256(_mm256_slli_epi16(hi, 4), lo);
+        __m256i out = _mm256_blendv_epi8(v0, decoded, valid);
+        uint32_t i_keep = ~((i_start << 1) | (i_start << 2));
+
+        // Every 8-byte store ends at or before the end of the block, which
+        // is already in registers
+        __m128i low = _mm256_castsi256_si128(out);
+        __m128i high = _mm256_extracti128_si256(out, 1);
+        p_write = compact8_avx2(p_write, low, i_keep & 0xFF);
+        p_write = compact8_avx2(p_write, _mm_srli_si128(low, 8), (i_keep >> 8) & 0xFF);
+        p_write = compact8_avx2(p_write, high, (i_keep >> 16) & 0xFF);
+        p_write = compact8_avx2(p_write, _mm_srli_si128(high, 8), i_keep >> 24);
+        p_read += 32 + ((i_start >> 31) ? 2 : (i_start >> 30) & 1);
     }
+    // Finish with 16-byte blocks, then scalar
+    return decode_span_sse2(p_write, p_read, p_end);
+}
+#endif
 
-    const size_t existing_len = strlen(existing_tags);
-    const size_t new_len = strlen(new_tag);
+typedef char *(*decode_span_fn)(char *, const char *, const char *);
 
-    const char *cursor = existing_tags;
-    while (*cursor != '\0') {
-        const char *next_delim = strchr(cursor, ',');
-        size_t token_len = next_delim ? (size_t)(next_delim - cursor) : strlen(cursor);
-        if (token_len == new_len && strncmp(cursor, new_tag, new_len) == 0) {
-            char *result = strndup(existing_tags, existing_len);
-            return result;
+static decode_span_fn decode_span_for(url_decode_impl_t impl)
+{
+    switch (impl) {
+        case URL_DECODE_SCALAR:
+            return decode_span_scalar;
+#ifdef TAG_UTILS_X86_SIMD
+        case URL_DECODE_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2") ? decode_span_sse2 : NULL;
+        case URL_DECODE_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? decode_span_avx2 : NULL;
+#endif
+        case URL_DECODE_AUTO: {
+#ifdef TAG_UTILS_X86_SIMD
+            // Resolved once; racing threads pick the same function
+            static decode_span_fn pf_cached;
+            decode_span_fn pf = __atomic_load_n(&pf_cached, __ATOMIC_ACQUIRE);
+            if (pf == NULL) {
+                pf = decode_span_for(URL_DECODE_AVX2);
+                if (pf == NULL)
+                    pf = decode_span_for(URL_DECODE_SSE2);
+                if (pf == NULL)
+                    pf = decode_span_scalar;
+                __atomic_store_n(&pf_cached, pf, __ATOMIC_RELEASE);
+            }
+            return pf;
+#else
+            return decode_span_scalar;
+#endif
         }
+        default:
+            return NULL;
+    }
+}
+
+bool url_decode_inplace_with(char *p_str, url_decode_impl_t impl)
+{
+    decode_span_fn pf_decode = decode_span_for(impl);
+    if (pf_decode == NULL)
+        return false;
+    if (p_str == NULL)
+        return true;
+
+    char *p_end = p_str + strlen(p_str);
+    *pf_decode(p_str, p_str, p_end) = '\0';
+    return true;
+}
+
+void url_decode_inplace(char *p_str)
+{
+    url_decode_inplace_with(p_str, URL_DECODE_AUTO);
+}
+
+static bool tag_list_contains(const char *list, size_t list_len,
+                              const char *tag, size_t tag_len)
+{
+    const char *cursor = list;
+    const char *end = list + list_len;
+    while (cursor < end) {
+        const char *next_delim = memchr(cursor, ',', (size_t)(end - cursor));
+        size_t token_len = next_delim ? (size_t)(next_delim - cursor) : (size_t)(end - cursor);
+        if (token_len == tag_len && strncmp(cursor, tag, tag_len) == 0)
+            return true;
         if (!next_delim)
             break;
         cursor = next_delim + 1;
     }
+    return false;
+}
+
+bool xdg_tags_contains(const char *tags, size_t tags_len, const char *tag)
+{
+    if (tags == NULL || tag == NULL || *tag == '\0')
+        return false;
+
+    const char *nul = memchr(tags, '\0', tags_len);
+    if (nul != NULL)
+        tags_len = (size_t)(nul - tags);
+    return tag_list_contains(tags, tags_len, tag, strlen(tag));
+}
+
+char *xdg_tags_append_if_missing(const char *existing_tags, const char *new_tag,
+                                 bool *out_added)
+{
+    size_t added = 0;
+    char *result = xdg_tags_append_many(existing_tags, &new_tag, 1, &added);
+    if (out_added)
+        *out_added = added > 0;
+    return result;
+}
+
+/* Bytes needed to append every usable tag with a separator, or 0 when
+ * \p tags holds none. */
+static size_t tags_append_size(const char *const *tags, size_t tag_count)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < tag_count; i++)
+        if (tags[i] != NULL && *tags[i] != '\0')
+            size += strlen(tags[i]) + 1 /* comma */;
+    return size;
+}
+
+/* Append missing tags to list[0..len), which has room for
+ * tags_append_size() more bytes plus the NUL. Returns the new length. */
+static size_t tags_append(char *list, size_t len, const char *const *tags, size_t tag_count,
+                          size_t *out_added)
+{
+    size_t added = 0;
+
+    // Checking against the result so far also dedupes tags within the batch
+    for (size_t i = 0; i < tag_count; i++) {
+        if (tags[i] == NULL || *tags[i] == '\0')
+            continue;
+        size_t tag_len = strlen(tags[i]);
+        if (tag_list_contains(list, len, tags[i], tag_len))
+            continue;
+        if (len > 0)
+            list[len++] = ',';
+        memcpy(list + len, tags[i], tag_len);
+        len += tag_len;
+        added++;
+    }
+    list[len] = '\0';
+
+    if (out_added)
+        *out_added = added;
+    return len;
+}
+
+char *xdg_tags_append_many(const char *existing_tags, const char *const *tags,
+                           size_t tag_count, size_t *out_added)
+{
+    if (out_added)
+        *out_added = 0;
+
+    if (tags == NULL)
+        return NULL;
+
+    size_t append_size = tags_append_size(tags, tag_count);
+    if (append_size == 0)
+        return NULL;
 
-    size_t combined_len = existing_len + 1 /* comma */ + new_len + 1 /* NUL */;
-    char *result = malloc(combined_len);
+    const size_t existing_len = existing_tags ? strlen(existing_tags) : 0;
+    char *result = malloc(existing_len + append_size + 1 /* NUL */);
     if (result == NULL)
         return NULL;
 
-    memcpy(result, existing_tags, existing_len);
-    result[existing_len] = ',';
-    memcpy(result + existing_len + 1, new_tag, new_len);
-    result[combined_len - 1] = '\0';
+    if (existing_len > 0)
+        memcpy(result, existing_tags, existing_len);
+    tags_append(result, existing_len, tags, tag_count, out_added);
+    return result;
+}
 
+bool tag_buffer_reserve(tag_buffer_t *p_buf, size_t size)
+{
+    if (size <= p_buf->i_capacity)
+        return true;
+
+    // Grow geometrically so a slowly growing list settles quickly
+    size_t capacity = p_buf->i_capacity ? p_buf->i_capacity : 256;
+    while (capacity < size)
+        capacity *= 2;
+    char *p_data = realloc(p_buf->p_data, capacity);
+    if (p_data == NULL)
+        return false;
+    p_buf->p_data = p_data;
+    p_buf->i_capacity = capacity;
+    return true;
+}
+
+void tag_buffer_free(tag_buffer_t *p_buf)
+{
+    free(p_buf->p_data);
+    p_buf->p_data = NULL;
+    p_buf->i_capacity = 0;
+}
+
+bool xdg_tags_append_many_buf(tag_buffer_t *p_buf, size_t *p_len,
+                              const char *const *tags, size_t tag_count, size_t *out_added)
+{
     if (out_added)
-        *out_added = true;
+        *out_added = 0;
+    if (p_buf == NULL || p_len == NULL || tags == NULL)
+        return false;
 
-    return result;
+    // Stored values may carry their terminator: the list ends at the first NUL
+    size_t len = *p_len;
+    if (len > 0) {
+        const char *nul = memchr(p_buf->p_data, '\0', len);
+        if (nul != NULL)
+            len = (size_t)(nul - p_buf->p_data);
+    }
+
+    size_t append_size = tags_append_size(tags, tag_count);
+    if (!tag_buffer_reserve(p_buf, len + append_size + 1 /* NUL */))
+        return false;
+
+    *p_len = tags_append(p_buf->p_data, len, tags, tag_count, out_added);
+    return true;
 }
 
 xattr_target_t *parse_xattr_targets(const char *config_str, int *count)
@@ -180,6 +537,18 @@ xattr_target_t *parse_xattr_targets(const char *config_str, int *count)
     }
 
     free(str_copy);
+
+    // Stable insertion sort by percent so callers can walk thresholds in order
+    for (int i = 1; i < *count; i++) {
+        xattr_target_t current = targets[i];
+        int j = i - 1;
+        while (j >= 0 && targets[j].percent > current.percent) {
+            targets[j + 1] = targets[j];
+            j--;
+        }
+        targets[j + 1] = current;
+    }
+
     return targets;
 }
 
@@ -192,6 +561,45 @@ void free_xattr_targets(xattr_target_t *targets, int count)
     free(targets);
 }
 
+size_t format_seconds_ms(char *psz_buf, size_t i_size, int64_t i_ms)
+{
+    if (i_ms < 0)
+        return 0;
+    int len = snprintf(psz_buf, i_size, "%lld.%03d", (long long)(i_ms / 1000), (int)(i_ms % 1000));
+    return len > 0 && (size_t)len < i_size ? (size_t)len : 0;
+}
+
+bool parse_seconds_ms(const char *p_value, size_t i_len, int64_t *p_ms)
+{
+    while (i_len > 0 && (p_value[i_len - 1] == '\0' || isspace((unsigned char)p_value[i_len - 1])))
+        i_len--;
+
+    size_t i = 0;
+    int64_t i_seconds = 0;
+    // 15 digits keep the millisecond count far from overflowing
+    while (i < i_len && isdigit((unsigned char)p_value[i]) && i < 15)
+        i_seconds = i_seconds * 10 + (p_value[i++] - '0');
+    if (i == 0 || (i < i_len && isdigit((unsigned char)p_value[i])))
+        return false;
+
+    int64_t i_fraction = 0;
+    if (i < i_len && p_value[i] == '.') {
+        size_t i_start = ++i;
+        for (; i < i_len && isdigit((unsigned char)p_value[i]); i++)
+            if (i - i_start < 3)
+                i_fraction = i_fraction * 10 + (p_value[i] - '0');
+        if (i == i_start)
+            return false;
+        for (size_t i_digits = i - i_start; i_digits < 3; i_digits++)
+            i_fraction *= 10;
+    }
+    if (i != i_len)
+        return false;
+
+    *p_ms = i_seconds * 1000 + i_fraction;
+    return true;
+}
+
 bool should_skip_path(const char *psz_path, const char *psz_skip_list)
 {
     if (psz_skip_list == NULL || *psz_skip_list == '\0')
@@ -224,3 +632,328 @@ bool should_skip_path(const char *psz_path, const char *psz_skip_list)
     free(psz_copy);
     return b_match;
 }
+
+static int compare_prefixes(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+skip_matcher_t *skip_matcher_compile(const char *psz_skip_list)
+{
+    skip_matcher_t *p_matcher = calloc(1, sizeof(*p_matcher));
+    if (p_matcher == NULL)
+        return NULL;
+
+    if (psz_skip_list == NULL || *psz_skip_list == '\0')
+        return p_matcher;
+
+    p_matcher->p_pool = strdup(psz_skip_list);
+    if (p_matcher->p_pool == NULL) {
+        free(p_matcher);
+        return NULL;
+    }
+
+    // Every prefix needs at least one character plus a delimiter
+    size_t capacity = strlen(psz_skip_list) / 2 + 1;
+    const char **ppsz_tokens = malloc(capacity * sizeof(*ppsz_tokens));
+    if (ppsz_tokens == NULL) {
+        skip_matcher_free(p_matcher);
+        return NULL;
+    }
+
+    size_t count = 0;
+    char *saveptr = NULL;
+    for (char *psz_token = strtok_r(p_matcher->p_pool, ",;\n", &saveptr);
+         psz_token != NULL;
+         psz_token = strtok_r(NULL, ",;\n", &saveptr))
+    {
+        psz_token = trim_token(psz_token);
+        if (*psz_token != '\0')
+            ppsz_tokens[count++] = psz_token;
+    }
+
+    qsort(ppsz_tokens, count, sizeof(*ppsz_tokens), compare_prefixes);
+
+    // Drop entries already covered by a shorter prefix; after sorting the
+    // covering prefix is always the last kept entry.
+    size_t kept = 0;
+    size_t last_len = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (kept > 0 && strncmp(ppsz_tokens[i], ppsz_tokens[kept - 1], last_len) == 0)
+            continue;
+        ppsz_tokens[kept++] = ppsz_tokens[i];
+        last_len = strlen(ppsz_tokens[i]);
+    }
+
+    p_matcher->ppsz_prefixes = ppsz_tokens;
+    p_matcher->i_count = kept;
+    if (kept > 0) {
+        p_matcher->p_lengths = malloc(kept * sizeof(*p_matcher->p_lengths));
+        if (p_matcher->p_lengths == NULL) {
+            skip_matcher_free(p_matcher);
+            return NULL;
+        }
+        for (size_t i = 0; i < kept; i++)
+            p_matcher->p_lengths[i] = strlen(ppsz_tokens[i]);
+    }
+
+    return p_matcher;
+}
+
+bool skip_matcher_match(const skip_matcher_t *p_matcher, const char *psz_path)
+{
+    if (p_matcher == NULL || psz_path == NULL || p_matcher->i_count == 0)
+        return false;
+
+    // Find the greatest prefix that sorts at or before the path. Anything
+    // between a matching prefix and the path would share that prefix, and
+    // compile() removed such entries, so this is the only candidate.
+    size_t lo = 0;
+    size_t hi = p_matcher->i_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(p_matcher->ppsz_prefixes[mid], psz_path) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return false;
+
+    size_t i = lo - 1;
+    return strncmp(psz_path, p_matcher->ppsz_prefixes[i], p_matcher->p_lengths[i]) == 0;
+}
+
+void skip_matcher_free(skip_matcher_t *p_matcher)
+{
+    if (p_matcher == NULL)
+        return;
+    free(p_matcher->ppsz_prefixes);
+    free(p_matcher->p_lengths);
+    free(p_matcher->p_pool);
+    free(p_matcher);
+}
+
+void tag_set_init(tag_set_t *p_set)
+{
+    memset(p_set, 0, sizeof(*p_set));
+}
+
+void tag_set_clear(tag_set_t *p_set)
+{
+    p_set->i_pool_len = 0;
+    p_set->i_entries = 0;
+    p_set->i_count = 0;
+    if (p_set->p_slots != NULL)
+        memset(p_set->p_slots, 0, (p_set->i_slot_mask + 1) * sizeof(*p_set->p_slots));
+}
+
+void tag_set_free(tag_set_t *p_set)
+{
+    free(p_set->p_pool);
+    free(p_set->p_entries);
+    free(p_set->p_slots);
+    tag_set_init(p_set);
+}
+
+static unsigned tag_hash(const char *tag, size_t tag_len)
+{
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < tag_len; i++) {
+        h ^= (unsigned char)tag[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Slot holding \p tag, or the empty slot where it would go. */
+static size_t *tag_set_find(const tag_set_t *p_set, const char *tag, size_t tag_len, unsigned hash)
+{
+    for (size_t i = hash & p_set->i_slot_mask;; i = (i + 1) & p_set->i_slot_mask) {
+        size_t *p_slot = &p_set->p_slots[i];
+        if (*p_slot == 0)
+            return p_slot;
+        const tag_set_entry_t *p_entry = &p_set->p_entries[*p_slot - 1];
+        if (p_entry->i_hash == hash && p_entry->i_len == tag_len
+         && memcmp(p_set->p_pool + p_entry->i_offset, tag, tag_len) == 0)
+            return p_slot;
+    }
+}
+
+static uint64_t tag_set_entry_hash(const void *p_opaque, size_t i_entry)
+{
+    return ((const tag_set_t *)p_opaque)->p_entries[i_entry].i_hash;
+}
+
+static bool tag_set_entry_live(const void *p_opaque, size_t i_entry)
+{
+    return !((const tag_set_t *)p_opaque)->p_entries[i_entry].b_removed;
+}
+
+static bool tag_set_grow_slots(tag_set_t *p_set)
+{
+    size_t slots = p_set->p_slots ? (p_set->i_slot_mask + 1) * 2 : 64;
+    size_t *p_slots = hash_slots_build(slots, p_set->i_entries, tag_set_entry_hash,
+                                       tag_set_entry_live, p_set);
+    if (p_slots == NULL)
+        return false;
+    free(p_set->p_slots);
+    p_set->p_slots = p_slots;
+    p_set->i_slot_mask = slots - 1;
+    return true;
+}
+
+bool tag_set_insert(tag_set_t *p_set, const char *tag, size_t tag_len, bool *out_added)
+{
+    if (out_added)
+        *out_added = false;
+    if (p_set == NULL || tag == NULL || tag_len == 0)
+        return false;
+
+    if (hash_slots_full(p_set->i_count, p_set->i_slot_mask) && !tag_set_grow_slots(p_set))
+        return false;
+
+    unsigned hash = tag_hash(tag, tag_len);
+    size_t *p_slot = tag_set_find(p_set, tag, tag_len, hash);
+    if (*p_slot != 0)
+        return true;
+
+    if (p_set->i_pool_len + tag_len > p_set->i_pool_capacity) {
+        size_t capacity = p_set->i_pool_capacity ? p_set->i_pool_capacity : 1024;
+        while (capacity < p_set->i_pool_len + tag_len)
+            capacity *= 2;
+        char *p_pool = realloc(p_set->p_pool, capacity);
+        if (p_pool == NULL)
+            return false;
+        p_set->p_pool = p_pool;
+        p_set->i_pool_capacity = capacity;
+    }
+    if (p_set->i_entries == p_set->i_entries_capacity) {
+        size_t capacity = p_set->i_entries_capacity ? p_set->i_entries_capacity * 2 : 64;
+        tag_set_entry_t *p_entries = realloc(p_set->p_entries, capacity * sizeof(*p_entries));
+        if (p_entries == NULL)
+            return false;
+        p_set->p_entries = p_entries;
+        p_set->i_entries_capacity = capacity;
+    }
+
+    tag_set_entry_t *p_entry = &p_set->p_entries[p_set->i_entries];
+    p_entry->i_offset = p_set->i_pool_len;
+    p_entry->i_len = tag_len;
+    p_entry->i_hash = hash;
+    p_entry->b_removed = false;
+    memcpy(p_set->p_pool + p_set->i_pool_len, tag, tag_len);
+    p_set->i_pool_len += tag_len;
+    *p_slot = ++p_set->i_entries;
+    p_set->i_count++;
+    if (out_added)
+        *out_added = true;
+    return true;
+}
+
+bool tag_set_remove(tag_set_t *p_set, const char *tag, size_t tag_len)
+{
+    if (p_set == NULL || tag == NULL || tag_len == 0 || p_set->i_count == 0)
+        return false;
+
+    size_t *p_slot = tag_set_find(p_set, tag, tag_len, tag_hash(tag, tag_len));
+    if (*p_slot == 0)
+        return false;
+    p_set->p_entries[*p_slot - 1].b_removed = true;
+    p_set->i_count--;
+    hash_slots_remove(p_set->p_slots, p_set->i_slot_mask, p_slot, tag_set_entry_hash, p_set);
+    return true;
+}
+
+bool tag_set_contains(const tag_set_t *p_set, const char *tag, size_t tag_len)
+{
+    if (p_set == NULL || tag == NULL || tag_len == 0 || p_set->i_count == 0)
+        return false;
+    return *tag_set_find(p_set, tag, tag_len, tag_hash(tag, tag_len)) != 0;
+}
+
+bool tag_set_add_list(tag_set_t *p_set, const char *tags, size_t tags_len)
+{
+    if (p_set == NULL)
+        return false;
+    if (tags == NULL)
+        return true;
+
+    const char *nul = memchr(tags, '\0', tags_len);
+    const char *end = nul ? nul : tags + tags_len;
+    for (const char *cursor = tags; cursor < end;) {
+        const char *comma = memchr(cursor, ',', (size_t)(end - cursor));
+        const char *token_end = comma ? comma : end;
+        if (token_end > cursor
+         && !tag_set_insert(p_set, cursor, (size_t)(token_end - cursor), NULL))
+            return false;
+        cursor = token_end + 1;
+    }
+    return true;
+}
+
+bool tag_set_serialize(const tag_set_t *p_set, tag_buffer_t *p_buf, size_t *p_len)
+{
+    if (p_set == NULL || p_buf == NULL || p_len == NULL)
+        return false;
+    if (!tag_buffer_reserve(p_buf, p_set->i_pool_len + p_set->i_count + 1))
+        return false;
+
+    size_t len = 0;
+    for (size_t i = 0; i < p_set->i_entries; i++) {
+        const tag_set_entry_t *p_entry = &p_set->p_entries[i];
+        if (p_entry->b_removed)
+            continue;
+        if (len > 0)
+            p_buf->p_data[len++] = ',';
+        memcpy(p_buf->p_data + len, p_set->p_pool + p_entry->i_offset, p_entry->i_len);
+        len += p_entry->i_len;
+    }
+    p_buf->p_data[len] = '\0';
+    *p_len = len;
+    return true;
+}
+
+bool xdg_tags_append_many_set(tag_set_t *p_set, tag_buffer_t *p_buf, size_t *p_len,
+                              const char *const *tags, size_t tag_count, size_t *out_added)
+{
+    if (out_added)
+        *out_added = 0;
+    if (p_set == NULL || p_buf == NULL || p_len == NULL || tags == NULL)
+        return false;
+
+    size_t len = *p_len;
+    if (len > 0) {
+        const char *nul = memchr(p_buf->p_data, '\0', len);
+        if (nul != NULL)
+            len = (size_t)(nul - p_buf->p_data);
+    }
+
+    tag_set_clear(p_set);
+    if (!tag_set_add_list(p_set, p_buf->p_data, len)
+     || !tag_buffer_reserve(p_buf, len + tags_append_size(tags, tag_count) + 1 /* NUL */))
+        return false;
+
+    size_t added = 0;
+    for (size_t i = 0; i < tag_count; i++) {
+        if (tags[i] == NULL || *tags[i] == '\0')
+            continue;
+        size_t tag_len = strlen(tags[i]);
+        bool b_new;
+        if (!tag_set_insert(p_set, tags[i], tag_len, &b_new))
+            return false;
+        if (!b_new)
+            continue;
+        if (len > 0)
+            p_buf->p_data[len++] = ',';
+        memcpy(p_buf->p_data + len, tags[i], tag_len);
+        len += tag_len;
+        added++;
+    }
+    p_buf->p_data[len] = '\0';
+
+    *p_len = len;
+    if (out_added)
+        *out_added = added;
+    return true;
+}
@@ -2,12 +2,68 @@
 #define TAG_UTILS_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct {
     char *name;
     int percent;
 } xattr_target_t;
 
+/**
+ * Skip list compiled for fast lookups: a sorted array of path prefixes in
+ * which no entry is a prefix of another, so at most one entry can match.
+ */
+typedef struct {
+    char *p_pool;              /**< Storage for all prefixes */
+    const char **ppsz_prefixes; /**< Sorted prefixes pointing into p_pool */
+    size_t *p_lengths;          /**< Length of each prefix */
+    size_t i_count;             /**< Number of prefixes */
+} skip_matcher_t;
+
+/**
+ * Growable byte buffer reused across calls, so steady-state callers make no
+ * heap allocations. Zero-initialise before first use.
+ */
+typedef struct {
+    char *p_data;
+    size_t i_capacity;
+} tag_buffer_t;
+
+/**
+ * One tag of a tag_set_t.
+ */
+typedef struct {
+    size_t i_offset;           /**< Start of the tag in the set's pool */
+    size_t i_len;
+    unsigned i_hash;
+    bool b_removed;
+} tag_set_entry_t;
+
+/**
+ * Set of tags with hashed membership that remembers insertion order.
+ * Meant to be reused: tag_set_clear() keeps the memory, so a set that has
+ * grown once serves later lists without allocating. Zero-initialise (or
+ * tag_set_init()) before first use.
+ */
+typedef struct {
+    char *p_pool;              /**< Bytes of every tag inserted since the last clear */
+    size_t i_pool_len;
+    size_t i_pool_capacity;
+    tag_set_entry_t *p_entries; /**< Insertion order, removed entries included */
+    size_t i_entries;
+    size_t i_entries_capacity;
+    size_t *p_slots;           /**< Open addressing, entry index + 1, 0 is empty */
+    size_t i_slot_mask;
+    size_t i_count;            /**< Tags currently in the set */
+} tag_set_t;
+
+/**
+ * Lists at least this long are better served by a tag_set_t than by the
+ * linear scans of xdg_tags_append_many().
+ */
+#define TAG_SET_MIN_LIST_LEN 512
+
 /**
  * Decode a percent-encoded triplet (e.g. "%20") into its byte value.
  *
@@ -17,13 +73,33 @@ typedef struct {
  */
 bool decode_percent_sequence(const char *p_src, char *p_decoded);
 
+/**
+ * Percent-decoder implementations, for testing and benchmarking.
+ */
+typedef enum {
+    URL_DECODE_AUTO,     /**< Fastest one the CPU supports */
+    URL_DECODE_SCALAR,   /**< Byte by byte, available everywhere */
+    URL_DECODE_SSE2,     /**< 16-byte blocks (x86 with GCC or Clang) */
+    URL_DECODE_AVX2,     /**< 32-byte blocks (x86 with GCC or Clang) */
+} url_decode_impl_t;
+
 /**
  * Decode percent-encoded sequences inside the given string in place.
  * The function stops at the first null terminator and always leaves the
- * string null-terminated.
+ * string null-terminated. Bytes past the new terminator are unspecified.
+ * Uses the fastest implementation the CPU supports.
  */
 void url_decode_inplace(char *p_str);
 
+/**
+ * url_decode_inplace() with a chosen implementation. All implementations
+ * produce identical bytes.
+ *
+ * \return false (leaving \p p_str untouched) when \p impl is not available
+ *         on this build or CPU.
+ */
+bool url_decode_inplace_with(char *p_str, url_decode_impl_t impl);
+
 /**
  * Ensure that \p new_tag exists inside the comma-separated list in
  * \p existing_tags. The returned buffer must be freed by the caller.
@@ -37,11 +113,131 @@ void url_decode_inplace(char *p_str);
 char *xdg_tags_append_if_missing(const char *existing_tags, const char *new_tag,
                                  bool *out_added);
 
+/**
+ * Check whether \p tag is a full token of the comma-separated list in
+ * \p tags (which need not be null-terminated).
+ *
+ * \param tags Comma-separated tag list (may be NULL).
+ * \param tags_len Length of \p tags in bytes; a NUL byte also ends the list.
+ * \param tag Tag to look for.
+ * \return true when the tag is present, false otherwise or for empty tags.
+ */
+bool xdg_tags_contains(const char *tags, size_t tags_len, const char *tag);
+
+/**
+ * Ensure every tag in \p tags exists inside the comma-separated list in
+ * \p existing_tags, building the result in a single allocation. Missing tags
+ * are appended in the order given; duplicates within \p tags and empty or
+ * NULL entries are ignored. The returned buffer must be freed by the caller.
+ *
+ * \param existing_tags Existing comma-separated tag list (may be NULL or empty).
+ * \param tags Tags to append when missing.
+ * \param tag_count Number of entries in \p tags.
+ * \param out_added Optional output set to the number of tags appended.
+ * \return Newly allocated string containing the resulting tag list, or NULL
+ *         when \p tags holds no usable tag or on allocation failure.
+ */
+char *xdg_tags_append_many(const char *existing_tags, const char *const *tags,
+                           size_t tag_count, size_t *out_added);
+
+/**
+ * Make sure \p p_buf holds at least \p size bytes, keeping its contents.
+ *
+ * \return false on allocation failure (the buffer is left unchanged).
+ */
+bool tag_buffer_reserve(tag_buffer_t *p_buf, size_t size);
+
+/**
+ * Release the memory held by \p p_buf and reset it to empty.
+ */
+void tag_buffer_free(tag_buffer_t *p_buf);
+
+/**
+ * In-place variant of xdg_tags_append_many(): the list is the first
+ * \p *p_len bytes of \p p_buf (up to the first NUL, so raw xattr values can
+ * be passed as read) and missing tags are appended to it. The buffer only
+ * grows when the result does not fit.
+ *
+ * \param p_buf Buffer holding the existing list.
+ * \param p_len In: bytes of the existing list. Out: length of the result,
+ *              which is NUL-terminated.
+ * \param tags Tags to append when missing.
+ * \param tag_count Number of entries in \p tags.
+ * \param out_added Optional output set to the number of tags appended.
+ * \return false on invalid arguments or allocation failure.
+ */
+bool xdg_tags_append_many_buf(tag_buffer_t *p_buf, size_t *p_len,
+                              const char *const *tags, size_t tag_count, size_t *out_added);
+
+/**
+ * Initialise an empty set.
+ */
+void tag_set_init(tag_set_t *p_set);
+
+/**
+ * Remove every tag, keeping the memory for reuse.
+ */
+void tag_set_clear(tag_set_t *p_set);
+
+/**
+ * Release the memory held by \p p_set and reset it to empty.
+ */
+void tag_set_free(tag_set_t *p_set);
+
+/**
+ * Insert the tags of the comma-separated list in \p tags (\p tags_len
+ * bytes, or up to the first NUL). Empty and duplicate tags are skipped.
+ *
+ * \return false on allocation failure.
+ */
+bool tag_set_add_list(tag_set_t *p_set, const char *tags, size_t tags_len);
+
+/**
+ * Insert \p tag (\p tag_len bytes) unless already present.
+ *
+ * \param out_added Optional output set to true when the tag was new.
+ * \return false on allocation failure or for an empty tag.
+ */
+bool tag_set_insert(tag_set_t *p_set, const char *tag, size_t tag_len, bool *out_added);
+
+/**
+ * Remove \p tag from the set.
+ *
+ * \return true when the tag was present.
+ */
+bool tag_set_remove(tag_set_t *p_set, const char *tag, size_t tag_len);
+
+/**
+ * Check whether \p tag (\p tag_len bytes) is in the set.
+ */
+bool tag_set_contains(const tag_set_t *p_set, const char *tag, size_t tag_len);
+
+/**
+ * Write the tags as a comma-separated list in insertion order, replacing
+ * the contents of \p p_buf.
+ *
+ * \param p_len Output set to the length of the NUL-terminated result.
+ * \return false on allocation failure.
+ */
+bool tag_set_serialize(const tag_set_t *p_set, tag_buffer_t *p_buf, size_t *p_len);
+
+/**
+ * Same contract as xdg_tags_append_many_buf(), with membership checked
+ * through \p p_set (cleared first) instead of rescanning the list for every
+ * tag. The existing list is kept byte for byte and missing tags are
+ * appended after it.
+ */
+bool xdg_tags_append_many_set(tag_set_t *p_set, tag_buffer_t *p_buf, size_t *p_len,
+                              const char *const *tags, size_t tag_count, size_t *out_added);
+
 /**
  * Parse a configuration string into a list of xattr_target_t.
  * Format: "name@percent,name2@percent2"
  * Example: "seen@90,started@0"
  *
+ * The returned targets are sorted by ascending percent; targets with the same
+ * percent keep their configuration order.
+ *
  * \param config_str The configuration string.
  * \param count Output pointer for the number of targets found.
  * \return Array of xattr_target_t (caller must free using free_xattr_targets).
@@ -53,6 +249,25 @@ xattr_target_t *parse_xattr_targets(const char *config_str, int *count);
  */
 void free_xattr_targets(xattr_target_t *targets, int count);
 
+/**
+ * Format a duration as decimal seconds with millisecond precision
+ * ("754.120"), as stored in the position and watch time xattrs.
+ *
+ * \return Length written without the terminator, or 0 when \p i_ms is
+ *         negative or \p i_size too small.
+ */
+size_t format_seconds_ms(char *psz_buf, size_t i_size, int64_t i_ms);
+
+/**
+ * Parse a duration written by format_seconds_ms(). Whole seconds and any
+ * number of decimals (beyond milliseconds truncated) are accepted; trailing
+ * NULs and whitespace are ignored.
+ *
+ * \param p_value Value, not necessarily NUL-terminated.
+ * \return false if the value is not a non-negative decimal number.
+ */
+bool parse_seconds_ms(const char *p_value, size_t i_len, int64_t *p_ms);
+
 /**
  * Trim whitespace from both ends of a string in place.
  */
@@ -67,4 +282,25 @@ char *trim_token(char *psz_token);
  */
 bool should_skip_path(const char *psz_path, const char *psz_skip_list);
 
+/**
+ * Compile a skip list (same syntax as should_skip_path()) for repeated
+ * lookups. Prefixes covered by a shorter prefix are dropped.
+ *
+ * \param psz_skip_list Comma/semicolon/newline separated list (may be NULL).
+ * \return The compiled matcher (possibly empty), or NULL on allocation
+ *         failure. Free with skip_matcher_free().
+ */
+skip_matcher_t *skip_matcher_compile(const char *psz_skip_list);
+
+/**
+ * Check \p psz_path against a compiled skip list in O(log n).
+ * Equivalent to should_skip_path() with the list the matcher was compiled from.
+ */
+bool skip_matcher_match(const skip_matcher_t *p_matcher, const char *psz_path);
+
+/**
+ * Free a matcher returned by skip_matcher_compile(). NULL is ignored.
+ */
+void skip_matcher_free(skip_matcher_t *p_matcher);
+
 #endif // TAG_UTILS_H
@@ -0,0 +1,53 @@
+#include "alloc_counter.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#if defined(__GLIBC__)
+#include <stdatomic.h>
+
+// glibc exports its allocator under these names so it can be wrapped
+extern void *__libc_malloc(size_t i_size);
+extern void *__libc_calloc(size_t i_count, size_t i_size);
+extern void *__libc_realloc(void *p, size_t i_size);
+
+static atomic_ulong i_allocs;
+
+void *malloc(size_t i_size)
+{
+    atomic_fetch_add_explicit(&i_allocs, 1, memory_order_relaxed);
+    return __libc_malloc(i_size);
+}
+
+void *calloc(size_t i_count, size_t i_size)
+{
+    atomic_fetch_add_explicit(&i_allocs, 1, memory_order_relaxed);
+    return __libc_calloc(i_count, i_size);
+}
+
+void *realloc(void *p, size_t i_size)
+{
+    atomic_fetch_add_explicit(&i_allocs, 1, memory_order_relaxed);
+    return __libc_realloc(p, i_size);
+}
+
+bool alloc_counter_available(void)
+{
+    return true;
+}
+
+unsigned long alloc_counter_get(void)
+{
+    return atomic_load_explicit(&i_allocs, memory_order_relaxed);
+}
+#else
+bool alloc_counter_available(void)
+{
+    return false;
+}
+
+unsigned long alloc_counter_get(void)
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,21 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stdbool.h>
+
+/**
+ * Heap allocation counting for tests and benchmarks.
+ *
+ * Linking alloc_counter.c replaces malloc, calloc and realloc with wrappers
+ * that count calls before forwarding to the C library. Counting is only
+ * available on glibc; elsewhere alloc_counter_available() returns false and
+ * the count stays at zero.
+ */
+bool alloc_counter_available(void);
+
+/**
+ * Number of allocations (malloc, calloc, and realloc calls) so far.
+ */
+unsigned long alloc_counter_get(void);
+
+#endif // ALLOC_COUNTER_H
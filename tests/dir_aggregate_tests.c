@@ -0,0 +1,99 @@
+#include "../dir_aggregate.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static void test_insert_contains(void)
+{
+    dir_aggregate_t agg;
+    dir_aggregate_init(&agg);
+    assert(!dir_aggregate_contains(&agg, 42));
+
+    bool b_added = false;
+    assert(dir_aggregate_insert(&agg, 42, &b_added) && b_added);
+    assert(dir_aggregate_insert(&agg, 7, &b_added) && b_added);
+    assert(dir_aggregate_insert(&agg, 1000000, NULL));
+    // Replays of a seen file are not counted twice
+    assert(dir_aggregate_insert(&agg, 42, &b_added) && !b_added);
+    assert(agg.i_count == 3);
+    assert(agg.p_inodes[0] == 7 && agg.p_inodes[1] == 42 && agg.p_inodes[2] == 1000000);
+    assert(dir_aggregate_contains(&agg, 42));
+    assert(!dir_aggregate_contains(&agg, 43));
+
+    char psz_count[16];
+    assert(dir_aggregate_format_count(&agg, psz_count, sizeof(psz_count)) == 1);
+    assert(strcmp(psz_count, "3") == 0);
+    assert(dir_aggregate_format_count(&agg, psz_count, 1) == 0);
+
+    dir_aggregate_clear(&agg);
+    assert(agg.i_count == 0 && !dir_aggregate_contains(&agg, 42));
+}
+
+static void test_round_trip(void)
+{
+    dir_aggregate_t agg = { 0 };
+    for (uint64_t i = 0; i < 500; i++)
+        assert(dir_aggregate_insert(&agg, 5000000 + i * 3, NULL));
+    assert(dir_aggregate_insert(&agg, UINT64_MAX, NULL));
+
+    // Sizing call first, as callers do
+    size_t i_len = dir_aggregate_encode(&agg, NULL, 0);
+    uint8_t buf[2048];
+    assert(i_len <= sizeof(buf));
+    assert(dir_aggregate_encode(&agg, buf, i_len - 1) == i_len);
+    assert(dir_aggregate_encode(&agg, buf, sizeof(buf)) == i_len);
+    // Close inodes cost a byte each
+    assert(i_len < 520 + 10);
+
+    dir_aggregate_t copy = { 0 };
+    assert(dir_aggregate_decode(&copy, buf, i_len));
+    assert(copy.i_count == agg.i_count);
+    assert(memcmp(copy.p_inodes, agg.p_inodes, agg.i_count * sizeof(uint64_t)) == 0);
+
+    // An empty value is an empty aggregate
+    assert(dir_aggregate_decode(&copy, "", 0) && copy.i_count == 0);
+    dir_aggregate_t empty = { 0 };
+    i_len = dir_aggregate_encode(&empty, buf, sizeof(buf));
+    assert(i_len == 2 && buf[0] == DIR_AGGREGATE_VERSION && buf[1] == 0);
+    assert(dir_aggregate_decode(&copy, buf, i_len) && copy.i_count == 0);
+
+    dir_aggregate_clear(&copy);
+    dir_aggregate_clear(&agg);
+}
+
+static void test_malformed(void)
+{
+    dir_aggregate_t agg = { 0 };
+    assert(dir_aggregate_insert(&agg, 1, NULL));
+
+    static const uint8_t wrong_version[] = { 2, 1, 5 };
+    static const uint8_t truncated[] = { DIR_AGGREGATE_VERSION, 2, 5 };
+    static const uint8_t duplicate[] = { DIR_AGGREGATE_VERSION, 2, 5, 0 };
+    static const uint8_t trailing[] = { DIR_AGGREGATE_VERSION, 1, 5, 9 };
+    static const uint8_t unterminated[] = { DIR_AGGREGATE_VERSION, 1, 0x85 };
+    static const uint8_t huge_count[] = { DIR_AGGREGATE_VERSION, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F };
+    static const uint8_t overflow[] = { DIR_AGGREGATE_VERSION, 2,
+                                        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 1 };
+    assert(!dir_aggregate_decode(&agg, wrong_version, sizeof(wrong_version)));
+    assert(agg.i_count == 0);
+    assert(!dir_aggregate_decode(&agg, truncated, sizeof(truncated)));
+    assert(!dir_aggregate_decode(&agg, duplicate, sizeof(duplicate)));
+    assert(!dir_aggregate_decode(&agg, trailing, sizeof(trailing)));
+    assert(!dir_aggregate_decode(&agg, unterminated, sizeof(unterminated)));
+    assert(!dir_aggregate_decode(&agg, huge_count, sizeof(huge_count)));
+    assert(!dir_aggregate_decode(&agg, overflow, sizeof(overflow)));
+    assert(agg.i_count == 0);
+
+    dir_aggregate_clear(&agg);
+}
+
+int main(void)
+{
+    test_insert_contains();
+    test_round_trip();
+    test_malformed();
+
+    printf("All tests passed\n");
+    return 0;
+}
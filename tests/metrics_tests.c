@@ -0,0 +1,178 @@
+#include "../metrics.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEXTFILE "metrics_test.prom"
+
+static char *read_file(const char *psz_file)
+{
+    FILE *f = fopen(psz_file, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *psz = malloc((size_t)size + 1);
+    assert(psz != NULL);
+    assert(fread(psz, 1, (size_t)size, f) == (size_t)size);
+    psz[size] = '\0';
+    fclose(f);
+    return psz;
+}
+
+static char *format(const metrics_t *p_metrics)
+{
+    FILE *f = tmpfile();
+    assert(f != NULL);
+    assert(metrics_write_prometheus(p_metrics, "test_", f));
+    long size = ftell(f);
+    rewind(f);
+    char *psz = malloc((size_t)size + 1);
+    assert(psz != NULL);
+    assert(fread(psz, 1, (size_t)size, f) == (size_t)size);
+    psz[size] = '\0';
+    fclose(f);
+    return psz;
+}
+
+static void test_buckets(void)
+{
+    assert(metrics_bucket(0) == 0);
+    assert(metrics_bucket(1) == 0);
+    assert(metrics_bucket(2) == 1);
+    assert(metrics_bucket(3) == 2);
+    assert(metrics_bucket(4) == 2);
+    assert(metrics_bucket(5) == 3);
+    assert(metrics_bucket(1000) == 10);
+    assert(metrics_bucket(1024) == 10);
+    assert(metrics_bucket(1025) == 11);
+    // Beyond the last finite bound everything lands in +Inf
+    assert(metrics_bucket(UINT64_C(1) << 22) == 22);
+    assert(metrics_bucket((UINT64_C(1) << 22) + 1) == METRICS_BUCKETS - 1);
+    assert(metrics_bucket(UINT64_MAX) == METRICS_BUCKETS - 1);
+}
+
+static void test_errors(void)
+{
+    const char *psz_errno, *psz_reason;
+    metrics_error_labels(metrics_error_slot(EACCES), &psz_errno, &psz_reason);
+    assert(strcmp(psz_errno, "EACCES") == 0 && strcmp(psz_reason, "permission") == 0);
+    metrics_error_labels(metrics_error_slot(EROFS), &psz_errno, &psz_reason);
+    assert(strcmp(psz_errno, "EROFS") == 0 && strcmp(psz_reason, "read_only") == 0);
+    metrics_error_labels(metrics_error_slot(ENOTSUP), &psz_errno, &psz_reason);
+    assert(strcmp(psz_reason, "unsupported") == 0);
+    // Unlisted values share the last slot
+    assert(metrics_error_slot(-1) == METRICS_ERROR_SLOTS - 1);
+    assert(metrics_error_slot(EINVAL) == METRICS_ERROR_SLOTS - 1);
+    metrics_error_labels(metrics_error_slot(-1), &psz_errno, &psz_reason);
+    assert(strcmp(psz_errno, "other") == 0 && strcmp(psz_reason, "other") == 0);
+
+    // Every listed value has a slot of its own
+    assert(metrics_error_slot(EACCES) != metrics_error_slot(EPERM));
+    assert(metrics_error_slot(ENOSPC) != METRICS_ERROR_SLOTS - 1);
+}
+
+static void test_prometheus_format(void)
+{
+    metrics_t metrics;
+    metrics_init(&metrics);
+
+    metrics_add(&metrics, METRIC_SCHEDULE_WAKEUPS, 3);
+    metrics_add(&metrics, METRIC_SCHEDULE_WAKEUPS, 2);
+    metrics_set(&metrics, METRIC_JOBS_QUEUED, 7);
+    assert(metrics_get(&metrics, METRIC_SCHEDULE_WAKEUPS) == 5);
+
+    metrics_observe(&metrics, METRIC_SETXATTR_SECONDS, 1);
+    metrics_observe(&metrics, METRIC_SETXATTR_SECONDS, 3);
+    metrics_observe(&metrics, METRIC_SETXATTR_SECONDS, 3000000000u);
+
+    metrics_count_error(&metrics, EACCES);
+    metrics_count_error(&metrics, EACCES);
+    metrics_count_error(&metrics, EINVAL);
+
+    char *psz = format(&metrics);
+    assert(strstr(psz, "# TYPE test_schedule_wakeups_total counter\n") != NULL);
+    assert(strstr(psz, "\ntest_schedule_wakeups_total 5\n") != NULL);
+    assert(strstr(psz, "\ntest_jobs_queued_total 7\n") != NULL);
+    assert(strstr(psz, "\ntest_jobs_written_total 0\n") != NULL);
+
+    // Buckets are cumulative and end with +Inf == count
+    assert(strstr(psz, "# TYPE test_setxattr_seconds histogram\n") != NULL);
+    assert(strstr(psz, "\ntest_setxattr_seconds_bucket{le=\"1e-06\"} 1\n") != NULL);
+    assert(strstr(psz, "\ntest_setxattr_seconds_bucket{le=\"2e-06\"} 1\n") != NULL);
+    assert(strstr(psz, "\ntest_setxattr_seconds_bucket{le=\"4e-06\"} 2\n") != NULL);
+    assert(strstr(psz, "\ntest_setxattr_seconds_bucket{le=\"4.194304\"} 2\n") != NULL);
+    assert(strstr(psz, "\ntest_setxattr_seconds_bucket{le=\"+Inf\"} 3\n") != NULL);
+    assert(strstr(psz, "\ntest_setxattr_seconds_sum 3000.000004\n") != NULL);
+    assert(strstr(psz, "\ntest_setxattr_seconds_count 3\n") != NULL);
+    assert(strstr(psz, "\ntest_getxattr_seconds_count 0\n") != NULL);
+
+    assert(strstr(psz, "\ntest_xattr_errors_total{errno=\"EACCES\",reason=\"permission\"} 2\n") != NULL);
+    assert(strstr(psz, "\ntest_xattr_errors_total{errno=\"EROFS\",reason=\"read_only\"} 0\n") != NULL);
+    assert(strstr(psz, "\ntest_xattr_errors_total{errno=\"other\",reason=\"other\"} 1\n") != NULL);
+
+    // Every line is a comment or "name[{labels}] value"
+    for (char *psz_line = strtok(psz, "\n"); psz_line != NULL; psz_line = strtok(NULL, "\n")) {
+        if (psz_line[0] == '#')
+            continue;
+        assert(strncmp(psz_line, "test_", 5) == 0);
+        char *psz_value = strrchr(psz_line, ' ');
+        assert(psz_value != NULL && psz_value[1] != '\0');
+        char *psz_end;
+        strtod(psz_value + 1, &psz_end);
+        assert(*psz_end == '\0');
+    }
+    free(psz);
+}
+
+static void test_textfile(void)
+{
+    metrics_t metrics;
+    metrics_init(&metrics);
+    metrics_add(&metrics, METRIC_BYTES_WRITTEN, 42);
+
+    remove(TEXTFILE);
+    assert(metrics_write_textfile(&metrics, "vlc_xattr_", TEXTFILE));
+    char *psz = read_file(TEXTFILE);
+    assert(psz != NULL);
+    assert(strstr(psz, "\nvlc_xattr_bytes_written_total 42\n") != NULL);
+    free(psz);
+
+    // Rewrites replace the file and leave no temporary behind
+    metrics_add(&metrics, METRIC_BYTES_WRITTEN, 1);
+    assert(metrics_write_textfile(&metrics, "vlc_xattr_", TEXTFILE));
+    psz = read_file(TEXTFILE);
+    assert(psz != NULL);
+    assert(strstr(psz, "\nvlc_xattr_bytes_written_total 43\n") != NULL);
+    free(psz);
+    assert(read_file(TEXTFILE ".tmp") == NULL);
+    remove(TEXTFILE);
+
+    assert(!metrics_write_textfile(&metrics, "vlc_xattr_", "no-such-dir/metrics.prom"));
+}
+
+static void test_names(void)
+{
+    assert(strcmp(metrics_counter_name(METRIC_SCHEDULE_WAKEUPS), "schedule_wakeups") == 0);
+    assert(strcmp(metrics_histogram_name(METRIC_SETXATTR_SECONDS), "setxattr_seconds") == 0);
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+        assert(metrics_counter_name((metrics_counter_t)i) != NULL);
+    for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+        assert(metrics_histogram_name((metrics_histogram_t)i) != NULL);
+}
+
+int main(void)
+{
+    test_buckets();
+    test_errors();
+    test_prometheus_format();
+    test_textfile();
+    test_names();
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "../mount_table.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#define MOUNTINFO_FILE "mount_table_test.mountinfo"
+
+static void write_mountinfo(const char *psz_content)
+{
+    FILE *f = fopen(MOUNTINFO_FILE, "w");
+    assert(f != NULL);
+    fputs(psz_content, f);
+    fclose(f);
+}
+
+static const char psz_mounts[] =
+    "22 1 8:1 / / rw,relatime shared:1 - ext4 /dev/sda1 rw\n"
+    "30 22 8:17 / /mnt/usb rw,nosuid - vfat /dev/sdb1 rw,fmask=0022\n"
+    "31 22 8:33 / /mnt/usb2 rw - ext4 /dev/sdc1 rw\n"
+    "32 22 8:49 / /mnt/My\\040Films ro,relatime - ntfs3 /dev/sdd1 ro\n"
+    "33 22 0:50 / /srv/media rw - nfs4 server:/media rw,vers=4.2\n"
+    "34 33 0:51 / /srv/media/cache rw master:3 - tmpfs tmpfs rw\n"
+    "35 22 8:65 / /mnt/disk rw - xfs /dev/sde1 ro\n"
+    "this line is not a mount\n"
+    "36 22 8:81 / /mnt/usb rw - exfat /dev/sdf1 rw\n";
+
+static void test_parse(void)
+{
+    write_mountinfo(psz_mounts);
+    mount_table_t *p_table = mount_table_open_file(MOUNTINFO_FILE);
+    assert(p_table != NULL);
+    assert(mount_table_count(p_table) == 8);
+
+    mount_entry_t *p_entry = mount_table_lookup(p_table, "/mnt/My Films/a.mkv", makedev(8, 49));
+    assert(p_entry != NULL);
+    assert(p_entry->i_id == 32);
+    assert(strcmp(p_entry->psz_point, "/mnt/My Films") == 0);
+    assert(strcmp(p_entry->psz_fstype, "ntfs3") == 0);
+    assert(p_entry->b_readonly);
+    assert(p_entry->user_xattr == MOUNT_XATTR_UNKNOWN);
+
+    // Read-only from either the mount or the superblock options
+    p_entry = mount_table_lookup(p_table, "/mnt/disk/a.mkv", makedev(8, 65));
+    assert(p_entry != NULL && p_entry->b_readonly);
+    p_entry = mount_table_lookup(p_table, "/home/user/a.mkv", makedev(8, 1));
+    assert(p_entry != NULL && !p_entry->b_readonly);
+    assert(strcmp(p_entry->psz_fstype, "ext4") == 0);
+
+    mount_table_close(p_table);
+    remove(MOUNTINFO_FILE);
+}
+
+static void test_longest_prefix(void)
+{
+    write_mountinfo(psz_mounts);
+    mount_table_t *p_table = mount_table_open_file(MOUNTINFO_FILE);
+
+    mount_entry_t *p_entry = mount_table_lookup(p_table, "/srv/media/cache/x", makedev(0, 51));
+    assert(p_entry != NULL && p_entry->i_id == 34);
+    p_entry = mount_table_lookup(p_table, "/srv/media/tv/a.mkv", makedev(0, 50));
+    assert(p_entry != NULL && p_entry->i_id == 33);
+    p_entry = mount_table_lookup(p_table, "/srv/media", makedev(0, 50));
+    assert(p_entry != NULL && p_entry->i_id == 33);
+    p_entry = mount_table_lookup(p_table, "/srv/media/", makedev(0, 50));
+    assert(p_entry != NULL && p_entry->i_id == 33);
+
+    // Whole components only
+    p_entry = mount_table_lookup(p_table, "/mnt/usb2/a.mkv", makedev(8, 33));
+    assert(p_entry != NULL && p_entry->i_id == 31);
+    p_entry = mount_table_lookup(p_table, "/mnt/usbx/a.mkv", makedev(8, 1));
+    assert(p_entry != NULL && p_entry->i_id == 22);
+
+    // The mount on top wins
+    p_entry = mount_table_lookup(p_table, "/mnt/usb/a.mkv", makedev(8, 81));
+    assert(p_entry != NULL && p_entry->i_id == 36);
+    assert(strcmp(p_entry->psz_fstype, "exfat") == 0);
+
+    // Another device (a symlink into another mount, a stale table): no answer
+    assert(mount_table_lookup(p_table, "/mnt/usb/a.mkv", makedev(8, 17)) == NULL);
+    assert(mount_table_lookup(p_table, "relative/a.mkv", makedev(8, 1)) == NULL);
+    assert(mount_table_lookup(p_table, NULL, 0) == NULL);
+
+    mount_table_close(p_table);
+    remove(MOUNTINFO_FILE);
+}
+
+static void test_reload_keeps_learned_state(void)
+{
+    write_mountinfo(psz_mounts);
+    mount_table_t *p_table = mount_table_open_file(MOUNTINFO_FILE);
+    mount_entry_t *p_entry = mount_table_lookup(p_table, "/mnt/usb/a.mkv", makedev(8, 81));
+    p_entry->user_xattr = MOUNT_XATTR_UNSUPPORTED;
+    p_entry = mount_table_lookup(p_table, "/mnt/usb2/a.mkv", makedev(8, 33));
+    p_entry->user_xattr = MOUNT_XATTR_SUPPORTED;
+    assert(mount_table_user_xattr(p_entry) == MOUNT_XATTR_SUPPORTED); // No probe once known
+
+    // Files are not watched: only an explicit reload picks changes up
+    write_mountinfo("22 1 8:1 / / rw - ext4 /dev/sda1 rw\n"
+                    "36 22 8:81 / /mnt/usb rw - exfat /dev/sdf1 rw\n"
+                    "37 22 8:33 / /mnt/usb2 ro - ext4 /dev/sdc1 rw\n");
+    assert(!mount_table_poll(p_table));
+    assert(mount_table_count(p_table) == 8);
+    assert(mount_table_reload(p_table));
+    assert(mount_table_count(p_table) == 3);
+
+    p_entry = mount_table_lookup(p_table, "/mnt/usb/a.mkv", makedev(8, 81));
+    assert(p_entry != NULL && p_entry->user_xattr == MOUNT_XATTR_UNSUPPORTED);
+    // Remounted under a new ID: learned again
+    p_entry = mount_table_lookup(p_table, "/mnt/usb2/a.mkv", makedev(8, 33));
+    assert(p_entry != NULL && p_entry->b_readonly && p_entry->user_xattr == MOUNT_XATTR_UNKNOWN);
+    assert(mount_table_lookup(p_table, "/srv/media/a.mkv", makedev(0, 50)) == NULL);
+
+    mount_table_close(p_table);
+    remove(MOUNTINFO_FILE);
+}
+
+static void test_probe_and_live_table(void)
+{
+    // A mount point that cannot be probed stays unknown, and is not probed again
+    write_mountinfo("40 1 8:1 / /does/not/exist rw - ext4 /dev/sda1 rw\n");
+    mount_table_t *p_table = mount_table_open_file(MOUNTINFO_FILE);
+    mount_entry_t *p_entry = mount_table_lookup(p_table, "/does/not/exist/a", makedev(8, 1));
+    assert(p_entry != NULL);
+    assert(mount_table_user_xattr(p_entry) == MOUNT_XATTR_UNKNOWN);
+    assert(p_entry->b_probed);
+    mount_table_close(p_table);
+    remove(MOUNTINFO_FILE);
+
+    // The process's own table holds the mount of the current directory
+    p_table = mount_table_open();
+    assert(p_table != NULL);
+    assert(mount_table_count(p_table) > 0);
+    assert(!mount_table_poll(p_table));
+    char psz_cwd[4096];
+    struct stat st;
+    assert(getcwd(psz_cwd, sizeof(psz_cwd)) != NULL && stat(psz_cwd, &st) == 0);
+    p_entry = mount_table_lookup(p_table, psz_cwd, (uint64_t)st.st_dev);
+    if (p_entry != NULL) { // Overlay and btrfs subvolumes report other devices
+        mount_table_user_xattr(p_entry);
+        assert(p_entry->b_probed);
+    }
+    mount_table_close(p_table);
+}
+
+static void test_invalid_arguments(void)
+{
+    assert(mount_table_open_file(NULL) == NULL);
+    assert(mount_table_open_file("does-not-exist.mountinfo") == NULL);
+    assert(mount_table_count(NULL) == 0);
+    assert(!mount_table_poll(NULL));
+    assert(!mount_table_reload(NULL));
+    assert(mount_table_lookup(NULL, "/a", 0) == NULL);
+    assert(mount_table_user_xattr(NULL) == MOUNT_XATTR_UNKNOWN);
+    mount_table_close(NULL); // Should not crash
+
+    // Empty table: nothing matches
+    write_mountinfo("");
+    mount_table_t *p_table = mount_table_open_file(MOUNTINFO_FILE);
+    assert(p_table != NULL);
+    assert(mount_table_count(p_table) == 0);
+    assert(mount_table_lookup(p_table, "/a", 0) == NULL);
+    mount_table_close(p_table);
+    remove(MOUNTINFO_FILE);
+}
+
+int main(void)
+{
+    test_parse();
+    test_longest_prefix();
+    test_reload_keeps_learned_state();
+    test_probe_and_live_table();
+    test_invalid_arguments();
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,349 @@
+#include "../record_log.h"
+#include "test_util.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_FILE "record_log_test.log"
+#define MAX_KEYS 1024
+
+enum {
+    RECORD_SET = 1,
+};
+
+/* A minimal owner: key -> value, one record per set. */
+typedef struct {
+    uint64_t values[MAX_KEYS];
+    bool b_set[MAX_KEYS];
+    size_t i_applied;
+    size_t i_resets;
+} owner_t;
+
+static bool apply(void *p_opaque, uint32_t i_type, const unsigned char *p_body, size_t i_body)
+{
+    owner_t *p_owner = p_opaque;
+    if (i_type != RECORD_SET)
+        return true;
+    if (i_body < 16 || record_log_get_u64(p_body) >= MAX_KEYS)
+        return false;
+    size_t i_key = (size_t)record_log_get_u64(p_body);
+    p_owner->values[i_key] = record_log_get_u64(p_body + 8);
+    p_owner->b_set[i_key] = true;
+    p_owner->i_applied++;
+    return true;
+}
+
+static void reset(void *p_opaque)
+{
+    owner_t *p_owner = p_opaque;
+    size_t i_resets = p_owner->i_resets;
+    memset(p_owner, 0, sizeof(*p_owner));
+    p_owner->i_resets = i_resets + 1;
+}
+
+static bool dump(void *p_opaque, FILE *p_file)
+{
+    owner_t *p_owner = p_opaque;
+    unsigned char body[16];
+    for (size_t i = 0; i < MAX_KEYS; i++) {
+        if (!p_owner->b_set[i])
+            continue;
+        record_log_put_u64(body, i);
+        record_log_put_u64(body + 8, p_owner->values[i]);
+        if (!record_log_write(p_file, RECORD_SET, body, sizeof(body)))
+            return false;
+    }
+    return true;
+}
+
+static const record_log_format_t format = {
+    .psz_magic = "XSTEST\0\1",
+    .i_version = 1,
+    .i_max_record = 1024,
+    .b_sync = false,
+    .pf_apply = apply,
+    .pf_reset = reset,
+    .pf_dump = dump,
+};
+
+/* Append key = value under the lock and apply it, the way the stores do. */
+static bool set(record_log_t *p_log, owner_t *p_owner, uint64_t i_key, uint64_t i_value)
+{
+    unsigned char record[RECORD_LOG_HEADER_SIZE + 16];
+    record_log_put_u64(record + RECORD_LOG_HEADER_SIZE, i_key);
+    record_log_put_u64(record + RECORD_LOG_HEADER_SIZE + 8, i_value);
+    record_log_seal(record, RECORD_SET, 16);
+    if (!record_log_lock(p_log))
+        return false;
+    bool b_ok = record_log_append(p_log, record, sizeof(record));
+    record_log_unlock(p_log);
+    return b_ok && apply(p_owner, RECORD_SET, record + RECORD_LOG_HEADER_SIZE, 16);
+}
+
+static size_t count(const owner_t *p_owner)
+{
+    size_t i_count = 0;
+    for (size_t i = 0; i < MAX_KEYS; i++)
+        i_count += p_owner->b_set[i];
+    return i_count;
+}
+
+static void test_framing(void)
+{
+    assert(record_log_size(0) == RECORD_LOG_HEADER_SIZE);
+    assert(record_log_size(1) == RECORD_LOG_HEADER_SIZE + 8);
+    assert(record_log_size(16) == RECORD_LOG_HEADER_SIZE + 16);
+
+    unsigned char buf[8];
+    record_log_put_u32(buf, 0x01020304u);
+    assert(buf[0] == 4 && buf[3] == 1);
+    assert(record_log_get_u32(buf) == 0x01020304u);
+    record_log_put_u64(buf, 0x0102030405060708ull);
+    assert(buf[0] == 8 && buf[7] == 1);
+    assert(record_log_get_u64(buf) == 0x0102030405060708ull);
+
+    // A sealed record and a written one are byte for byte the same
+    unsigned char record[RECORD_LOG_HEADER_SIZE + 8];
+    memcpy(record + RECORD_LOG_HEADER_SIZE, "abc", 3);
+    record_log_seal(record, 7, 3);
+    FILE *f = fopen(LOG_FILE, "wb");
+    assert(f != NULL);
+    assert(record_log_write(f, 7, "abc", 3));
+    fclose(f);
+    unsigned char written[sizeof(record)];
+    f = fopen(LOG_FILE, "rb");
+    assert(fread(written, 1, sizeof(written), f) == sizeof(written));
+    fclose(f);
+    assert(memcmp(record, written, sizeof(record)) == 0);
+    remove(LOG_FILE);
+}
+
+static void test_append_reopen(void)
+{
+    remove(LOG_FILE);
+    owner_t owner = { 0 };
+    record_log_t *p_log = record_log_open(LOG_FILE, &format, &owner);
+    assert(p_log != NULL);
+    assert(count(&owner) == 0);
+    // Appending needs the lock
+    unsigned char record[RECORD_LOG_HEADER_SIZE];
+    record_log_seal(record, RECORD_SET, 0);
+    assert(!record_log_append(p_log, record, sizeof(record)));
+    assert(set(p_log, &owner, 1, 10));
+    assert(set(p_log, &owner, 2, 20));
+    assert(set(p_log, &owner, 1, 11));
+    record_log_close(p_log);
+
+    owner_t reader = { 0 };
+    p_log = record_log_open_readonly(LOG_FILE, &format, &reader);
+    assert(p_log != NULL);
+    assert(reader.i_applied == 3);
+    assert(reader.values[1] == 11 && reader.values[2] == 20);
+    // Read-only logs cannot be locked
+    assert(!record_log_lock(p_log));
+    record_log_close(p_log);
+    remove(LOG_FILE);
+}
+
+static void test_torn_tail(void)
+{
+    remove(LOG_FILE);
+    owner_t owner = { 0 };
+    record_log_t *p_log = record_log_open(LOG_FILE, &format, &owner);
+    assert(set(p_log, &owner, 1, 10));
+    assert(set(p_log, &owner, 2, 20));
+    record_log_close(p_log);
+
+    // Readers stop at the torn record
+    append_torn_record(LOG_FILE);
+    long torn_size = file_size(LOG_FILE);
+    owner_t reader = { 0 };
+    p_log = record_log_open_readonly(LOG_FILE, &format, &reader);
+    assert(p_log != NULL && count(&reader) == 2);
+    record_log_close(p_log);
+    assert(file_size(LOG_FILE) == torn_size);
+
+    // Opening for writing compacts it away
+    memset(&owner, 0, sizeof(owner));
+    p_log = record_log_open(LOG_FILE, &format, &owner);
+    assert(p_log != NULL && count(&owner) == 2);
+    assert(file_size(LOG_FILE) < torn_size);
+
+    // So does locking, when a crashed writer left one behind meanwhile
+    append_torn_record(LOG_FILE);
+    assert(set(p_log, &owner, 3, 30));
+    record_log_close(p_log);
+    memset(&reader, 0, sizeof(reader));
+    p_log = record_log_open_readonly(LOG_FILE, &format, &reader);
+    assert(reader.i_applied == 3);
+    record_log_close(p_log);
+    remove(LOG_FILE);
+}
+
+static void test_compaction(void)
+{
+    remove(LOG_FILE);
+    owner_t owner = { 0 };
+    record_log_t *p_log = record_log_open(LOG_FILE, &format, &owner);
+    for (uint64_t i = 0; i < 300; i++)
+        assert(set(p_log, &owner, i % 10, i));
+    long before = file_size(LOG_FILE);
+
+    // Needs the lock
+    assert(!record_log_compact(p_log));
+    assert(record_log_lock(p_log));
+    size_t i_resets = owner.i_resets;
+    assert(record_log_compact(p_log));
+    record_log_unlock(p_log);
+    assert(file_size(LOG_FILE) < before / 10);
+    assert(owner.i_resets == i_resets + 1);
+    assert(owner.i_applied == 10);
+    assert(owner.values[9] == 299);
+
+    // Still appendable after the swap
+    assert(set(p_log, &owner, 10, 1000));
+    record_log_close(p_log);
+    owner_t reader = { 0 };
+    p_log = record_log_open_readonly(LOG_FILE, &format, &reader);
+    assert(count(&reader) == 11 && reader.values[10] == 1000);
+    record_log_close(p_log);
+    remove(LOG_FILE);
+}
+
+static void test_refresh_sees_other_writer(void)
+{
+    remove(LOG_FILE);
+    owner_t one = { 0 }, two = { 0 }, reader = { 0 };
+    record_log_t *p_one = record_log_open(LOG_FILE, &format, &one);
+    record_log_t *p_two = record_log_open(LOG_FILE, &format, &two);
+    record_log_t *p_reader = record_log_open_readonly(LOG_FILE, &format, &reader);
+    assert(p_one != NULL && p_two != NULL && p_reader != NULL);
+
+    assert(set(p_one, &one, 1, 10));
+    assert(count(&reader) == 0);
+    assert(record_log_refresh(p_reader));
+    assert(count(&reader) == 1);
+    // Nothing new: nothing applied again
+    assert(record_log_refresh(p_reader));
+    assert(reader.i_applied == 1);
+
+    // Locking picks up the other writer's records first
+    assert(set(p_two, &two, 2, 20));
+    assert(count(&two) == 2);
+
+    // Compaction by one is parsed from scratch by the others, and later
+    // appends go to the new file
+    assert(record_log_lock(p_two));
+    assert(record_log_compact(p_two));
+    record_log_unlock(p_two);
+    size_t i_resets = reader.i_resets;
+    assert(set(p_one, &one, 3, 30));
+    assert(record_log_refresh(p_reader));
+    assert(reader.i_resets == i_resets + 1);
+    assert(count(&reader) == 3);
+
+    record_log_close(p_reader);
+    record_log_close(p_two);
+    record_log_close(p_one);
+    remove(LOG_FILE);
+}
+
+static void test_invalid_files(void)
+{
+    owner_t owner = { 0 };
+    remove(LOG_FILE);
+    assert(record_log_open_readonly(LOG_FILE, &format, &owner) == NULL);
+    assert(record_log_open(NULL, &format, &owner) == NULL);
+    assert(record_log_open(LOG_FILE, NULL, &owner) == NULL);
+
+    // Not a log of this format, or a newer version: nobody touches it
+    FILE *f = fopen(LOG_FILE, "wb");
+    fputs("not a record log", f);
+    fclose(f);
+    assert(record_log_open_readonly(LOG_FILE, &format, &owner) == NULL);
+    assert(record_log_open(LOG_FILE, &format, &owner) == NULL);
+    assert(file_size(LOG_FILE) == 16);
+
+    record_log_format_t newer = format;
+    newer.i_version = format.i_version + 1;
+    record_log_t *p_log = record_log_open(LOG_FILE ".newer", &newer, &owner);
+    assert(p_log != NULL);
+    assert(set(p_log, &owner, 1, 10));
+    record_log_close(p_log);
+    memset(&owner, 0, sizeof(owner));
+    assert(record_log_open(LOG_FILE ".newer", &format, &owner) == NULL);
+    assert(file_size(LOG_FILE ".newer") == 16 + RECORD_LOG_HEADER_SIZE + 16);
+    remove(LOG_FILE ".newer");
+    remove(LOG_FILE ".newer.lock");
+
+    // An empty file, as left by a crash before the header was written, is
+    // started over
+    f = fopen(LOG_FILE, "wb");
+    fclose(f);
+    p_log = record_log_open(LOG_FILE, &format, &owner);
+    assert(p_log != NULL && count(&owner) == 0);
+    assert(set(p_log, &owner, 1, 10));
+    record_log_close(p_log);
+
+    assert(!record_log_refresh(NULL));
+    assert(!record_log_lock(NULL));
+    assert(!record_log_append(NULL, "", 0));
+    assert(!record_log_compact(NULL));
+    record_log_unlock(NULL);
+    record_log_close(NULL); // Should not crash
+    remove(LOG_FILE);
+}
+
+#ifndef _WIN32
+static bool concurrent_writer(int i_proc)
+{
+    owner_t owner = { 0 };
+    record_log_t *p_log = record_log_open(LOG_FILE, &format, &owner);
+    if (p_log == NULL)
+        return false;
+    bool b_ok = true;
+    for (uint64_t i = 0; i < 200 && b_ok; i++) {
+        b_ok = set(p_log, &owner, (uint64_t)i_proc * 500 + i, i);
+        if (b_ok && i % 40 == 39) {
+            b_ok = record_log_lock(p_log) && record_log_compact(p_log);
+            record_log_unlock(p_log);
+        }
+    }
+    record_log_close(p_log);
+    return b_ok;
+}
+
+static void test_concurrent_writers(void)
+{
+    // Appends and compactions of two processes interleave without losing
+    // or tearing a record
+    remove(LOG_FILE);
+    run_writers(2, concurrent_writer);
+    owner_t reader = { 0 };
+    record_log_t *p_log = record_log_open_readonly(LOG_FILE, &format, &reader);
+    assert(p_log != NULL);
+    assert(count(&reader) == 400);
+    for (uint64_t i = 0; i < 200; i++)
+        assert(reader.values[i] == i && reader.values[500 + i] == i);
+    record_log_close(p_log);
+    remove(LOG_FILE);
+}
+#endif
+
+int main(void)
+{
+    test_framing();
+    test_append_reopen();
+    test_torn_tail();
+    test_compaction();
+    test_refresh_sees_other_writer();
+    test_invalid_files();
+#ifndef _WIN32
+    test_concurrent_writers();
+#endif
+    remove(LOG_FILE ".lock");
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include "../seen_index.h"
+#include "test_util.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_FILE "seen_index_test.bin"
+
+static bool count_cb(const seen_index_entry_t *p_entry, void *p_opaque)
+{
+    (void)p_entry;
+    (*(int *)p_opaque)++;
+    return true;
+}
+
+static bool stop_cb(const seen_index_entry_t *p_entry, void *p_opaque)
+{
+    (void)p_entry;
+    (*(int *)p_opaque)++;
+    return false;
+}
+
+static void test_update_lookup_reopen(void)
+{
+    remove(INDEX_FILE);
+    seen_index_t *p_index = seen_index_open(INDEX_FILE);
+    assert(p_index != NULL);
+    assert(seen_index_count(p_index) == 0);
+
+    const char *started[] = { "started" };
+    const char *seen[] = { "seen" };
+    assert(seen_index_update(p_index, 1, 100, "/media/tv/a.mkv", started, 1));
+    assert(seen_index_update(p_index, 1, 101, "/media/tv/b.mkv", started, 1));
+    const char *psz_path = seen_index_lookup(p_index, 1, 100)->psz_path;
+    assert(seen_index_update(p_index, 1, 100, "/media/tv/a.mkv", seen, 1));
+    // New tags under the same path keep the entry's copy of it
+    assert(seen_index_lookup(p_index, 1, 100)->psz_path == psz_path);
+    assert(seen_index_update(p_index, 2, 100, "/media/films/c.mkv", seen, 1));
+    assert(seen_index_count(p_index) == 3);
+
+    int i_started = seen_index_tag_bit(p_index, "started");
+    int i_seen = seen_index_tag_bit(p_index, "seen");
+    assert(i_started == 0 && i_seen == 1);
+    assert(seen_index_tag_bit(p_index, "missing") == -1);
+
+    // Tags accumulate per file
+    const seen_index_entry_t *p_entry = seen_index_lookup(p_index, 1, 100);
+    assert(p_entry != NULL);
+    assert(p_entry->i_tag_bits == 3);
+    assert(strcmp(p_entry->psz_path, "/media/tv/a.mkv") == 0);
+    assert(seen_index_lookup(p_index, 2, 101) == NULL);
+    assert(seen_index_lookup_path(p_index, "/media/films/c.mkv")->i_ino == 100);
+    assert(seen_index_lookup_path(p_index, "/media/films") == NULL);
+    seen_index_close(p_index);
+
+    // The last record per file wins after a restart
+    p_index = seen_index_open_readonly(INDEX_FILE);
+    assert(p_index != NULL);
+    assert(seen_index_count(p_index) == 3);
+    assert(seen_index_lookup(p_index, 1, 100)->i_tag_bits == 3);
+    assert(seen_index_lookup(p_index, 1, 101)->i_tag_bits == 1);
+    assert(!seen_index_update(p_index, 1, 102, "/x", seen, 1));
+    seen_index_close(p_index);
+    remove(INDEX_FILE);
+}
+
+static void test_query(void)
+{
+    remove(INDEX_FILE);
+    seen_index_t *p_index = seen_index_open(INDEX_FILE);
+    assert(p_index != NULL);
+
+    const char *started[] = { "started" };
+    const char *both[] = { "started", "seen" };
+    assert(seen_index_update(p_index, 1, 1, "/media/tv/show/e1.mkv", both, 2));
+    assert(seen_index_update(p_index, 1, 2, "/media/tv/show/e2.mkv", started, 1));
+    assert(seen_index_update(p_index, 1, 3, "/media/tv/other/e1.mkv", both, 2));
+    assert(seen_index_update(p_index, 1, 4, "/media/films/f.mkv", started, 1));
+
+    int i_calls = 0;
+    assert(seen_index_query(p_index, "/media/tv/", "seen", true, count_cb, &i_calls) == 2);
+    assert(i_calls == 2);
+    assert(seen_index_query(p_index, "/media/tv/", "seen", false, NULL, NULL) == 1);
+    assert(seen_index_query(p_index, "/media/tv/show/", NULL, true, NULL, NULL) == 2);
+    assert(seen_index_query(p_index, NULL, "started", true, NULL, NULL) == 4);
+    assert(seen_index_query(p_index, "", "unknown", true, NULL, NULL) == 0);
+    assert(seen_index_query(p_index, "", "unknown", false, NULL, NULL) == 4);
+
+    i_calls = 0;
+    assert(seen_index_query(p_index, NULL, NULL, true, stop_cb, &i_calls) == 1);
+    assert(i_calls == 1);
+    seen_index_close(p_index);
+    remove(INDEX_FILE);
+}
+
+static void test_rename_and_noop_update(void)
+{
+    remove(INDEX_FILE);
+    seen_index_t *p_index = seen_index_open(INDEX_FILE);
+    assert(p_index != NULL);
+
+    const char *seen[] = { "seen" };
+    assert(seen_index_update(p_index, 1, 1, "/media/old.mkv", seen, 1));
+    long size = file_size(INDEX_FILE);
+
+    // Nothing changed: nothing appended
+    assert(seen_index_update(p_index, 1, 1, "/media/old.mkv", seen, 1));
+    assert(file_size(INDEX_FILE) == size);
+
+    // Same inode under a new name
+    assert(seen_index_update(p_index, 1, 1, "/media/new.mkv", seen, 1));
+    assert(seen_index_count(p_index) == 1);
+    assert(seen_index_lookup_path(p_index, "/media/old.mkv") == NULL);
+    assert(seen_index_lookup_path(p_index, "/media/new.mkv") != NULL);
+    seen_index_close(p_index);
+    remove(INDEX_FILE);
+}
+
+static void test_compaction(void)
+{
+    remove(INDEX_FILE);
+    seen_index_t *p_index = seen_index_open(INDEX_FILE);
+    const char *started[] = { "started" };
+    const char *seen[] = { "seen" };
+    char path[64];
+    for (int i = 0; i < 300; i++) {
+        snprintf(path, sizeof(path), "/media/%d.mkv", i);
+        assert(seen_index_update(p_index, 7, (uint64_t)i, path, started, 1));
+    }
+    assert(!seen_index_needs_compaction(p_index));
+    for (int i = 0; i < 300; i++) {
+        snprintf(path, sizeof(path), "/media/renamed/%d.mkv", i);
+        assert(seen_index_update(p_index, 7, (uint64_t)i, path, seen, 1));
+    }
+    // Only one rename per file so far; another round tips the balance
+    for (int i = 0; i < 300; i++) {
+        snprintf(path, sizeof(path), "/media/final/%d.mkv", i);
+        assert(seen_index_update(p_index, 7, (uint64_t)i, path, seen, 1));
+    }
+    assert(seen_index_needs_compaction(p_index));
+
+    assert(seen_index_compact(p_index));
+    assert(!seen_index_needs_compaction(p_index));
+    assert(seen_index_count(p_index) == 300);
+
+    // Still appendable after the swap
+    assert(seen_index_update(p_index, 8, 1, "/media/new.mkv", seen, 1));
+    seen_index_close(p_index);
+
+    p_index = seen_index_open_readonly(INDEX_FILE);
+    assert(seen_index_count(p_index) == 301);
+    const seen_index_entry_t *p_entry = seen_index_lookup(p_index, 7, 123);
+    assert(strcmp(p_entry->psz_path, "/media/final/123.mkv") == 0);
+    assert(p_entry->i_tag_bits == 3);
+    assert(seen_index_query(p_index, "/media/final/", "seen", true, NULL, NULL) == 300);
+    seen_index_close(p_index);
+    remove(INDEX_FILE);
+}
+
+static void test_writers_share_tag_bits(void)
+{
+    remove(INDEX_FILE);
+    seen_index_t *p_writer = seen_index_open(INDEX_FILE);
+    seen_index_t *p_other = seen_index_open(INDEX_FILE);
+    assert(p_writer != NULL && p_other != NULL);
+
+    // A writer picks up the other one's tag records before assigning bits
+    const char *seen[] = { "seen" };
+    const char *both[] = { "started", "seen" };
+    assert(seen_index_update(p_writer, 1, 1, "/media/a.mkv", seen, 1));
+    assert(seen_index_update(p_other, 1, 2, "/media/b.mkv", both, 2));
+    assert(seen_index_tag_bit(p_other, "seen") == 0);
+    assert(seen_index_tag_bit(p_other, "started") == 1);
+    assert(seen_index_refresh(p_writer));
+    assert(seen_index_lookup(p_writer, 1, 2)->i_tag_bits == 3);
+
+    seen_index_close(p_other);
+    seen_index_close(p_writer);
+    remove(INDEX_FILE);
+}
+
+#ifndef _WIN32
+static bool concurrent_writer(int i_proc)
+{
+    seen_index_t *p_index = seen_index_open(INDEX_FILE);
+    char tag[16], path[64];
+    bool b_ok = p_index != NULL;
+    for (int i = 0; i < 200 && b_ok; i++) {
+        snprintf(tag, sizeof(tag), "p%d-%d", i_proc, i % 16);
+        snprintf(path, sizeof(path), "/media/%d/%d.mkv", i_proc, i);
+        const char *tags[] = { tag };
+        b_ok = seen_index_update(p_index, (uint64_t)i_proc, (uint64_t)i, path, tags, 1)
+            && (i % 50 != 49 || seen_index_compact(p_index));
+    }
+    seen_index_close(p_index);
+    return b_ok;
+}
+
+static void test_concurrent_writers(void)
+{
+    // Each process adds its own tags, racing the other's refresh, tag
+    // assignment and compaction
+    remove(INDEX_FILE);
+    run_writers(2, concurrent_writer);
+
+    // Every file carries exactly the bit of the tag its writer named
+    seen_index_t *p_index = seen_index_open_readonly(INDEX_FILE);
+    assert(seen_index_count(p_index) == 400);
+    char tag[16];
+    for (int i_proc = 0; i_proc < 2; i_proc++) {
+        for (int i = 0; i < 200; i++) {
+            snprintf(tag, sizeof(tag), "p%d-%d", i_proc, i % 16);
+            int i_bit = seen_index_tag_bit(p_index, tag);
+            const seen_index_entry_t *p_entry = seen_index_lookup(p_index, (uint64_t)i_proc, (uint64_t)i);
+            assert(i_bit >= 0 && p_entry != NULL);
+            assert(p_entry->i_tag_bits == UINT64_C(1) << i_bit);
+        }
+    }
+    seen_index_close(p_index);
+    remove(INDEX_FILE);
+}
+#endif
+
+static void test_hash_and_invalid_arguments(void)
+{
+    // FNV-1a reference values
+    assert(seen_index_hash_path("") == 0xcbf29ce484222325ull);
+    assert(seen_index_hash_path("a") == 0xaf63dc4c8601ec8cull);
+
+    assert(seen_index_open(NULL) == NULL);
+    assert(seen_index_open_readonly(NULL) == NULL);
+    assert(seen_index_open_readonly("does-not-exist.bin") == NULL);
+    assert(seen_index_count(NULL) == 0);
+    assert(seen_index_lookup(NULL, 1, 1) == NULL);
+    assert(seen_index_lookup_path(NULL, "/a") == NULL);
+    assert(seen_index_tag_bit(NULL, "seen") == -1);
+    assert(seen_index_query(NULL, NULL, NULL, true, NULL, NULL) == 0);
+    assert(!seen_index_update(NULL, 1, 1, "/a", NULL, 0));
+    assert(!seen_index_compact(NULL));
+    seen_index_close(NULL); // Should not crash
+}
+
+int main(void)
+{
+    test_update_lookup_reopen();
+    test_query();
+    test_rename_and_noop_update();
+    test_compaction();
+    test_writers_share_tag_bits();
+#ifndef _WIN32
+    test_concurrent_writers();
+#endif
+    test_hash_and_invalid_arguments();
+    remove(INDEX_FILE ".lock");
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,302 @@
+#include "../sidecar_store.h"
+#include "test_util.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STORE_FILE "sidecar_store_test.log"
+
+static bool has_value(const sidecar_store_t *p_store, uint64_t i_dev, uint64_t i_ino,
+                      const char *psz_path, const char *psz_key, const char *psz_expected)
+{
+    const void *p_value;
+    size_t i_len;
+    if (!sidecar_store_get(p_store, i_dev, i_ino, psz_path, psz_key, &p_value, &i_len))
+        return psz_expected == NULL;
+    return psz_expected != NULL && i_len == strlen(psz_expected) + 1
+        && memcmp(p_value, psz_expected, i_len) == 0;
+}
+
+static bool put(sidecar_store_t *p_store, uint64_t i_dev, uint64_t i_ino,
+                const char *psz_path, const char *psz_key, const char *psz_value)
+{
+    return sidecar_store_put(p_store, i_dev, i_ino, psz_path, psz_key, psz_value,
+                             strlen(psz_value) + 1);
+}
+
+static void test_put_get_commit_reopen(void)
+{
+    remove(STORE_FILE);
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    assert(p_store != NULL);
+    assert(sidecar_store_count(p_store) == 0);
+    long empty_size = file_size(STORE_FILE);
+
+    assert(put(p_store, 1, 100, "/mnt/usb/a.mkv", "user.xdg.tags", "started"));
+    assert(put(p_store, 1, 100, "/mnt/usb/a.mkv", "user.vlc.position", "754.120"));
+    assert(put(p_store, 1, 101, "/mnt/usb/b.mkv", "user.xdg.tags", "started"));
+    assert(put(p_store, 1, 100, "/mnt/usb/a.mkv", "user.xdg.tags", "started,seen"));
+    assert(sidecar_store_count(p_store) == 3);
+
+    // Visible at once, but only written by the commit, in one group
+    assert(has_value(p_store, 1, 100, "/mnt/usb/a.mkv", "user.xdg.tags", "started,seen"));
+    assert(has_value(p_store, 1, 100, "/mnt/usb/a.mkv", "user.vlc.position", "754.120"));
+    assert(has_value(p_store, 1, 101, "/mnt/usb/b.mkv", "user.xdg.tags", "started"));
+    assert(has_value(p_store, 1, 102, "/mnt/usb/c.mkv", "user.xdg.tags", NULL));
+    assert(has_value(p_store, 1, 101, "/mnt/usb/b.mkv", "user.vlc.position", NULL));
+    assert(sidecar_store_pending(p_store) == 4);
+    assert(file_size(STORE_FILE) == empty_size);
+    assert(sidecar_store_commit(p_store));
+    assert(sidecar_store_pending(p_store) == 0);
+    assert(file_size(STORE_FILE) > empty_size);
+    assert(sidecar_store_commit(p_store)); // Nothing to do
+
+    // Closing commits what is still buffered
+    assert(put(p_store, 2, 7, "/mnt/ntfs/c.mkv", "user.xdg.tags", "seen"));
+    sidecar_store_close(p_store);
+
+    p_store = sidecar_store_open(STORE_FILE);
+    assert(p_store != NULL);
+    assert(sidecar_store_count(p_store) == 4);
+    assert(has_value(p_store, 1, 100, "/mnt/usb/a.mkv", "user.xdg.tags", "started,seen"));
+    assert(has_value(p_store, 2, 7, "/mnt/ntfs/c.mkv", "user.xdg.tags", "seen"));
+    sidecar_store_close(p_store);
+    remove(STORE_FILE);
+}
+
+static void test_identity_changes(void)
+{
+    remove(STORE_FILE);
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    assert(put(p_store, 1, 100, "/mnt/usb/a.mkv", "user.xdg.tags", "seen"));
+
+    // Remounted: new device and inode numbers, same path
+    assert(has_value(p_store, 9, 555, "/mnt/usb/a.mkv", "user.xdg.tags", "seen"));
+    assert(put(p_store, 9, 555, "/mnt/usb/a.mkv", "user.xdg.tags", "seen,liked"));
+    assert(sidecar_store_count(p_store) == 1);
+    assert(has_value(p_store, 1, 100, "/elsewhere.mkv", "user.xdg.tags", NULL));
+
+    // Renamed on the same mount: found by inode, then moved to the new path
+    assert(has_value(p_store, 9, 555, "/mnt/usb/renamed.mkv", "user.xdg.tags", "seen,liked"));
+    assert(put(p_store, 9, 555, "/mnt/usb/renamed.mkv", "user.xdg.tags", "seen,liked,kept"));
+    assert(sidecar_store_count(p_store) == 1);
+    assert(has_value(p_store, 3, 3, "/mnt/usb/a.mkv", "user.xdg.tags", NULL));
+
+    // A new file reusing a stale inode number takes it over
+    assert(put(p_store, 4, 1, "/mnt/fat/x.mkv", "user.xdg.tags", "x"));
+    assert(put(p_store, 4, 2, "/mnt/fat/y.mkv", "user.xdg.tags", "y"));
+    assert(put(p_store, 4, 1, "/mnt/fat/y.mkv", "user.xdg.tags", "y2"));
+    assert(sidecar_store_count(p_store) == 2);
+    assert(has_value(p_store, 4, 1, "/mnt/fat/y.mkv", "user.xdg.tags", "y2"));
+    assert(has_value(p_store, 5, 5, "/mnt/fat/x.mkv", "user.xdg.tags", NULL));
+    sidecar_store_close(p_store);
+
+    // Replaying the log gives the same result
+    p_store = sidecar_store_open(STORE_FILE);
+    assert(sidecar_store_count(p_store) == 2);
+    assert(has_value(p_store, 9, 555, "/mnt/usb/renamed.mkv", "user.xdg.tags", "seen,liked,kept"));
+    assert(has_value(p_store, 4, 1, "/mnt/fat/y.mkv", "user.xdg.tags", "y2"));
+    sidecar_store_close(p_store);
+    remove(STORE_FILE);
+}
+
+static void test_torn_tail(void)
+{
+    remove(STORE_FILE);
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    assert(put(p_store, 1, 1, "/media/a.mkv", "user.xdg.tags", "seen"));
+    assert(sidecar_store_commit(p_store));
+
+    // A crashed writer's torn group is compacted away under the buffered puts
+    append_torn_record(STORE_FILE);
+    assert(put(p_store, 1, 2, "/media/b.mkv", "user.xdg.tags", "seen"));
+    assert(sidecar_store_commit(p_store));
+    assert(sidecar_store_pending(p_store) == 0);
+    sidecar_store_close(p_store);
+
+    p_store = sidecar_store_open(STORE_FILE);
+    assert(sidecar_store_count(p_store) == 2);
+    assert(has_value(p_store, 1, 2, "/media/b.mkv", "user.xdg.tags", "seen"));
+    sidecar_store_close(p_store);
+    remove(STORE_FILE);
+}
+
+static void test_compaction(void)
+{
+    remove(STORE_FILE);
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    char path[64];
+    char value[32];
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 300; i++) {
+            snprintf(path, sizeof(path), "/media/%d.mkv", i);
+            snprintf(value, sizeof(value), "round%d", round);
+            assert(put(p_store, 7, (uint64_t)i, path, "user.xdg.tags", value));
+        }
+        assert(sidecar_store_commit(p_store));
+        // One superseded value per file is not enough yet
+        assert(sidecar_store_needs_compaction(p_store) == (round == 2));
+    }
+
+    assert(put(p_store, 8, 1, "/media/pending.mkv", "user.xdg.tags", "seen"));
+    assert(sidecar_store_compact(p_store));
+    assert(sidecar_store_pending(p_store) == 0);
+    assert(!sidecar_store_needs_compaction(p_store));
+    assert(sidecar_store_count(p_store) == 301);
+
+    // Still appendable after the swap
+    assert(put(p_store, 8, 2, "/media/new.mkv", "user.xdg.tags", "seen"));
+    sidecar_store_close(p_store);
+
+    p_store = sidecar_store_open(STORE_FILE);
+    assert(sidecar_store_count(p_store) == 302);
+    assert(has_value(p_store, 7, 123, "/media/123.mkv", "user.xdg.tags", "round2"));
+    assert(has_value(p_store, 8, 1, "/media/pending.mkv", "user.xdg.tags", "seen"));
+    sidecar_store_close(p_store);
+    remove(STORE_FILE);
+}
+
+static void test_refresh_sees_other_writer(void)
+{
+    remove(STORE_FILE);
+    sidecar_store_t *p_one = sidecar_store_open(STORE_FILE);
+    sidecar_store_t *p_two = sidecar_store_open(STORE_FILE);
+    assert(p_one != NULL && p_two != NULL);
+
+    assert(put(p_one, 1, 1, "/media/a.mkv", "user.xdg.tags", "seen"));
+    assert(sidecar_store_commit(p_one));
+    assert(sidecar_store_count(p_two) == 0);
+    assert(sidecar_store_refresh(p_two));
+    assert(has_value(p_two, 1, 1, "/media/a.mkv", "user.xdg.tags", "seen"));
+
+    // Compaction by one keeps the other's buffered puts and later commits
+    assert(put(p_two, 1, 2, "/media/b.mkv", "user.xdg.tags", "seen"));
+    assert(sidecar_store_compact(p_one));
+    assert(sidecar_store_commit(p_two));
+    assert(sidecar_store_refresh(p_one));
+    assert(has_value(p_one, 1, 2, "/media/b.mkv", "user.xdg.tags", "seen"));
+    assert(put(p_two, 1, 3, "/media/c.mkv", "user.xdg.tags", "seen"));
+    assert(sidecar_store_refresh(p_one)); // Swaps in the compacted file under p_two's puts
+    assert(sidecar_store_commit(p_two));
+    assert(sidecar_store_refresh(p_one));
+    assert(sidecar_store_count(p_one) == 3);
+
+    sidecar_store_close(p_one);
+    sidecar_store_close(p_two);
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    assert(sidecar_store_count(p_store) == 3);
+    sidecar_store_close(p_store);
+    remove(STORE_FILE);
+}
+
+#ifndef _WIN32
+static bool concurrent_writer(int i_proc)
+{
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    char path[64];
+    bool b_ok = p_store != NULL;
+    for (int i = 0; i < 300 && b_ok; i++) {
+        snprintf(path, sizeof(path), "/media/%d/%d.mkv", i_proc, i);
+        b_ok = put(p_store, (uint64_t)i_proc, (uint64_t)i, path, "user.xdg.tags", "seen")
+            && (i % 3 != 2 || sidecar_store_commit(p_store))
+            && (i % 60 != 59 || sidecar_store_compact(p_store));
+        if (b_ok && i % 100 == 99) {
+            sidecar_store_close(p_store);
+            p_store = sidecar_store_open(STORE_FILE);
+            b_ok = p_store != NULL;
+        }
+    }
+    sidecar_store_close(p_store);
+    return b_ok;
+}
+
+static void test_concurrent_writers(void)
+{
+    // Each process commits its own values in small groups, racing the
+    // other's commits, compactions and opens
+    remove(STORE_FILE);
+    run_writers(2, concurrent_writer);
+
+    // Nothing either process committed was lost
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    assert(sidecar_store_count(p_store) == 600);
+    char path[64];
+    for (int i_proc = 0; i_proc < 2; i_proc++) {
+        for (int i = 0; i < 300; i++) {
+            snprintf(path, sizeof(path), "/media/%d/%d.mkv", i_proc, i);
+            assert(has_value(p_store, (uint64_t)i_proc, (uint64_t)i, path, "user.xdg.tags", "seen"));
+        }
+    }
+    sidecar_store_close(p_store);
+    remove(STORE_FILE);
+}
+#endif
+
+static void test_many_entries(void)
+{
+    remove(STORE_FILE);
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    char path[64];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(path, sizeof(path), "/media/library/%d.mkv", i);
+        assert(put(p_store, (uint64_t)(i % 3), (uint64_t)i, path, "user.xdg.tags", "seen"));
+    }
+    assert(sidecar_store_count(p_store) == 5000);
+    for (int i = 0; i < 5000; i++) {
+        snprintf(path, sizeof(path), "/media/library/%d.mkv", i);
+        assert(has_value(p_store, (uint64_t)(i % 3), (uint64_t)i, path, "user.xdg.tags", "seen"));
+    }
+    sidecar_store_close(p_store);
+    remove(STORE_FILE);
+}
+
+static void test_invalid_arguments(void)
+{
+    const void *p_value;
+    size_t i_len;
+    assert(sidecar_store_open(NULL) == NULL);
+    assert(!sidecar_store_get(NULL, 1, 1, "/a", "k", &p_value, &i_len));
+    assert(!sidecar_store_put(NULL, 1, 1, "/a", "k", "v", 1));
+    assert(sidecar_store_pending(NULL) == 0);
+    assert(sidecar_store_count(NULL) == 0);
+    assert(!sidecar_store_commit(NULL));
+    assert(!sidecar_store_refresh(NULL));
+    assert(!sidecar_store_needs_compaction(NULL));
+    assert(!sidecar_store_compact(NULL));
+    sidecar_store_close(NULL); // Should not crash
+
+    remove(STORE_FILE);
+    sidecar_store_t *p_store = sidecar_store_open(STORE_FILE);
+    assert(!sidecar_store_put(p_store, 1, 1, NULL, "k", "v", 1));
+    assert(!sidecar_store_put(p_store, 1, 1, "/a", NULL, "v", 1));
+    size_t i_huge = 2u << 20;
+    char *p_huge = calloc(1, i_huge);
+    assert(p_huge != NULL);
+    assert(!sidecar_store_put(p_store, 1, 1, "/a", "k", p_huge, i_huge));
+    free(p_huge);
+    // An empty value is a value
+    assert(sidecar_store_put(p_store, 1, 1, "/a", "k", "", 0));
+    assert(sidecar_store_get(p_store, 1, 1, "/a", "k", &p_value, &i_len) && i_len == 0);
+    sidecar_store_close(p_store);
+    remove(STORE_FILE);
+}
+
+int main(void)
+{
+    test_put_get_commit_reopen();
+    test_identity_changes();
+    test_torn_tail();
+    test_compaction();
+    test_refresh_sees_other_writer();
+#ifndef _WIN32
+    test_concurrent_writers();
+#endif
+    test_many_entries();
+    test_invalid_arguments();
+    remove(STORE_FILE ".lock");
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include "../tag_cache.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/stat.h>
+#endif
+
+#define WATCH_FILE "tag_cache_test.tmp"
+
+static void test_store_lookup_invalidate(void)
+{
+    tag_cache_t *p_cache = tag_cache_new(4, false);
+    assert(p_cache != NULL);
+    assert(!tag_cache_is_watching(p_cache));
+
+    bool b_recheck = false;
+    assert(tag_cache_lookup(p_cache, 1, 10, &b_recheck) == NULL);
+    assert(b_recheck);
+
+    assert(tag_cache_store(p_cache, 1, 10, 100, 5, NULL, "seen,started", 12));
+    const tag_cache_entry_t *p_entry = tag_cache_lookup(p_cache, 1, 10, &b_recheck);
+    assert(p_entry != NULL);
+    assert(strcmp(p_entry->psz_tags, "seen,started") == 0);
+    assert(p_entry->i_len == 12);
+    assert(p_entry->i_ctime_sec == 100 && p_entry->i_ctime_nsec == 5);
+    // Without a watch, every hit must be checked against ctime
+    assert(b_recheck);
+
+    // Same inode on another device is another file
+    assert(tag_cache_lookup(p_cache, 2, 10, NULL) == NULL);
+
+    // Lengths stop at the first NUL, as stored in the xattr
+    assert(tag_cache_store(p_cache, 1, 10, 101, 0, NULL, "seen\0junk", 9));
+    p_entry = tag_cache_lookup(p_cache, 1, 10, NULL);
+    assert(p_entry != NULL && p_entry->i_len == 4 && strcmp(p_entry->psz_tags, "seen") == 0);
+    assert(p_entry->i_ctime_sec == 101);
+    assert(tag_cache_count(p_cache) == 1);
+
+    tag_cache_invalidate(p_cache, 1, 10);
+    assert(tag_cache_lookup(p_cache, 1, 10, NULL) == NULL);
+    assert(tag_cache_count(p_cache) == 0);
+    tag_cache_invalidate(p_cache, 1, 10); // Missing entries are ignored
+
+    tag_cache_free(p_cache);
+}
+
+static void test_lru_eviction(void)
+{
+    tag_cache_t *p_cache = tag_cache_new(3, false);
+    assert(p_cache != NULL);
+
+    for (uint64_t i = 1; i <= 3; i++)
+        assert(tag_cache_store(p_cache, 1, i, 0, 0, NULL, "seen", 4));
+    assert(tag_cache_count(p_cache) == 3);
+
+    // Touch 1 so 2 becomes the least recently used
+    assert(tag_cache_lookup(p_cache, 1, 1, NULL) != NULL);
+    assert(tag_cache_store(p_cache, 1, 4, 0, 0, NULL, "started", 7));
+    assert(tag_cache_count(p_cache) == 3);
+    assert(tag_cache_lookup(p_cache, 1, 2, NULL) == NULL);
+    assert(tag_cache_lookup(p_cache, 1, 1, NULL) != NULL);
+    assert(tag_cache_lookup(p_cache, 1, 3, NULL) != NULL);
+    assert(tag_cache_lookup(p_cache, 1, 4, NULL) != NULL);
+
+    // Churn well past capacity keeps the table consistent
+    for (uint64_t i = 100; i < 1100; i++) {
+        assert(tag_cache_store(p_cache, i % 7, i, 0, 0, NULL, "seen", 4));
+        if (i % 3 == 0)
+            tag_cache_invalidate(p_cache, (i - 1) % 7, i - 1);
+        assert(tag_cache_count(p_cache) <= 3);
+        assert(tag_cache_lookup(p_cache, i % 7, i, NULL) != NULL);
+    }
+
+    tag_cache_free(p_cache);
+}
+
+static void test_clear(void)
+{
+    tag_cache_t *p_cache = tag_cache_new(8, false);
+    assert(p_cache != NULL);
+
+    for (uint64_t i = 1; i <= 5; i++)
+        assert(tag_cache_store(p_cache, 1, i, 0, 0, NULL, "seen", 4));
+    tag_cache_clear(p_cache);
+    assert(tag_cache_count(p_cache) == 0);
+    for (uint64_t i = 1; i <= 5; i++)
+        assert(tag_cache_lookup(p_cache, 1, i, NULL) == NULL);
+
+    // Still usable afterwards, up to its full capacity
+    for (uint64_t i = 1; i <= 8; i++)
+        assert(tag_cache_store(p_cache, 2, i, 0, 0, NULL, "started", 7));
+    assert(tag_cache_count(p_cache) == 8);
+    assert(tag_cache_lookup(p_cache, 2, 8, NULL) != NULL);
+
+    tag_cache_free(p_cache);
+}
+
+static void test_invalid_arguments(void)
+{
+    assert(tag_cache_new(0, false) == NULL);
+    assert(!tag_cache_store(NULL, 1, 1, 0, 0, NULL, "seen", 4));
+    assert(tag_cache_lookup(NULL, 1, 1, NULL) == NULL);
+    assert(tag_cache_count(NULL) == 0);
+    assert(!tag_cache_is_watching(NULL));
+    tag_cache_poll(NULL);
+    tag_cache_confirm(NULL, 1, 1);
+    tag_cache_invalidate(NULL, 1, 1);
+    tag_cache_clear(NULL);
+    tag_cache_free(NULL); // Should not crash
+}
+
+#ifdef __linux__
+static void test_watch_reports_changes(void)
+{
+    FILE *f = fopen(WATCH_FILE, "w");
+    assert(f != NULL);
+    fclose(f);
+    struct stat st;
+    assert(stat(WATCH_FILE, &st) == 0);
+
+    tag_cache_t *p_cache = tag_cache_new(4, true);
+    assert(p_cache != NULL);
+    if (!tag_cache_is_watching(p_cache)) {
+        printf("inotify unavailable, skipping watch test\n");
+        tag_cache_free(p_cache);
+        remove(WATCH_FILE);
+        return;
+    }
+
+    assert(tag_cache_store(p_cache, (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+                           (int64_t)st.st_ctime, 0, WATCH_FILE, "seen", 4));
+    bool b_recheck = true;
+    tag_cache_poll(p_cache);
+    assert(tag_cache_lookup(p_cache, (uint64_t)st.st_dev, (uint64_t)st.st_ino, &b_recheck) != NULL);
+    assert(!b_recheck);
+
+    // Any attribute change (xattrs included) raises IN_ATTRIB
+    assert(chmod(WATCH_FILE, 0600) == 0);
+    tag_cache_poll(p_cache);
+    assert(tag_cache_lookup(p_cache, (uint64_t)st.st_dev, (uint64_t)st.st_ino, &b_recheck) != NULL);
+    assert(b_recheck);
+
+    tag_cache_confirm(p_cache, (uint64_t)st.st_dev, (uint64_t)st.st_ino);
+    assert(tag_cache_lookup(p_cache, (uint64_t)st.st_dev, (uint64_t)st.st_ino, &b_recheck) != NULL);
+    assert(!b_recheck);
+
+    // A deleted file loses its watch and is never trusted again
+    remove(WATCH_FILE);
+    tag_cache_poll(p_cache);
+    assert(tag_cache_lookup(p_cache, (uint64_t)st.st_dev, (uint64_t)st.st_ino, &b_recheck) != NULL);
+    assert(b_recheck);
+    tag_cache_confirm(p_cache, (uint64_t)st.st_dev, (uint64_t)st.st_ino);
+    assert(tag_cache_lookup(p_cache, (uint64_t)st.st_dev, (uint64_t)st.st_ino, &b_recheck) != NULL);
+    assert(b_recheck);
+
+    tag_cache_free(p_cache);
+}
+#endif
+
+int main(void)
+{
+    test_store_lookup_invalidate();
+    test_lru_eviction();
+    test_clear();
+    test_invalid_arguments();
+#ifdef __linux__
+    test_watch_reports_changes();
+#endif
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include "../tag_journal.h"
+#include "test_util.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOURNAL_FILE "tag_journal_test.log"
+
+static void test_retryable(void)
+{
+    assert(tag_journal_is_retryable(EROFS));
+    assert(tag_journal_is_retryable(ENOSPC));
+    assert(tag_journal_is_retryable(EIO));
+    assert(!tag_journal_is_retryable(EACCES));
+    assert(!tag_journal_is_retryable(ENOENT));
+    assert(!tag_journal_is_retryable(0));
+}
+
+static void test_append_complete_reopen(void)
+{
+    remove(JOURNAL_FILE);
+    tag_journal_t *p_journal = tag_journal_open(JOURNAL_FILE);
+    assert(p_journal != NULL);
+    assert(tag_journal_count(p_journal) == 0);
+
+    const char *tags[] = { "started", "seen" };
+    uint64_t id1 = 0, id2 = 0;
+    assert(tag_journal_append(p_journal, "/media/a.mkv", "user.xdg.tags", tags, 2, &id1));
+    assert(tag_journal_append(p_journal, "/media/b.mkv", "user.xdg.tags", tags + 1, 1, &id2));
+    assert(id2 > id1);
+    assert(tag_journal_count(p_journal) == 2);
+
+    const tag_journal_entry_t *p_entry = tag_journal_get(p_journal, 0);
+    assert(strcmp(p_entry->psz_path, "/media/a.mkv") == 0);
+    assert(strcmp(p_entry->psz_key, "user.xdg.tags") == 0);
+    assert(strcmp(p_entry->psz_tags, "started,seen") == 0);
+    assert(tag_journal_get(p_journal, 2) == NULL);
+
+    assert(tag_journal_complete(p_journal, id1));
+    assert(!tag_journal_complete(p_journal, id1));
+    assert(tag_journal_count(p_journal) == 1);
+    tag_journal_close(p_journal);
+
+    // Only the entry that was never completed survives a restart
+    p_journal = tag_journal_open(JOURNAL_FILE);
+    assert(p_journal != NULL);
+    assert(tag_journal_count(p_journal) == 1);
+    p_entry = tag_journal_get(p_journal, 0);
+    assert(p_entry->i_id == id2);
+    assert(strcmp(p_entry->psz_path, "/media/b.mkv") == 0);
+    assert(strcmp(p_entry->psz_tags, "seen") == 0);
+
+    // New ids never reuse old ones
+    uint64_t id3 = 0;
+    assert(tag_journal_append(p_journal, "/media/c.mkv", "user.xdg.tags", tags, 1, &id3));
+    assert(id3 > id2);
+    tag_journal_close(p_journal);
+    remove(JOURNAL_FILE);
+}
+
+static void test_compaction(void)
+{
+    remove(JOURNAL_FILE);
+    tag_journal_t *p_journal = tag_journal_open(JOURNAL_FILE);
+    const char *tag = "seen";
+    assert(!tag_journal_needs_compaction(p_journal));
+
+    for (int i = 0; i < 100; i++) {
+        uint64_t id;
+        assert(tag_journal_append(p_journal, "/media/a.mkv", "user.xdg.tags", &tag, 1, &id));
+        assert(tag_journal_complete(p_journal, id));
+    }
+    assert(tag_journal_append(p_journal, "/media/keep.mkv", "user.xdg.tags", &tag, 1, NULL));
+    assert(tag_journal_needs_compaction(p_journal));
+
+    long before = file_size(JOURNAL_FILE);
+    assert(tag_journal_compact(p_journal));
+    assert(!tag_journal_needs_compaction(p_journal));
+    assert(file_size(JOURNAL_FILE) < before);
+    assert(tag_journal_count(p_journal) == 1);
+
+    // Appends keep working after the file was swapped
+    assert(tag_journal_append(p_journal, "/media/next.mkv", "user.xdg.tags", &tag, 1, NULL));
+    tag_journal_close(p_journal);
+
+    p_journal = tag_journal_open(JOURNAL_FILE);
+    assert(tag_journal_count(p_journal) == 2);
+    assert(strcmp(tag_journal_get(p_journal, 0)->psz_path, "/media/keep.mkv") == 0);
+    assert(strcmp(tag_journal_get(p_journal, 1)->psz_path, "/media/next.mkv") == 0);
+    uint64_t last_id = tag_journal_get(p_journal, 1)->i_id;
+
+    // Once everything is written the journal compacts to nothing
+    assert(tag_journal_complete(p_journal, tag_journal_get(p_journal, 0)->i_id));
+    assert(tag_journal_complete(p_journal, tag_journal_get(p_journal, 0)->i_id));
+    assert(tag_journal_needs_compaction(p_journal));
+    assert(tag_journal_compact(p_journal));
+    tag_journal_close(p_journal);
+
+    // ... but ids carry on where they were
+    p_journal = tag_journal_open(JOURNAL_FILE);
+    assert(tag_journal_count(p_journal) == 0);
+    uint64_t id;
+    assert(tag_journal_append(p_journal, "/media/later.mkv", "user.xdg.tags", &tag, 1, &id));
+    assert(id > last_id);
+    tag_journal_close(p_journal);
+    remove(JOURNAL_FILE);
+}
+
+static void test_shared_between_instances(void)
+{
+    remove(JOURNAL_FILE);
+    tag_journal_t *p_one = tag_journal_open(JOURNAL_FILE);
+    tag_journal_t *p_two = tag_journal_open(JOURNAL_FILE);
+    assert(p_one != NULL && p_two != NULL);
+    const char *tag = "seen";
+
+    // Ids are assigned from both instances' records
+    uint64_t id1, id2;
+    assert(tag_journal_append(p_one, "/media/a.mkv", "user.xdg.tags", &tag, 1, &id1));
+    assert(tag_journal_append(p_two, "/media/b.mkv", "user.xdg.tags", &tag, 1, &id2));
+    assert(id2 > id1);
+    assert(tag_journal_count(p_two) == 2);
+    assert(tag_journal_count(p_one) == 1);
+    assert(tag_journal_refresh(p_one));
+    assert(tag_journal_count(p_one) == 2);
+
+    // An entry replayed by one is no longer pending for the other
+    assert(tag_journal_complete(p_one, id2));
+    assert(tag_journal_find(p_two, id2) != NULL);
+    assert(tag_journal_refresh(p_two));
+    assert(tag_journal_find(p_two, id2) == NULL);
+    assert(!tag_journal_complete(p_two, id2));
+    assert(strcmp(tag_journal_find(p_two, id1)->psz_path, "/media/a.mkv") == 0);
+
+    // Compaction by one keeps what the other appended meanwhile
+    uint64_t id3;
+    assert(tag_journal_append(p_two, "/media/c.mkv", "user.xdg.tags", &tag, 1, &id3));
+    assert(tag_journal_compact(p_one));
+    assert(tag_journal_count(p_one) == 2);
+    assert(tag_journal_refresh(p_two));
+    assert(tag_journal_find(p_two, id3) != NULL);
+
+    tag_journal_close(p_one);
+    tag_journal_close(p_two);
+    remove(JOURNAL_FILE);
+}
+
+#ifndef _WIN32
+static bool concurrent_writer(int i_proc)
+{
+    tag_journal_t *p_journal = tag_journal_open(JOURNAL_FILE);
+    char path[64];
+    const char *tag = "seen";
+    bool b_ok = p_journal != NULL;
+    for (int i = 0; i < 200 && b_ok; i++) {
+        uint64_t id;
+        snprintf(path, sizeof(path), "/media/%d/%d.mkv", i_proc, i);
+        b_ok = tag_journal_append(p_journal, path, "user.xdg.tags", &tag, 1, &id)
+            && (i % 2 == 0 || tag_journal_complete(p_journal, id))
+            && (i % 50 != 49 || tag_journal_compact(p_journal));
+    }
+    tag_journal_close(p_journal);
+    return b_ok;
+}
+
+static void test_concurrent_writers(void)
+{
+    // Two processes append, complete and compact at once: every entry left
+    // pending survives, under an id of its own
+    remove(JOURNAL_FILE);
+    run_writers(2, concurrent_writer);
+    tag_journal_t *p_journal = tag_journal_open(JOURNAL_FILE);
+    assert(tag_journal_count(p_journal) == 200);
+    for (size_t i = 1; i < tag_journal_count(p_journal); i++)
+        for (size_t j = 0; j < i; j++)
+            assert(tag_journal_get(p_journal, i)->i_id != tag_journal_get(p_journal, j)->i_id);
+    tag_journal_close(p_journal);
+    remove(JOURNAL_FILE);
+}
+#endif
+
+static void test_invalid_arguments(void)
+{
+    assert(tag_journal_open(NULL) == NULL);
+    assert(tag_journal_count(NULL) == 0);
+    assert(tag_journal_get(NULL, 0) == NULL);
+    assert(!tag_journal_append(NULL, "/a", "user.xdg.tags", NULL, 0, NULL));
+    assert(!tag_journal_complete(NULL, 1));
+    assert(!tag_journal_refresh(NULL));
+    assert(tag_journal_find(NULL, 1) == NULL);
+    tag_journal_close(NULL); // Should not crash
+}
+
+int main(void)
+{
+    test_retryable();
+    test_append_complete_reopen();
+    test_compaction();
+    test_shared_between_instances();
+#ifndef _WIN32
+    test_concurrent_writers();
+#endif
+    test_invalid_arguments();
+    remove(JOURNAL_FILE ".lock");
+
+    printf("All tests passed\n");
+    return 0;
+}
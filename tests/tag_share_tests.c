@@ -0,0 +1,176 @@
+#include "../tag_share.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KEY "user.xdg.tags"
+
+static char psz_name[64];
+
+static void sleep_ms(long i_ms)
+{
+    struct timespec ts = { i_ms / 1000, (i_ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+/* Map the raw segment, as a peer with its own view of the layout would */
+static tag_share_header_t *map_raw(size_t i_slots)
+{
+    int fd = shm_open(psz_name, O_RDWR, 0600);
+    assert(fd >= 0);
+    void *p_map = mmap(NULL, sizeof(tag_share_header_t) + i_slots * sizeof(tag_share_slot_t),
+                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(p_map != MAP_FAILED);
+    return p_map;
+}
+
+static void unmap_raw(tag_share_header_t *p_header, size_t i_slots)
+{
+    munmap(p_header, sizeof(tag_share_header_t) + i_slots * sizeof(tag_share_slot_t));
+}
+
+static void test_publish_contains(void)
+{
+    tag_share_unlink(psz_name);
+    tag_share_t *p_share = tag_share_open(psz_name, 64, 60000);
+    assert(p_share != NULL);
+    assert(tag_share_slots(p_share) == 64);
+
+    assert(!tag_share_contains(p_share, 1, 10, 100, 5, KEY, "seen"));
+    tag_share_publish(p_share, 1, 10, 100, 5, KEY, "seen");
+    assert(tag_share_contains(p_share, 1, 10, 100, 5, KEY, "seen"));
+
+    // Any other file, ctime, key or tag is a miss
+    assert(!tag_share_contains(p_share, 2, 10, 100, 5, KEY, "seen"));
+    assert(!tag_share_contains(p_share, 1, 11, 100, 5, KEY, "seen"));
+    assert(!tag_share_contains(p_share, 1, 10, 100, 6, KEY, "seen"));
+    assert(!tag_share_contains(p_share, 1, 10, 101, 5, KEY, "seen"));
+    assert(!tag_share_contains(p_share, 1, 10, 100, 5, "user.other", "seen"));
+    assert(!tag_share_contains(p_share, 1, 10, 100, 5, KEY, "started"));
+    assert(tag_share_hash(KEY, "seen") != tag_share_hash(KEY "s", "een"));
+
+    // Republishing after our own write moves the entry to the new ctime
+    tag_share_publish(p_share, 1, 10, 102, 0, KEY, "seen");
+    assert(tag_share_contains(p_share, 1, 10, 102, 0, KEY, "seen"));
+    assert(!tag_share_contains(p_share, 1, 10, 100, 5, KEY, "seen"));
+
+    // A second mapping, as another process would have, sees the same entries
+    tag_share_t *p_peer = tag_share_open(psz_name, 64, 60000);
+    assert(p_peer != NULL);
+    assert(tag_share_contains(p_peer, 1, 10, 102, 0, KEY, "seen"));
+    tag_share_publish(p_peer, 3, 30, 7, 0, KEY, "started");
+    assert(tag_share_contains(p_share, 3, 30, 7, 0, KEY, "started"));
+    tag_share_close(p_peer);
+
+    tag_share_close(p_share);
+    tag_share_unlink(psz_name);
+}
+
+static void test_ttl_and_eviction(void)
+{
+    tag_share_unlink(psz_name);
+    tag_share_t *p_share = tag_share_open(psz_name, 1, 0);
+    assert(p_share != NULL);
+
+    tag_share_publish(p_share, 1, 1, 0, 0, KEY, "seen");
+    sleep_ms(5);
+    assert(!tag_share_contains(p_share, 1, 1, 0, 0, KEY, "seen"));
+    tag_share_close(p_share);
+
+    // With a single slot, a new entry replaces the oldest one
+    p_share = tag_share_open(psz_name, 1, 60000);
+    assert(p_share != NULL);
+    tag_share_publish(p_share, 1, 1, 0, 0, KEY, "seen");
+    tag_share_publish(p_share, 2, 2, 0, 0, KEY, "seen");
+    assert(!tag_share_contains(p_share, 1, 1, 0, 0, KEY, "seen"));
+    assert(tag_share_contains(p_share, 2, 2, 0, 0, KEY, "seen"));
+
+    tag_share_close(p_share);
+    tag_share_unlink(psz_name);
+}
+
+static void test_crashed_peer(void)
+{
+    tag_share_unlink(psz_name);
+    tag_share_t *p_share = tag_share_open(psz_name, 1, 60000);
+    assert(p_share != NULL);
+    tag_share_publish(p_share, 1, 1, 0, 0, KEY, "seen");
+
+    tag_share_header_t *p_header = map_raw(1);
+    tag_share_slot_t *p_slot = (tag_share_slot_t *)(p_header + 1);
+
+    // A peer died with the slot claimed: readers skip it
+    uint64_t i_seq = atomic_load(&p_slot->i_seq);
+    assert(i_seq != 0 && (i_seq & 1) == 0);
+    atomic_store(&p_slot->i_seq, i_seq + 1);
+    assert(!tag_share_contains(p_share, 1, 1, 0, 0, KEY, "seen"));
+
+    // A fresh claim is respected, an old one is taken over
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    atomic_store(&p_slot->i_claimed_ms, (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+    tag_share_publish(p_share, 2, 2, 0, 0, KEY, "seen");
+    assert(!tag_share_contains(p_share, 2, 2, 0, 0, KEY, "seen"));
+    atomic_store(&p_slot->i_claimed_ms, 0);
+    tag_share_publish(p_share, 2, 2, 0, 0, KEY, "seen");
+    assert(tag_share_contains(p_share, 2, 2, 0, 0, KEY, "seen"));
+    assert((atomic_load(&p_slot->i_seq) & 1) == 0);
+
+    // A peer that wrote into the slot after losing it leaves a torn entry
+    atomic_store(&p_slot->i_ino, 3);
+    assert(!tag_share_contains(p_share, 2, 2, 0, 0, KEY, "seen"));
+    assert(!tag_share_contains(p_share, 2, 3, 0, 0, KEY, "seen"));
+    tag_share_publish(p_share, 2, 2, 0, 0, KEY, "seen");
+    assert(tag_share_contains(p_share, 2, 2, 0, 0, KEY, "seen"));
+
+    unmap_raw(p_header, 1);
+    tag_share_close(p_share);
+    tag_share_unlink(psz_name);
+}
+
+static void test_foreign_segment(void)
+{
+    tag_share_unlink(psz_name);
+    tag_share_t *p_share = tag_share_open(psz_name, 4, 60000);
+    assert(p_share != NULL);
+    tag_share_close(p_share);
+
+    // Another layout version is left alone
+    tag_share_header_t *p_header = map_raw(4);
+    atomic_store(&p_header->i_magic, TAG_SHARE_MAGIC + 1);
+    unmap_raw(p_header, 4);
+    assert(tag_share_open(psz_name, 4, 60000) == NULL);
+    tag_share_unlink(psz_name);
+
+    assert(tag_share_open(NULL, 4, 60000) == NULL);
+    assert(tag_share_open(psz_name, 0, 60000) == NULL);
+    tag_share_close(NULL); // Should not crash
+    assert(tag_share_slots(NULL) == 0);
+    assert(!tag_share_contains(NULL, 1, 1, 0, 0, KEY, "seen"));
+    tag_share_publish(NULL, 1, 1, 0, 0, KEY, "seen");
+}
+#endif
+
+int main(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    snprintf(psz_name, sizeof(psz_name), "/tag_share_test-%ld", (long)getpid());
+    test_publish_contains();
+    test_ttl_and_eviction();
+    test_crashed_peer();
+    test_foreign_segment();
+#else
+    printf("No POSIX shared memory, skipping\n");
+#endif
+
+    printf("All tests passed\n");
+    return 0;
+}
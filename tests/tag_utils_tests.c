@@ -1,6 +1,8 @@
 #include "../tag_utils.h"
+#include "alloc_counter.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,6 +58,66 @@ static void test_url_decode_inplace(void)
     url_decode_inplace(NULL); // Should not crash
 }
 
+/* The original byte-by-byte decoder, kept as the reference the optimised
+ * implementations must match. Returns the decoded length, which counts
+ * decoded NUL bytes. */
+static size_t reference_url_decode(char *p_str)
+{
+    char *p_read = p_str;
+    char *p_write = p_str;
+    while (*p_read != '\0') {
+        if (p_read[0] == '%' && p_read[1] != '\0' && p_read[2] != '\0'
+         && isxdigit((unsigned char)p_read[1]) && isxdigit((unsigned char)p_read[2])) {
+            char hex[3] = { p_read[1], p_read[2], '\0' };
+            *p_write++ = (char)strtol(hex, NULL, 16);
+            p_read += 3;
+            continue;
+        }
+        *p_write++ = *p_read++;
+    }
+    *p_write = '\0';
+    return (size_t)(p_write - p_str);
+}
+
+static void test_url_decode_implementations(void)
+{
+    static const url_decode_impl_t impls[] = {
+        URL_DECODE_AUTO, URL_DECODE_SCALAR, URL_DECODE_SSE2, URL_DECODE_AVX2,
+    };
+    // Weighted towards '%' and hex digits, with invalid digits, %00 and high bytes
+    static const char alphabet[] = "%%%%%%0123456789abcdefABCDEF0gG/ z\x80\xe4\xff";
+
+    assert(url_decode_inplace_with(NULL, URL_DECODE_SCALAR));
+    assert(!url_decode_inplace_with(NULL, (url_decode_impl_t)42));
+
+    srand(4321);
+    char input[600], expected[600], actual[640];
+    for (int round = 0; round < 20000; round++) {
+        size_t len = (size_t)(rand() % (round < 10000 ? 80 : 550));
+        for (size_t i = 0; i < len; i++)
+            input[i] = alphabet[rand() % (int)(sizeof(alphabet) - 1)];
+        // Long runs of triplets, like CJK file names
+        if (round % 3 == 0)
+            for (size_t i = 0; i + 3 <= len && rand() % 8; i += 3)
+                memcpy(input + i, "%E4", 3);
+        input[len] = '\0';
+
+        memcpy(expected, input, len + 1);
+        size_t decoded_len = reference_url_decode(expected);
+
+        for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+            // Vary alignment; compare every output byte, decoded NULs included
+            char *p = actual + (round % 32);
+            memcpy(p, input, len + 1);
+            if (!url_decode_inplace_with(p, impls[k])) {
+                assert(impls[k] != URL_DECODE_AUTO && impls[k] != URL_DECODE_SCALAR);
+                continue;
+            }
+            assert(memcmp(p, expected, decoded_len + 1) == 0);
+        }
+    }
+}
+
 static void test_xdg_tags_append_if_missing(void)
 {
     bool added = false;
@@ -110,6 +172,277 @@ static void test_xdg_tags_append_if_missing(void)
     free(result);
 }
 
+static void test_xdg_tags_contains(void)
+{
+    const char *tags = "alpha,seen,beta";
+    assert(xdg_tags_contains(tags, strlen(tags), "seen"));
+    assert(xdg_tags_contains(tags, strlen(tags), "alpha"));
+    assert(xdg_tags_contains(tags, strlen(tags), "beta"));
+    assert(!xdg_tags_contains(tags, strlen(tags), "see"));
+    assert(!xdg_tags_contains(tags, strlen(tags), "seen,beta"));
+    assert(!xdg_tags_contains(tags, strlen(tags), ""));
+
+    // Length-bounded, as read from an xattr value
+    assert(!xdg_tags_contains(tags, 5, "seen"));
+    assert(xdg_tags_contains(tags, 10, "seen"));
+
+    // Stored values may carry a trailing NUL
+    const char stored[] = { 's', 'e', 'e', 'n', '\0' };
+    assert(xdg_tags_contains(stored, sizeof(stored), "seen"));
+
+    assert(!xdg_tags_contains(NULL, 0, "seen"));
+    assert(!xdg_tags_contains(tags, strlen(tags), NULL));
+}
+
+static void test_xdg_tags_append_many(void)
+{
+    size_t added = 99;
+    const char *tags[] = { "p10", "seen", "p10", "", NULL, "alpha", "p20" };
+    char *result = xdg_tags_append_many("alpha,beta", tags, 7, &added);
+    assert(result != NULL);
+    // Appended in the given order, skipping existing, repeated and empty tags
+    assert(strcmp(result, "alpha,beta,p10,seen,p20") == 0);
+    assert(added == 3);
+    free(result);
+
+    const char *present[] = { "beta", "alpha" };
+    result = xdg_tags_append_many("alpha,beta", present, 2, &added);
+    assert(result != NULL);
+    assert(strcmp(result, "alpha,beta") == 0);
+    assert(added == 0);
+    free(result);
+
+    const char *fresh[] = { "started", "seen", "started" };
+    result = xdg_tags_append_many(NULL, fresh, 3, &added);
+    assert(result != NULL);
+    assert(strcmp(result, "started,seen") == 0);
+    assert(added == 2);
+    free(result);
+
+    result = xdg_tags_append_many("", fresh, 1, &added);
+    assert(result != NULL);
+    assert(strcmp(result, "started") == 0);
+    assert(added == 1);
+    free(result);
+
+    // Token match only, not substring
+    const char *sub[] = { "tag", "ta" };
+    result = xdg_tags_append_many("tags,mytag", sub, 2, &added);
+    assert(strcmp(result, "tags,mytag,tag,ta") == 0);
+    assert(added == 2);
+    free(result);
+
+    // Nothing usable to add
+    const char *empty[] = { "", NULL };
+    assert(xdg_tags_append_many("alpha", empty, 2, &added) == NULL);
+    assert(added == 0);
+    assert(xdg_tags_append_many("alpha", NULL, 3, &added) == NULL);
+    assert(xdg_tags_append_many("alpha", tags, 0, NULL) == NULL);
+}
+
+static void test_xdg_tags_append_many_buf(void)
+{
+    tag_buffer_t buf = { 0 };
+    const char *tags[] = { "started", "seen", "started" };
+    size_t added = 99;
+
+    // Empty list
+    size_t len = 0;
+    assert(xdg_tags_append_many_buf(&buf, &len, tags, 3, &added));
+    assert(added == 2);
+    assert(len == strlen("started,seen"));
+    assert(strcmp(buf.p_data, "started,seen") == 0);
+
+    // Raw xattr value with its stored terminator, nothing to add
+    memcpy(buf.p_data, "seen,started", sizeof("seen,started"));
+    len = sizeof("seen,started");
+    assert(xdg_tags_append_many_buf(&buf, &len, tags, 3, &added));
+    assert(added == 0);
+    assert(len == strlen("seen,started"));
+
+    // Growing past the current capacity keeps the existing list
+    char big[2000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    assert(tag_buffer_reserve(&buf, sizeof(big)));
+    memcpy(buf.p_data, big, sizeof(big) - 1);
+    len = sizeof(big) - 1;
+    const char *long_tags[] = { big, "seen" };
+    assert(xdg_tags_append_many_buf(&buf, &len, long_tags, 2, &added));
+    assert(added == 1);
+    assert(len == sizeof(big) - 1 + strlen(",seen"));
+    assert(strncmp(buf.p_data, big, sizeof(big) - 1) == 0);
+    assert(strcmp(buf.p_data + sizeof(big) - 1, ",seen") == 0);
+
+    assert(!xdg_tags_append_many_buf(NULL, &len, tags, 1, NULL));
+    assert(!xdg_tags_append_many_buf(&buf, NULL, tags, 1, NULL));
+    assert(!xdg_tags_append_many_buf(&buf, &len, NULL, 1, NULL));
+
+    tag_buffer_free(&buf);
+    assert(buf.p_data == NULL && buf.i_capacity == 0);
+    tag_buffer_free(&buf); // Idempotent
+}
+
+static void test_tag_write_steady_state_allocations(void)
+{
+    if (!alloc_counter_available())
+        return;
+
+    // The read-modify-write WriteTags performs, against a fake stored value
+    tag_buffer_t buf = { 0 };
+    const char stored[] = "favourite,started";
+    const char *tags[] = { "started", "seen" };
+    assert(tag_buffer_reserve(&buf, 10000));
+
+    unsigned long before = 0;
+    for (int round = 0; round < 3; round++) {
+        if (round == 1)
+            before = alloc_counter_get();
+        assert(tag_buffer_reserve(&buf, 10000));
+        memcpy(buf.p_data, stored, sizeof(stored));
+        size_t len = sizeof(stored);
+        size_t added;
+        assert(xdg_tags_append_many_buf(&buf, &len, tags, 2, &added));
+        assert(added == 1);
+        assert(strcmp(buf.p_data, "favourite,started,seen") == 0);
+    }
+    // Only the first round may allocate
+    assert(alloc_counter_get() == before);
+    tag_buffer_free(&buf);
+}
+
+static void test_tag_set(void)
+{
+    tag_set_t set;
+    tag_set_init(&set);
+    assert(!tag_set_contains(&set, "seen", 4));
+
+    bool added;
+    assert(tag_set_insert(&set, "started", 7, &added) && added);
+    assert(tag_set_insert(&set, "seen", 4, &added) && added);
+    assert(tag_set_insert(&set, "seen", 4, &added) && !added);
+    assert(!tag_set_insert(&set, "", 0, &added));
+    assert(set.i_count == 2);
+    assert(tag_set_contains(&set, "seen", 4));
+    assert(tag_set_contains(&set, "seenX", 4)); // Length-delimited
+    assert(!tag_set_contains(&set, "see", 3));
+
+    // Duplicates and empty tokens in a list are skipped, order is kept
+    assert(tag_set_add_list(&set, "a,,seen,b,a", 11));
+    assert(set.i_count == 4);
+    tag_buffer_t buf = { 0 };
+    size_t len;
+    assert(tag_set_serialize(&set, &buf, &len));
+    assert(strcmp(buf.p_data, "started,seen,a,b") == 0);
+    assert(len == strlen("started,seen,a,b"));
+
+    assert(tag_set_remove(&set, "seen", 4));
+    assert(!tag_set_remove(&set, "seen", 4));
+    assert(!tag_set_contains(&set, "seen", 4));
+    assert(tag_set_serialize(&set, &buf, &len));
+    assert(strcmp(buf.p_data, "started,a,b") == 0);
+
+    // Re-inserting goes to the end
+    assert(tag_set_insert(&set, "seen", 4, &added) && added);
+    assert(tag_set_serialize(&set, &buf, &len));
+    assert(strcmp(buf.p_data, "started,a,b,seen") == 0);
+
+    tag_set_clear(&set);
+    assert(set.i_count == 0);
+    assert(!tag_set_contains(&set, "a", 1));
+    assert(tag_set_serialize(&set, &buf, &len));
+    assert(len == 0 && buf.p_data[0] == '\0');
+
+    // Far beyond XATTR_SIZE, with removals exercising the probe chains
+    char tag[16];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(tag, sizeof(tag), "tag%05d", i);
+        assert(tag_set_insert(&set, tag, strlen(tag), &added) && added);
+    }
+    for (int i = 0; i < 5000; i += 3) {
+        snprintf(tag, sizeof(tag), "tag%05d", i);
+        assert(tag_set_remove(&set, tag, strlen(tag)));
+    }
+    for (int i = 0; i < 5000; i++) {
+        snprintf(tag, sizeof(tag), "tag%05d", i);
+        assert(tag_set_contains(&set, tag, strlen(tag)) == (i % 3 != 0));
+    }
+    assert(tag_set_serialize(&set, &buf, &len));
+    assert(strncmp(buf.p_data, "tag00001,tag00002,tag00004,", 27) == 0);
+    assert(len == (size_t)(set.i_count * 9 - 1));
+
+    tag_set_free(&set);
+    tag_set_free(&set); // Idempotent
+    tag_buffer_free(&buf);
+
+    assert(!tag_set_insert(NULL, "a", 1, NULL));
+    assert(!tag_set_contains(NULL, "a", 1));
+    assert(!tag_set_remove(NULL, "a", 1));
+    assert(!tag_set_add_list(NULL, "a", 1));
+}
+
+static void test_xdg_tags_append_many_set(void)
+{
+    // Same results as the linear version on random lists, including
+    // duplicate and empty tokens that must be preserved verbatim
+    static const char *words[] = { "a", "b", "seen", "started", "", "ab", "seen2" };
+    const size_t n_words = sizeof(words) / sizeof(words[0]);
+    tag_set_t set;
+    tag_set_init(&set);
+    tag_buffer_t linear = { 0 }, hashed = { 0 };
+
+    srand(99);
+    for (int round = 0; round < 2000; round++) {
+        char list[256] = "";
+        size_t list_len = 0;
+        int tokens = rand() % 10;
+        for (int i = 0; i < tokens; i++)
+            list_len += (size_t)snprintf(list + list_len, sizeof(list) - list_len, "%s%s",
+                                         i ? "," : "", words[(size_t)rand() % n_words]);
+        const char *tags[4];
+        size_t tag_count = (size_t)(rand() % 5);
+        for (size_t i = 0; i < tag_count; i++)
+            tags[i] = words[(size_t)rand() % n_words];
+
+        // Half the rounds pass the value with its stored terminator
+        size_t in_len = list_len + (size_t)(round & 1);
+        assert(tag_buffer_reserve(&linear, in_len + 1) && tag_buffer_reserve(&hashed, in_len + 1));
+        memcpy(linear.p_data, list, list_len + 1);
+        memcpy(hashed.p_data, list, list_len + 1);
+        size_t linear_len = in_len, hashed_len = in_len, linear_added, hashed_added;
+        assert(xdg_tags_append_many_buf(&linear, &linear_len, tags, tag_count, &linear_added));
+        assert(xdg_tags_append_many_set(&set, &hashed, &hashed_len, tags, tag_count, &hashed_added));
+        assert(linear_added == hashed_added);
+        assert(linear_len == hashed_len);
+        assert(strcmp(linear.p_data, hashed.p_data) == 0);
+    }
+
+    // Steady state: no allocations once the set and buffer have grown
+    if (alloc_counter_available()) {
+        const char *tags[] = { "seen", "tag01999" };
+        unsigned long before = 0;
+        for (int round = 0; round < 3; round++) {
+            if (round == 1)
+                before = alloc_counter_get();
+            size_t len = 0;
+            char tag[16];
+            assert(tag_buffer_reserve(&hashed, 20000));
+            for (int i = 0; i < 2000; i++)
+                len += (size_t)snprintf(hashed.p_data + len, 20000 - len, "%stag%05d", i ? "," : "", i);
+            size_t added;
+            assert(xdg_tags_append_many_set(&set, &hashed, &len, tags, 2, &added));
+            assert(added == 1);
+            snprintf(tag, sizeof(tag), ",seen");
+            assert(strcmp(hashed.p_data + len - 5, tag) == 0);
+        }
+        assert(alloc_counter_get() == before);
+    }
+
+    tag_set_free(&set);
+    tag_buffer_free(&linear);
+    tag_buffer_free(&hashed);
+}
+
 static void test_parse_xattr_targets(void)
 {
     int count = 0;
@@ -122,29 +455,41 @@ static void test_parse_xattr_targets(void)
     assert(targets[0].percent == 90);
     free_xattr_targets(targets, count);
 
-    // Test 2: Multiple tags
+    // Test 2: Multiple tags, returned sorted by percent
     targets = parse_xattr_targets("seen@90,started@0", &count);
     assert(count == 2);
-    assert(strcmp(targets[0].name, "seen") == 0);
-    assert(targets[0].percent == 90);
-    assert(strcmp(targets[1].name, "started") == 0);
-    assert(targets[1].percent == 0);
+    assert(strcmp(targets[0].name, "started") == 0);
+    assert(targets[0].percent == 0);
+    assert(strcmp(targets[1].name, "seen") == 0);
+    assert(targets[1].percent == 90);
     free_xattr_targets(targets, count);
 
     // Test 3: Whitespace handling
     targets = parse_xattr_targets(" seen @ 50 ,  watched ", &count);
     assert(count == 2);
-    assert(strcmp(targets[0].name, "seen") == 0);
-    assert(targets[0].percent == 50);
-    assert(strcmp(targets[1].name, "watched") == 0);
-    assert(targets[1].percent == 0); // Default
+    assert(strcmp(targets[0].name, "watched") == 0);
+    assert(targets[0].percent == 0); // Default
+    assert(strcmp(targets[1].name, "seen") == 0);
+    assert(targets[1].percent == 50);
     free_xattr_targets(targets, count);
 
     // Test 4: Invalid percentage
     targets = parse_xattr_targets("seen@200,bad@-1", &count);
     assert(count == 2);
-    assert(targets[0].percent == 100); // Clamped
-    assert(targets[1].percent == 0);   // Clamped
+    assert(strcmp(targets[0].name, "bad") == 0);
+    assert(targets[0].percent == 0);   // Clamped
+    assert(strcmp(targets[1].name, "seen") == 0);
+    assert(targets[1].percent == 100); // Clamped
+    free_xattr_targets(targets, count);
+
+    // Test 4b: Equal percentages keep their configured order
+    targets = parse_xattr_targets("p50@50,b@10,a@10,started@0,c@10", &count);
+    assert(count == 5);
+    assert(strcmp(targets[0].name, "started") == 0);
+    assert(strcmp(targets[1].name, "b") == 0);
+    assert(strcmp(targets[2].name, "a") == 0);
+    assert(strcmp(targets[3].name, "c") == 0);
+    assert(strcmp(targets[4].name, "p50") == 0);
     free_xattr_targets(targets, count);
 
     // Test 5: Empty/Null
@@ -157,6 +502,44 @@ static void test_parse_xattr_targets(void)
     assert(targets == NULL);
 }
 
+static void test_seconds_ms(void)
+{
+    char buf[32];
+    assert(format_seconds_ms(buf, sizeof(buf), 754120) == 7);
+    assert(strcmp(buf, "754.120") == 0);
+    assert(format_seconds_ms(buf, sizeof(buf), 0) == 5);
+    assert(strcmp(buf, "0.000") == 0);
+    assert(format_seconds_ms(buf, sizeof(buf), 5) == 5);
+    assert(strcmp(buf, "0.005") == 0);
+    assert(format_seconds_ms(buf, sizeof(buf), -1) == 0);
+    assert(format_seconds_ms(buf, 5, 754120) == 0); // Does not fit
+
+    int64_t ms = -1;
+    assert(parse_seconds_ms("754.120", 7, &ms) && ms == 754120);
+    assert(parse_seconds_ms("754", 3, &ms) && ms == 754000);
+    assert(parse_seconds_ms("754.1", 5, &ms) && ms == 754100);
+    assert(parse_seconds_ms("754.12345", 9, &ms) && ms == 754123);
+    assert(parse_seconds_ms("12.5\n", 5, &ms) && ms == 12500);
+    assert(parse_seconds_ms("12.5", 5, &ms) && ms == 12500); // Stored terminator
+    assert(parse_seconds_ms("12.5xyz", 4, &ms) && ms == 12500); // Only i_len counts
+
+    ms = 42;
+    assert(!parse_seconds_ms("", 0, &ms));
+    assert(!parse_seconds_ms(".5", 2, &ms));
+    assert(!parse_seconds_ms("5.", 2, &ms));
+    assert(!parse_seconds_ms("-5", 2, &ms));
+    assert(!parse_seconds_ms("5s", 2, &ms));
+    assert(!parse_seconds_ms("1.2.3", 5, &ms));
+    assert(!parse_seconds_ms("1234567890123456", 16, &ms));
+    assert(ms == 42);
+
+    // Round trip
+    for (int64_t i = 0; i < 100000; i += 997) {
+        size_t len = format_seconds_ms(buf, sizeof(buf), i);
+        assert(len > 0 && parse_seconds_ms(buf, len, &ms) && ms == i);
+    }
+}
+
 static void test_trim_token(void)
 {
     char t1[] = "  hello  ";
@@ -200,15 +583,100 @@ static void test_should_skip_path(void)
     assert(!should_skip_path("/path", ""));
 }
 
+static void test_skip_matcher(void)
+{
+    const char *skip_list = "/mnt/skip,/tmp/ignore;/var/cache\n/home/user/private";
+    skip_matcher_t *p_matcher = skip_matcher_compile(skip_list);
+    assert(p_matcher != NULL);
+    assert(p_matcher->i_count == 4);
+
+    assert(skip_matcher_match(p_matcher, "/mnt/skip"));
+    assert(skip_matcher_match(p_matcher, "/mnt/skip/file.mp4"));
+    assert(skip_matcher_match(p_matcher, "/tmp/ignore_this"));
+    assert(skip_matcher_match(p_matcher, "/home/user/private/a.mkv"));
+    assert(!skip_matcher_match(p_matcher, "/mnt/other"));
+    assert(!skip_matcher_match(p_matcher, "/home/user/public"));
+    assert(!skip_matcher_match(p_matcher, "/"));
+    assert(!skip_matcher_match(p_matcher, ""));
+    assert(!skip_matcher_match(p_matcher, NULL));
+    skip_matcher_free(p_matcher);
+
+    // Redundant prefixes collapse onto the shortest one
+    p_matcher = skip_matcher_compile(" /a/b/c , /a/b ,/a/bc,/a/b/d,/z ");
+    assert(p_matcher->i_count == 2);
+    assert(strcmp(p_matcher->ppsz_prefixes[0], "/a/b") == 0);
+    assert(strcmp(p_matcher->ppsz_prefixes[1], "/z") == 0);
+    assert(skip_matcher_match(p_matcher, "/a/bc/x"));
+    assert(skip_matcher_match(p_matcher, "/a/b/d/e"));
+    assert(!skip_matcher_match(p_matcher, "/a/a"));
+    skip_matcher_free(p_matcher);
+
+    // Empty lists compile to an empty matcher
+    p_matcher = skip_matcher_compile(NULL);
+    assert(p_matcher != NULL && p_matcher->i_count == 0);
+    assert(!skip_matcher_match(p_matcher, "/path"));
+    skip_matcher_free(p_matcher);
+
+    p_matcher = skip_matcher_compile(" , ;\n");
+    assert(p_matcher != NULL && p_matcher->i_count == 0);
+    skip_matcher_free(p_matcher);
+
+    assert(!skip_matcher_match(NULL, "/path"));
+    skip_matcher_free(NULL); // Should not crash
+}
+
+static void random_path(char *buf, size_t max_len)
+{
+    static const char alphabet[] = "/ab";
+    size_t len = (size_t)rand() % max_len;
+    for (size_t i = 0; i < len; i++)
+        buf[i] = alphabet[rand() % 3];
+    buf[len] = '\0';
+}
+
+static void test_skip_matcher_matches_should_skip_path(void)
+{
+    srand(1234);
+    for (int round = 0; round < 200; round++) {
+        char list[512] = "";
+        size_t used = 0;
+        int entries = rand() % 12;
+        for (int i = 0; i < entries; i++) {
+            char prefix[8];
+            random_path(prefix, sizeof(prefix));
+            used += (size_t)snprintf(list + used, sizeof(list) - used, "%s,", prefix);
+        }
+
+        skip_matcher_t *p_matcher = skip_matcher_compile(list);
+        assert(p_matcher != NULL);
+        for (int i = 0; i < 50; i++) {
+            char path[12];
+            random_path(path, sizeof(path));
+            assert(skip_matcher_match(p_matcher, path) == should_skip_path(path, list));
+        }
+        skip_matcher_free(p_matcher);
+    }
+}
+
 int main(void)
 {
     test_decode_percent_sequence_valid();
     test_decode_percent_sequence_invalid();
     test_url_decode_inplace();
+    test_url_decode_implementations();
     test_xdg_tags_append_if_missing();
+    test_xdg_tags_contains();
+    test_xdg_tags_append_many();
+    test_xdg_tags_append_many_buf();
+    test_tag_write_steady_state_allocations();
+    test_tag_set();
+    test_xdg_tags_append_many_set();
     test_parse_xattr_targets();
+    test_seconds_ms();
     test_trim_token();
     test_should_skip_path();
+    test_skip_matcher();
+    test_skip_matcher_matches_should_skip_path();
 
     printf("All tests passed\n");
     return 0;
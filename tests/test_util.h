@@ -0,0 +1,57 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/* Helpers shared by the tests of the on-disk stores. */
+
+static inline long file_size(const char *psz_file)
+{
+    FILE *f = fopen(psz_file, "rb");
+    if (f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+/* Simulate a crash in the middle of an append: a record header promising
+ * more bytes than follow. */
+static inline void append_torn_record(const char *psz_file)
+{
+    FILE *f = fopen(psz_file, "ab");
+    assert(f != NULL);
+    fwrite("\x01\x00\x00\x00\x40\x00\x00\x00garbage", 1, 15, f);
+    fclose(f);
+}
+
+#ifndef _WIN32
+/* Run pf_writer(0) .. pf_writer(i_procs - 1) in as many child processes at
+ * once and wait for them; each must return true. */
+static inline void run_writers(int i_procs, bool (*pf_writer)(int i_proc))
+{
+    pid_t pids[8];
+    assert(i_procs <= 8);
+    for (int i = 0; i < i_procs; i++) {
+        pids[i] = fork();
+        assert(pids[i] >= 0);
+        if (pids[i] == 0)
+            _exit(pf_writer(i) ? 0 : 1);
+    }
+    for (int i = 0; i < i_procs; i++) {
+        int status;
+        assert(waitpid(pids[i], &status, 0) == pids[i]);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+#endif
+
+#endif // TEST_UTIL_H
@@ -0,0 +1,398 @@
+#include "../write_queue.h"
+#include "../seen_index.h"
+#include "../tag_cache.h"
+#include "../tag_utils.h"
+#include "../xattr_compat.h"
+#include "alloc_counter.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static xattr_file_t *p_missing_file;
+
+static xattr_job_t *make_job(const char *psz_tag)
+{
+    xattr_job_t *p_job = xattr_job_new(NULL, p_missing_file, "user.xdg.tags", &psz_tag, 1);
+    assert(p_job != NULL);
+    return p_job;
+}
+
+static void test_file_refcount(void)
+{
+    const char *test_file = "write_queue_test.tmp";
+    FILE *f = fopen(test_file, "w");
+    assert(f != NULL);
+    fclose(f);
+
+    xattr_file_t *p_file = xattr_file_open(test_file);
+    assert(p_file != NULL);
+    assert(strcmp(p_file->psz_path, test_file) == 0);
+#if defined(__linux__) || defined(__APPLE__)
+    assert(p_file->i_fd >= 0);
+#endif
+    assert(atomic_load(&p_file->i_refs) == 1);
+
+    const char *tag = "seen";
+    xattr_job_t *p_job = xattr_job_new(NULL, p_file, "user.xdg.tags", &tag, 1);
+    assert(atomic_load(&p_file->i_refs) == 2);
+
+    // The job keeps the file alive after the owner lets go
+    xattr_file_release(p_file);
+    assert(atomic_load(&p_job->p_file->i_refs) == 1);
+    xattr_job_free(p_job);
+
+    remove(test_file);
+
+    // A file that cannot be opened still works through its path
+    assert(p_missing_file->i_fd == -1);
+    assert(xattr_file_open(NULL) == NULL);
+    xattr_file_release(NULL); // Should not crash
+}
+
+static void test_file_resolve(void)
+{
+    const char *test_file = "write_queue_resolve.tmp";
+    FILE *f = fopen(test_file, "w");
+    assert(f != NULL);
+    fclose(f);
+
+    // Creating a file does not touch it: the thread running its jobs does
+    xattr_file_t *p_file = xattr_file_new(test_file);
+    assert(p_file != NULL);
+    assert(!p_file->b_resolved && p_file->i_fd == -1 && !p_file->b_identity);
+
+    assert(xattr_file_resolve(p_file));
+    assert(p_file->b_resolved && p_file->b_identity);
+#if defined(__linux__) || defined(__APPLE__)
+    assert(p_file->i_fd >= 0);
+#endif
+    // Only the first call opens it
+    int i_fd = p_file->i_fd;
+    assert(!xattr_file_resolve(p_file));
+    assert(p_file->i_fd == i_fd);
+    xattr_file_release(p_file);
+    remove(test_file);
+
+    assert(p_missing_file->b_resolved && !p_missing_file->b_identity);
+    assert(xattr_file_new(NULL) == NULL);
+}
+
+static void test_job_new(void)
+{
+    const char *tags[] = { "started", "seen" };
+    assert(xattr_job_new(NULL, NULL, "user.xdg.tags", tags, 2) == NULL);
+    assert(xattr_job_new(NULL, p_missing_file, NULL, tags, 2) == NULL);
+    assert(xattr_job_new(NULL, p_missing_file, "user.xdg.tags", NULL, 2) == NULL);
+    assert(xattr_job_new(NULL, p_missing_file, "user.xdg.tags", tags, 0) == NULL);
+
+    const char *with_null[] = { "seen", NULL };
+    assert(xattr_job_new(NULL, p_missing_file, "user.xdg.tags", with_null, 2) == NULL);
+
+    xattr_job_t *p_job = xattr_job_new(NULL, p_missing_file, "user.xdg.tags", tags, 2);
+    assert(p_job != NULL);
+    assert(p_job->p_file == p_missing_file);
+    assert(strcmp(p_job->psz_key, "user.xdg.tags") == 0);
+    assert(p_job->i_tag_count == 2);
+    assert(strcmp(p_job->ppsz_tags[0], "started") == 0);
+    assert(strcmp(p_job->ppsz_tags[1], "seen") == 0);
+    xattr_job_free(p_job);
+    xattr_job_free(NULL); // Should not crash
+
+    // Failed constructions must not leak references
+    assert(atomic_load(&p_missing_file->i_refs) == 1);
+}
+
+static void test_checkpoint_job_new(void)
+{
+    assert(xattr_checkpoint_job_new(NULL, NULL, 1000, 0) == NULL);
+    assert(xattr_checkpoint_job_new(NULL, p_missing_file, -1, 0) == NULL); // Nothing to record
+
+    xattr_job_t *p_job = xattr_checkpoint_job_new(NULL, p_missing_file, 754120, 30000);
+    assert(p_job != NULL);
+    assert(p_job->i_kind == XATTR_JOB_CHECKPOINT);
+    assert(p_job->p_file == p_missing_file);
+    assert(p_job->psz_key == NULL && p_job->i_tag_count == 0);
+    assert(p_job->i_position_ms == 754120 && p_job->i_watch_ms == 30000);
+    assert(atomic_load(&p_missing_file->i_refs) == 2);
+    xattr_job_free(p_job);
+
+    p_job = xattr_checkpoint_job_new(NULL, p_missing_file, -5, 100);
+    assert(p_job != NULL && p_job->i_position_ms == -1 && p_job->i_watch_ms == 100);
+    xattr_job_free(p_job);
+
+    // Tag jobs keep the default kind
+    const char *tag = "seen";
+    p_job = xattr_job_new(NULL, p_missing_file, "user.xdg.tags", &tag, 1);
+    assert(p_job != NULL && p_job->i_kind == XATTR_JOB_TAGS);
+    xattr_job_free(p_job);
+    assert(atomic_load(&p_missing_file->i_refs) == 1);
+}
+
+static void test_resume_job_new(void)
+{
+    assert(xattr_resume_job_new(NULL, NULL, 1) == NULL);
+
+    xattr_job_t *p_job = xattr_resume_job_new(NULL, "/media/a.flac", 7);
+    assert(p_job != NULL);
+    assert(p_job->i_kind == XATTR_JOB_RESUME);
+    assert(p_job->p_file == NULL);
+    assert(strcmp(p_job->psz_path, "/media/a.flac") == 0);
+    assert(p_job->i_generation == 7);
+    xattr_job_free(p_job);
+}
+
+static void test_fifo_order(void)
+{
+    write_queue_t queue;
+    assert(write_queue_init(&queue, 4, WRITE_QUEUE_DROP_NEWEST));
+    assert(write_queue_pop(&queue) == NULL);
+
+    assert(write_queue_push(&queue, make_job("a")));
+    assert(write_queue_push(&queue, make_job("b")));
+    assert(write_queue_push(&queue, make_job("c")));
+
+    const char *expected[] = { "a", "b", "c" };
+    for (int i = 0; i < 3; i++) {
+        xattr_job_t *p_job = write_queue_pop(&queue);
+        assert(p_job != NULL);
+        assert(strcmp(p_job->ppsz_tags[0], expected[i]) == 0);
+        xattr_job_free(p_job);
+    }
+    assert(write_queue_pop(&queue) == NULL);
+    assert(atomic_load(&queue.i_enqueued) == 3);
+    assert(atomic_load(&queue.i_dropped) == 0);
+    write_queue_destroy(&queue);
+}
+
+static void test_overflow_drop_newest(void)
+{
+    write_queue_t queue;
+    assert(write_queue_init(&queue, 2, WRITE_QUEUE_DROP_NEWEST));
+
+    assert(write_queue_push(&queue, make_job("a")));
+    assert(write_queue_push(&queue, make_job("b")));
+    assert(!write_queue_push(&queue, make_job("c")));
+    assert(atomic_load(&queue.i_dropped) == 1);
+
+    xattr_job_t *p_job = write_queue_pop(&queue);
+    assert(strcmp(p_job->ppsz_tags[0], "a") == 0);
+    xattr_job_free(p_job);
+
+    // Leave one job queued: destroy must free it
+    write_queue_destroy(&queue);
+}
+
+static void test_overflow_drop_oldest(void)
+{
+    write_queue_t queue;
+    assert(write_queue_init(&queue, 2, WRITE_QUEUE_DROP_OLDEST));
+
+    assert(write_queue_push(&queue, make_job("a")));
+    assert(write_queue_push(&queue, make_job("b")));
+    assert(write_queue_push(&queue, make_job("c")));
+    assert(atomic_load(&queue.i_dropped) == 1);
+    assert(atomic_load(&queue.i_enqueued) == 3);
+
+    xattr_job_t *p_job = write_queue_pop(&queue);
+    assert(strcmp(p_job->ppsz_tags[0], "b") == 0);
+    xattr_job_free(p_job);
+    p_job = write_queue_pop(&queue);
+    assert(strcmp(p_job->ppsz_tags[0], "c") == 0);
+    xattr_job_free(p_job);
+    assert(write_queue_pop(&queue) == NULL);
+
+    write_queue_destroy(&queue);
+}
+
+#define PRODUCERS 4
+#define JOBS_PER_PRODUCER 2000
+
+static void *producer_main(void *data)
+{
+    write_queue_t *p_queue = data;
+    for (int i = 0; i < JOBS_PER_PRODUCER; i++) {
+        xattr_job_t *p_job = make_job("t");
+        while (!write_queue_push(p_queue, p_job))
+            p_job = make_job("t");
+    }
+    return NULL;
+}
+
+static void test_concurrent_producers(void)
+{
+    write_queue_t queue;
+    assert(write_queue_init(&queue, 64, WRITE_QUEUE_DROP_NEWEST));
+
+    pthread_t threads[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; i++)
+        assert(pthread_create(&threads[i], NULL, producer_main, &queue) == 0);
+
+    int received = 0;
+    while (received < PRODUCERS * JOBS_PER_PRODUCER) {
+        xattr_job_t *p_job = write_queue_pop(&queue);
+        if (p_job != NULL) {
+            received++;
+            xattr_job_free(p_job);
+        }
+    }
+
+    for (int i = 0; i < PRODUCERS; i++)
+        pthread_join(threads[i], NULL);
+
+    assert(write_queue_pop(&queue) == NULL);
+    assert(atomic_load(&queue.i_enqueued) == PRODUCERS * JOBS_PER_PRODUCER);
+    write_queue_destroy(&queue);
+}
+
+static void test_spare_jobs(void)
+{
+    write_queue_t queue;
+    assert(write_queue_init(&queue, 2, WRITE_QUEUE_DROP_NEWEST));
+    const char *tags[] = { "started", "seen" };
+
+    // A freed job comes back, storage included, for any kind of job
+    xattr_job_t *p_job = xattr_job_new(&queue, p_missing_file, "user.xdg.tags", tags, 2);
+    assert(p_job != NULL && p_job->p_queue == &queue);
+    char *p_strings = p_job->p_strings;
+    assert(write_queue_push(&queue, p_job));
+    assert(write_queue_pop(&queue) == p_job);
+    xattr_job_free(p_job);
+    assert(atomic_load(&p_missing_file->i_refs) == 1);
+
+    xattr_job_t *p_reused = xattr_checkpoint_job_new(&queue, p_missing_file, 1000, 0);
+    assert(p_reused == p_job);
+    assert(p_reused->i_kind == XATTR_JOB_CHECKPOINT);
+    assert(p_reused->psz_key == NULL && p_reused->i_tag_count == 0);
+    xattr_job_free(p_reused);
+
+    p_reused = xattr_job_new(&queue, p_missing_file, "user.xdg.tags", tags + 1, 1);
+    assert(p_reused == p_job && p_reused->p_strings == p_strings);
+    assert(p_reused->i_kind == XATTR_JOB_TAGS);
+    assert(strcmp(p_reused->psz_key, "user.xdg.tags") == 0);
+    assert(p_reused->i_tag_count == 1 && strcmp(p_reused->ppsz_tags[0], "seen") == 0);
+    xattr_job_free(p_reused);
+
+    p_reused = xattr_resume_job_new(&queue, "/media/a.flac", 3);
+    assert(p_reused == p_job && strcmp(p_reused->psz_path, "/media/a.flac") == 0);
+    assert(p_reused->p_file == NULL && p_reused->i_generation == 3);
+    xattr_job_free(p_reused);
+
+    // More jobs than the spares hold: the extra ones are freed
+    xattr_job_t *p_jobs[4];
+    for (int i = 0; i < 4; i++)
+        assert((p_jobs[i] = xattr_job_new(&queue, p_missing_file, "k", tags, 1)) != NULL);
+    for (int i = 0; i < 4; i++)
+        xattr_job_free(p_jobs[i]);
+    assert(atomic_load(&p_missing_file->i_refs) == 1);
+
+    // Destroy frees the queued jobs and the spares
+    assert(write_queue_push(&queue, xattr_job_new(&queue, p_missing_file, "k", tags, 1)));
+    write_queue_destroy(&queue);
+    assert(atomic_load(&p_missing_file->i_refs) == 1);
+}
+
+/* One batch of tags down the writer's path, as QueueTags, RunJob and
+ * WriteTags take it: queue the job, pop it, merge the tags into the stored
+ * value and write it, then record the list in the tag cache and the index. */
+static void write_batch(write_queue_t *p_queue, tag_buffer_t *p_buf, tag_cache_t *p_cache,
+                        seen_index_t *p_index, xattr_file_t *p_file,
+                        const char *const *ppsz_tags, size_t i_count)
+{
+    assert(write_queue_push(p_queue, xattr_job_new(p_queue, p_file, "user.xdg.tags",
+                                                   ppsz_tags, i_count)));
+    xattr_job_t *p_job = write_queue_pop(p_queue);
+    assert(p_job != NULL);
+    const char *const *ppsz_job_tags = (const char *const *)p_job->ppsz_tags;
+
+    assert(tag_buffer_reserve(p_buf, 10000));
+    ssize_t len = sys_getxattr(p_file->psz_path, p_job->psz_key, p_buf->p_data, p_buf->i_capacity);
+    size_t tags_len = len > 0 ? (size_t)len : 0;
+    size_t added;
+    assert(xdg_tags_append_many_buf(p_buf, &tags_len, ppsz_job_tags, p_job->i_tag_count, &added));
+    if (added > 0)
+        assert(sys_setxattr(p_file->psz_path, p_job->psz_key, p_buf->p_data, tags_len + 1, 0) == 0);
+    assert(tag_cache_store(p_cache, p_file->i_dev, p_file->i_ino, 1, 0, p_file->psz_path,
+                           p_buf->p_data, tags_len));
+    assert(seen_index_update(p_index, p_file->i_dev, p_file->i_ino, p_file->psz_path,
+                             ppsz_job_tags, p_job->i_tag_count));
+    xattr_job_free(p_job);
+}
+
+static void test_write_path_steady_state_allocations(void)
+{
+    const char *test_file = "write_queue_path.tmp";
+    const char *index_file = "write_queue_path.idx";
+    FILE *f = fopen(test_file, "w");
+    assert(f != NULL);
+    fclose(f);
+    if (!alloc_counter_available()
+     || (sys_setxattr(test_file, "user.xdg.tags", "favourite", 10, 0) != 0 && errno == ENOTSUP)) {
+        remove(test_file);
+        return;
+    }
+
+    write_queue_t queue;
+    tag_buffer_t buf = { 0 };
+    assert(write_queue_init(&queue, 8, WRITE_QUEUE_DROP_NEWEST));
+    tag_cache_t *p_cache = tag_cache_new(16, true);
+    remove(index_file);
+    seen_index_t *p_index = seen_index_open(index_file);
+    xattr_file_t *p_file = xattr_file_open(test_file);
+    assert(p_cache != NULL && p_index != NULL && p_file != NULL && p_file->b_identity);
+
+    const char *started[] = { "started" };
+    const char *seen[] = { "started", "seen" };
+    unsigned long before = 0;
+    for (int round = 0; round < 4; round++) {
+        if (round == 1)
+            before = alloc_counter_get();
+        // Another tagger rewrote the value: both batches merge and write again
+        assert(sys_setxattr(test_file, "user.xdg.tags", "favourite", 10, 0) == 0);
+        write_batch(&queue, &buf, p_cache, p_index, p_file, started, 1);
+        write_batch(&queue, &buf, p_cache, p_index, p_file, seen, 2);
+    }
+    // Only the first round may allocate
+    assert(alloc_counter_get() == before);
+
+    char value[64];
+    assert(sys_getxattr(test_file, "user.xdg.tags", value, sizeof(value)) > 0);
+    assert(strcmp(value, "favourite,started,seen") == 0);
+    const seen_index_entry_t *p_entry = seen_index_lookup(p_index, p_file->i_dev, p_file->i_ino);
+    assert(p_entry != NULL && strcmp(p_entry->psz_path, test_file) == 0);
+
+    xattr_file_release(p_file);
+    seen_index_close(p_index);
+    tag_cache_free(p_cache);
+    tag_buffer_free(&buf);
+    write_queue_destroy(&queue);
+    remove(test_file);
+    remove(index_file);
+    remove("write_queue_path.idx.lock");
+}
+
+int main(void)
+{
+    p_missing_file = xattr_file_open("/nonexistent/dir/file.mp4");
+    assert(p_missing_file != NULL);
+
+    test_file_refcount();
+    test_file_resolve();
+    test_job_new();
+    test_checkpoint_job_new();
+    test_resume_job_new();
+    test_fifo_order();
+    test_overflow_drop_newest();
+    test_overflow_drop_oldest();
+    test_concurrent_producers();
+    test_spare_jobs();
+    test_write_path_steady_state_allocations();
+
+    xattr_file_release(p_missing_file);
+
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "../xattr_batch.h"
+#include "../xattr_compat.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT 6
+#define ATTR_NAME "user.batch_test"
+
+static char psz_files[FILE_COUNT][32];
+
+static bool create_files(void)
+{
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(psz_files[i], sizeof(psz_files[i]), "xattr_batch_%d.tmp", i);
+        FILE *f = fopen(psz_files[i], "w");
+        assert(f != NULL);
+        fclose(f);
+    }
+    if (sys_setxattr(psz_files[0], ATTR_NAME, "x", 1, 0) != 0
+     && (errno == ENOTSUP || errno == EOPNOTSUPP))
+        return false;
+    sys_setxattr(psz_files[0], ATTR_NAME, "", 0, 0);
+    return true;
+}
+
+static void remove_files(void)
+{
+    for (int i = 0; i < FILE_COUNT; i++)
+        remove(psz_files[i]);
+}
+
+/* The same operations must give the same results with and without a ring */
+static void run_suite(xattr_batch_t *p_batch)
+{
+    char psz_values[FILE_COUNT][16];
+    xattr_batch_op_t ops[FILE_COUNT + 1];
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        sys_setxattr(psz_files[i], ATTR_NAME, "", 0, 0);
+        snprintf(psz_values[i], sizeof(psz_values[i]), "seen,%d", i);
+        ops[i] = (xattr_batch_op_t) {
+            .i_kind = XATTR_BATCH_SET, .psz_path = psz_files[i], .i_fd = -1,
+            .psz_name = ATTR_NAME, .p_value = psz_values[i], .i_size = strlen(psz_values[i]),
+        };
+    }
+    // XATTR_CREATE on an existing name fails alone, without failing the batch
+    ops[FILE_COUNT] = ops[0];
+    ops[FILE_COUNT].psz_name = "user.batch_test_other";
+    ops[0].i_flags = XATTR_CREATE;
+    xattr_batch_run(p_batch, ops, FILE_COUNT + 1);
+    assert(ops[0].i_result == -1 && ops[0].i_errno == EEXIST);
+    for (int i = 1; i <= FILE_COUNT; i++)
+        assert(ops[i].i_result == 0);
+    sys_setxattr(psz_files[0], ATTR_NAME, psz_values[0], strlen(psz_values[0]), 0);
+
+    char buf[FILE_COUNT][16];
+    int fd = sys_xattr_open(psz_files[1]);
+    for (int i = 0; i < FILE_COUNT; i++)
+        ops[i] = (xattr_batch_op_t) {
+            .i_kind = XATTR_BATCH_GET, .psz_path = psz_files[i], .i_fd = -1,
+            .psz_name = ATTR_NAME, .p_value = buf[i], .i_size = sizeof(buf[i]),
+        };
+    ops[1].i_fd = fd;                   // Through a descriptor when there is one
+    ops[2].i_size = 0;                  // Size query
+    ops[3].i_size = 2;                  // Too small
+    ops[4].psz_name = "user.missing";
+    ops[5].psz_path = "xattr_batch_none.tmp";
+    xattr_batch_run(p_batch, ops, FILE_COUNT);
+
+    assert(ops[0].i_result == (ssize_t)strlen(psz_values[0]));
+    assert(memcmp(buf[0], psz_values[0], (size_t)ops[0].i_result) == 0);
+    if (fd >= 0) {
+        assert(ops[1].i_result == (ssize_t)strlen(psz_values[1]));
+        assert(memcmp(buf[1], psz_values[1], (size_t)ops[1].i_result) == 0);
+        sys_xattr_close(fd);
+    }
+    assert(ops[2].i_result == (ssize_t)strlen(psz_values[2]));
+    assert(ops[3].i_result == -1 && ops[3].i_errno == ERANGE);
+    assert(ops[4].i_result == -1 && ops[4].i_errno != 0);
+    assert(ops[5].i_result == -1 && ops[5].i_errno == ENOENT);
+}
+
+int main(void)
+{
+    if (!create_files()) {
+        printf("xattr not supported on this filesystem. Skipping.\n");
+        remove_files();
+        printf("All tests passed\n");
+        return 0;
+    }
+
+    run_suite(NULL);
+
+    // A shallow ring splits the run into several submissions
+    xattr_batch_t *p_batch = xattr_batch_new(2);
+    if (p_batch == NULL)
+        printf("io_uring xattr operations unavailable, tested the syscall fallback only\n");
+    else {
+        run_suite(p_batch);
+        run_suite(p_batch);
+        xattr_batch_free(p_batch);
+    }
+    xattr_batch_free(NULL);
+
+    remove_files();
+    printf("All tests passed\n");
+    return 0;
+}
@@ -92,8 +92,129 @@ void test_set_get_xattr(void) {
     #endif
 }
 
+void test_fd_set_get_xattr(void) {
+    const char *test_file = "test_xattr_fd.txt";
+    const char *renamed_file = "test_xattr_fd_renamed.txt";
+    const char *attr_name = "user.test";
+    const char *attr_value = "Tagged via fd";
+
+    FILE *f = fopen(test_file, "w");
+    if (!f) {
+        perror("fopen");
+        exit(1);
+    }
+    fclose(f);
+
+    int fd = sys_xattr_open(test_file);
+    if (fd < 0) {
+        if (errno == ENOTSUP) {
+            printf("fd-based xattrs not available on this platform. Skipping.\n");
+            remove(test_file);
+            return;
+        }
+        perror("sys_xattr_open");
+        remove(test_file);
+        exit(1);
+    }
+
+    // The descriptor must keep reaching the file after a rename
+    if (rename(test_file, renamed_file) != 0) {
+        perror("rename");
+        sys_xattr_close(fd);
+        remove(test_file);
+        exit(1);
+    }
+
+    if (sys_fsetxattr(fd, attr_name, attr_value, strlen(attr_value), 0) != 0) {
+        if (errno == ENOTSUP || errno == EOPNOTSUPP) {
+            printf("xattr not supported on this filesystem. Skipping.\n");
+            sys_xattr_close(fd);
+            remove(renamed_file);
+            return;
+        }
+        perror("sys_fsetxattr");
+        sys_xattr_close(fd);
+        remove(renamed_file);
+        exit(1);
+    }
+
+    char buf[64];
+    ssize_t len = sys_fgetxattr(fd, attr_name, buf, sizeof(buf) - 1);
+    if (len != (ssize_t)strlen(attr_value)) {
+        perror("sys_fgetxattr");
+        sys_xattr_close(fd);
+        remove(renamed_file);
+        exit(1);
+    }
+    buf[len] = '\0';
+
+    // Path-based read sees the value written through the descriptor
+    char path_buf[64];
+    ssize_t path_len = sys_getxattr(renamed_file, attr_name, path_buf, sizeof(path_buf) - 1);
+    sys_xattr_close(fd);
+    remove(renamed_file);
+    if (path_len != len || memcmp(path_buf, buf, (size_t)len) != 0 || strcmp(buf, attr_value) != 0) {
+        fprintf(stderr, "fd value mismatch: expected '%s', got '%s'\n", attr_value, buf);
+        exit(1);
+    }
+
+    printf("fd xattr test passed: %s = %s\n", attr_name, buf);
+}
+
+// Optimistic tag writers rely on both flags failing instead of overwriting
+void test_conditional_flags(void) {
+    const char *test_file = "test_xattr_flags.txt";
+    const char *attr_name = "user.test";
+
+    FILE *f = fopen(test_file, "w");
+    if (!f) {
+        perror("fopen");
+        exit(1);
+    }
+    fclose(f);
+
+    if (sys_setxattr(test_file, attr_name, "new", 3, XATTR_REPLACE) == 0) {
+        fprintf(stderr, "XATTR_REPLACE created a missing attribute\n");
+        remove(test_file);
+        exit(1);
+    }
+    if (errno == ENOTSUP || errno == EOPNOTSUPP) {
+        printf("xattr not supported on this filesystem. Skipping.\n");
+        remove(test_file);
+        return;
+    }
+
+    if (sys_setxattr(test_file, attr_name, "first", 5, XATTR_CREATE) != 0) {
+        perror("sys_setxattr XATTR_CREATE");
+        remove(test_file);
+        exit(1);
+    }
+    if (sys_setxattr(test_file, attr_name, "second", 6, XATTR_CREATE) == 0 || errno != EEXIST) {
+        fprintf(stderr, "XATTR_CREATE replaced an existing attribute\n");
+        remove(test_file);
+        exit(1);
+    }
+    if (sys_setxattr(test_file, attr_name, "third", 5, XATTR_REPLACE) != 0) {
+        perror("sys_setxattr XATTR_REPLACE");
+        remove(test_file);
+        exit(1);
+    }
+
+    char buf[16];
+    ssize_t len = sys_getxattr(test_file, attr_name, buf, sizeof(buf) - 1);
+    remove(test_file);
+    if (len != 5 || memcmp(buf, "third", 5) != 0) {
+        fprintf(stderr, "Conditional writes left the wrong value\n");
+        exit(1);
+    }
+
+    printf("conditional xattr test passed\n");
+}
+
 int main(void) {
     printf("Running xattr_compat tests...\n");
     test_set_get_xattr();
+    test_fd_set_get_xattr();
+    test_conditional_flags();
     return 0;
 }
@@ -0,0 +1,87 @@
+/*****************************************************************************
+ * seen_index_query: answer library questions from the plugin's index
+ *
+ * Reads the seen-state index the plugin maintains next to its journal and
+ * lists or counts the files under a path prefix that have, or lack, a tag.
+ * Only files the plugin has tagged at least once are in the index; files
+ * that were never played need xattr_scan.
+ *****************************************************************************/
+#include "../seen_index.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_TAG "seen"
+
+static bool print_cb(const seen_index_entry_t *p_entry, void *p_opaque)
+{
+    (void)p_opaque;
+    printf("%s\n", p_entry->psz_path);
+    return true;
+}
+
+static void usage(const char *psz_argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] INDEX [PREFIX]\n"
+            "List indexed files under PREFIX that carry (or lack) a tag.\n\n"
+            "  -t, --tag TAG     tag to test (default: " DEFAULT_TAG ")\n"
+            "  -n, --without     list files that do not carry the tag\n"
+            "  -a, --all         ignore tags and list every indexed file\n"
+            "  -c, --count       print the number of matches instead of paths\n"
+            "  -h, --help        show this help\n\n"
+            "The plugin keeps its index in VLC's user data directory as\n"
+            "xattr-index.bin (e.g. ~/.local/share/vlc/xattr-index.bin).\n",
+            psz_argv0);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "tag", required_argument, NULL, 't' },
+        { "without", no_argument, NULL, 'n' },
+        { "all", no_argument, NULL, 'a' },
+        { "count", no_argument, NULL, 'c' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    const char *psz_tag = DEFAULT_TAG;
+    bool b_with = true;
+    bool b_count = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:nach", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't': psz_tag = optarg; break;
+            case 'n': b_with = false; break;
+            case 'a': psz_tag = NULL; break;
+            case 'c': b_count = true; break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc || argc - optind > 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    seen_index_t *p_index = seen_index_open_readonly(argv[optind]);
+    if (p_index == NULL) {
+        fprintf(stderr, "seen_index_query: %s: cannot read index\n", argv[optind]);
+        return 1;
+    }
+    const char *psz_prefix = optind + 1 < argc ? argv[optind + 1] : NULL;
+    size_t i_matched = seen_index_query(p_index, psz_prefix, psz_tag, b_with,
+                                        b_count ? NULL : print_cb, NULL);
+    if (b_count)
+        printf("%zu\n", i_matched);
+    seen_index_close(p_index);
+    return 0;
+}
@@ -0,0 +1,684 @@
+/*****************************************************************************
+ * xattr_scan: report seen/unseen state across a media library
+ *
+ * Walks directory trees with a work-stealing pool of threads and reads the
+ * configured xattr key of every regular file. Directories are listed with
+ * getdents64 in large batches; file attributes are read relative to the
+ * open directory so deep paths are never resolved again, and statx is only
+ * called for entries whose type getdents64 could not report. The reads of
+ * a directory's files are submitted together through io_uring on Linux
+ * 5.19+, so they overlap on network filesystems (see xattr_batch.h).
+ *
+ * With --rebuild-aggregates, the per-directory seen counts the plugin keeps
+ * (see dir_aggregate.h) are recomputed from the children's tags.
+ *****************************************************************************/
+#define _GNU_SOURCE
+
+#include "../tag_utils.h"
+#include "../dir_aggregate.h"
+#include "../xattr_batch.h"
+#include "../xattr_compat.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#define DEFAULT_KEY "user.xdg.tags"
+#define DEFAULT_TAG "seen"
+#define DENTS_BUFFER_SIZE (64 * 1024)
+#define VALUE_BUFFER_SIZE 10000
+#define STEAL_ATTEMPTS 4
+#define READ_BATCH 64       // Files whose key is read by one submission
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef enum {
+    FORMAT_JSONL,
+    FORMAT_CSV,
+} output_format_t;
+
+typedef enum {
+    LIST_NONE,
+    LIST_SEEN,
+    LIST_UNSEEN,
+    LIST_ALL,
+} list_mode_t;
+
+/* Per-worker deque: the owner pushes and pops at the bottom, thieves take
+ * from the top so they grab the oldest (usually largest) subtrees. */
+typedef struct {
+    pthread_mutex_t lock;
+    char **ppsz_paths;
+    size_t i_top;
+    size_t i_bottom;
+    size_t i_capacity;
+} work_deque_t;
+
+typedef struct scanner_t scanner_t;
+
+/* A regular file waiting for its key to be read */
+typedef struct {
+    const char *psz_name;       /**< Points into the getdents buffer */
+    uint64_t i_ino;
+} pending_file_t;
+
+typedef struct {
+    scanner_t *p_scanner;
+    work_deque_t deque;
+    unsigned i_index;
+    unsigned i_seed;
+    char *p_dents;
+    char *p_values;                 /**< READ_BATCH buffers of VALUE_BUFFER_SIZE */
+    xattr_batch_t *p_batch;         /**< NULL without io_uring: one read at a time */
+    xattr_batch_op_t ops[READ_BATCH];
+    pending_file_t files[READ_BATCH];
+    size_t i_files;
+} worker_t;
+
+/* State of the directory being scanned */
+typedef struct {
+    const char *psz_dir;
+    int dir_fd;
+    uint64_t i_seen;
+    uint64_t i_unseen;
+    dir_aggregate_t aggregate;
+} dir_scan_t;
+
+struct scanner_t {
+    const char *psz_key;
+    const char *psz_tag;
+    output_format_t format;
+    list_mode_t list_mode;
+    skip_matcher_t *p_skip;
+    bool b_proc_fd;                 /**< /proc/self/fd paths are usable */
+    bool b_rebuild;                 /**< Rewrite the directory aggregates */
+
+    worker_t *p_workers;
+    unsigned i_workers;
+    atomic_size_t i_pending;        /**< Directories queued or being scanned */
+    atomic_size_t i_queued;         /**< Directories waiting in a deque */
+    atomic_uint i_idle;             /**< Workers parked on idle_cond */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;       /**< Work was queued, or the scan is over */
+
+    pthread_mutex_t output_lock;
+    atomic_uint_fast64_t i_seen;
+    atomic_uint_fast64_t i_unseen;
+    atomic_uint_fast64_t i_dirs;
+    atomic_uint_fast64_t i_errors;
+    atomic_uint_fast64_t i_rebuilt;
+};
+
+static bool deque_push(work_deque_t *p_deque, char *psz_path)
+{
+    pthread_mutex_lock(&p_deque->lock);
+    if (p_deque->i_bottom == p_deque->i_capacity) {
+        // Reclaim the slots thieves freed at the top before growing
+        size_t used = p_deque->i_bottom - p_deque->i_top;
+        if (p_deque->i_top > 0 && used < p_deque->i_capacity / 2) {
+            memmove(p_deque->ppsz_paths, p_deque->ppsz_paths + p_deque->i_top,
+                    used * sizeof(char *));
+        } else {
+            size_t capacity = p_deque->i_capacity ? p_deque->i_capacity * 2 : 64;
+            char **pp_grown = malloc(capacity * sizeof(char *));
+            if (pp_grown == NULL) {
+                pthread_mutex_unlock(&p_deque->lock);
+                return false;
+            }
+            if (used > 0)
+                memcpy(pp_grown, p_deque->ppsz_paths + p_deque->i_top, used * sizeof(char *));
+            free(p_deque->ppsz_paths);
+            p_deque->ppsz_paths = pp_grown;
+            p_deque->i_capacity = capacity;
+        }
+        p_deque->i_top = 0;
+        p_deque->i_bottom = used;
+    }
+    p_deque->ppsz_paths[p_deque->i_bottom++] = psz_path;
+    pthread_mutex_unlock(&p_deque->lock);
+    return true;
+}
+
+static char *deque_pop(work_deque_t *p_deque)
+{
+    char *psz_path = NULL;
+    pthread_mutex_lock(&p_deque->lock);
+    if (p_deque->i_bottom > p_deque->i_top)
+        psz_path = p_deque->ppsz_paths[--p_deque->i_bottom];
+    pthread_mutex_unlock(&p_deque->lock);
+    return psz_path;
+}
+
+static char *deque_steal(work_deque_t *p_deque)
+{
+    char *psz_path = NULL;
+    if (pthread_mutex_trylock(&p_deque->lock) != 0)
+        return NULL;
+    if (p_deque->i_bottom > p_deque->i_top)
+        psz_path = p_deque->ppsz_paths[p_deque->i_top++];
+    pthread_mutex_unlock(&p_deque->lock);
+    return psz_path;
+}
+
+/* Queue a directory for any worker and wake one that is idle. */
+static bool queue_directory(scanner_t *p_scanner, work_deque_t *p_deque, char *psz_path)
+{
+    atomic_fetch_add(&p_scanner->i_pending, 1);
+    atomic_fetch_add(&p_scanner->i_queued, 1);
+    if (!deque_push(p_deque, psz_path)) {
+        atomic_fetch_sub(&p_scanner->i_queued, 1);
+        atomic_fetch_sub(&p_scanner->i_pending, 1);
+        return false;
+    }
+    // A worker counts itself idle before checking i_queued, so one of the
+    // two sees the other's increment
+    if (atomic_load(&p_scanner->i_idle) > 0) {
+        pthread_mutex_lock(&p_scanner->idle_lock);
+        pthread_cond_signal(&p_scanner->idle_cond);
+        pthread_mutex_unlock(&p_scanner->idle_lock);
+    }
+    return true;
+}
+
+/* Write a JSON string literal, escaping what JSON requires. */
+static void json_string(FILE *p_out, const char *psz)
+{
+    fputc('"', p_out);
+    for (const unsigned char *p = (const unsigned char *)psz; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(p_out, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(p_out, "\\u%04x", *p);
+        else
+            fputc(*p, p_out);
+    }
+    fputc('"', p_out);
+}
+
+/* Write a CSV field, quoting it when needed. */
+static void csv_field(FILE *p_out, const char *psz)
+{
+    if (strpbrk(psz, ",\"\n\r") == NULL) {
+        fputs(psz, p_out);
+        return;
+    }
+    fputc('"', p_out);
+    for (const char *p = psz; *p; p++) {
+        if (*p == '"')
+            fputc('"', p_out);
+        fputc(*p, p_out);
+    }
+    fputc('"', p_out);
+}
+
+static void emit_record(scanner_t *p_scanner, const char *psz_type, const char *psz_path,
+                        uint64_t i_seen, uint64_t i_unseen)
+{
+    pthread_mutex_lock(&p_scanner->output_lock);
+    if (p_scanner->format == FORMAT_CSV) {
+        fprintf(stdout, "%s,", psz_type);
+        csv_field(stdout, psz_path);
+        fprintf(stdout, ",%" PRIu64 ",%" PRIu64 "\n", i_seen, i_unseen);
+    } else {
+        fprintf(stdout, "{\"type\":\"%s\",\"path\":", psz_type);
+        json_string(stdout, psz_path);
+        fprintf(stdout, ",\"seen\":%" PRIu64 ",\"unseen\":%" PRIu64 "}\n", i_seen, i_unseen);
+    }
+    pthread_mutex_unlock(&p_scanner->output_lock);
+}
+
+static char *join_path(const char *psz_dir, const char *psz_name)
+{
+    size_t dir_len = strlen(psz_dir);
+    size_t name_len = strlen(psz_name);
+    bool b_slash = dir_len > 0 && psz_dir[dir_len - 1] == '/';
+    char *psz_path = malloc(dir_len + !b_slash + name_len + 1);
+    if (psz_path == NULL)
+        return NULL;
+    memcpy(psz_path, psz_dir, dir_len);
+    if (!b_slash)
+        psz_path[dir_len++] = '/';
+    memcpy(psz_path + dir_len, psz_name, name_len + 1);
+    return psz_path;
+}
+
+/* Path reaching \p psz_name inside the open directory \p dir_fd. */
+static char *file_path(const scanner_t *p_scanner, int dir_fd, const char *psz_dir,
+                       const char *psz_name)
+{
+    char *psz_path;
+    if (p_scanner->b_proc_fd && asprintf(&psz_path, "/proc/self/fd/%d/%s", dir_fd, psz_name) != -1)
+        return psz_path;
+    return join_path(psz_dir, psz_name);
+}
+
+static unsigned char entry_type(int dir_fd, const struct linux_dirent64 *p_entry)
+{
+    if (p_entry->d_type != DT_UNKNOWN)
+        return p_entry->d_type;
+
+    // Some filesystems (and old XFS) do not fill d_type
+    struct statx stx;
+    if (statx(dir_fd, p_entry->d_name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_TYPE, &stx) != 0)
+        return DT_UNKNOWN;
+    if (S_ISDIR(stx.stx_mode))
+        return DT_DIR;
+    if (S_ISREG(stx.stx_mode))
+        return DT_REG;
+    return DT_UNKNOWN;
+}
+
+/* Replace the aggregate of the open directory with its seen children. */
+static void write_aggregate(scanner_t *p_scanner, int dir_fd, const char *psz_dir,
+                            const dir_aggregate_t *p_agg)
+{
+    if (p_agg->i_count == 0) {
+        // Nothing seen: no aggregate at all, like a folder the plugin never touched
+        if ((fremovexattr(dir_fd, DIR_AGGREGATE_CHILDREN_KEY) != 0 && errno != ENODATA)
+         || (fremovexattr(dir_fd, DIR_AGGREGATE_COUNT_KEY) != 0 && errno != ENODATA)) {
+            fprintf(stderr, "xattr_scan: %s: %s\n", psz_dir, strerror(errno));
+            atomic_fetch_add(&p_scanner->i_errors, 1);
+        }
+        return;
+    }
+
+    size_t i_len = dir_aggregate_encode(p_agg, NULL, 0);
+    uint8_t *p_value = malloc(i_len);
+    char psz_count[24];
+    size_t i_count_len = dir_aggregate_format_count(p_agg, psz_count, sizeof(psz_count));
+    if (p_value == NULL) {
+        atomic_fetch_add(&p_scanner->i_errors, 1);
+        return;
+    }
+    dir_aggregate_encode(p_agg, p_value, i_len);
+    if (fsetxattr(dir_fd, DIR_AGGREGATE_CHILDREN_KEY, p_value, i_len, 0) != 0
+     || fsetxattr(dir_fd, DIR_AGGREGATE_COUNT_KEY, psz_count, i_count_len, 0) != 0) {
+        fprintf(stderr, "xattr_scan: %s: %s\n", psz_dir, strerror(errno));
+        atomic_fetch_add(&p_scanner->i_errors, 1);
+    } else
+        atomic_fetch_add(&p_scanner->i_rebuilt, 1);
+    free(p_value);
+}
+
+/* Read a value larger than the batch buffers: ask for its size and read it
+ * again, for as long as it keeps growing in between. *pp_value is the
+ * caller's to free, even on failure. */
+static ssize_t read_large_value(const char *psz_path, const char *psz_key, char **pp_value)
+{
+    *pp_value = NULL;
+    for (;;) {
+        ssize_t size = sys_getxattr(psz_path, psz_key, NULL, 0);
+        if (size <= 0)
+            return size;
+        char *p_grown = realloc(*pp_value, (size_t)size);
+        if (p_grown == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        *pp_value = p_grown;
+        ssize_t len = sys_getxattr(psz_path, psz_key, p_grown, (size_t)size);
+        if (len >= 0 || errno != ERANGE)
+            return len;
+    }
+}
+
+/* Read the key of every pending file in one batch and count them. */
+static void flush_files(worker_t *p_worker, dir_scan_t *p_dir)
+{
+    scanner_t *p_scanner = p_worker->p_scanner;
+    size_t i_ops = 0;
+
+    for (size_t i = 0; i < p_worker->i_files; i++) {
+        char *psz_path = file_path(p_scanner, p_dir->dir_fd, p_dir->psz_dir,
+                                   p_worker->files[i].psz_name);
+        if (psz_path == NULL) {
+            atomic_fetch_add(&p_scanner->i_errors, 1);
+            continue;
+        }
+        p_worker->files[i_ops] = p_worker->files[i];
+        p_worker->ops[i_ops] = (xattr_batch_op_t) {
+            .i_kind = XATTR_BATCH_GET, .psz_path = psz_path, .i_fd = -1,
+            .psz_name = p_scanner->psz_key,
+            .p_value = p_worker->p_values + i_ops * VALUE_BUFFER_SIZE, .i_size = VALUE_BUFFER_SIZE,
+        };
+        i_ops++;
+    }
+    p_worker->i_files = 0;
+    xattr_batch_run(p_worker->p_batch, p_worker->ops, i_ops);
+
+    for (size_t i = 0; i < i_ops; i++) {
+        const xattr_batch_op_t *p_op = &p_worker->ops[i];
+        const char *p_value = p_op->p_value;
+        char *p_large = NULL;
+        ssize_t len = p_op->i_result;
+        int err = p_op->i_errno;
+        if (len < 0 && err == ERANGE) {
+            len = read_large_value(p_op->psz_path, p_scanner->psz_key, &p_large);
+            err = errno;
+            p_value = p_large;
+        }
+        free((char *)p_op->psz_path);
+        bool b_seen = len > 0 && xdg_tags_contains(p_value, (size_t)len, p_scanner->psz_tag);
+        free(p_large);
+        if (len < 0 && err != ENODATA && err != ENOTSUP) {
+            fprintf(stderr, "xattr_scan: %s/%s: %s\n", p_dir->psz_dir,
+                    p_worker->files[i].psz_name, strerror(err));
+            atomic_fetch_add(&p_scanner->i_errors, 1);
+            continue;
+        }
+        if (b_seen) {
+            p_dir->i_seen++;
+            if (p_scanner->b_rebuild
+             && !dir_aggregate_insert(&p_dir->aggregate, p_worker->files[i].i_ino, NULL))
+                atomic_fetch_add(&p_scanner->i_errors, 1);
+        } else
+            p_dir->i_unseen++;
+
+        if (p_scanner->list_mode == LIST_ALL
+         || (p_scanner->list_mode == LIST_SEEN && b_seen)
+         || (p_scanner->list_mode == LIST_UNSEEN && !b_seen)) {
+            char *psz_file = join_path(p_dir->psz_dir, p_worker->files[i].psz_name);
+            if (psz_file != NULL)
+                emit_record(p_scanner, "file", psz_file, b_seen, !b_seen);
+            free(psz_file);
+        }
+    }
+}
+
+static void scan_directory(worker_t *p_worker, char *psz_dir)
+{
+    scanner_t *p_scanner = p_worker->p_scanner;
+    dir_scan_t dir = { .psz_dir = psz_dir };
+    dir_aggregate_init(&dir.aggregate);
+
+    dir.dir_fd = open(psz_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (dir.dir_fd < 0) {
+        fprintf(stderr, "xattr_scan: %s: %s\n", psz_dir, strerror(errno));
+        atomic_fetch_add(&p_scanner->i_errors, 1);
+        return;
+    }
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, dir.dir_fd, p_worker->p_dents, DENTS_BUFFER_SIZE);
+        if (n <= 0) {
+            if (n < 0) {
+                fprintf(stderr, "xattr_scan: %s: %s\n", psz_dir, strerror(errno));
+                atomic_fetch_add(&p_scanner->i_errors, 1);
+            }
+            break;
+        }
+
+        for (long offset = 0; offset < n;) {
+            const struct linux_dirent64 *p_entry =
+                (const struct linux_dirent64 *)(p_worker->p_dents + offset);
+            offset += p_entry->d_reclen;
+
+            const char *psz_name = p_entry->d_name;
+            if (psz_name[0] == '.' && (psz_name[1] == '\0' || (psz_name[1] == '.' && psz_name[2] == '\0')))
+                continue;
+
+            unsigned char type = entry_type(dir.dir_fd, p_entry);
+            if (type == DT_DIR) {
+                char *psz_child = join_path(psz_dir, psz_name);
+                if (psz_child == NULL || skip_matcher_match(p_scanner->p_skip, psz_child)) {
+                    free(psz_child);
+                    continue;
+                }
+                if (!queue_directory(p_scanner, &p_worker->deque, psz_child)) {
+                    free(psz_child);
+                    atomic_fetch_add(&p_scanner->i_errors, 1);
+                }
+                continue;
+            }
+            if (type != DT_REG)
+                continue;
+
+            p_worker->files[p_worker->i_files++] = (pending_file_t) { psz_name, p_entry->d_ino };
+            if (p_worker->i_files == READ_BATCH)
+                flush_files(p_worker, &dir);
+        }
+        // The names live in the getdents buffer, which the next call overwrites
+        flush_files(p_worker, &dir);
+    }
+    if (p_scanner->b_rebuild)
+        write_aggregate(p_scanner, dir.dir_fd, psz_dir, &dir.aggregate);
+    dir_aggregate_clear(&dir.aggregate);
+    close(dir.dir_fd);
+
+    atomic_fetch_add(&p_scanner->i_seen, dir.i_seen);
+    atomic_fetch_add(&p_scanner->i_unseen, dir.i_unseen);
+    atomic_fetch_add(&p_scanner->i_dirs, 1);
+    if (dir.i_seen + dir.i_unseen > 0)
+        emit_record(p_scanner, "dir", psz_dir, dir.i_seen, dir.i_unseen);
+}
+
+static char *find_work(worker_t *p_worker)
+{
+    scanner_t *p_scanner = p_worker->p_scanner;
+    char *psz_path = deque_pop(&p_worker->deque);
+    for (int attempt = 0; psz_path == NULL && attempt < STEAL_ATTEMPTS; attempt++) {
+        unsigned victim = (unsigned)rand_r(&p_worker->i_seed) % p_scanner->i_workers;
+        if (victim != p_worker->i_index)
+            psz_path = deque_steal(&p_scanner->p_workers[victim].deque);
+    }
+    if (psz_path != NULL)
+        atomic_fetch_sub(&p_scanner->i_queued, 1);
+    return psz_path;
+}
+
+/* Sleep until some deque has work or the last directory is done. */
+static void wait_for_work(scanner_t *p_scanner)
+{
+    pthread_mutex_lock(&p_scanner->idle_lock);
+    atomic_fetch_add(&p_scanner->i_idle, 1);
+    while (atomic_load(&p_scanner->i_pending) > 0 && atomic_load(&p_scanner->i_queued) == 0)
+        pthread_cond_wait(&p_scanner->idle_cond, &p_scanner->idle_lock);
+    atomic_fetch_sub(&p_scanner->i_idle, 1);
+    pthread_mutex_unlock(&p_scanner->idle_lock);
+}
+
+static void *worker_main(void *p_data)
+{
+    worker_t *p_worker = p_data;
+    scanner_t *p_scanner = p_worker->p_scanner;
+
+    while (atomic_load(&p_scanner->i_pending) > 0) {
+        char *psz_dir = find_work(p_worker);
+        if (psz_dir == NULL) {
+            wait_for_work(p_scanner);
+            continue;
+        }
+        scan_directory(p_worker, psz_dir);
+        free(psz_dir);
+        if (atomic_fetch_sub(&p_scanner->i_pending, 1) == 1) {
+            // Last one: release the workers still waiting
+            pthread_mutex_lock(&p_scanner->idle_lock);
+            pthread_cond_broadcast(&p_scanner->idle_cond);
+            pthread_mutex_unlock(&p_scanner->idle_lock);
+        }
+    }
+    return NULL;
+}
+
+static void usage(const char *psz_argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [OPTIONS] DIR...\n"
+            "Report which files under DIR carry a tag in their xattrs.\n\n"
+            "  -k, --key KEY          xattr key to read (default: " DEFAULT_KEY ")\n"
+            "  -t, --tag TAG          tag that marks a file as seen (default: " DEFAULT_TAG ")\n"
+            "  -j, --threads N        worker threads (default: online CPUs)\n"
+            "  -f, --format FORMAT    jsonl or csv (default: jsonl)\n"
+            "  -l, --list WHICH       also list files: seen, unseen or all\n"
+            "  -s, --skip-paths LIST  comma/newline separated path prefixes to skip\n"
+            "  -A, --rebuild-aggregates\n"
+            "                         rewrite each directory's " DIR_AGGREGATE_COUNT_KEY " and\n"
+            "                         " DIR_AGGREGATE_CHILDREN_KEY " from its children's tags\n"
+            "  -h, --help             show this help\n\n"
+            "Each directory with files yields a \"dir\" record counting its direct\n"
+            "children; a final \"total\" record sums the whole scan.\n",
+            psz_argv0);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "key", required_argument, NULL, 'k' },
+        { "tag", required_argument, NULL, 't' },
+        { "threads", required_argument, NULL, 'j' },
+        { "format", required_argument, NULL, 'f' },
+        { "list", required_argument, NULL, 'l' },
+        { "skip-paths", required_argument, NULL, 's' },
+        { "rebuild-aggregates", no_argument, NULL, 'A' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    scanner_t scanner = {
+        .psz_key = DEFAULT_KEY,
+        .psz_tag = DEFAULT_TAG,
+        .format = FORMAT_JSONL,
+        .list_mode = LIST_NONE,
+    };
+    long i_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *psz_skip = NULL;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "k:t:j:f:l:s:Ah", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'k': scanner.psz_key = optarg; break;
+            case 't': scanner.psz_tag = optarg; break;
+            case 'j': i_threads = strtol(optarg, NULL, 10); break;
+            case 's': psz_skip = optarg; break;
+            case 'A': scanner.b_rebuild = true; break;
+            case 'f':
+                if (strcmp(optarg, "csv") == 0)
+                    scanner.format = FORMAT_CSV;
+                else if (strcmp(optarg, "jsonl") == 0)
+                    scanner.format = FORMAT_JSONL;
+                else {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'l':
+                if (strcmp(optarg, "seen") == 0)
+                    scanner.list_mode = LIST_SEEN;
+                else if (strcmp(optarg, "unseen") == 0)
+                    scanner.list_mode = LIST_UNSEEN;
+                else if (strcmp(optarg, "all") == 0)
+                    scanner.list_mode = LIST_ALL;
+                else {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (i_threads < 1)
+        i_threads = 1;
+
+    scanner.p_skip = skip_matcher_compile(psz_skip);
+    scanner.b_proc_fd = access("/proc/self/fd", X_OK) == 0;
+    scanner.i_workers = (unsigned)i_threads;
+    scanner.p_workers = calloc(scanner.i_workers, sizeof(worker_t));
+    if (scanner.p_skip == NULL || scanner.p_workers == NULL) {
+        fprintf(stderr, "xattr_scan: out of memory\n");
+        return 1;
+    }
+    pthread_mutex_init(&scanner.output_lock, NULL);
+    pthread_mutex_init(&scanner.idle_lock, NULL);
+    pthread_cond_init(&scanner.idle_cond, NULL);
+    atomic_init(&scanner.i_pending, 0);
+    atomic_init(&scanner.i_queued, 0);
+    atomic_init(&scanner.i_idle, 0);
+
+    for (unsigned i = 0; i < scanner.i_workers; i++) {
+        worker_t *p_worker = &scanner.p_workers[i];
+        p_worker->p_scanner = &scanner;
+        p_worker->i_index = i;
+        p_worker->i_seed = i * 2654435761u + 1;
+        p_worker->p_dents = malloc(DENTS_BUFFER_SIZE);
+        p_worker->p_values = malloc((size_t)READ_BATCH * VALUE_BUFFER_SIZE);
+        p_worker->p_batch = xattr_batch_new(READ_BATCH);
+        pthread_mutex_init(&p_worker->deque.lock, NULL);
+        if (p_worker->p_dents == NULL || p_worker->p_values == NULL) {
+            fprintf(stderr, "xattr_scan: out of memory\n");
+            return 1;
+        }
+    }
+
+    if (scanner.format == FORMAT_CSV)
+        printf("type,path,seen,unseen\n");
+
+    // Seed the roots round-robin so every worker starts with something
+    for (int i = optind; i < argc; i++) {
+        char *psz_root = strdup(argv[i]);
+        if (psz_root == NULL)
+            continue;
+        if (!queue_directory(&scanner, &scanner.p_workers[(unsigned)(i - optind) % scanner.i_workers].deque,
+                             psz_root))
+            free(psz_root);
+    }
+
+    pthread_t *p_threads = calloc(scanner.i_workers, sizeof(pthread_t));
+    if (p_threads == NULL) {
+        fprintf(stderr, "xattr_scan: out of memory\n");
+        return 1;
+    }
+    for (unsigned i = 0; i < scanner.i_workers; i++)
+        pthread_create(&p_threads[i], NULL, worker_main, &scanner.p_workers[i]);
+    for (unsigned i = 0; i < scanner.i_workers; i++)
+        pthread_join(p_threads[i], NULL);
+
+    emit_record(&scanner, "total", "", atomic_load(&scanner.i_seen), atomic_load(&scanner.i_unseen));
+    fprintf(stderr, "xattr_scan: %" PRIu64 " directories, %" PRIu64 " errors\n",
+            (uint64_t)atomic_load(&scanner.i_dirs), (uint64_t)atomic_load(&scanner.i_errors));
+    if (scanner.b_rebuild)
+        fprintf(stderr, "xattr_scan: %" PRIu64 " directory aggregates written\n",
+                (uint64_t)atomic_load(&scanner.i_rebuilt));
+
+    for (unsigned i = 0; i < scanner.i_workers; i++) {
+        free(scanner.p_workers[i].deque.ppsz_paths);
+        free(scanner.p_workers[i].p_dents);
+        free(scanner.p_workers[i].p_values);
+        xattr_batch_free(scanner.p_workers[i].p_batch);
+        pthread_mutex_destroy(&scanner.p_workers[i].deque.lock);
+    }
+    free(p_threads);
+    free(scanner.p_workers);
+    skip_matcher_free(scanner.p_skip);
+    pthread_mutex_destroy(&scanner.output_lock);
+    pthread_mutex_destroy(&scanner.idle_lock);
+    pthread_cond_destroy(&scanner.idle_cond);
+    return atomic_load(&scanner.i_errors) > 0 ? 1 : 0;
+}
@@ -0,0 +1,354 @@
+#include "write_queue.h"
+#include "compat.h"
+#include "xattr_compat.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+xattr_file_t *xattr_file_new(const char *psz_path)
+{
+    if (psz_path == NULL)
+        return NULL;
+
+    xattr_file_t *p_file = malloc(sizeof(*p_file));
+    if (p_file == NULL)
+        return NULL;
+
+    p_file->psz_path = strdup(psz_path);
+    if (p_file->psz_path == NULL) {
+        free(p_file);
+        return NULL;
+    }
+    p_file->b_resolved = false;
+    p_file->i_fd = -1;
+    p_file->b_identity = false;
+    p_file->i_dev = 0;
+    p_file->i_ino = 0;
+    p_file->b_key_exists = false;
+    atomic_init(&p_file->i_refs, 1);
+    return p_file;
+}
+
+bool xattr_file_resolve(xattr_file_t *p_file)
+{
+    if (p_file->b_resolved)
+        return false;
+    p_file->b_resolved = true;
+    p_file->i_fd = sys_xattr_open(p_file->psz_path);
+
+    // Identify the file once, for caches and indexes keyed by inode
+    struct stat st;
+    p_file->b_identity = (p_file->i_fd >= 0 && fstat(p_file->i_fd, &st) == 0)
+                      || stat(p_file->psz_path, &st) == 0;
+    p_file->i_dev = p_file->b_identity ? (uint64_t)st.st_dev : 0;
+    p_file->i_ino = p_file->b_identity ? (uint64_t)st.st_ino : 0;
+    return true;
+}
+
+xattr_file_t *xattr_file_open(const char *psz_path)
+{
+    xattr_file_t *p_file = xattr_file_new(psz_path);
+    if (p_file != NULL)
+        xattr_file_resolve(p_file);
+    return p_file;
+}
+
+xattr_file_t *xattr_file_hold(xattr_file_t *p_file)
+{
+    atomic_fetch_add_explicit(&p_file->i_refs, 1, memory_order_relaxed);
+    return p_file;
+}
+
+void xattr_file_release(xattr_file_t *p_file)
+{
+    if (p_file == NULL)
+        return;
+    if (atomic_fetch_sub_explicit(&p_file->i_refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    if (p_file->i_fd >= 0)
+        sys_xattr_close(p_file->i_fd);
+    free(p_file->psz_path);
+    free(p_file);
+}
+
+static bool ring_push(write_queue_ring_t *p_ring, xattr_job_t *p_job);
+static xattr_job_t *ring_pop(write_queue_ring_t *p_ring);
+
+/* A spare job of \p p_queue, or a new one. Spares keep their storage and
+ * have everything else cleared. */
+static xattr_job_t *job_take(write_queue_t *p_queue)
+{
+    xattr_job_t *p_job = p_queue != NULL ? ring_pop(&p_queue->spares) : NULL;
+    if (p_job != NULL)
+        return p_job;
+    p_job = calloc(1, sizeof(*p_job));
+    if (p_job != NULL)
+        p_job->p_queue = p_queue;
+    return p_job;
+}
+
+static void job_delete(xattr_job_t *p_job)
+{
+    xattr_file_release(p_job->p_file);
+    free(p_job->p_strings);
+    free(p_job->ppsz_tags);
+    free(p_job);
+}
+
+static bool reserve_strings(xattr_job_t *p_job, size_t i_size)
+{
+    if (i_size <= p_job->i_strings_size)
+        return true;
+    char *p_grown = realloc(p_job->p_strings, i_size);
+    if (p_grown == NULL)
+        return false;
+    p_job->p_strings = p_grown;
+    p_job->i_strings_size = i_size;
+    return true;
+}
+
+static bool reserve_tags(xattr_job_t *p_job, size_t i_count)
+{
+    if (i_count <= p_job->i_tags_size)
+        return true;
+    char **pp_grown = realloc(p_job->ppsz_tags, i_count * sizeof(*pp_grown));
+    if (pp_grown == NULL)
+        return false;
+    p_job->ppsz_tags = pp_grown;
+    p_job->i_tags_size = i_count;
+    return true;
+}
+
+/* Copy \p psz to \p p_dst and return the byte after its terminator. */
+static char *copy_string(char *p_dst, const char *psz)
+{
+    size_t i_size = strlen(psz) + 1;
+    memcpy(p_dst, psz, i_size);
+    return p_dst + i_size;
+}
+
+xattr_job_t *xattr_job_new(write_queue_t *p_queue, xattr_file_t *p_file, const char *psz_key,
+                           const char *const *ppsz_tags, size_t i_tag_count)
+{
+    if (p_file == NULL || psz_key == NULL || ppsz_tags == NULL || i_tag_count == 0)
+        return NULL;
+    size_t i_size = strlen(psz_key) + 1;
+    for (size_t i = 0; i < i_tag_count; i++) {
+        if (ppsz_tags[i] == NULL)
+            return NULL;
+        i_size += strlen(ppsz_tags[i]) + 1;
+    }
+
+    xattr_job_t *p_job = job_take(p_queue);
+    if (p_job == NULL)
+        return NULL;
+    if (!reserve_strings(p_job, i_size) || !reserve_tags(p_job, i_tag_count)) {
+        xattr_job_free(p_job);
+        return NULL;
+    }
+
+    p_job->i_kind = XATTR_JOB_TAGS;
+    p_job->p_file = xattr_file_hold(p_file);
+    p_job->psz_key = p_job->p_strings;
+    char *p = copy_string(p_job->psz_key, psz_key);
+    for (size_t i = 0; i < i_tag_count; i++) {
+        p_job->ppsz_tags[i] = p;
+        p = copy_string(p, ppsz_tags[i]);
+    }
+    p_job->i_tag_count = i_tag_count;
+    return p_job;
+}
+
+xattr_job_t *xattr_checkpoint_job_new(write_queue_t *p_queue, xattr_file_t *p_file,
+                                      int64_t i_position_ms, int64_t i_watch_ms)
+{
+    if (p_file == NULL || (i_position_ms < 0 && i_watch_ms <= 0))
+        return NULL;
+
+    xattr_job_t *p_job = job_take(p_queue);
+    if (p_job == NULL)
+        return NULL;
+
+    p_job->i_kind = XATTR_JOB_CHECKPOINT;
+    p_job->p_file = xattr_file_hold(p_file);
+    p_job->i_position_ms = i_position_ms < 0 ? -1 : i_position_ms;
+    p_job->i_watch_ms = i_watch_ms > 0 ? i_watch_ms : 0;
+    return p_job;
+}
+
+xattr_job_t *xattr_resume_job_new(write_queue_t *p_queue, const char *psz_path,
+                                  uint64_t i_generation)
+{
+    if (psz_path == NULL)
+        return NULL;
+
+    xattr_job_t *p_job = job_take(p_queue);
+    if (p_job == NULL)
+        return NULL;
+    if (!reserve_strings(p_job, strlen(psz_path) + 1)) {
+        xattr_job_free(p_job);
+        return NULL;
+    }
+
+    p_job->i_kind = XATTR_JOB_RESUME;
+    p_job->i_generation = i_generation;
+    p_job->psz_path = p_job->p_strings;
+    copy_string(p_job->psz_path, psz_path);
+    return p_job;
+}
+
+void xattr_job_free(xattr_job_t *p_job)
+{
+    if (p_job == NULL)
+        return;
+    if (p_job->p_queue == NULL) {
+        job_delete(p_job);
+        return;
+    }
+
+    xattr_file_release(p_job->p_file);
+    *p_job = (xattr_job_t) {
+        .p_queue = p_job->p_queue,
+        .p_strings = p_job->p_strings,
+        .i_strings_size = p_job->i_strings_size,
+        .ppsz_tags = p_job->ppsz_tags,
+        .i_tags_size = p_job->i_tags_size,
+    };
+    // More jobs in flight than the queue holds: let the extra ones go
+    if (!ring_push(&p_job->p_queue->spares, p_job))
+        job_delete(p_job);
+}
+
+static bool ring_init(write_queue_ring_t *p_ring, size_t size)
+{
+    p_ring->slots = calloc(size, sizeof(*p_ring->slots));
+    if (p_ring->slots == NULL)
+        return false;
+
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&p_ring->slots[i].seq, i);
+
+    p_ring->i_mask = size - 1;
+    atomic_init(&p_ring->i_head, 0);
+    atomic_init(&p_ring->i_tail, 0);
+    return true;
+}
+
+bool write_queue_init(write_queue_t *p_queue, size_t capacity,
+                      write_queue_overflow_t overflow)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    if (!ring_init(&p_queue->jobs, size))
+        return false;
+    if (!ring_init(&p_queue->spares, size)) {
+        free(p_queue->jobs.slots);
+        p_queue->jobs.slots = NULL;
+        return false;
+    }
+
+    p_queue->i_overflow = overflow;
+    atomic_init(&p_queue->i_enqueued, 0);
+    atomic_init(&p_queue->i_dropped, 0);
+    return true;
+}
+
+void write_queue_destroy(write_queue_t *p_queue)
+{
+    if (p_queue->jobs.slots == NULL)
+        return;
+
+    xattr_job_t *p_job;
+    while ((p_job = write_queue_pop(p_queue)) != NULL)
+        xattr_job_free(p_job);
+    while ((p_job = ring_pop(&p_queue->spares)) != NULL)
+        job_delete(p_job);
+
+    free(p_queue->jobs.slots);
+    free(p_queue->spares.slots);
+    p_queue->jobs.slots = NULL;
+    p_queue->spares.slots = NULL;
+}
+
+/* Claim the next free slot, or return false when the ring is full. */
+static bool ring_push(write_queue_ring_t *p_ring, xattr_job_t *p_job)
+{
+    size_t pos = atomic_load_explicit(&p_ring->i_head, memory_order_relaxed);
+    for (;;) {
+        write_queue_slot_t *p_slot = &p_ring->slots[pos & p_ring->i_mask];
+        size_t seq = atomic_load_explicit(&p_slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&p_ring->i_head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                p_slot->p_job = p_job;
+                atomic_store_explicit(&p_slot->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&p_ring->i_head, memory_order_relaxed);
+        }
+    }
+}
+
+static xattr_job_t *ring_pop(write_queue_ring_t *p_ring)
+{
+    size_t pos = atomic_load_explicit(&p_ring->i_tail, memory_order_relaxed);
+    for (;;) {
+        write_queue_slot_t *p_slot = &p_ring->slots[pos & p_ring->i_mask];
+        size_t seq = atomic_load_explicit(&p_slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&p_ring->i_tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                xattr_job_t *p_job = p_slot->p_job;
+                p_slot->p_job = NULL;
+                atomic_store_explicit(&p_slot->seq, pos + p_ring->i_mask + 1,
+                                      memory_order_release);
+                return p_job;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&p_ring->i_tail, memory_order_relaxed);
+        }
+    }
+}
+
+bool write_queue_push(write_queue_t *p_queue, xattr_job_t *p_job)
+{
+    if (p_job == NULL)
+        return false;
+
+    while (!ring_push(&p_queue->jobs, p_job)) {
+        if (p_queue->i_overflow != WRITE_QUEUE_DROP_OLDEST) {
+            atomic_fetch_add_explicit(&p_queue->i_dropped, 1, memory_order_relaxed);
+            xattr_job_free(p_job);
+            return false;
+        }
+
+        xattr_job_t *p_oldest = write_queue_pop(p_queue);
+        if (p_oldest != NULL) {
+            atomic_fetch_add_explicit(&p_queue->i_dropped, 1, memory_order_relaxed);
+            xattr_job_free(p_oldest);
+        }
+    }
+
+    atomic_fetch_add_explicit(&p_queue->i_enqueued, 1, memory_order_relaxed);
+    return true;
+}
+
+xattr_job_t *write_queue_pop(write_queue_t *p_queue)
+{
+    return ring_pop(&p_queue->jobs);
+}
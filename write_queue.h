@@ -0,0 +1,203 @@
+#ifndef WRITE_QUEUE_H
+#define WRITE_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A file being tagged, shared by the playing item and its queued jobs.
+ * The descriptor is opened once so every write skips the path walk and
+ * keeps reaching the same file if it is renamed during playback. Only
+ * \c psz_path is set up front; the thread that runs the jobs resolves the
+ * rest with xattr_file_resolve(), so creating a file never touches the
+ * filesystem.
+ */
+typedef struct xattr_file_t {
+    char *psz_path;
+    bool b_resolved;            /**< Whether the fields below were filled in */
+    int i_fd;                   /**< From sys_xattr_open(), or -1 to use psz_path */
+    bool b_identity;            /**< Whether i_dev and i_ino were read at open */
+    uint64_t i_dev;             /**< st_dev of the file when opened */
+    uint64_t i_ino;             /**< st_ino of the file when opened */
+    bool b_key_exists;          /**< The tag key was seen on the file; writer thread only */
+    atomic_uint i_refs;
+} xattr_file_t;
+
+typedef enum {
+    XATTR_JOB_TAGS = 0,         /**< Append tags to a key */
+    XATTR_JOB_CHECKPOINT,       /**< Record playback position and watch time */
+    XATTR_JOB_RESUME,           /**< Read the stored position of a file about to play */
+} xattr_job_kind_t;
+
+struct write_queue_t;
+
+/**
+ * A single pending xattr write. A tags job appends every tag in
+ * \c ppsz_tags to \c psz_key on \c p_file with one read-modify-write; a
+ * checkpoint job stores \c i_position_ms and adds \c i_watch_ms to the
+ * configured playback keys. A resume job opens \c psz_path itself, so the
+ * caller never waits on the filesystem. The job holds a reference to
+ * \c p_file and owns its strings, which share one buffer.
+ */
+typedef struct xattr_job_t {
+    xattr_job_kind_t i_kind;
+    xattr_file_t *p_file;
+    char *psz_key;              /**< Tags only */
+    char **ppsz_tags;           /**< Tags only */
+    size_t i_tag_count;
+    int64_t i_position_ms;      /**< Checkpoint only: playback time, or -1 to keep */
+    int64_t i_watch_ms;         /**< Checkpoint only: watch time to add */
+    char *psz_path;             /**< Resume only: file to read */
+    uint64_t i_generation;      /**< Resume only: item the read is for */
+    struct write_queue_t *p_queue; /**< Queue the job is recycled into, or NULL */
+    char *p_strings;            /**< Storage of the strings above, kept when recycled */
+    size_t i_strings_size;
+    size_t i_tags_size;         /**< Slots allocated in ppsz_tags */
+} xattr_job_t;
+
+/**
+ * What write_queue_push() does when the queue is full.
+ */
+typedef enum {
+    WRITE_QUEUE_DROP_NEWEST = 0, /**< Reject the job being pushed */
+    WRITE_QUEUE_DROP_OLDEST,     /**< Evict the oldest queued job to make room */
+} write_queue_overflow_t;
+
+typedef struct {
+    atomic_size_t seq;
+    xattr_job_t *p_job;
+} write_queue_slot_t;
+
+/**
+ * Bounded lock-free multi-producer/multi-consumer ring of jobs.
+ *
+ * Each slot carries a sequence number so producers and consumers can claim
+ * positions with a single compare-and-swap and never block each other.
+ */
+typedef struct {
+    write_queue_slot_t *slots;
+    size_t i_mask;
+    atomic_size_t i_head;                   /**< Next position to enqueue */
+    atomic_size_t i_tail;                   /**< Next position to dequeue */
+} write_queue_ring_t;
+
+/**
+ * Bounded lock-free queue of xattr jobs. Jobs built with the queue are
+ * recycled into a second ring of the same size when freed, so queuing a
+ * write allocates nothing once enough jobs have been through it.
+ */
+typedef struct write_queue_t {
+    write_queue_ring_t jobs;
+    write_queue_ring_t spares;              /**< Freed jobs waiting to be reused */
+    write_queue_overflow_t i_overflow;
+    atomic_uint_fast64_t i_enqueued;        /**< Jobs accepted by push */
+    atomic_uint_fast64_t i_dropped;         /**< Jobs lost to overflow */
+} write_queue_t;
+
+/**
+ * Create an unresolved file for \p psz_path without any filesystem access.
+ *
+ * \return A file with one reference, or NULL on allocation failure.
+ */
+xattr_file_t *xattr_file_new(const char *psz_path);
+
+/**
+ * Open the descriptor and read the identity of \p p_file, once. Failing to
+ * get a descriptor is not an error: the file then falls back to path-based
+ * calls. Not thread-safe: call it from the one thread that uses the file.
+ *
+ * \return true if this call resolved the file, false if it already was.
+ */
+bool xattr_file_resolve(xattr_file_t *p_file);
+
+/**
+ * Open \p psz_path for xattr access: xattr_file_new() then
+ * xattr_file_resolve().
+ *
+ * \return A file with one reference, or NULL on allocation failure.
+ */
+xattr_file_t *xattr_file_open(const char *psz_path);
+
+/**
+ * Take an extra reference on \p p_file.
+ */
+xattr_file_t *xattr_file_hold(xattr_file_t *p_file);
+
+/**
+ * Drop a reference, closing the descriptor with the last one. NULL is ignored.
+ */
+void xattr_file_release(xattr_file_t *p_file);
+
+/**
+ * Build a job holding a reference to \p p_file and copies of the given
+ * strings.
+ *
+ * \param p_queue Queue whose freed jobs to reuse, and that the job returns
+ *        to when freed; or NULL to allocate a job of its own.
+ * \return The new job, or NULL on allocation failure, NULL arguments or an
+ *         empty tag list.
+ */
+xattr_job_t *xattr_job_new(write_queue_t *p_queue, xattr_file_t *p_file, const char *psz_key,
+                           const char *const *ppsz_tags, size_t i_tag_count);
+
+/**
+ * Build a checkpoint job holding a reference to \p p_file.
+ *
+ * \param p_queue As for xattr_job_new().
+ * \param i_position_ms Playback time to store, or -1 to leave it unchanged.
+ * \param i_watch_ms Watch time to add, or 0.
+ * \return The new job, or NULL on allocation failure, a NULL file or
+ *         nothing to record.
+ */
+xattr_job_t *xattr_checkpoint_job_new(write_queue_t *p_queue, xattr_file_t *p_file,
+                                      int64_t i_position_ms, int64_t i_watch_ms);
+
+/**
+ * Build a resume job reading the stored position of \p psz_path.
+ *
+ * \param p_queue As for xattr_job_new().
+ * \return The new job, or NULL on allocation failure or a NULL path.
+ */
+xattr_job_t *xattr_resume_job_new(write_queue_t *p_queue, const char *psz_path,
+                                  uint64_t i_generation);
+
+/**
+ * Free a job returned by one of the xattr_*_job_new() functions, or keep it
+ * for reuse by the queue it was built with; that queue must not have been
+ * destroyed yet. NULL is ignored.
+ */
+void xattr_job_free(xattr_job_t *p_job);
+
+/**
+ * Initialise an empty queue. \p capacity is rounded up to a power of two
+ * (minimum 2).
+ *
+ * \return true on success, false on allocation failure.
+ */
+bool write_queue_init(write_queue_t *p_queue, size_t capacity,
+                      write_queue_overflow_t overflow);
+
+/**
+ * Free the queue storage together with any jobs still queued and the spare
+ * ones.
+ */
+void write_queue_destroy(write_queue_t *p_queue);
+
+/**
+ * Enqueue \p p_job, transferring ownership to the queue. When the queue is
+ * full the overflow policy decides which job is dropped (and freed).
+ *
+ * \return true when \p p_job was queued, false when it was dropped.
+ */
+bool write_queue_push(write_queue_t *p_queue, xattr_job_t *p_job);
+
+/**
+ * Dequeue the oldest job, transferring ownership to the caller.
+ *
+ * \return The job, or NULL when the queue is empty.
+ */
+xattr_job_t *write_queue_pop(write_queue_t *p_queue);
+
+#endif // WRITE_QUEUE_H
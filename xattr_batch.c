@@ -0,0 +1,256 @@
+#include "xattr_batch.h"
+#include "xattr_compat.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__linux__) && !defined(XATTR_BATCH_NO_URING) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/version.h>
+#  if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+#   define HAVE_URING 1
+#  endif
+# endif
+#endif
+
+#ifdef HAVE_URING
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Room for "/proc/self/fd/" and any int */
+#define PROC_PATH_SIZE 32
+
+struct xattr_batch_t {
+    int i_ring_fd;
+    unsigned i_depth;               /**< Submission queue entries */
+    void *p_sq_map;
+    size_t i_sq_map_size;
+    void *p_cq_map;                 /**< Same as p_sq_map with IORING_FEAT_SINGLE_MMAP */
+    size_t i_cq_map_size;
+    struct io_uring_sqe *p_sqes;
+    size_t i_sqes_size;
+    unsigned *p_sq_tail, *p_sq_mask, *p_sq_array;
+    unsigned *p_cq_head, *p_cq_tail, *p_cq_mask;
+    struct io_uring_cqe *p_cqes;
+    char (*p_proc_paths)[PROC_PATH_SIZE];   /**< Per submission slot */
+    bool b_broken;                  /**< io_uring_enter failed: syscalls only from now on */
+};
+
+static bool probe_ops(int i_ring_fd)
+{
+    const unsigned i_ops = 256;
+    struct io_uring_probe *p_probe = calloc(1, sizeof(*p_probe)
+                                               + i_ops * sizeof(struct io_uring_probe_op));
+    if (p_probe == NULL)
+        return false;
+    bool b_ok = syscall(__NR_io_uring_register, i_ring_fd, IORING_REGISTER_PROBE, p_probe, i_ops) == 0
+             && p_probe->last_op >= IORING_OP_GETXATTR && p_probe->last_op >= IORING_OP_SETXATTR
+             && (p_probe->ops[IORING_OP_GETXATTR].flags & IO_URING_OP_SUPPORTED)
+             && (p_probe->ops[IORING_OP_SETXATTR].flags & IO_URING_OP_SUPPORTED);
+    free(p_probe);
+    return b_ok;
+}
+
+xattr_batch_t *xattr_batch_new(unsigned i_depth)
+{
+    if (i_depth == 0)
+        return NULL;
+
+    xattr_batch_t *p_batch = calloc(1, sizeof(*p_batch));
+    if (p_batch == NULL)
+        return NULL;
+    p_batch->p_sq_map = p_batch->p_cq_map = MAP_FAILED;
+    p_batch->p_sqes = MAP_FAILED;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // ENOSYS on old kernels, EPERM under seccomp or kernel.io_uring_disabled
+    p_batch->i_ring_fd = (int)syscall(__NR_io_uring_setup, i_depth, &params);
+    if (p_batch->i_ring_fd < 0) {
+        free(p_batch);
+        return NULL;
+    }
+    if (!probe_ops(p_batch->i_ring_fd))
+        goto error;
+
+    p_batch->i_depth = params.sq_entries;
+    p_batch->i_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    p_batch->i_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (p_batch->i_cq_map_size > p_batch->i_sq_map_size)
+            p_batch->i_sq_map_size = p_batch->i_cq_map_size;
+        p_batch->i_cq_map_size = 0;
+    }
+    p_batch->p_sq_map = mmap(NULL, p_batch->i_sq_map_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, p_batch->i_ring_fd, IORING_OFF_SQ_RING);
+    if (p_batch->p_sq_map == MAP_FAILED)
+        goto error;
+    if (p_batch->i_cq_map_size == 0)
+        p_batch->p_cq_map = p_batch->p_sq_map;
+    else {
+        p_batch->p_cq_map = mmap(NULL, p_batch->i_cq_map_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, p_batch->i_ring_fd, IORING_OFF_CQ_RING);
+        if (p_batch->p_cq_map == MAP_FAILED)
+            goto error;
+    }
+    p_batch->i_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    p_batch->p_sqes = mmap(NULL, p_batch->i_sqes_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, p_batch->i_ring_fd, IORING_OFF_SQES);
+    if (p_batch->p_sqes == MAP_FAILED)
+        goto error;
+    p_batch->p_proc_paths = malloc(params.sq_entries * sizeof(*p_batch->p_proc_paths));
+    if (p_batch->p_proc_paths == NULL)
+        goto error;
+
+    char *p_sq = p_batch->p_sq_map, *p_cq = p_batch->p_cq_map;
+    p_batch->p_sq_tail = (unsigned *)(p_sq + params.sq_off.tail);
+    p_batch->p_sq_mask = (unsigned *)(p_sq + params.sq_off.ring_mask);
+    p_batch->p_sq_array = (unsigned *)(p_sq + params.sq_off.array);
+    p_batch->p_cq_head = (unsigned *)(p_cq + params.cq_off.head);
+    p_batch->p_cq_tail = (unsigned *)(p_cq + params.cq_off.tail);
+    p_batch->p_cq_mask = (unsigned *)(p_cq + params.cq_off.ring_mask);
+    p_batch->p_cqes = (struct io_uring_cqe *)(p_cq + params.cq_off.cqes);
+    return p_batch;
+
+error:
+    xattr_batch_free(p_batch);
+    return NULL;
+}
+
+void xattr_batch_free(xattr_batch_t *p_batch)
+{
+    if (p_batch == NULL)
+        return;
+    if (p_batch->p_sqes != MAP_FAILED)
+        munmap(p_batch->p_sqes, p_batch->i_sqes_size);
+    if (p_batch->p_cq_map != MAP_FAILED && p_batch->p_cq_map != p_batch->p_sq_map)
+        munmap(p_batch->p_cq_map, p_batch->i_cq_map_size);
+    if (p_batch->p_sq_map != MAP_FAILED)
+        munmap(p_batch->p_sq_map, p_batch->i_sq_map_size);
+    free(p_batch->p_proc_paths);
+    close(p_batch->i_ring_fd);
+    free(p_batch);
+}
+#else
+xattr_batch_t *xattr_batch_new(unsigned i_depth)
+{
+    (void)i_depth;
+    return NULL;
+}
+
+void xattr_batch_free(xattr_batch_t *p_batch)
+{
+    (void)p_batch;
+}
+#endif
+
+static void run_sync(xattr_batch_op_t *p_op)
+{
+    if (p_op->i_kind == XATTR_BATCH_GET)
+        p_op->i_result = p_op->i_fd >= 0
+                       ? sys_fgetxattr(p_op->i_fd, p_op->psz_name, p_op->p_value, p_op->i_size)
+                       : sys_getxattr(p_op->psz_path, p_op->psz_name, p_op->p_value, p_op->i_size);
+    else
+        p_op->i_result = p_op->i_fd >= 0
+                       ? sys_fsetxattr(p_op->i_fd, p_op->psz_name, p_op->p_value, p_op->i_size,
+                                       p_op->i_flags)
+                       : sys_setxattr(p_op->psz_path, p_op->psz_name, p_op->p_value, p_op->i_size,
+                                      p_op->i_flags);
+    p_op->i_errno = p_op->i_result == -1 ? errno : 0;
+}
+
+#ifdef HAVE_URING
+/*
+ * Submit up to i_depth operations and wait for all of them. Descriptors are
+ * reached through their /proc/self/fd link: the O_PATH descriptors of
+ * sys_xattr_open() are rejected by IORING_OP_FGETXATTR, as by fgetxattr.
+ */
+static bool run_ring(xattr_batch_t *p_batch, xattr_batch_op_t *p_ops, unsigned i_count)
+{
+    unsigned i_tail = *p_batch->p_sq_tail;
+    unsigned i_mask = *p_batch->p_sq_mask;
+    for (unsigned i = 0; i < i_count; i++) {
+        xattr_batch_op_t *p_op = &p_ops[i];
+        unsigned i_index = (i_tail + i) & i_mask;
+        const char *psz_path = p_op->psz_path;
+        if (p_op->i_fd >= 0) {
+            snprintf(p_batch->p_proc_paths[i_index], PROC_PATH_SIZE, "/proc/self/fd/%d", p_op->i_fd);
+            psz_path = p_batch->p_proc_paths[i_index];
+        }
+
+        struct io_uring_sqe *p_sqe = &p_batch->p_sqes[i_index];
+        memset(p_sqe, 0, sizeof(*p_sqe));
+        p_sqe->opcode = p_op->i_kind == XATTR_BATCH_GET ? IORING_OP_GETXATTR : IORING_OP_SETXATTR;
+        p_sqe->addr = (uintptr_t)p_op->psz_name;
+        p_sqe->addr2 = (uintptr_t)p_op->p_value;
+        p_sqe->addr3 = (uintptr_t)psz_path;
+        p_sqe->len = (unsigned)p_op->i_size;
+        p_sqe->xattr_flags = p_op->i_kind == XATTR_BATCH_SET ? (unsigned)p_op->i_flags : 0;
+        p_sqe->user_data = i;
+        p_batch->p_sq_array[i_index] = i_index;
+        p_op->i_errno = -1; // Pending
+
+    }
+    // The kernel must see the entries before the new tail
+    __atomic_store_n(p_batch->p_sq_tail, i_tail + i_count, __ATOMIC_RELEASE);
+
+    unsigned i_unsubmitted = i_count, i_reaped = 0;
+    while (i_reaped < i_count) {
+        long i_ret = syscall(__NR_io_uring_enter, p_batch->i_ring_fd, i_unsubmitted,
+                             i_count - i_reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (i_ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            // Entries may be stuck in the ring: never submit through it again.
+            // Only argument errors get here, before anything was submitted.
+            p_batch->b_broken = true;
+            return false;
+        }
+        i_unsubmitted -= (unsigned)i_ret < i_unsubmitted ? (unsigned)i_ret : i_unsubmitted;
+
+        unsigned i_head = *p_batch->p_cq_head;
+        unsigned i_cq_tail = __atomic_load_n(p_batch->p_cq_tail, __ATOMIC_ACQUIRE);
+        for (; i_head != i_cq_tail; i_head++, i_reaped++) {
+            const struct io_uring_cqe *p_cqe = &p_batch->p_cqes[i_head & *p_batch->p_cq_mask];
+            xattr_batch_op_t *p_op = &p_ops[p_cqe->user_data];
+            p_op->i_result = p_cqe->res >= 0 ? p_cqe->res : -1;
+            p_op->i_errno = p_cqe->res >= 0 ? 0 : -p_cqe->res;
+        }
+        __atomic_store_n(p_batch->p_cq_head, i_head, __ATOMIC_RELEASE);
+    }
+
+    // Without /proc, descriptors go through the regular calls
+    for (unsigned i = 0; i < i_count; i++)
+        if (p_ops[i].i_fd >= 0 && p_ops[i].i_result == -1 && p_ops[i].i_errno == ENOENT)
+            run_sync(&p_ops[i]);
+    return true;
+}
+#endif
+
+void xattr_batch_run(xattr_batch_t *p_batch, xattr_batch_op_t *p_ops, size_t i_count)
+{
+    size_t i_done = 0;
+#ifdef HAVE_URING
+    while (p_batch != NULL && !p_batch->b_broken && i_done < i_count) {
+        unsigned i_chunk = i_count - i_done < p_batch->i_depth
+                         ? (unsigned)(i_count - i_done) : p_batch->i_depth;
+        if (!run_ring(p_batch, p_ops + i_done, i_chunk)) {
+            for (size_t i = i_done; i < i_done + i_chunk; i++)
+                if (p_ops[i].i_errno == -1)
+                    run_sync(&p_ops[i]);
+            i_done += i_chunk;
+            break;
+        }
+        i_done += i_chunk;
+    }
+#else
+    (void)p_batch;
+#endif
+    for (; i_done < i_count; i_done++)
+        run_sync(&p_ops[i_done]);
+}
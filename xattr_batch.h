@@ -0,0 +1,63 @@
+#ifndef XATTR_BATCH_H
+#define XATTR_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Batched xattr reads and writes.
+ *
+ * On Linux 5.19 and later, a batch submits its operations through an
+ * io_uring (IORING_OP_GETXATTR/SETXATTR) with one io_uring_enter call; the
+ * kernel runs them concurrently, so a directory of files on a high-latency
+ * network filesystem costs about one round trip instead of one per file.
+ * Where io_uring or its xattr operations are unavailable (older kernels,
+ * seccomp filters, other platforms, XATTR_BATCH_NO_URING builds),
+ * xattr_batch_new() returns NULL and xattr_batch_run() with a NULL batch
+ * performs the same operations one by one with the xattr_compat.h calls.
+ *
+ * A batch is not thread-safe: give each thread its own.
+ */
+typedef struct xattr_batch_t xattr_batch_t;
+
+typedef enum {
+    XATTR_BATCH_GET,
+    XATTR_BATCH_SET,
+} xattr_batch_kind_t;
+
+typedef struct {
+    xattr_batch_kind_t i_kind;
+    const char *psz_path;       /**< File, used when i_fd is -1 */
+    int i_fd;                   /**< Descriptor from sys_xattr_open(), or -1 */
+    const char *psz_name;
+    void *p_value;              /**< GET: buffer to fill; SET: value to write */
+    size_t i_size;              /**< GET: 0 asks for the value's size */
+    int i_flags;                /**< SET: 0, XATTR_CREATE or XATTR_REPLACE */
+    ssize_t i_result;           /**< Set by the run: as sys_getxattr/sys_setxattr return */
+    int i_errno;                /**< Set by the run: errno when i_result is -1 */
+} xattr_batch_op_t;
+
+/**
+ * Create an io_uring batch of up to \p i_depth operations in flight.
+ *
+ * \return The batch, or NULL when io_uring xattr operations are not
+ *         available here: pass NULL to xattr_batch_run() then.
+ */
+xattr_batch_t *xattr_batch_new(unsigned i_depth);
+
+/**
+ * Free the batch. NULL is ignored.
+ */
+void xattr_batch_free(xattr_batch_t *p_batch);
+
+/**
+ * Run \p i_count operations and fill in their results. Operations are
+ * independent and may complete in any order; give a read and a write of
+ * the same attribute to separate runs. Returns when all are done.
+ *
+ * \param p_batch The batch, or NULL to use plain syscalls.
+ */
+void xattr_batch_run(xattr_batch_t *p_batch, xattr_batch_op_t *p_ops, size_t i_count);
+
+#endif // XATTR_BATCH_H
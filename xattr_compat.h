@@ -12,10 +12,22 @@
  * - Linux: Uses sys/xattr.h (getxattr, setxattr)
  * - macOS: Uses sys/xattr.h (getxattr, setxattr with extra args)
  * - Windows: Uses NTFS Alternate Data Streams (ADS)
+ *
+ * File-descriptor variants (sys_xattr_open, sys_fgetxattr, sys_fsetxattr)
+ * resolve the path once and keep following the file across renames. They
+ * fail with ENOTSUP where unavailable (Windows, stub) so callers can fall
+ * back to the path-based functions.
+ *
+ * XATTR_CREATE (fail with EEXIST if the name exists) and XATTR_REPLACE
+ * (fail with ENODATA/ENOATTR if it does not) are honoured everywhere.
  */
 
 #if defined(__linux__)
     #include <sys/xattr.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <stdio.h>
+    #include <unistd.h>
 
     static inline ssize_t sys_getxattr(const char *path, const char *name, void *value, size_t size) {
         return getxattr(path, name, value, size);
@@ -25,6 +37,41 @@
         return setxattr(path, name, value, size, flags);
     }
 
+    // O_PATH only resolves the path: no read permission or device open needed
+    static inline int sys_xattr_open(const char *path) {
+    #ifdef O_PATH
+        return open(path, O_PATH | O_CLOEXEC);
+    #else
+        return open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY);
+    #endif
+    }
+
+    static inline int sys_xattr_close(int fd) {
+        return close(fd);
+    }
+
+    // The f*xattr calls reject O_PATH descriptors with EBADF; the
+    // /proc/self/fd magic link reaches the same inode without a path walk.
+    static inline ssize_t sys_fgetxattr(int fd, const char *name, void *value, size_t size) {
+        ssize_t ret = fgetxattr(fd, name, value, size);
+        if (ret == -1 && errno == EBADF && fd >= 0) {
+            char proc_path[32];
+            snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+            ret = getxattr(proc_path, name, value, size);
+        }
+        return ret;
+    }
+
+    static inline int sys_fsetxattr(int fd, const char *name, const void *value, size_t size, int flags) {
+        int ret = fsetxattr(fd, name, value, size, flags);
+        if (ret == -1 && errno == EBADF && fd >= 0) {
+            char proc_path[32];
+            snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+            ret = setxattr(proc_path, name, value, size, flags);
+        }
+        return ret;
+    }
+
 #elif defined(__APPLE__)
     #include <sys/xattr.h>
 
@@ -34,13 +81,38 @@
     }
 
     static inline int sys_setxattr(const char *path, const char *name, const void *value, size_t size, int flags) {
-        // macOS setxattr takes position and options.
-        return setxattr(path, name, value, size, 0, 0);
+        // macOS setxattr takes a position; its XATTR_CREATE/XATTR_REPLACE
+        // options mean the same as on Linux.
+        return setxattr(path, name, value, size, 0, flags & (XATTR_CREATE | XATTR_REPLACE));
+    }
+
+    #include <fcntl.h>
+    #include <unistd.h>
+
+    static inline int sys_xattr_open(const char *path) {
+        return open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY);
+    }
+
+    static inline int sys_xattr_close(int fd) {
+        return close(fd);
+    }
+
+    static inline ssize_t sys_fgetxattr(int fd, const char *name, void *value, size_t size) {
+        return fgetxattr(fd, name, value, size, 0, 0);
+    }
+
+    static inline int sys_fsetxattr(int fd, const char *name, const void *value, size_t size, int flags) {
+        return fsetxattr(fd, name, value, size, 0, flags & (XATTR_CREATE | XATTR_REPLACE));
     }
 
 #elif defined(_WIN32)
     #include <stdio.h>
     #include <errno.h>
+
+    #ifndef XATTR_CREATE
+    #define XATTR_CREATE  0x1
+    #define XATTR_REPLACE 0x2
+    #endif
     #include <vlc_common.h>
     #include <vlc_fs.h>
 
@@ -173,9 +245,36 @@
         return 0;
     }
 
+    // ADS are reached by name only; there is no handle-based equivalent
+    static inline int sys_xattr_open(const char *path) {
+        (void)path;
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    static inline int sys_xattr_close(int fd) {
+        (void)fd;
+        errno = EBADF;
+        return -1;
+    }
+
+    static inline ssize_t sys_fgetxattr(int fd, const char *name, void *value, size_t size) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    static inline int sys_fsetxattr(int fd, const char *name, const void *value, size_t size, int flags) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
 #else
     // Fallback for other systems: stub
     #include <errno.h>
+    #ifndef XATTR_CREATE
+    #define XATTR_CREATE  0x1
+    #define XATTR_REPLACE 0x2
+    #endif
     static inline ssize_t sys_getxattr(const char *path, const char *name, void *value, size_t size) {
         errno = ENOTSUP;
         return -1;
@@ -184,6 +283,22 @@
         errno = ENOTSUP;
         return -1;
     }
+    static inline int sys_xattr_open(const char *path) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    static inline int sys_xattr_close(int fd) {
+        errno = EBADF;
+        return -1;
+    }
+    static inline ssize_t sys_fgetxattr(int fd, const char *name, void *value, size_t size) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    static inline int sys_fsetxattr(int fd, const char *name, const void *value, size_t size, int flags) {
+        errno = ENOTSUP;
+        return -1;
+    }
 #endif
 
 #endif // XATTR_COMPAT_H